@@ -0,0 +1,134 @@
+// 封禁列表测试与基准：BanList 载入 N 个封禁 ID（默认 100 万），R 个线程持续查询的同时
+// 一个线程反复封禁/解封，检查读者始终看到一致的结果、重启后状态与预期一致；
+// 另外检查日志中写了一半的最后一条不会生效、日志无法写入时 add/remove 返回 false。
+//   ./ban_list_bench [封禁 ID 数，默认 1000000] [封禁/解封次数，默认 2000，超过 1024 次时会触发一次压缩] [读线程数，默认 4]
+#include "component_bench.hpp"
+
+static std::string benchDir() {
+    return "/tmp/ban_list_bench." + std::to_string(getpid());
+}
+
+static void writeFile(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << data;
+}
+
+static void checkJournal(const std::string& dir) {
+    std::string file = dir + "/torn.txt";
+    writeFile(file, "3\n");
+    writeFile(file + ".journal", "+5\n+7\n-5\n+12"); // 最后一条崩溃时只写了一半
+    {
+        BanList bans(file);
+        BENCH_CHECK(bans.load());
+        BENCH_CHECK(bans.contains(3) && bans.contains(7));
+        BENCH_CHECK(!bans.contains(5) && !bans.contains(12));
+        BENCH_CHECK(bans.add(345));
+        BENCH_CHECK(bans.add(345)); // 已封禁，不再写日志
+        BENCH_CHECK(bans.remove(3));
+    }
+    {
+        BanList bans(file);
+        BENCH_CHECK(bans.load());
+        BENCH_CHECK(bans.contains(345) && bans.contains(7));
+        BENCH_CHECK(!bans.contains(3) && !bans.contains(12) && !bans.contains(12345));
+        BENCH_CHECK(bans.size() == 2);
+    }
+
+    // 日志无法打开：变更失败且状态不变
+    BanList broken(dir + "/missing/banned.txt");
+    BENCH_CHECK(!broken.load());
+    BENCH_CHECK(!broken.add(1));
+    BENCH_CHECK(!broken.contains(1));
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    int churn = argc > 2 ? std::atoi(argv[2]) : 2000;
+    int readers = argc > 3 ? std::atoi(argv[3]) : 4;
+    BENCH_CHECK(count > 0 && churn > 0 && readers > 0);
+
+    std::string dir = benchDir();
+    BENCH_CHECK(::mkdir(dir.c_str(), 0755) == 0);
+    checkJournal(dir);
+
+    // 偶数 ID 预先封禁；churn 在奇数 ID 上进行，读者据此判断结果是否一致
+    std::string file = dir + "/banned.txt";
+    {
+        std::string data;
+        data.reserve(count * 12);
+        for (uint64_t i = 0; i < count; ++i) {
+            data += std::to_string(1000000000 + 2 * static_cast<int64_t>(i));
+            data.push_back('\n');
+        }
+        writeFile(file, data);
+    }
+
+    std::unique_ptr<BanList> bans(new BanList(file));
+    Stopwatch loadClock;
+    BENCH_CHECK(bans->load());
+    double loadSeconds = loadClock.seconds();
+    BENCH_CHECK(bans->size() == count);
+
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> lookups{0}, wrong{0};
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            std::mt19937_64 rng(r + 1);
+            uint64_t n = 0, bad = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                for (int k = 0; k < 1024; ++k) {
+                    int64_t even = 1000000000 + 2 * static_cast<int64_t>(rng() % count);
+                    if (!bans->contains(even)) ++bad; // 从未解封
+                    if (bans->contains(even + 2 * static_cast<int64_t>(count) + 1)) ++bad; // 从未封禁
+                    bans->contains(even + 1); // 正被反复封禁/解封
+                }
+                n += 2048 + 1024;
+            }
+            lookups += n;
+            wrong += bad;
+        });
+    }
+
+    // 封禁/解封奇数 ID：第 i 次操作 churnId(i % 64)，偶数轮封禁、奇数轮解封
+    auto churnId = [](int i) { return 1000000001 + 2 * static_cast<int64_t>(i % 64); };
+    std::vector<double> latencies;
+    std::set<int64_t> expected;
+    Stopwatch churnClock;
+    for (int i = 0; i < churn; ++i) {
+        int64_t id = churnId(i);
+        bool ban = (i / 64) % 2 == 0;
+        Stopwatch one;
+        BENCH_CHECK(ban ? bans->add(id) : bans->remove(id));
+        latencies.push_back(one.seconds());
+        if (ban) expected.insert(id);
+        else expected.erase(id);
+    }
+    double churnSeconds = churnClock.seconds();
+    done = true;
+    for (auto& t : threads) t.join();
+    BENCH_CHECK(wrong.load() == 0);
+    BENCH_CHECK(bans->size() == count + expected.size());
+
+    // 重启后与预期一致
+    bans.reset(new BanList(file));
+    BENCH_CHECK(bans->load());
+    BENCH_CHECK(bans->size() == count + expected.size());
+    for (int i = 0; i < 64; ++i) {
+        BENCH_CHECK(bans->contains(churnId(i)) == (expected.count(churnId(i)) > 0));
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << std::fixed << std::setprecision(2) << count << " 个封禁 ID，载入 " << loadSeconds * 1000 << " ms\n"
+              << churn << " 次封禁/解封: 平均 " << churnSeconds / churn * 1000 << " ms，p99 "
+              << latencies[latencies.size() * 99 / 100] * 1000 << " ms（含 fdatasync）\n"
+              << readers << " 个读线程同时查询 " << lookups.load() << " 次: "
+              << lookups.load() / churnSeconds / 1e6 << " 百万次/秒，结果不一致 " << wrong.load() << " 次\n";
+
+    bans.reset();
+    for (const char* name : {"/banned.txt", "/banned.txt.journal", "/torn.txt", "/torn.txt.journal"}) {
+        std::remove((dir + name).c_str());
+    }
+    ::rmdir(dir.c_str());
+    return 0;
+}
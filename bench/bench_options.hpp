@@ -0,0 +1,132 @@
+// 基准程序的命令行参数
+#pragma once
+
+#include "mock_bot_api.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct BenchOptions {
+    MockBotApi::Options mock;
+    std::string botPath = "./telegram_forward_bot";
+    std::vector<int> workerCounts = {4};
+    std::string transport = "curl_multi";
+    std::string mode = "polling"; // UPDATE_MODE：polling 或 webhook
+    int webhookThreads = 2;
+    bool keepRateLimits = false; // 默认放开出站限速，只测机器人自身的处理能力
+    bool checkOrder = false; // 有乱序送达时以非零状态退出
+    int timeoutSeconds = 120;
+
+    static std::vector<int> parseList(const std::string& value) {
+        std::vector<int> out;
+        std::istringstream in(value);
+        std::string item;
+        while (std::getline(in, item, ',')) {
+            out.push_back(std::stoi(item));
+        }
+        return out;
+    }
+
+    // text=70,req=10,reply=15,callback=5
+    static MockBotApi::Mix parseMix(const std::string& value) {
+        MockBotApi::Mix mix;
+        mix.text = mix.request = mix.reply = mix.callback = 0;
+        std::istringstream in(value);
+        std::string item;
+        while (std::getline(in, item, ',')) {
+            size_t eq = item.find('=');
+            if (eq == std::string::npos) throw std::invalid_argument(item);
+            std::string key = item.substr(0, eq);
+            int weight = std::stoi(item.substr(eq + 1));
+            if (key == "text") {
+                mix.text = weight;
+            } else if (key == "req") {
+                mix.request = weight;
+            } else if (key == "reply") {
+                mix.reply = weight;
+            } else if (key == "callback") {
+                mix.callback = weight;
+            } else {
+                throw std::invalid_argument(key);
+            }
+        }
+        return mix;
+    }
+
+    bool parse(int argc, char* argv[]) {
+        try {
+            for (int i = 1; i < argc; ++i) {
+                std::string key = argv[i];
+                if (key == "--keep-rate-limits") {
+                    keepRateLimits = true;
+                    continue;
+                }
+                if (key == "--check-order") {
+                    checkOrder = true;
+                    continue;
+                }
+                if (i + 1 >= argc) return false;
+                std::string value = argv[++i];
+                if (key == "--bot") {
+                    botPath = value;
+                } else if (key == "--workers") {
+                    workerCounts = parseList(value);
+                } else if (key == "--transport") {
+                    transport = value;
+                } else if (key == "--mode") {
+                    mode = value;
+                } else if (key == "--webhook-threads") {
+                    webhookThreads = std::stoi(value);
+                } else if (key == "--webhook-connections") {
+                    mock.webhookConnections = std::stoi(value);
+                } else if (key == "--timeout") {
+                    timeoutSeconds = std::stoi(value);
+                } else if (key == "--port") {
+                    mock.port = static_cast<unsigned short>(std::stoi(value));
+                } else if (key == "--users") {
+                    mock.users = std::stoi(value);
+                } else if (key == "--messages") {
+                    mock.messages = std::stoull(value);
+                } else if (key == "--mix") {
+                    mock.mix = parseMix(value);
+                } else if (key == "--latency-ms") {
+                    mock.latencyMs = std::stoi(value);
+                } else if (key == "--jitter-ms") {
+                    mock.jitterMs = std::stoi(value);
+                } else if (key == "--rate-429") {
+                    mock.rate429 = std::stod(value);
+                } else if (key == "--retry-after") {
+                    mock.retryAfter = std::stoi(value);
+                } else {
+                    return false;
+                }
+            }
+        } catch (std::exception&) {
+            return false;
+        }
+        return !workerCounts.empty() && (mode == "polling" || mode == "webhook");
+    }
+
+    static void usage(const char* program) {
+        std::cerr << "用法: " << program << " [选项]\n"
+                  << "  --bot PATH             机器人可执行文件（默认 ./telegram_forward_bot）\n"
+                  << "  --workers 1,2,4,8      依次测试的 WORKER_THREADS 取值\n"
+                  << "  --transport NAME       HTTP_TRANSPORT（默认 curl_multi）\n"
+                  << "  --mode NAME            UPDATE_MODE：polling（默认）或 webhook\n"
+                  << "  --webhook-threads N    WEBHOOK_THREADS（默认 2）\n"
+                  << "  --webhook-connections N  模拟 Telegram 推送的并发连接数（默认 40）\n"
+                  << "  --users N              模拟用户数\n"
+                  << "  --messages N           每轮模拟消息数\n"
+                  << "  --mix text=70,req=10,reply=15,callback=5   消息构成（权重）\n"
+                  << "  --latency-ms N         模拟 API 固定延迟\n"
+                  << "  --jitter-ms N          模拟 API 随机延迟上限\n"
+                  << "  --rate-429 P           发送类调用返回 429 的概率\n"
+                  << "  --retry-after N        429 响应中的 retry_after（秒）\n"
+                  << "  --keep-rate-limits     保留默认出站限速和用户限流（默认放开）\n"
+                  << "  --check-order          同一会话有乱序送达时以非零状态退出\n"
+                  << "  --timeout N            每轮最长等待秒数\n"
+                  << "  --port N               模拟服务端口（默认自动分配）\n";
+    }
+};
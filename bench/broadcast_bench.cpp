@@ -0,0 +1,121 @@
+// 广播测试与基准：用户登记表中预先写入 N 个用户，留下一个未完成的广播状态文件，机器人启动后继续该广播，
+// 经 curl_multi 发往模拟 API（bench/mock_bot_api.hpp），其中每 10 个用户有一个已屏蔽机器人（返回 403）。
+// 任务日志中另有一条管理员的 /broadcast，启动后在广播进行中执行，应收到“已有广播在进行”的提示而不是卡住。
+// 检查广播完成报告送达、屏蔽了机器人的用户全部移出登记表（重新载入后），并输出发送速率。
+//   ./broadcast_bench [用户数，默认 20000] [BROADCAST_RATE，默认 2000] [API 延迟毫秒，默认 5]
+#include "component_bench.hpp"
+#include "mock_bot_api.hpp"
+
+enum { BLOCKED_EVERY = 10 };
+
+static bool hasNotice(const MockBotApi::Result& result, const std::string& text) {
+    for (const std::string& notice : result.adminNotices) {
+        if (notice.find(text) != std::string::npos) return true;
+    }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    int64_t users = argc > 1 ? std::atoll(argv[1]) : 20000;
+    double rate = argc > 2 ? std::atof(argv[2]) : 2000;
+    int latencyMs = argc > 3 ? std::atoi(argv[3]) : 5;
+    BENCH_CHECK(users > 0 && rate > 0 && latencyMs >= 0);
+
+    // 机器人的数据文件都写在临时目录中
+    std::string dir = "/tmp/broadcast_bench." + std::to_string(getpid());
+    BENCH_CHECK(::mkdir(dir.c_str(), 0755) == 0);
+    BENCH_CHECK(::chdir(dir.c_str()) == 0);
+
+    const int64_t adminId = 1;
+    const int64_t firstUser = 100000;
+    {
+        UserRegistry registry("users.dat");
+        BENCH_CHECK(registry.load());
+        for (int64_t i = 0; i < users; ++i) {
+            registry.add(firstUser + i);
+        }
+        registry.sync();
+    }
+    BroadcastJob job;
+    job.text = "broadcast bench";
+    job.total = static_cast<uint64_t>(users);
+    job.reportChatId = adminId;
+    BENCH_CHECK(job.save("users.dat.broadcast"));
+    {
+        TaskJournal journal("task_journal");
+        TaskJournal::Recovered recovered;
+        BENCH_CHECK(journal.open(recovered));
+        MessageTask command;
+        command.type = MessageTask::HANDLE_BROADCAST;
+        auto message = std::make_shared<TgBot::Message>();
+        message->messageId = 1;
+        message->from = std::make_shared<TgBot::User>();
+        message->from->id = adminId;
+        message->chat = std::make_shared<TgBot::Chat>();
+        message->chat->id = adminId;
+        message->chat->type = TgBot::Chat::Type::Private;
+        message->text = "/broadcast 第二条广播";
+        command.message = message;
+        std::string data;
+        TaskCodec::encode(command, data);
+        journal.append(data);
+        journal.commit();
+    }
+
+    MockBotApi::Options mockOptions;
+    mockOptions.adminId = adminId;
+    mockOptions.messages = 0;
+    mockOptions.latencyMs = latencyMs;
+    mockOptions.blockedEvery = BLOCKED_EVERY;
+    MockBotApi api(mockOptions);
+    unsigned short port = api.start();
+
+    Config config;
+    config.botToken = "bench";
+    config.adminId = adminId;
+    config.apiUrl = "http://127.0.0.1:" + std::to_string(port);
+    config.broadcastRate = rate;
+    config.globalRateLimit = 1000000;
+    config.chatRateLimit = 1000000;
+    config.enableLogging = false;
+    config.logStdout = false;
+
+    // 完成报告送达即广播结束；超时说明广播卡住
+    auto timeout = std::chrono::seconds(30 + static_cast<int64_t>(3 * users / rate));
+    Stopwatch clock;
+    double seconds = 0;
+    bool finished = false;
+    {
+        ForwardBot bot(config, "");
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!(finished = hasNotice(api.snapshot(), "广播已完成")) && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        seconds = clock.seconds();
+    }
+    MockBotApi::Result result = api.snapshot();
+    api.stop();
+    BENCH_CHECK(finished);
+    BENCH_CHECK(hasNotice(result, "已有广播在进行"));
+
+    int64_t blocked = 0;
+    for (int64_t i = 0; i < users; ++i) {
+        if ((firstUser + i) % BLOCKED_EVERY == 0) ++blocked;
+    }
+    BENCH_CHECK(result.blocked == static_cast<uint64_t>(blocked));
+    {
+        UserRegistry registry("users.dat");
+        BENCH_CHECK(registry.load());
+        BENCH_CHECK(registry.size() == static_cast<size_t>(users - blocked));
+        for (int64_t i = 0; i < users; ++i) {
+            BENCH_CHECK(registry.contains(firstUser + i) == ((firstUser + i) % BLOCKED_EVERY != 0));
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(1) << users << " 个用户（" << blocked << " 个已屏蔽机器人），BROADCAST_RATE "
+              << rate << "，模拟 API 延迟 " << latencyMs << " ms\n"
+              << "广播用时 " << seconds << " 秒，实际 " << users / seconds << " 条/秒\n";
+
+    BENCH_CHECK(std::system(("rm -rf " + dir).c_str()) == 0);
+    return 0;
+}
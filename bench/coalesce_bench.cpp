@@ -0,0 +1,275 @@
+// 相册收集与连续消息合并测试与基准：MessageCoalescer 由测试传入时间，检查 COALESCE_MAX_MESSAGES 条数上限、
+// 合并窗口和 COALESCE_MAX_DELAY_MS 期限、合并后超过 MAX_MERGED_LENGTH 前拆开、相册窗口和 10 项上限，
+// 同一会话中相册、文字和不能合并的媒体之间按到达顺序送出，以及每条消息单独写入日志的序号随所在任务交回、不重不漏。
+// 输出 N 个用户（默认 10000）交替发送时每条消息的收集耗时。
+//   ./coalesce_bench [用户数，默认 10000] [消息数，默认 1000000]
+#include "component_bench.hpp"
+
+typedef MessageCoalescer::Clock Clock;
+
+static Clock::time_point at(int ms) {
+    return Clock::time_point() + std::chrono::hours(1) + std::chrono::milliseconds(ms);
+}
+
+static TgBot::Message::Ptr makeMessage(int64_t chatId, int32_t messageId, const std::string& text,
+                                       const std::string& group = "") {
+    auto message = std::make_shared<TgBot::Message>();
+    message->messageId = messageId;
+    message->from = std::make_shared<TgBot::User>();
+    message->from->id = chatId;
+    message->chat = std::make_shared<TgBot::Chat>();
+    message->chat->id = chatId;
+    message->text = text;
+    message->mediaGroupId = group;
+    return message;
+}
+
+// 记录每条消息单独写入日志的任务，序号从 1 开始
+struct JournalLog {
+    std::vector<MessageTask> tasks;
+
+    MessageCoalescer::Journal hook() {
+        return [this](const MessageTask& task) {
+            tasks.push_back(task);
+            return static_cast<uint64_t>(tasks.size());
+        };
+    }
+};
+
+static MessageCoalescer::Limits limits(int windowMs, int maxDelayMs, int maxMessages) {
+    MessageCoalescer::Limits out;
+    out.albumWindowMs = 1000;
+    out.windowMs = windowMs;
+    out.maxDelayMs = maxDelayMs;
+    out.maxMessages = maxMessages;
+    return out;
+}
+
+static std::vector<uint64_t> seqs(uint64_t first, uint64_t last) {
+    std::vector<uint64_t> out;
+    for (uint64_t seq = first; seq <= last; ++seq) out.push_back(seq);
+    return out;
+}
+
+static void checkMaxMessages() {
+    JournalLog journal;
+    MessageCoalescer coalescer(limits(1000, 5000, 3), journal.hook());
+    std::vector<MessageCoalescer::Ready> ready;
+    for (int i = 1; i <= 7; ++i) {
+        bool first = coalescer.addText(makeMessage(5, i, "m" + std::to_string(i)), at(i), ready);
+        BENCH_CHECK(first == (i == 1 || i == 4 || i == 7));
+        BENCH_CHECK(ready.size() == static_cast<size_t>(i / 3));
+    }
+    BENCH_CHECK(ready[0].count == 3 && ready[0].task.message->text == "m1\n💭 m2\n💭 m3");
+    BENCH_CHECK(ready[0].task.message->messageId == 3 && ready[0].journalSeqs == seqs(1, 3));
+    BENCH_CHECK(ready[1].task.message->text == "m4\n💭 m5\n💭 m6" && ready[1].journalSeqs == seqs(4, 6));
+    BENCH_CHECK(coalescer.burstCount() == 1);
+    BENCH_CHECK(journal.tasks.size() == 7 && journal.tasks[6].type == MessageTask::FORWARD_TO_ADMIN &&
+                journal.tasks[6].message->text == "m7");
+
+    // 只有一条时原样转交
+    BENCH_CHECK(coalescer.flushBurst(5, at(10), true, ready) == Clock::time_point());
+    BENCH_CHECK(ready.size() == 3 && ready[2].count == 1 && ready[2].task.message->text == "m7");
+    BENCH_CHECK(ready[2].journalSeqs == seqs(7, 7) && coalescer.burstCount() == 0);
+
+    // 上限为 1 时每条立即转交，不需要安排检查
+    MessageCoalescer single(limits(1000, 5000, 1));
+    ready.clear();
+    BENCH_CHECK(!single.addText(makeMessage(5, 1, "a"), at(0), ready));
+    BENCH_CHECK(ready.size() == 1 && ready[0].journalSeqs.empty() && single.burstCount() == 0);
+}
+
+static void checkDeadlines() {
+    MessageCoalescer coalescer(limits(1000, 3000, 100));
+    std::vector<MessageCoalescer::Ready> ready;
+    // 窗口内没有新消息：最后一条后 1000 ms 转交
+    BENCH_CHECK(coalescer.addText(makeMessage(7, 1, "a"), at(0), ready));
+    BENCH_CHECK(coalescer.flushBurst(7, at(999), false, ready) == at(1000) && ready.empty());
+    BENCH_CHECK(coalescer.flushBurst(7, at(1000), false, ready) == Clock::time_point() && ready.size() == 1);
+
+    // 每 800 ms 一条，窗口不断顺延，但第一条到达 3000 ms 后必须转交
+    ready.clear();
+    for (int t = 0; t <= 2400; t += 800) {
+        BENCH_CHECK(coalescer.addText(makeMessage(7, 10 + t, "b" + std::to_string(t)), at(10000 + t), ready) == (t == 0));
+    }
+    BENCH_CHECK(coalescer.flushBurst(7, at(12500), false, ready) == at(13000) && ready.empty());
+    BENCH_CHECK(coalescer.flushBurst(7, at(12999), false, ready) == at(13000) && ready.empty());
+    BENCH_CHECK(coalescer.flushBurst(7, at(13000), false, ready) == Clock::time_point());
+    BENCH_CHECK(ready.size() == 1 && ready[0].count == 4);
+    // 已转交后的检查不再顺延
+    BENCH_CHECK(coalescer.flushBurst(7, at(14000), false, ready) == Clock::time_point() && ready.size() == 1);
+
+    // 相册：最后一项后 1000 ms 没有新项才送出
+    ready.clear();
+    BENCH_CHECK(coalescer.addAlbumItem(makeMessage(7, 100, "", "g"), 0, at(20000), ready));
+    BENCH_CHECK(coalescer.joinAlbum(makeMessage(7, 101, "", "g"), at(20600), ready));
+    BENCH_CHECK(coalescer.flushAlbum("7:g", at(21000), false, ready) == at(21600) && ready.empty());
+    BENCH_CHECK(coalescer.flushAlbum("7:g", at(21600), false, ready) == Clock::time_point());
+    BENCH_CHECK(ready.size() == 1 && ready[0].task.type == MessageTask::FORWARD_ALBUM && ready[0].count == 2);
+    BENCH_CHECK(!coalescer.joinAlbum(makeMessage(7, 102, "", "g"), at(21700), ready));
+}
+
+static void checkLength() {
+    JournalLog journal;
+    MessageCoalescer coalescer(limits(1000, 5000, 100), journal.hook());
+    std::vector<MessageCoalescer::Ready> ready;
+    // 汉字各占 1 个码元，两条 1500 字加分隔（4 个码元）在上限内，第三条会超出
+    std::string han;
+    for (int i = 0; i < 1500; ++i) han += "字";
+    BENCH_CHECK(coalescer.addText(makeMessage(9, 1, han), at(0), ready));
+    BENCH_CHECK(!coalescer.addText(makeMessage(9, 2, han), at(1), ready) && ready.empty());
+    BENCH_CHECK(coalescer.addText(makeMessage(9, 3, han), at(2), ready));
+    BENCH_CHECK(ready.size() == 1 && ready[0].count == 2 && ready[0].journalSeqs == seqs(1, 2));
+    BENCH_CHECK(telegramLength(ready[0].task.message->text) == 3004);
+
+    // 表情占 2 个码元：900 个表情 1800 码元，两条合并后超出上限
+    std::string emoji;
+    for (int i = 0; i < 900; ++i) emoji += "😀";
+    ready.clear();
+    BENCH_CHECK(coalescer.addText(makeMessage(10, 1, emoji), at(0), ready));
+    BENCH_CHECK(coalescer.addText(makeMessage(10, 2, emoji), at(1), ready));
+    BENCH_CHECK(ready.size() == 1 && ready[0].count == 1 && ready[0].task.message->messageId == 1);
+    // 超长的单条不拆，原样转交
+    std::string huge(5000, 'x');
+    ready.clear();
+    BENCH_CHECK(coalescer.addText(makeMessage(11, 1, huge), at(0), ready));
+    coalescer.flushAll(ready);
+    for (const auto& item : ready) {
+        if (item.task.message->from->id == 11) BENCH_CHECK(item.count == 1 && item.task.message->text == huge);
+    }
+}
+
+// 一个会话依次发来：相册 g1 两项、文字 a、b、一张图片、相册 g2、g3 各一项、文字 c，另一用户穿插发送文字
+static void checkOrdering() {
+    JournalLog journal;
+    MessageCoalescer coalescer(limits(1000, 5000, 10), journal.hook());
+    std::vector<MessageCoalescer::Ready> ready;
+    auto media = [&](int64_t chatId, int32_t id) {
+        // 不能合并的消息：先送出会话中收集的相册和文字，再由调用方直接入队
+        coalescer.flushChat(chatId, chatId, ready);
+        MessageCoalescer::Ready item;
+        item.task.type = MessageTask::FORWARD_TO_ADMIN;
+        item.task.message = makeMessage(chatId, id, "");
+        ready.push_back(item);
+    };
+
+    BENCH_CHECK(coalescer.addAlbumItem(makeMessage(500, 1, "", "g1"), 0, at(0), ready));
+    BENCH_CHECK(coalescer.addText(makeMessage(600, 1, "x"), at(5), ready));
+    BENCH_CHECK(coalescer.joinAlbum(makeMessage(500, 2, "", "g1"), at(10), ready));
+    BENCH_CHECK(coalescer.addText(makeMessage(500, 3, "a"), at(20), ready)); // 相册 g1 先送出
+    BENCH_CHECK(!coalescer.addText(makeMessage(500, 4, "b"), at(30), ready));
+    BENCH_CHECK(!coalescer.addText(makeMessage(600, 2, "y"), at(35), ready));
+    media(500, 5); // 文字 a、b 先送出
+    BENCH_CHECK(coalescer.addAlbumItem(makeMessage(500, 6, "", "g2"), 0, at(50), ready));
+    BENCH_CHECK(coalescer.addAlbumItem(makeMessage(500, 7, "", "g3"), 0, at(60), ready)); // g2 先送出
+    BENCH_CHECK(!coalescer.joinAlbum(makeMessage(500, 8, "", "g2"), at(65), ready)); // g2 已送出，后到的项不再并入
+    BENCH_CHECK(coalescer.addText(makeMessage(500, 9, "c"), at(70), ready)); // g3 先送出
+    BENCH_CHECK(coalescer.albumCount() == 0 && coalescer.burstCount() == 2);
+    coalescer.flushChat(500, 500, ready);
+    coalescer.flushChat(500, 500, ready); // 没有收集中的消息时什么也不做
+    coalescer.flushAll(ready);
+    BENCH_CHECK(coalescer.albumCount() == 0 && coalescer.burstCount() == 0);
+
+    // 会话 500 送出的顺序与到达顺序一致，每个任务中最后一条消息的 ID 递增
+    std::vector<std::string> order;
+    int32_t lastId = 0;
+    for (const auto& item : ready) {
+        const MessageTask& task = item.task;
+        if (task.message->chat->id != 500) continue;
+        int32_t id = task.album.empty() ? task.message->messageId : task.album.back()->messageId;
+        BENCH_CHECK(id > lastId);
+        lastId = id;
+        order.push_back(task.album.empty() ? (task.message->text.empty() ? "media" : task.message->text)
+                                           : "album" + std::to_string(task.album.size()));
+    }
+    std::vector<std::string> expected = {"album2", "a\n💭 b", "media", "album1", "album1", "c"};
+    BENCH_CHECK(order == expected);
+    // 另一用户的文字不受影响，仍合并为一条
+    size_t other = 0;
+    for (const auto& item : ready) {
+        if (item.task.message->chat->id == 600) {
+            BENCH_CHECK(item.task.message->text == "x\n💭 y");
+            ++other;
+        }
+    }
+    BENCH_CHECK(other == 1);
+
+    // 收集的每条消息（g2 后到的一项由调用方另行处理，不在其中）恰好随一个任务交回
+    std::vector<uint64_t> returned;
+    for (const auto& item : ready) {
+        returned.insert(returned.end(), item.journalSeqs.begin(), item.journalSeqs.end());
+    }
+    std::sort(returned.begin(), returned.end());
+    BENCH_CHECK(returned == seqs(1, journal.tasks.size()));
+    BENCH_CHECK(journal.tasks.size() == 9);
+    for (const MessageTask& task : journal.tasks) {
+        if (task.message->mediaGroupId.empty()) {
+            BENCH_CHECK(task.type == MessageTask::FORWARD_TO_ADMIN && task.album.empty());
+        } else {
+            BENCH_CHECK(task.type == MessageTask::FORWARD_ALBUM && task.album.size() == 1);
+        }
+    }
+}
+
+// 管理员回复的相册：沿用第一项的接收者，收满 10 项立即送出，第 11 项开始新相册
+static void checkReplyAlbum() {
+    JournalLog journal;
+    MessageCoalescer coalescer(limits(1000, 5000, 10), journal.hook());
+    std::vector<MessageCoalescer::Ready> ready;
+    BENCH_CHECK(coalescer.addAlbumItem(makeMessage(1, 1, "", "r"), 42, at(0), ready));
+    for (int i = 2; i <= 10; ++i) {
+        BENCH_CHECK(coalescer.joinAlbum(makeMessage(1, i, "", "r"), at(i), ready));
+        BENCH_CHECK(ready.size() == (i == 10 ? 1u : 0u));
+    }
+    BENCH_CHECK(ready[0].task.type == MessageTask::REPLY_ALBUM && ready[0].task.targetUserId == 42);
+    BENCH_CHECK(ready[0].count == 10 && ready[0].journalSeqs == seqs(1, 10));
+    BENCH_CHECK(journal.tasks[9].type == MessageTask::REPLY_ALBUM && journal.tasks[9].targetUserId == 42);
+    BENCH_CHECK(!coalescer.joinAlbum(makeMessage(1, 11, "", "r"), at(11), ready));
+    BENCH_CHECK(coalescer.addAlbumItem(makeMessage(1, 11, "", "r"), 42, at(11), ready));
+    BENCH_CHECK(coalescer.albumCount() == 1);
+}
+
+int main(int argc, char* argv[]) {
+    int users = argc > 1 ? std::atoi(argv[1]) : 10000;
+    uint64_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+    BENCH_CHECK(users > 0 && count > 0);
+
+    checkMaxMessages();
+    checkDeadlines();
+    checkLength();
+    checkOrdering();
+    checkReplyAlbum();
+
+    // 用户轮流发送，每 1 ms 一条，窗口 1500 ms；每 50 条模拟一次到期检查
+    std::vector<TgBot::Message::Ptr> messages;
+    for (int u = 0; u < users; ++u) {
+        messages.push_back(makeMessage(100000 + u, 1, "在吗？我想问一下订单的发货进度"));
+    }
+    MessageCoalescer coalescer(limits(1500, 5000, 10));
+    std::vector<MessageCoalescer::Ready> ready;
+    size_t tasks = 0;
+    size_t merged = 0;
+    Stopwatch clock;
+    for (uint64_t i = 0; i < count; ++i) {
+        const TgBot::Message::Ptr& message = messages[i % users];
+        coalescer.addText(message, at(static_cast<int>(i)), ready);
+        if (i % 50 == 49) {
+            int64_t userId = messages[(i / 50) % users]->from->id;
+            coalescer.flushBurst(userId, at(static_cast<int>(i)), false, ready);
+        }
+        for (const auto& item : ready) merged += item.count;
+        tasks += ready.size();
+        ready.clear();
+    }
+    coalescer.flushAll(ready);
+    for (const auto& item : ready) merged += item.count;
+    tasks += ready.size();
+    double perMessageNs = clock.seconds() / count * 1e9;
+    BENCH_CHECK(merged == count);
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "条数上限、合并期限、长度拆分、相册窗口、会话内顺序、日志序号检查通过\n"
+              << count << " 条消息（" << users << " 个用户）合并为 " << tasks << " 个任务，每条收集 " << perMessageNs
+              << " ns\n";
+    return 0;
+}
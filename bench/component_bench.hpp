@@ -0,0 +1,67 @@
+// 组件级基准与测试：直接编入机器人源码（CMake 为这些目标定义 FORWARD_BOT_NO_MAIN，去掉机器人自身的 main），
+// 单独测各个数据结构，不需要模拟 Bot API。
+#pragma once
+
+#include "../telegram_forward_bot.cpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// 测试断言：失败时打印位置并以非零状态退出，供 ctest 判定
+#define BENCH_CHECK(cond)                                                                     \
+    do {                                                                                      \
+        if (!(cond)) {                                                                        \
+            std::cerr << __FILE__ << ":" << __LINE__ << " 检查失败: " #cond << std::endl;     \
+            std::exit(1);                                                                     \
+        }                                                                                     \
+    } while (0)
+
+class Stopwatch {
+private:
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+public:
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+};
+
+// 当前进程常驻内存（KB）
+inline long residentKb() {
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// 在子进程中运行 body，结果经管道传回。各次测量的内存互不干扰（释放的内存不一定还给系统）
+template <typename Result, typename Body>
+Result runIsolated(Body body) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        std::exit(1);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        Result result = body();
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == static_cast<ssize_t>(sizeof(result)) ? 0 : 1);
+    }
+    close(fds[1]);
+    Result result{};
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (got != static_cast<ssize_t>(sizeof(result)) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "子进程异常退出" << std::endl;
+        std::exit(1);
+    }
+    return result;
+}
@@ -0,0 +1,182 @@
+// 按用户限流测试与基准：用注入的时间检查 FloodGate 的突发额度、稳定速率、retryAfter 的准确性、
+// 拒绝次数达到 FLOOD_BAN_STRIKES 时恰好报告一次封禁（限流结束后重新计数）、重新配置后保留用户状态；
+// 再让远多于 FLOOD_TABLE_SIZE 的不同用户涌入，检查表容量和常驻内存不变，同时活跃的用户超出容量时才淘汰。
+// 输出 N 个线程同时判断时每次 admit 的耗时。
+//   ./flood_gate_bench [线程数列表，默认 1,4,16] [不同用户数，默认 1000000]
+#include "component_bench.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+static Clock::time_point at(Clock::time_point start, int64_t micros) {
+    return start + std::chrono::microseconds(micros);
+}
+
+// 注入的时间不能早于 FloodGate 的构造时间，各个用例先构造全部 FloodGate 再取 t0
+
+static void checkBurstAndRate() {
+    // 每秒 2 条、突发 5 条
+    FloodGate gate(2, 5, 0, 1024), steady(2, 5, 0, 1024), greedy(2, 5, 0, 1024), idle(2, 5, 0, 1024);
+    Clock::time_point t0 = Clock::now();
+    for (int i = 0; i < 5; ++i) {
+        FloodGate::Verdict v = gate.admit(1, t0);
+        BENCH_CHECK(v.allowed && !v.firstReject && !v.ban);
+    }
+    FloodGate::Verdict rejected = gate.admit(1, t0);
+    BENCH_CHECK(!rejected.allowed && rejected.firstReject && !rejected.ban);
+    BENCH_CHECK(rejected.retryAfter == std::chrono::microseconds(500000));
+    // 其他用户不受影响
+    BENCH_CHECK(gate.admit(2, t0).allowed);
+
+    // retryAfter 之前仍被拒绝（不再是第一次），到点恰好放行一条
+    FloodGate::Verdict early = gate.admit(1, at(t0, 499999));
+    BENCH_CHECK(!early.allowed && !early.firstReject && early.retryAfter == std::chrono::microseconds(1));
+    BENCH_CHECK(gate.admit(1, at(t0, 500000)).allowed);
+    BENCH_CHECK(!gate.admit(1, at(t0, 500000)).allowed);
+
+    // 按速率发送一直放行；额度用完后 60 秒内每 10 毫秒尝试一次，放行条数等于速率 × 时长
+    for (int64_t i = 0; i < 1000; ++i) {
+        BENCH_CHECK(steady.admit(3, at(t0, i * 500000)).allowed);
+    }
+    int allowed = 0;
+    for (int64_t us = 0; us <= 60000000; us += 10000) {
+        if (greedy.admit(4, at(t0, us)).allowed) ++allowed;
+    }
+    BENCH_CHECK(allowed == 5 + 60 * 2);
+
+    // 空闲足够久后突发额度恢复
+    for (int i = 0; i < 5; ++i) BENCH_CHECK(idle.admit(5, t0).allowed);
+    BENCH_CHECK(!idle.admit(5, t0).allowed);
+    for (int i = 0; i < 5; ++i) BENCH_CHECK(idle.admit(5, at(t0, 2500000)).allowed);
+    BENCH_CHECK(!idle.admit(5, at(t0, 2500000)).allowed);
+
+    // 调整速率后已有用户的欠额保留，新的间隔从下一条开始生效
+    idle.configure(10, 1, 0);
+    FloodGate::Verdict slowed = idle.admit(5, at(t0, 2500000));
+    BENCH_CHECK(!slowed.allowed && slowed.retryAfter == std::chrono::microseconds(2500000));
+    BENCH_CHECK(idle.admit(5, at(t0, 5000000)).allowed);
+    BENCH_CHECK(!idle.admit(5, at(t0, 5050000)).allowed);
+    BENCH_CHECK(idle.admit(5, at(t0, 5100000)).allowed);
+}
+
+static void checkStrikes() {
+    // 每秒 1 条、突发 1 条、第 3 次拒绝时封禁
+    FloodGate gate(1, 1, 3, 1024), carry(1, 2, 3, 1024), noBan(1, 1, 0, 1024);
+    Clock::time_point t0 = Clock::now();
+    BENCH_CHECK(gate.admit(7, t0).allowed);
+    std::vector<FloodGate::Verdict> rejects;
+    for (int i = 1; i <= 5; ++i) {
+        rejects.push_back(gate.admit(7, at(t0, i * 1000)));
+    }
+    for (size_t i = 0; i < rejects.size(); ++i) {
+        BENCH_CHECK(!rejects[i].allowed);
+        BENCH_CHECK(rejects[i].firstReject == (i == 0));
+        BENCH_CHECK(rejects[i].ban == (i == 2)); // 只在恰好达到阈值时报告一次
+    }
+    // 拒绝不推迟放行时间：被拒的消息不计入额度
+    BENCH_CHECK(rejects.back().retryAfter == std::chrono::microseconds(1000000 - 5000));
+
+    // 限流结束（tat 过期）后拒绝次数清零，下一轮重新计数
+    BENCH_CHECK(gate.admit(7, at(t0, 2000000)).allowed);
+    FloodGate::Verdict again = gate.admit(7, at(t0, 2000001));
+    BENCH_CHECK(!again.allowed && again.firstReject && !again.ban);
+    BENCH_CHECK(!gate.admit(7, at(t0, 2000002)).ban);
+    BENCH_CHECK(gate.admit(7, at(t0, 2000003)).ban);
+
+    // 刚放行过的用户 tat 未过期，拒绝次数不清零
+    BENCH_CHECK(carry.admit(8, t0).allowed && carry.admit(8, t0).allowed);
+    BENCH_CHECK(!carry.admit(8, t0).allowed);
+    BENCH_CHECK(carry.admit(8, at(t0, 1000000)).allowed); // 仍有 1 秒欠额
+    BENCH_CHECK(!carry.admit(8, at(t0, 1000000)).firstReject);
+    BENCH_CHECK(carry.admit(8, at(t0, 1000000)).ban);
+
+    // FLOOD_BAN_STRIKES=0 不封禁
+    BENCH_CHECK(noBan.admit(9, t0).allowed);
+    for (int i = 1; i <= 100; ++i) BENCH_CHECK(!noBan.admit(9, at(t0, i)).ban);
+}
+
+struct Footprint {
+    long kb;
+    uint64_t crowdedEvictions; // 同一时刻涌入的用户远超容量时的淘汰次数
+    uint64_t spreadEvictions;  // 用户陆续到达、同时活跃的不超过容量时的淘汰次数
+    size_t capacity;
+};
+
+// users 个不同用户涌入容量 4096 的表
+static Footprint floodUsers(int64_t users) {
+    FloodGate gate(1, 3, 0, 4000);
+    Clock::time_point t0 = Clock::now();
+    for (int64_t u = 1; u <= 1000; ++u) gate.admit(u, t0);
+    long baseKb = residentKb();
+    // 同一时刻：每个新用户都有突发额度，旧用户被淘汰
+    for (int64_t u = 1; u <= users; ++u) {
+        BENCH_CHECK(gate.admit(u, t0).allowed);
+    }
+    Footprint f;
+    f.crowdedEvictions = gate.evictionCount();
+    // 每秒到达 200 个新用户，每人 3 条用完突发额度后 3 秒过期，同时活跃的约 600 个
+    Clock::time_point t1 = at(t0, 10000000);
+    for (int64_t u = 0; u < users; ++u) {
+        Clock::time_point when = at(t1, u * 5000);
+        for (int k = 0; k < 3; ++k) BENCH_CHECK(gate.admit(users + 1 + u, when).allowed);
+        BENCH_CHECK(!gate.admit(users + 1 + u, when).allowed);
+    }
+    f.spreadEvictions = gate.evictionCount() - f.crowdedEvictions;
+    f.kb = residentKb() - baseKb;
+    f.capacity = gate.capacity();
+    return f;
+}
+
+struct Throughput {
+    double nsPerAdmit;
+    uint64_t allowed;
+};
+
+static Throughput measure(int threads, int perThread) {
+    FloodGate gate(1000000, 1000000, 0, 1 << 16);
+    std::atomic<uint64_t> allowed{0};
+    std::vector<std::thread> workers;
+    Stopwatch clock;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&gate, &allowed, t, perThread] {
+            uint64_t local = 0;
+            for (int i = 0; i < perThread; ++i) {
+                if (gate.admit(1 + (static_cast<int64_t>(t) * perThread + i) % 50000).allowed) ++local;
+            }
+            allowed += local;
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    double seconds = clock.seconds();
+    return Throughput{seconds / (static_cast<double>(threads) * perThread) * 1e9, allowed.load()};
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> threadCounts = {1, 4, 16};
+    if (argc > 1) {
+        threadCounts.clear();
+        std::istringstream in(argv[1]);
+        std::string item;
+        while (std::getline(in, item, ',')) threadCounts.push_back(std::atoi(item.c_str()));
+    }
+    int64_t users = argc > 2 ? std::atoll(argv[2]) : 1000000;
+    BENCH_CHECK(!threadCounts.empty() && users >= 10000);
+
+    checkBurstAndRate();
+    checkStrikes();
+
+    Footprint f = runIsolated<Footprint>([users] { return floodUsers(users); });
+    BENCH_CHECK(f.capacity == 4096);
+    BENCH_CHECK(f.kb < 1024);
+    BENCH_CHECK(f.crowdedEvictions > 0);
+    BENCH_CHECK(f.spreadEvictions == 0);
+
+    std::cout << std::fixed << std::setprecision(1) << "突发、稳定速率、retryAfter、封禁阈值、重新配置检查通过\n"
+              << users << " 个不同用户涌入容量 " << f.capacity << " 的表: 常驻内存增长 " << f.kb << " KB，同时涌入时淘汰 "
+              << f.crowdedEvictions << " 次，陆续到达时淘汰 " << f.spreadEvictions << " 次\n";
+    for (int threads : threadCounts) {
+        Throughput result = measure(threads, 2000000 / threads);
+        BENCH_CHECK(result.allowed == static_cast<uint64_t>(threads) * (2000000 / threads));
+        std::cout << threads << " 个线程: 每次 admit " << result.nsPerAdmit << " ns\n";
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+// 端到端吞吐基准：启动本地模拟 Bot API，按不同 WORKER_THREADS 依次运行机器人，
+// 报告吞吐（条/秒）、端到端延迟 p50/p99、机器人进程内存峰值和同一会话内的乱序送达数。
+// 加 --check-order 时有乱序即失败，可作为按会话保序的回归测试：
+//   ./forward_bench --workers 1,4 --users 20 --messages 4000 --jitter-ms 5 --check-order
+//   ./forward_bench --bot ./telegram_forward_bot --workers 1,2,4,8 --users 1000
+//                   --messages 20000 --mix text=70,req=10,reply=15,callback=5 --latency-ms 20
+#include "bench_options.hpp"
+#include "mock_bot_api.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct RunResult {
+    int workers = 0;
+    bool finished = false;
+    MockBotApi::Result mock;
+    long peakRssKb = 0;
+};
+
+// 读取 /proc/<pid>/status 中的内存峰值（VmHWM）
+static long peakRssKb(pid_t pid) {
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::atol(line.c_str() + 6);
+        }
+    }
+    return 0;
+}
+
+// 让系统分配一个空闲端口给机器人的 Webhook 服务
+static unsigned short freePort() {
+    boost::asio::io_context io;
+    boost::asio::ip::tcp::acceptor acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), 0));
+    return acceptor.local_endpoint().port();
+}
+
+static void writeConfig(const std::string& path, const std::string& dir, const BenchOptions& opts,
+                        int workers, unsigned short port) {
+    std::ofstream out(path);
+    out << "BOT_TOKEN=bench\n"
+        << "ADMIN_ID=" << opts.mock.adminId << "\n"
+        << "WORKER_THREADS=" << workers << "\n"
+        << "API_URL=http://127.0.0.1:" << port << "\n"
+        << "HTTP_TRANSPORT=" << opts.transport << "\n"
+        << "LOG_FILE=" << dir << "/bot.log\n"
+        << "LOG_STDOUT=false\n"
+        << "BANNED_USERS_FILE=" << dir << "/banned_users.txt\n"
+        << "MESSAGE_INDEX_FILE=" << dir << "/message_index.dat\n"
+        << "UPDATE_MODE=" << opts.mode << "\n";
+    if (opts.mode == "webhook") {
+        unsigned short webhookPort = freePort();
+        out << "WEBHOOK_LISTEN=127.0.0.1:" << webhookPort << "\n"
+            << "WEBHOOK_URL=http://127.0.0.1:" << webhookPort << "/webhook\n"
+            << "WEBHOOK_SECRET=bench-secret\n"
+            << "WEBHOOK_THREADS=" << opts.webhookThreads << "\n";
+    }
+    if (!opts.keepRateLimits) {
+        out << "GLOBAL_RATE_LIMIT=1000000\n"
+            << "CHAT_RATE_LIMIT=1000000\n"
+            << "GROUP_RATE_LIMIT=1000000\n"
+            << "FLOOD_RATE=0\n";
+    }
+}
+
+// 发送 SIGTERM 并等待退出，超时后强制结束
+static void stopBot(pid_t pid) {
+    kill(pid, SIGTERM);
+    for (int i = 0; i < 200; ++i) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) return;
+        usleep(100 * 1000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+static RunResult runOnce(const BenchOptions& opts, int workers) {
+    RunResult run;
+    run.workers = workers;
+
+    char dirTemplate[] = "/tmp/forward_bench.XXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        throw std::runtime_error("无法创建临时目录");
+    }
+    std::string dir = dirTemplate;
+
+    MockBotApi mock(opts.mock);
+    unsigned short port = mock.start();
+    std::string configPath = dir + "/bot_config.ini";
+    writeConfig(configPath, dir, opts, workers, port);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw std::runtime_error("fork 失败");
+    }
+    if (pid == 0) {
+        execl(opts.botPath.c_str(), opts.botPath.c_str(), configPath.c_str(), static_cast<char*>(nullptr));
+        perror("execl");
+        _exit(127);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(opts.timeoutSeconds);
+    bool exited = false;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (mock.waitDone(std::chrono::seconds(1))) {
+            run.finished = true;
+            break;
+        }
+        if (waitpid(pid, nullptr, WNOHANG) == pid) {
+            exited = true;
+            std::cerr << "机器人提前退出，日志见 " << dir << "/bot.log" << std::endl;
+            break;
+        }
+    }
+
+    if (!exited) {
+        run.peakRssKb = peakRssKb(pid);
+        stopBot(pid);
+    }
+    mock.stop();
+    run.mock = mock.snapshot();
+
+    if (run.finished) {
+        std::system(("rm -rf '" + dir + "'").c_str());
+    }
+    return run;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opts;
+    if (!opts.parse(argc, argv)) {
+        BenchOptions::usage(argv[0]);
+        return 1;
+    }
+    if (opts.mock.port != 0 && opts.workerCounts.size() > 1) {
+        // 每轮重新监听，固定端口可能仍处于 TIME_WAIT，改为自动分配
+        opts.mock.port = 0;
+    }
+
+    std::cout << "用户 " << opts.mock.users << "，每轮消息 " << opts.mock.messages
+              << "，构成 text=" << opts.mock.mix.text << " req=" << opts.mock.mix.request
+              << " reply=" << opts.mock.mix.reply << " callback=" << opts.mock.mix.callback
+              << "，API 延迟 " << opts.mock.latencyMs << "+" << opts.mock.jitterMs << " ms"
+              << "，429 概率 " << opts.mock.rate429 << "，接收方式 " << opts.mode << "\n\n";
+    std::cout << std::left << std::setw(8) << "workers" << std::setw(10) << "done"
+              << std::setw(12) << "msg/s" << std::setw(12) << "p50(ms)" << std::setw(12) << "p99(ms)"
+              << std::setw(12) << "max(ms)" << std::setw(12) << "rss(MB)" << std::setw(10) << "api"
+              << std::setw(8) << "429" << "reordered" << std::endl;
+
+    int failures = 0;
+    for (int workers : opts.workerCounts) {
+        RunResult run = runOnce(opts, workers);
+        const MockBotApi::Result& r = run.mock;
+        double rate = r.seconds > 0 ? r.completed / r.seconds : 0;
+        std::cout << std::left << std::fixed << std::setprecision(1)
+                  << std::setw(8) << workers
+                  << std::setw(10) << (std::to_string(r.completed) + (run.finished ? "" : "*"))
+                  << std::setw(12) << rate
+                  << std::setw(12) << MockBotApi::percentile(r.latencies, 0.5) * 1000
+                  << std::setw(12) << MockBotApi::percentile(r.latencies, 0.99) * 1000
+                  << std::setw(12) << (r.latencies.empty() ? 0 : r.latencies.back() * 1000)
+                  << std::setw(12) << run.peakRssKb / 1024.0
+                  << std::setw(10) << r.requests
+                  << std::setw(8) << r.injected429
+                  << r.reordered << std::endl;
+        if (!run.finished || (opts.checkOrder && r.reordered > 0)) ++failures;
+    }
+    if (failures > 0) {
+        std::cout << "\n* 表示超时前未全部完成" << (opts.checkOrder ? "；reordered 非零表示同一会话内乱序送达" : "")
+                  << std::endl;
+    }
+    return failures > 0 ? 1 : 0;
+}
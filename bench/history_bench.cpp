@@ -0,0 +1,181 @@
+// 会话历史测试与基准：MessageHistory 写入 N 条消息（默认 200 万），输出后台写入和建索引的速度、索引内存、
+// /search 和 /history 的耗时，以及重启后在后台重建索引的耗时，并检查重建前后查询结果一致；
+// 另外用 4 KB 的长消息写满多个分段，检查超出总大小上限后最早的分段被删除，其中的消息同时从倒排表和每用户的最近消息中清除。
+//   ./history_bench [消息数，默认 2000000] [长消息数，默认 20000，约 80 MB]
+#include "component_bench.hpp"
+
+enum { USERS = 10000, ITEMS = 50000 };
+
+static std::string benchDir() {
+    return "/tmp/history_bench." + std::to_string(getpid());
+}
+
+static void clearDir(const std::string& dir) {
+    BENCH_CHECK(std::system(("rm -f " + dir + "/*").c_str()) == 0);
+}
+
+// 等待后台线程写完 expected 条
+static void waitWritten(MessageHistory& history, size_t expected) {
+    while (!history.isLoaded() || history.size() < expected) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+static std::string messageText(uint64_t i) {
+    return "你好，订单 " + std::to_string(i) + " 的发货进度 item" + std::to_string(i % ITEMS);
+}
+
+struct Query {
+    std::string text;
+    size_t expected; // 结果条数（最多 20）
+};
+
+// 前 count 条中 item<item> 出现的次数
+static size_t itemMatches(uint64_t count, uint64_t item) {
+    return static_cast<size_t>(count / ITEMS + (count % ITEMS > item ? 1 : 0));
+}
+
+// 各个查询的平均耗时（毫秒）
+static std::vector<double> timeQueries(MessageHistory& history, const std::vector<Query>& queries,
+                                       std::vector<std::vector<MessageHistory::Entry>>& results) {
+    std::vector<double> out;
+    results.clear();
+    for (const Query& query : queries) {
+        const int rounds = 20;
+        Stopwatch clock;
+        std::vector<MessageHistory::Entry> found;
+        for (int r = 0; r < rounds; ++r) {
+            found = history.search(query.text, 20);
+        }
+        out.push_back(clock.seconds() / rounds * 1000);
+        BENCH_CHECK(found.size() == query.expected);
+        results.push_back(found);
+    }
+    return out;
+}
+
+static void checkRetention(const std::string& dir, uint64_t count) {
+    // 前 10000 条来自只在这期间发言的用户；每 1000 条一个 tag 词，每条都有 common
+    const uint64_t maxBytes = 70ull << 20;
+    const std::string padding(4000, 'x'); // 超过 MAX_TERM_BYTES，不进入索引
+    auto userOf = [](uint64_t i) { return static_cast<int64_t>(i < 10000 ? 1000 + i % 50 : 2000 + i % 50); };
+    MessageHistory::Stats stats;
+    uint64_t firstLive;
+    {
+        MessageHistory history(dir + "/history", 200, maxBytes);
+        BENCH_CHECK(history.open());
+        for (uint64_t i = 0; i < count; ++i) {
+            history.append(userOf(i), MessageHistory::FROM_USER,
+                           "common tag" + std::to_string(i / 1000) + " " + padding);
+        }
+        // 删除分段后 size() 会变小，这里按最后一个 tag 的消息是否全部可查判断写完
+        std::string lastTag = "tag" + std::to_string((count - 1) / 1000);
+        while (!history.isLoaded() || history.search(lastTag, 1000).size() != (count - 1) % 1000 + 1) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        firstLive = count - history.size();
+        BENCH_CHECK(firstLive > 0); // 至少删除了一个分段
+        stats = history.stats();
+
+        // 最早的用户和 tag 已无有效消息，整个从索引中删除
+        BENCH_CHECK(history.recent(1000, 10).empty() == (firstLive >= 10000));
+        BENCH_CHECK(history.search("tag0", 20).empty());
+        uint64_t liveTags = (count - 1) / 1000 - firstLive / 1000 + 1;
+        BENCH_CHECK(stats.terms == liveTags + 1);
+        BENCH_CHECK(stats.users == (firstLive >= 10000 ? 50u : 100u));
+        // 倒排表只剩有效消息，外加每个词至多一个部分过期的块
+        uint64_t live = count - firstLive;
+        BENCH_CHECK(stats.postings >= 2 * live && stats.postings <= 2 * live + stats.terms * 128);
+        BENCH_CHECK(history.search("common", 1000).size() == std::min<uint64_t>(live, 1000));
+    }
+    // 重启后索引与删除分段后相同
+    {
+        MessageHistory history(dir + "/history", 200, maxBytes);
+        BENCH_CHECK(history.open());
+        waitWritten(history, 0);
+        BENCH_CHECK(history.size() == count - firstLive);
+        MessageHistory::Stats reloaded = history.stats();
+        BENCH_CHECK(reloaded.terms == stats.terms && reloaded.users == stats.users);
+        BENCH_CHECK(reloaded.postings <= stats.postings);
+    }
+    std::cout << count << " 条 4 KB 消息，上限 " << (maxBytes >> 20) << " MB: 删除最早的 " << firstLive << " 条，"
+              << "剩余 " << stats.terms << " 个词、" << stats.postings << " 个倒排条目、" << stats.users << " 个用户\n";
+    clearDir(dir);
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    uint64_t longCount = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20000;
+    BENCH_CHECK(count >= ITEMS && longCount >= 20000);
+
+    std::string dir = benchDir();
+    BENCH_CHECK(::mkdir(dir.c_str(), 0755) == 0);
+    checkRetention(dir, longCount);
+
+    // item 词每 ITEMS 条出现一次；订单号只出现一次
+    std::vector<Query> queries = {
+        {"item123", std::min<size_t>(20, itemMatches(count, 123))},
+        {"发货 item42", std::min<size_t>(20, itemMatches(count, 42))},
+        {"订单", 20},
+        {"订单 " + std::to_string(count / 2), 1},
+        {"nomatch", 0},
+    };
+    std::vector<std::vector<MessageHistory::Entry>> before, after;
+    std::vector<double> searchMs;
+    double writeSeconds, loadSeconds, recentUs;
+    long indexKb;
+    MessageHistory::Stats stats;
+    {
+        long baseKb = residentKb();
+        MessageHistory history(dir + "/history", 200, uint64_t(1) << 40);
+        BENCH_CHECK(history.open());
+        Stopwatch clock;
+        for (uint64_t i = 0; i < count; ++i) {
+            history.append(1 + static_cast<int64_t>(i % USERS), i % 4 == 0 ? MessageHistory::FROM_ADMIN
+                                                                             : MessageHistory::FROM_USER,
+                           messageText(i));
+        }
+        waitWritten(history, count);
+        writeSeconds = clock.seconds();
+        indexKb = residentKb() - baseKb;
+        stats = history.stats();
+
+        searchMs = timeQueries(history, queries, before);
+        Stopwatch recentClock;
+        const int rounds = 10000;
+        size_t limit = std::min<size_t>(50, count / USERS);
+        for (int r = 0; r < rounds; ++r) {
+            BENCH_CHECK(history.recent(1 + r % USERS, limit).size() == limit);
+        }
+        recentUs = recentClock.seconds() / rounds * 1e6;
+        BENCH_CHECK(history.recent(1 + (count - 1) % USERS, 1)[0].text == messageText(count - 1));
+    }
+    {
+        MessageHistory history(dir + "/history", 200, uint64_t(1) << 40);
+        Stopwatch clock;
+        BENCH_CHECK(history.open());
+        waitWritten(history, count);
+        loadSeconds = clock.seconds();
+        BENCH_CHECK(history.size() == count);
+        timeQueries(history, queries, after);
+        for (size_t q = 0; q < queries.size(); ++q) {
+            BENCH_CHECK(before[q].size() == after[q].size());
+            for (size_t k = 0; k < before[q].size(); ++k) {
+                BENCH_CHECK(before[q][k].text == after[q][k].text && before[q][k].userId == after[q][k].userId);
+            }
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(2) << count << " 条消息（" << USERS << " 个用户）: 写入并建索引 "
+              << writeSeconds << " 秒（" << count / writeSeconds / 1000 << " 千条/秒），索引约 " << indexKb / 1024
+              << " MB（" << stats.terms << " 个词，倒排表 " << stats.postingBytes / (1 << 20) << " MB）\n"
+              << "重启后重建索引 " << loadSeconds << " 秒\n"
+              << "/history " << std::min<uint64_t>(50, count / USERS) << " 条: " << recentUs << " us\n";
+    for (size_t q = 0; q < queries.size(); ++q) {
+        std::cout << "/search " << queries[q].text << ": " << searchMs[q] << " ms，" << before[q].size() << " 条\n";
+    }
+
+    clearDir(dir);
+    ::rmdir(dir.c_str());
+    return 0;
+}
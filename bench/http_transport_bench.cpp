@@ -0,0 +1,127 @@
+// Bot API 传输对比：模拟 API（bench/mock_bot_api.hpp）给每个调用加固定延迟，W 个工作线程共发出 N 个 sendMessage。
+// 同步：库自带的 BoostHttpOnlySslClient（HTTP_TRANSPORT=boost，原先的做法），工作线程阻塞到响应返回；
+// 异步：CurlMultiHttpClient 的 submit，工作线程提交后立即处理下一个，由事件循环复用连接并发执行。
+// 输出吞吐和工作线程被占用的时间比例，并检查每个请求都成功返回、停止后的 submit 抛出异常。
+//   ./http_transport_bench [工作线程数列表，默认 1,4,16,64] [请求数，默认 4000] [延迟毫秒，默认 20]
+#include "component_bench.hpp"
+#include "mock_bot_api.hpp"
+
+struct Run {
+    double seconds = 0;
+    double busySeconds = 0; // 工作线程在发送调用中度过的时间合计
+    uint64_t ok = 0;
+};
+
+static std::vector<TgBot::HttpReqArg> sendArgs(uint64_t i) {
+    return {TgBot::HttpReqArg("chat_id", static_cast<int64_t>(1000 + i % 100)),
+            TgBot::HttpReqArg("text", "transport bench " + std::to_string(i))};
+}
+
+static bool succeeded(const std::string& response) {
+    return response.find("\"ok\":true") != std::string::npos;
+}
+
+// workers 个线程分摊 requests 个请求，send(i) 发出第 i 个请求；waitAll 等待异步请求全部完成
+template <typename Send>
+static Run runWorkers(int workers, uint64_t requests, Send send, std::function<void()> waitAll) {
+    Run run;
+    std::atomic<int64_t> busyMicros{0};
+    std::vector<std::thread> threads;
+    Stopwatch clock;
+    for (int w = 0; w < workers; ++w) {
+        threads.emplace_back([&, w] {
+            for (uint64_t i = w; i < requests; i += workers) {
+                auto start = std::chrono::steady_clock::now();
+                send(i);
+                busyMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    waitAll();
+    run.seconds = clock.seconds();
+    run.busySeconds = busyMicros.load() / 1e6;
+    return run;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> workerCounts = {1, 4, 16, 64};
+    uint64_t requests = 4000;
+    int latencyMs = 20;
+    if (argc > 1) {
+        workerCounts.clear();
+        std::istringstream in(argv[1]);
+        std::string item;
+        while (std::getline(in, item, ',')) workerCounts.push_back(std::atoi(item.c_str()));
+    }
+    if (argc > 2) requests = std::strtoull(argv[2], nullptr, 10);
+    if (argc > 3) latencyMs = std::atoi(argv[3]);
+    BENCH_CHECK(requests > 0 && latencyMs >= 0);
+
+    MockBotApi::Options mockOptions;
+    mockOptions.latencyMs = latencyMs;
+    MockBotApi api(mockOptions);
+    unsigned short port = api.start();
+    TgBot::Url url("http://127.0.0.1:" + std::to_string(port) + "/botbench/sendMessage");
+
+    CurlMultiHttpClient::Options curlOptions;
+    std::unique_ptr<CurlMultiHttpClient> curl(new CurlMultiHttpClient(curlOptions));
+    TgBot::BoostHttpOnlySslClient boost;
+
+    std::cout << requests << " 个 sendMessage，模拟 API 延迟 " << latencyMs << " ms\n"
+              << std::left << std::setw(8) << "线程" << std::setw(16) << "同步(次/秒)" << std::setw(16)
+              << "异步(次/秒)" << std::setw(10) << "加速比" << std::setw(16) << "同步占用(%)"
+              << "异步占用(%)\n" << std::fixed << std::setprecision(1);
+    for (int workers : workerCounts) {
+        BENCH_CHECK(workers > 0);
+        std::atomic<uint64_t> syncOk{0};
+        Run sync = runWorkers(workers, requests, [&](uint64_t i) {
+            try {
+                if (succeeded(boost.makeRequest(url, sendArgs(i)))) ++syncOk;
+            } catch (std::exception& e) {
+                std::cerr << "同步请求失败: " << e.what() << std::endl;
+            }
+        }, [] {});
+        sync.ok = syncOk;
+
+        std::mutex doneMutex;
+        std::condition_variable doneCv;
+        std::atomic<uint64_t> finished{0}, asyncOk{0};
+        Run async = runWorkers(workers, requests, [&](uint64_t i) {
+            curl->submit(url, sendArgs(i), [&](const std::string& response, std::exception_ptr error) {
+                if (!error && succeeded(response)) ++asyncOk;
+                if (++finished == requests) {
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    doneCv.notify_all();
+                }
+            });
+        }, [&] {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneCv.wait(lock, [&] { return finished.load() == requests; });
+        });
+        async.ok = asyncOk;
+
+        BENCH_CHECK(sync.ok == requests);
+        BENCH_CHECK(async.ok == requests);
+        double before = requests / sync.seconds;
+        double after = requests / async.seconds;
+        std::cout << std::setw(8) << workers << std::setw(16) << before << std::setw(16) << after << std::setw(10)
+                  << after / before << std::setw(16) << 100 * sync.busySeconds / (workers * sync.seconds)
+                  << 100 * async.busySeconds / (workers * async.seconds) << "\n";
+    }
+
+    CurlMultiHttpClient::Stats stats = curl->stats();
+    std::cout << "异步连接: 新建 " << stats.newConnections << " 复用 " << stats.reusedConnections << "\n";
+
+    // 停止后提交的请求被拒绝，不会留下永远不完成的 future
+    curl->stop();
+    bool rejected = false;
+    try {
+        curl->makeRequestAsync(url, sendArgs(0));
+    } catch (std::runtime_error&) {
+        rejected = true;
+    }
+    BENCH_CHECK(rejected);
+    return 0;
+}
@@ -0,0 +1,201 @@
+// 日志微基准：Logger（无锁环形缓冲区 + 后台批量写出）与原先的实现（全局互斥量、stringstream、
+// std::localtime、每行 std::endl + flush）对比，N 个线程同时记录 INFO 日志，只写文件不回显。
+// 输出调用方看到的每秒调用数和写完全部日志的总耗时；检查每条日志都已写出（或计入丢弃数）、
+// 级别过滤生效、超出记录内联长度的消息完整写出且顺序不变、超过 64 KB 的消息在 UTF-8 字符边界截断并注明原长度。
+//   ./logger_bench [线程数列表，默认 1,4,16] [每线程条数，默认 200000]
+#include "component_bench.hpp"
+
+#include <ctime>
+
+// 原先的实现
+class MutexLogger {
+private:
+    std::ofstream logFile;
+    std::mutex logMutex;
+
+public:
+    explicit MutexLogger(const std::string& filename) { logFile.open(filename, std::ios::app); }
+
+    void log(const std::string& level, const std::string& message) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        auto now = std::chrono::system_clock::now();
+        auto time_t = std::chrono::system_clock::to_time_t(now);
+        std::stringstream ss;
+        ss << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
+        ss << " [" << level << "] " << message;
+        logFile << ss.str() << std::endl;
+        logFile.flush();
+    }
+
+    void info(const std::string& message) { log("INFO", message); }
+};
+
+struct Run {
+    double callSeconds = 0; // 最后一个线程返回为止
+    double totalSeconds = 0; // 日志全部写入文件为止
+};
+
+static std::string benchPath() {
+    return "/tmp/logger_bench." + std::to_string(getpid()) + ".log";
+}
+
+template <typename Log>
+static double callThreads(int threads, uint64_t perThread, Log log) {
+    std::vector<std::thread> workers;
+    Stopwatch clock;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&log, t, perThread] {
+            for (uint64_t i = 0; i < perThread; ++i) {
+                log("转发消息 - 用户: " + std::to_string(1000000 + t) + " 序号 " + std::to_string(i));
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    return clock.seconds();
+}
+
+// 数据行数和写出线程报告的丢弃数
+static void countLines(const std::string& path, uint64_t& lines, uint64_t& dropped) {
+    std::ifstream in(path);
+    std::string line;
+    lines = dropped = 0;
+    while (std::getline(in, line)) {
+        if (line.find("转发消息 - 用户: ") != std::string::npos) {
+            ++lines;
+        } else {
+            size_t pos = line.find("丢弃 ");
+            if (pos != std::string::npos) dropped += std::strtoull(line.c_str() + pos + 7, nullptr, 10);
+        }
+    }
+}
+
+static bool validUtf8(const std::string& s) {
+    size_t i = 0;
+    while (i < s.size()) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        size_t n = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+        if (n == 0 || i + n > s.size()) return false;
+        for (size_t k = 1; k < n; ++k) {
+            if ((static_cast<unsigned char>(s[i + k]) & 0xC0) != 0x80) return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+static void checkLogger() {
+    std::string path = benchPath();
+    std::remove(path.c_str());
+    std::string wide;
+    for (int i = 0; i < 400; ++i) wide += "中";
+    std::string huge;
+    while (huge.size() < 70000) huge += "日志";
+    {
+        Logger logger(path, true, false, LogLevel::INFO, 64);
+        logger.debug("不应写出的调试日志");
+        logger.info(wide);
+        logger.warning(huge);
+        logger.error("结束");
+    }
+    std::ifstream in(path);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) lines.push_back(line);
+    BENCH_CHECK(lines.size() == 3);
+    std::vector<std::string> texts;
+    for (const std::string& l : lines) {
+        size_t body = l.find("] ");
+        BENCH_CHECK(body != std::string::npos);
+        texts.push_back(l.substr(body + 2));
+        BENCH_CHECK(validUtf8(texts.back()));
+    }
+    // 超出内联长度的消息完整写出
+    BENCH_CHECK(texts[0] == wide);
+    // 超过上限的在字符边界截断，并注明原长度
+    std::string marker = "…（已截断，共 " + std::to_string(huge.size()) + " 字节）";
+    BENCH_CHECK(texts[1].size() == 65536 - 65536 % 3 + marker.size());
+    BENCH_CHECK(texts[1].compare(0, 65536 - 65536 % 3, huge, 0, 65536 - 65536 % 3) == 0);
+    BENCH_CHECK(texts[1].compare(texts[1].size() - marker.size(), marker.size(), marker) == 0);
+    BENCH_CHECK(lines[2].find("[ERROR] 结束") != std::string::npos);
+    std::remove(path.c_str());
+
+    // 多个线程交替记录短消息和长消息：每条都完整写出，同一线程内的先后顺序不变
+    {
+        Logger logger(path, true, false, LogLevel::INFO, 64);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < 4; ++t) {
+            workers.emplace_back([&logger, &wide, t] {
+                for (int i = 0; i < 2000; ++i) {
+                    std::string prefix = "线程 " + std::to_string(t) + " 序号 " + std::to_string(i) + " ";
+                    logger.warning(i % 3 == 0 ? prefix + wide : prefix);
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+    }
+    std::ifstream mixed(path);
+    int next[4] = {0, 0, 0, 0};
+    while (std::getline(mixed, line)) {
+        int t, i;
+        size_t body = line.find("] 线程 ");
+        BENCH_CHECK(body != std::string::npos && std::sscanf(line.c_str() + body, "] 线程 %d 序号 %d", &t, &i) == 2);
+        BENCH_CHECK(t >= 0 && t < 4 && i == next[t]++);
+        std::string prefix = "线程 " + std::to_string(t) + " 序号 " + std::to_string(i) + " ";
+        BENCH_CHECK(line.substr(body + 2) == (i % 3 == 0 ? prefix + wide : prefix));
+    }
+    for (int t = 0; t < 4; ++t) BENCH_CHECK(next[t] == 2000);
+    std::remove(path.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> threadCounts = {1, 4, 16};
+    uint64_t perThread = 200000;
+    if (argc > 1) {
+        threadCounts.clear();
+        std::istringstream in(argv[1]);
+        std::string item;
+        while (std::getline(in, item, ',')) threadCounts.push_back(std::atoi(item.c_str()));
+    }
+    if (argc > 2) perThread = std::strtoull(argv[2], nullptr, 10);
+    checkLogger();
+
+    std::string path = benchPath();
+    std::cout << "每线程 " << perThread << " 条 INFO 日志，写入 " << path << "\n"
+              << std::left << std::setw(8) << "N" << std::setw(24) << "互斥量(万次/秒)" << std::setw(28)
+              << "环形缓冲(万次/秒)" << std::setw(22) << "写完(万条/秒)" << "丢弃\n" << std::fixed << std::setprecision(1);
+    for (int threads : threadCounts) {
+        BENCH_CHECK(threads > 0);
+        uint64_t total = perThread * threads;
+
+        std::remove(path.c_str());
+        Run before;
+        {
+            MutexLogger logger(path);
+            before.callSeconds = callThreads(threads, perThread, [&logger](const std::string& m) { logger.info(m); });
+        }
+        uint64_t lines = 0, dropped = 0;
+        countLines(path, lines, dropped);
+        BENCH_CHECK(lines == total);
+
+        std::remove(path.c_str());
+        Run after;
+        uint64_t reported = 0;
+        {
+            Stopwatch clock;
+            std::unique_ptr<Logger> logger(new Logger(path, true, false));
+            after.callSeconds = callThreads(threads, perThread, [&logger](const std::string& m) { logger->info(m); });
+            reported = logger->droppedCount();
+            logger.reset(); // 析构时写出剩余日志
+            after.totalSeconds = clock.seconds();
+        }
+        countLines(path, lines, dropped);
+        BENCH_CHECK(lines + reported == total);
+        BENCH_CHECK(dropped == reported);
+
+        std::cout << std::setw(8) << threads << std::setw(20) << total / before.callSeconds / 1e4 << std::setw(20)
+                  << total / after.callSeconds / 1e4 << std::setw(16) << total / after.totalSeconds / 1e4 << reported
+                  << "\n";
+    }
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,118 @@
+// 指标测试与基准：N 个短命线程（默认 10000）各写入一次计数器和直方图后退出，检查抓取结果不丢计数，
+// 退出线程的分片被并入合计后释放（分片数回到仍在运行的线程数，常驻内存不随线程数增长）；
+// 线程改用另一个 Metrics、Metrics 先于线程销毁时也不会访问已释放的分片。输出每次计数的耗时。
+//   ./metrics_bench [短命线程数，默认 10000]
+#include "component_bench.hpp"
+
+// 抓取结果中某条序列的值
+static double seriesValue(const std::string& text, const std::string& series) {
+    size_t pos = text.find("\n" + series + " ");
+    BENCH_CHECK(pos != std::string::npos);
+    return std::atof(text.c_str() + pos + series.size() + 2);
+}
+
+struct Growth {
+    long kb;
+    size_t slots;
+};
+
+// threads 个短命线程分批运行，返回常驻内存的增长和最后剩余的分片数
+static Growth runThreads(int threads) {
+    Metrics metrics;
+    Metrics::Id events = metrics.counter("bench_events_total", "", "事件数");
+    Metrics::Id latency = metrics.histogram("bench_latency_seconds", "", "耗时");
+    metrics.add(events, 5);
+    long baseKb = 0;
+    const int batch = 50;
+    for (int t = 0; t < threads; t += batch) {
+        std::vector<std::thread> group;
+        for (int k = t; k < std::min(threads, t + batch); ++k) {
+            group.emplace_back([&metrics, events, latency, k] {
+                metrics.add(events, 2);
+                metrics.observe(latency, std::chrono::milliseconds(k % 2 == 0 ? 1 : 20));
+            });
+        }
+        for (auto& thread : group) thread.join();
+        // 第一批之后的内存作为基准：线程栈、分配器的线程缓存等在此后复用
+        if (t == 0) {
+            BENCH_CHECK(metrics.threadSlots() == 1);
+            baseKb = residentKb();
+        }
+    }
+    std::string text = metrics.render();
+    BENCH_CHECK(seriesValue(text, "bench_events_total") == 5 + 2.0 * threads);
+    BENCH_CHECK(seriesValue(text, "bench_latency_seconds_count") == threads);
+    BENCH_CHECK(seriesValue(text, "bench_latency_seconds_bucket{le=\"0.001\"}") == (threads + 1) / 2);
+    BENCH_CHECK(seriesValue(text, "bench_latency_seconds_bucket{le=\"0.025\"}") == threads);
+    double sum = seriesValue(text, "bench_latency_seconds_sum");
+    BENCH_CHECK(std::abs(sum - (0.001 * ((threads + 1) / 2) + 0.02 * (threads / 2))) < 1e-6);
+    return Growth{residentKb() - baseKb, metrics.threadSlots()};
+}
+
+int main(int argc, char* argv[]) {
+    int threads = argc > 1 ? std::atoi(argv[1]) : 10000;
+    BENCH_CHECK(threads >= 100);
+
+    Growth growth = runIsolated<Growth>([threads] { return runThreads(threads); });
+    BENCH_CHECK(growth.slots == 1);
+    // 每个分片约 15 KB，不释放时 10000 个线程约 150 MB
+    BENCH_CHECK(growth.kb < 4096);
+
+    // 线程改用另一个 Metrics：原分片被标记为已退出，计数保留
+    {
+        Metrics first, second;
+        Metrics::Id a = first.counter("first_total", "", "");
+        Metrics::Id b = second.counter("second_total", "", "");
+        std::thread worker([&] {
+            first.add(a, 3);
+            second.add(b, 4);
+            BENCH_CHECK(first.threadSlots() == 0);
+            first.add(a, 1);
+        });
+        worker.join();
+        BENCH_CHECK(seriesValue(first.render(), "first_total") == 4);
+        BENCH_CHECK(seriesValue(second.render(), "second_total") == 4);
+        BENCH_CHECK(first.threadSlots() == 0 && second.threadSlots() == 0);
+    }
+
+    // Metrics 先于线程销毁：线程退出时只释放自己持有的分片
+    {
+        std::unique_ptr<Metrics> metrics(new Metrics());
+        Metrics::Id id = metrics->counter("short_total", "", "");
+        std::mutex mutex;
+        std::condition_variable cv;
+        int stage = 0;
+        std::thread worker([&] {
+            metrics->add(id);
+            std::unique_lock<std::mutex> lock(mutex);
+            stage = 1;
+            cv.notify_all();
+            cv.wait(lock, [&] { return stage == 2; });
+        });
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return stage == 1; });
+            metrics.reset();
+            stage = 2;
+            cv.notify_all();
+        }
+        worker.join();
+    }
+
+    // 每次计数的耗时（分片已创建）
+    const int rounds = 10000000;
+    Metrics metrics;
+    Metrics::Id id = metrics.counter("hot_total", "", "");
+    metrics.add(id);
+    Stopwatch clock;
+    for (int i = 0; i < rounds; ++i) {
+        metrics.add(id);
+    }
+    double addNs = clock.seconds() / rounds * 1e9;
+    BENCH_CHECK(seriesValue(metrics.render(), "hot_total") == rounds + 1);
+
+    std::cout << std::fixed << std::setprecision(1) << threads << " 个短命线程的计数和直方图检查通过，"
+              << "退出线程的分片全部释放，常驻内存增长 " << growth.kb << " KB\n"
+              << "每次计数: " << addNs << " ns\n";
+    return 0;
+}
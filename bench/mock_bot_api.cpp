@@ -0,0 +1,46 @@
+// 独立运行的模拟 Bot API，便于手动调试：
+//   ./mock_bot_api --port 18080 --messages 10000 --latency-ms 20 --rate-429 0.01
+// 然后把机器人配置中的 API_URL 指向 http://127.0.0.1:18080
+#include "bench_options.hpp"
+#include "mock_bot_api.hpp"
+
+#include <csignal>
+#include <iostream>
+
+static std::atomic<bool> running(true);
+
+static void signalHandler(int) {
+    running = false;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions opts;
+    if (!opts.parse(argc, argv)) {
+        opts.usage(argv[0]);
+        return 1;
+    }
+    if (opts.mock.port == 0) {
+        opts.mock.port = 18080;
+    }
+
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+
+    MockBotApi mock(opts.mock);
+    unsigned short port = mock.start();
+    std::cout << "模拟 Bot API 已启动: http://" << opts.mock.address << ":" << port << std::endl;
+
+    while (running && !mock.waitDone(std::chrono::seconds(1))) {
+    }
+    mock.stop();
+
+    MockBotApi::Result r = mock.snapshot();
+    std::cout << "发出 " << r.served << " 完成 " << r.completed << " 请求 " << r.requests
+              << " 注入 429 " << r.injected429 << std::endl;
+    if (r.completed > 0) {
+        std::cout << "吞吐 " << r.completed / std::max(r.seconds, 1e-9) << " 条/秒"
+                  << " p50 " << MockBotApi::percentile(r.latencies, 0.5) * 1000 << " ms"
+                  << " p99 " << MockBotApi::percentile(r.latencies, 0.99) * 1000 << " ms" << std::endl;
+    }
+    return 0;
+}
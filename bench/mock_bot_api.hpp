@@ -0,0 +1,802 @@
+// 本地模拟 Telegram Bot API：按给定负载生成 getUpdates 批次（机器人调用 setWebhook 后
+// 改为像 Telegram 一样并发推送到 Webhook），接收机器人发出的
+// sendMessage / editMessageText / answerCallbackQuery 等调用，并统计端到端延迟。
+// 每条模拟消息的文本带有唯一标记 bench#<序号>，从该消息首次发出，
+// 到机器人第一次发出包含该标记的消息为止，计为一次端到端延迟。
+// 同一用户转给管理员的消息、发给同一用户的回复各自应按发出顺序送达，先发后至的计为乱序。
+// 给定录制轨迹（Options::script）时按轨迹回放：按原始间隔（或加速）依次发出，类型、长度与录制时一致。
+#pragma once
+
+#include "update_trace.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class MockBotApi {
+public:
+    // 更新类型：普通消息、/req 请求、管理员回复、管理员点击请求按钮，以及回放时才有的媒体和其他命令
+    enum Kind { TEXT, REQUEST, REPLY, CALLBACK, MEDIA, COMMAND, KIND_COUNT };
+
+    static const char* kindName(int kind) {
+        static const char* const names[] = {"text", "req", "reply", "callback", "media", "command"};
+        return kind >= 0 && kind < KIND_COUNT ? names[kind] : "unknown";
+    }
+
+    // 负载构成（权重）：普通消息、/req 请求、管理员回复、管理员点击请求按钮
+    struct Mix {
+        int text = 70;
+        int request = 10;
+        int reply = 15;
+        int callback = 5;
+    };
+
+    struct Options {
+        std::string address = "127.0.0.1";
+        unsigned short port = 0; // 0 为自动分配
+        int64_t adminId = 1;
+        int users = 1000; // 模拟用户数
+        uint64_t messages = 10000; // 模拟消息总数
+        Mix mix;
+        int latencyMs = 0; // 每个非 getUpdates 调用的固定延迟
+        int jitterMs = 0; // 在固定延迟上叠加的随机延迟
+        double rate429 = 0; // 发送类调用返回 429 的概率
+        int retryAfter = 1; // 429 响应中的 retry_after（秒）
+        int blockedEvery = 0; // 非 0 时 chat_id 能被它整除的用户已屏蔽机器人，发给他们的消息返回 403
+        int pollHoldMs = 500; // 没有新消息时 getUpdates 的最长挂起时间
+        int webhookConnections = 0; // Webhook 推送并发连接数，0 为按 setWebhook 的 max_connections
+        unsigned seed = 42;
+        std::shared_ptr<const std::vector<TraceEvent>> script; // 非空时按轨迹回放，忽略 users/messages/mix
+        double speed = 1; // 回放速度倍数，0 为不等待、尽快发出
+    };
+
+    struct Result {
+        uint64_t served = 0; // 已通过 getUpdates 发出的模拟消息
+        uint64_t completed = 0; // 已观察到机器人处理结果的消息
+        double seconds = 0; // 第一条消息发出到最后一条完成
+        uint64_t requests = 0; // 收到的 API 调用总数
+        uint64_t injected429 = 0;
+        uint64_t blocked = 0; // 因 blockedEvery 返回 403 的发送
+        uint64_t pushed = 0; // 通过 Webhook 推送成功的更新
+        uint64_t pushErrors = 0; // Webhook 推送失败（连接错误或非 200）
+        uint64_t untracked = 0; // 无法从机器人的输出中观察到结果的更新（管理员命令、相册的后续项等）
+        uint64_t reordered = 0; // 同一会话中晚发出的消息先于早发出的送达
+        std::vector<std::string> adminNotices; // 发给管理员、不带标记的文本（命令回复、广播报告等）
+        std::unordered_map<std::string, uint64_t> methods; // 各方法调用次数
+        std::vector<double> latencies; // 端到端延迟（秒），已排序
+        uint64_t kindServed[KIND_COUNT] = {}; // 各类型发出的更新数
+        std::vector<double> kindLatencies[KIND_COUNT]; // 各类型的端到端延迟（秒），已排序
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    typedef boost::asio::ip::tcp tcp;
+
+    struct Update {
+        uint64_t id;
+        std::string json;
+    };
+
+    // 一条待生成的更新
+    struct Plan {
+        Kind kind = TEXT;
+        int64_t userId = 0;
+        uint64_t textLength = 0; // 回放时按录制的长度填充文本，0 为默认文本
+        std::string command; // COMMAND：不带斜杠的命令名；CALLBACK：按钮动作
+        int media = TraceEvent::PHOTO;
+        uint64_t album = 0;
+        bool fromAdmin = false; // TEXT/COMMAND 由管理员发出
+        bool tracked = true; // 能否从机器人的输出中观察到结果
+    };
+
+    struct Pending {
+        Clock::time_point at;
+        Kind kind;
+        int64_t from; // 发出该更新的会话
+    };
+
+    enum { MAX_TEXT = 3000, MAX_CAPTION = 800 }; // 填充长度上限，给机器人加的消息头留出余量
+
+    Options options;
+    boost::asio::io_context io;
+    tcp::acceptor acceptor;
+    std::thread acceptThread;
+    std::atomic<bool> stopping{false};
+
+    std::mutex connMutex;
+    std::vector<std::shared_ptr<tcp::socket>> sockets;
+    std::vector<std::thread> connThreads;
+    std::vector<std::thread> pushThreads; // Webhook 推送线程，受 connMutex 保护
+    std::atomic<bool> webhookActive{false};
+
+    // 以下状态受 stateMutex 保护
+    std::mutex stateMutex;
+    std::condition_variable doneCond;
+    std::mt19937 rng;
+    uint64_t nextUpdateId = 1;
+    uint64_t nextSeq = 0; // 已生成的模拟消息数
+    int64_t nextMessageId = 1000;
+    std::deque<Update> unacked; // 已发出但机器人尚未确认的更新
+    std::deque<int64_t> adminMessages; // 转发给管理员的消息，可被回复
+    std::deque<int64_t> requestMessages; // 带按钮的请求消息，可被点击
+    std::unordered_map<uint64_t, Pending> inflight; // 标记 -> 首次发出时间和类型
+    std::unordered_map<int64_t, uint64_t> commandWaiters; // 发了 /start 或 /help 的会话 -> 标记
+    std::unordered_set<uint64_t> albumsSeen;
+    std::map<std::pair<bool, int64_t>, uint64_t> lastDelivered; // (发往管理员?, 用户) -> 已送达的最大序号
+    bool replayStarted = false;
+    Clock::time_point replayStart;
+    Clock::time_point firstServed;
+    Clock::time_point lastCompleted;
+    Result result;
+
+    static std::string jsonEscape(const std::string& s) {
+        std::string out;
+        out.reserve(s.size() + 8);
+        for (unsigned char c : s) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        out += buf;
+                    } else {
+                        out += static_cast<char>(c);
+                    }
+            }
+        }
+        return out;
+    }
+
+    static std::string urlDecode(const std::string& s) {
+        std::string out;
+        out.reserve(s.size());
+        for (size_t i = 0; i < s.size(); ++i) {
+            if (s[i] == '+') {
+                out += ' ';
+            } else if (s[i] == '%' && i + 2 < s.size()) {
+                out += static_cast<char>(std::stoi(s.substr(i + 1, 2), nullptr, 16));
+                i += 2;
+            } else {
+                out += s[i];
+            }
+        }
+        return out;
+    }
+
+    static std::unordered_map<std::string, std::string> parseForm(const std::string& body) {
+        std::unordered_map<std::string, std::string> args;
+        std::istringstream in(body);
+        std::string pair;
+        while (std::getline(in, pair, '&')) {
+            size_t eq = pair.find('=');
+            if (eq == std::string::npos) continue;
+            try {
+                args[urlDecode(pair.substr(0, eq))] = urlDecode(pair.substr(eq + 1));
+            } catch (...) {
+            }
+        }
+        return args;
+    }
+
+    static std::string userJson(int64_t id) {
+        return "{\"id\":" + std::to_string(id) + ",\"is_bot\":false,\"first_name\":\"user" + std::to_string(id) +
+               "\",\"username\":\"u" + std::to_string(id) + "\"}";
+    }
+
+    static std::string chatJson(int64_t id) {
+        return "{\"id\":" + std::to_string(id) + ",\"type\":\"private\"}";
+    }
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    Kind pickKind() {
+        const Mix& m = options.mix;
+        int total = std::max(1, m.text + m.request + m.reply + m.callback);
+        int r = std::uniform_int_distribution<int>(0, total - 1)(rng);
+        Kind kind = r < m.text ? TEXT
+                  : r < m.text + m.request ? REQUEST
+                  : r < m.text + m.request + m.reply ? REPLY : CALLBACK;
+        return kind;
+    }
+
+    Plan randomPlan() {
+        Plan plan;
+        plan.kind = pickKind();
+        plan.userId = 100000 + std::uniform_int_distribution<int>(0, std::max(1, options.users) - 1)(rng);
+        return plan;
+    }
+
+    // 录制的更新对应的模拟更新。管理员都由 options.adminId 发出；管理员的媒体回复按文字回复回放，
+    // 管理员不是回复的消息和管理员命令照常发出，但不计延迟
+    Plan scriptedPlan(const TraceEvent& e) {
+        Plan plan;
+        plan.userId = 100000 + static_cast<int64_t>(e.user);
+        plan.textLength = e.textLength;
+        bool admin = (e.flags & TraceEvent::ADMIN) != 0;
+        switch (e.kind) {
+            case TraceEvent::TEXT:
+            case TraceEvent::MEDIA:
+                if (admin && (e.flags & TraceEvent::REPLY)) {
+                    plan.kind = REPLY;
+                } else if (admin) {
+                    plan.fromAdmin = true;
+                    plan.tracked = false;
+                } else if (e.kind == TraceEvent::MEDIA) {
+                    plan.kind = MEDIA;
+                    plan.media = e.media;
+                    plan.album = e.album;
+                    // 机器人只把相册第一项的说明文字带给管理员
+                    plan.tracked = e.album == 0 || albumsSeen.insert(e.album).second;
+                }
+                break;
+            case TraceEvent::COMMAND:
+                if (!admin && e.name == "req") {
+                    plan.kind = REQUEST;
+                } else {
+                    plan.kind = COMMAND;
+                    plan.command = e.name;
+                    plan.fromAdmin = admin;
+                    plan.tracked = !admin && (e.name == "start" || e.name == "help");
+                }
+                break;
+            case TraceEvent::CALLBACK:
+                plan.kind = CALLBACK;
+                plan.command = e.name;
+                break;
+        }
+        return plan;
+    }
+
+    // 回放时第 seq 条的发出时间；随机负载和不限速回放立即发出
+    Clock::time_point dueAt(uint64_t seq) {
+        if (!options.script || options.speed <= 0) return Clock::time_point::min();
+        if (!replayStarted) {
+            replayStarted = true;
+            replayStart = Clock::now();
+        }
+        double micros = static_cast<double>((*options.script)[seq].atMicros) / options.speed;
+        return replayStart + std::chrono::microseconds(static_cast<int64_t>(micros));
+    }
+
+    // 标记加上填充，凑出录制时的文本长度
+    static std::string filled(const std::string& marker, uint64_t length, size_t limit, const std::string& fallback) {
+        if (length == 0) return marker + fallback;
+        size_t target = static_cast<size_t>(std::min<uint64_t>(length, limit));
+        return target > marker.size() + 1 ? marker + " " + std::string(target - marker.size() - 1, 'x') : marker;
+    }
+
+    static std::string mediaJson(int media, uint64_t seq) {
+        std::string file = "{\"file_id\":\"f" + std::to_string(seq) + "\",\"file_unique_id\":\"u" + std::to_string(seq) + "\"";
+        switch (media) {
+            case TraceEvent::PHOTO: return "\"photo\":[" + file + ",\"width\":90,\"height\":90}]";
+            case TraceEvent::VIDEO: return "\"video\":" + file + ",\"width\":640,\"height\":360,\"duration\":5}";
+            case TraceEvent::AUDIO: return "\"audio\":" + file + ",\"duration\":30}";
+            case TraceEvent::VOICE: return "\"voice\":" + file + ",\"duration\":3}";
+            case TraceEvent::STICKER:
+                return "\"sticker\":" + file + ",\"type\":\"regular\",\"width\":512,\"height\":512," +
+                       "\"is_animated\":false,\"is_video\":false}";
+            case TraceEvent::ANIMATION: return "\"animation\":" + file + ",\"width\":320,\"height\":240,\"duration\":2}";
+            case TraceEvent::VIDEO_NOTE: return "\"video_note\":" + file + ",\"length\":240,\"duration\":3}";
+            default: return "\"document\":" + file + ",\"file_name\":\"file.bin\"}";
+        }
+    }
+
+    // 生成一条模拟更新，调用方持有 stateMutex
+    Update generate() {
+        uint64_t seq = nextSeq++;
+        Plan plan = options.script ? scriptedPlan((*options.script)[seq]) : randomPlan();
+        // 还没有可回复或可点击的消息时退化为普通消息
+        if (plan.kind == REPLY && adminMessages.empty()) plan.kind = TEXT;
+        if (plan.kind == CALLBACK && requestMessages.empty()) plan.kind = REQUEST;
+
+        std::string marker = "bench#" + std::to_string(seq);
+        int64_t from = plan.fromAdmin || plan.kind == REPLY || plan.kind == CALLBACK ? options.adminId : plan.userId;
+        int64_t messageId = nextMessageId++;
+        std::string date = std::to_string(now());
+
+        Update u;
+        u.id = nextUpdateId++;
+        std::string head = "{\"update_id\":" + std::to_string(u.id) + ",";
+        std::string message = head + "\"message\":{\"message_id\":" + std::to_string(messageId) + ",\"from\":" +
+                              userJson(from) + ",\"chat\":" + chatJson(from) + ",\"date\":" + date + ",";
+        switch (plan.kind) {
+            case TEXT:
+                u.json = message + "\"text\":\"" + filled(marker, plan.textLength, MAX_TEXT, " 你好，我需要帮助") + "\"}}";
+                break;
+            case REQUEST:
+                u.json = message + "\"text\":\"/req " + filled(marker, plan.textLength, MAX_TEXT, " 申请开通高级功能") + "\"," +
+                         "\"entities\":[{\"type\":\"bot_command\",\"offset\":0,\"length\":4}]}}";
+                break;
+            case REPLY: {
+                int64_t target = adminMessages.front();
+                adminMessages.pop_front();
+                u.json = message + "\"text\":\"" + filled(marker, plan.textLength, MAX_TEXT, " 已收到，请稍候") +
+                         "\",\"reply_to_message\":{\"message_id\":" + std::to_string(target) + ",\"chat\":" +
+                         chatJson(options.adminId) + ",\"date\":" + date + ",\"text\":\"\"}}}";
+                break;
+            }
+            case CALLBACK: {
+                int64_t target = requestMessages.front();
+                requestMessages.pop_front();
+                static const char* const actions[] = {"accept", "reject", "complete"};
+                std::string action = plan.command;
+                if (action != "accept" && action != "reject" && action != "complete") action = actions[seq % 3];
+                u.json = head + "\"callback_query\":{\"id\":\"cb" + std::to_string(seq) + "\",\"from\":" +
+                         userJson(options.adminId) + ",\"message\":{\"message_id\":" + std::to_string(target) +
+                         ",\"chat\":" + chatJson(options.adminId) + ",\"date\":" + date + ",\"text\":\"📨 新请求 " +
+                         marker + "\"},\"chat_instance\":\"1\",\"data\":\"" + action + "_" + std::to_string(target) + "\"}}";
+                break;
+            }
+            case MEDIA:
+                // 说明文字带标记，机器人复制或发送消息头时会带上
+                u.json = message + mediaJson(plan.media, seq) +
+                         (plan.album != 0 ? ",\"media_group_id\":\"album" + std::to_string(plan.album) + "\"" : "") +
+                         (plan.tracked ? ",\"caption\":\"" + filled(marker, plan.textLength, MAX_CAPTION, "") + "\"" : "") + "}}";
+                break;
+            case COMMAND: {
+                std::string command = "/" + plan.command;
+                u.json = message + "\"text\":\"" + jsonEscape(command) + "\",\"entities\":[{\"type\":\"bot_command\"," +
+                         "\"offset\":0,\"length\":" + std::to_string(command.size()) + "}]}}";
+                if (plan.tracked) commandWaiters[from] = seq; // 回复中没有标记，以发给该会话的第一条消息为准
+                break;
+            }
+            case KIND_COUNT:
+                break;
+        }
+        if (plan.tracked) {
+            inflight[seq] = Pending{Clock::now(), plan.kind, from};
+        } else {
+            ++result.untracked;
+        }
+        if (seq == 0) firstServed = Clock::now();
+        ++result.served;
+        ++result.kindServed[plan.kind];
+        checkDone();
+        return u;
+    }
+
+    bool allDone() const { return result.completed + result.untracked >= options.messages; }
+
+    void checkDone() {
+        if (allDone()) doneCond.notify_all();
+    }
+
+    // chatId 为机器人发出该消息的会话，0 为不检查顺序
+    void complete(uint64_t seq, int64_t chatId) {
+        auto it = inflight.find(seq);
+        if (it == inflight.end()) return;
+        // 用户的消息按来源用户、发给用户的回复按目标用户检查顺序；管理员自己的操作不检查
+        bool toAdmin = chatId == options.adminId;
+        int64_t user = toAdmin ? it->second.from : chatId;
+        if (chatId != 0 && user != options.adminId) {
+            uint64_t& last = lastDelivered[std::make_pair(toAdmin, user)];
+            if (seq < last) {
+                ++result.reordered;
+            } else {
+                last = seq;
+            }
+        }
+        auto t = Clock::now();
+        double latency = std::chrono::duration<double>(t - it->second.at).count();
+        result.latencies.push_back(latency);
+        result.kindLatencies[it->second.kind].push_back(latency);
+        inflight.erase(it);
+        lastCompleted = t;
+        ++result.completed;
+        checkDone();
+    }
+
+    // 发出到期的更新，直到凑满 limit 条，调用方持有 stateMutex
+    void fillUnacked(size_t limit) {
+        while (unacked.size() < limit && nextSeq < options.messages && dueAt(nextSeq) <= Clock::now()) {
+            unacked.push_back(generate());
+        }
+    }
+
+    // 机器人发出的文本中带有标记时记录完成，返回是否带有标记
+    bool observe(const std::string& text, int64_t chatId) {
+        size_t pos = text.find("bench#");
+        if (pos == std::string::npos) return false;
+        try {
+            complete(std::stoull(text.substr(pos + 6)), chatId);
+        } catch (...) {
+        }
+        return true;
+    }
+
+    std::string ok(const std::string& resultJson) {
+        return "{\"ok\":true,\"result\":" + resultJson + "}";
+    }
+
+    std::string getUpdates(const std::unordered_map<std::string, std::string>& args) {
+        uint64_t offset = 0;
+        size_t limit = 100;
+        int timeout = 0;
+        auto it = args.find("offset");
+        if (it != args.end()) offset = std::stoull(it->second);
+        it = args.find("limit");
+        if (it != args.end()) limit = std::max(1, std::min(100, std::stoi(it->second)));
+        it = args.find("timeout");
+        if (it != args.end()) timeout = std::stoi(it->second);
+
+        std::unique_lock<std::mutex> lock(stateMutex);
+        while (!unacked.empty() && unacked.front().id < offset) {
+            unacked.pop_front();
+        }
+        fillUnacked(limit);
+
+        if (unacked.empty()) {
+            // 负载已全部发出（或回放的下一条未到时间）：挂起一段时间模拟长轮询，避免机器人空转
+            auto until = Clock::now() + std::chrono::milliseconds(std::min(options.pollHoldMs, timeout * 1000));
+            if (nextSeq < options.messages) until = std::min(until, dueAt(nextSeq));
+            lock.unlock();
+            if (!stopping) std::this_thread::sleep_until(until);
+            lock.lock();
+            fillUnacked(limit);
+            if (unacked.empty()) return ok("[]");
+        }
+
+        std::string body = "[";
+        for (size_t i = 0; i < unacked.size() && i < limit; ++i) {
+            if (i > 0) body += ",";
+            body += unacked[i].json;
+        }
+        return ok(body + "]");
+    }
+
+    std::string sentMessage(int64_t chatId, const std::string& text, int64_t messageId) {
+        return ok("{\"message_id\":" + std::to_string(messageId) + ",\"chat\":" + chatJson(chatId) +
+                  ",\"date\":" + std::to_string(now()) + ",\"text\":\"" + jsonEscape(text) + "\"}");
+    }
+
+    std::string handle(const std::string& method, const std::unordered_map<std::string, std::string>& args) {
+        auto arg = [&args](const char* name) {
+            auto it = args.find(name);
+            return it == args.end() ? std::string() : it->second;
+        };
+
+        if (method == "getUpdates") {
+            return getUpdates(args);
+        }
+
+        if (options.latencyMs > 0 || options.jitterMs > 0) {
+            int jitter = 0;
+            if (options.jitterMs > 0) {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                jitter = std::uniform_int_distribution<int>(0, options.jitterMs)(rng);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.latencyMs + jitter));
+        }
+
+        bool sending = method.compare(0, 4, "send") == 0 || method.compare(0, 4, "copy") == 0 ||
+                       method.compare(0, 7, "forward") == 0 || method.compare(0, 4, "edit") == 0;
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (sending && options.rate429 > 0 &&
+            std::uniform_real_distribution<double>(0, 1)(rng) < options.rate429) {
+            ++result.injected429;
+            return "{\"ok\":false,\"error_code\":429,\"description\":\"Too Many Requests: retry after " +
+                   std::to_string(options.retryAfter) + "\",\"parameters\":{\"retry_after\":" +
+                   std::to_string(options.retryAfter) + "}}";
+        }
+        if (sending && options.blockedEvery > 0) {
+            int64_t chatId = std::atoll(arg("chat_id").c_str());
+            if (chatId != options.adminId && chatId % options.blockedEvery == 0) {
+                ++result.blocked;
+                return "{\"ok\":false,\"error_code\":403,\"description\":\"Forbidden: bot was blocked by the user\"}";
+            }
+        }
+
+        if (method == "sendMessage" || method == "editMessageText") {
+            int64_t chatId = 0;
+            try {
+                chatId = std::stoll(arg("chat_id"));
+            } catch (...) {
+            }
+            std::string text = arg("text");
+            int64_t messageId = method == "sendMessage" ? nextMessageId++ : std::atoll(arg("message_id").c_str());
+            if (method == "sendMessage" && chatId == options.adminId && text.find("bench#") == std::string::npos) {
+                result.adminNotices.push_back(text);
+            }
+            if (method == "sendMessage" && chatId == options.adminId && text.find("bench#") != std::string::npos) {
+                // 转发到管理员的消息供后续回复/点击使用
+                if (args.count("reply_markup")) {
+                    requestMessages.push_back(messageId);
+                } else {
+                    adminMessages.push_back(messageId);
+                }
+            }
+            if (!observe(text, method == "sendMessage" ? chatId : 0) && method == "sendMessage") {
+                auto waiter = commandWaiters.find(chatId);
+                if (waiter != commandWaiters.end()) {
+                    complete(waiter->second, 0);
+                    commandWaiters.erase(waiter);
+                }
+            }
+            return sentMessage(chatId, text, messageId);
+        }
+        if (method == "copyMessage") {
+            observe(arg("caption"), std::atoll(arg("chat_id").c_str()));
+            return ok("{\"message_id\":" + std::to_string(nextMessageId++) + "}");
+        }
+        if (method == "sendMediaGroup") {
+            int64_t chatId = std::atoll(arg("chat_id").c_str());
+            std::string messages;
+            std::string media = arg("media");
+            observe(media, chatId);
+            for (size_t pos = media.find("\"media\""); pos != std::string::npos; pos = media.find("\"media\"", pos + 1)) {
+                if (!messages.empty()) messages += ",";
+                messages += "{\"message_id\":" + std::to_string(nextMessageId++) + ",\"chat\":" + chatJson(chatId) +
+                            ",\"date\":" + std::to_string(now()) + "}";
+            }
+            return ok("[" + messages + "]");
+        }
+        if (method == "setWebhook") {
+            startPushing(arg("url"), arg("secret_token"), std::atoi(arg("max_connections").c_str()));
+            return ok("true");
+        }
+        if (method == "deleteWebhook") {
+            webhookActive = false;
+            return ok("true");
+        }
+        if (method == "getMe") {
+            return ok("{\"id\":1,\"is_bot\":true,\"first_name\":\"bench\",\"username\":\"bench_bot\"}");
+        }
+        return ok("true");
+    }
+
+    void serve(std::shared_ptr<tcp::socket> socket) {
+        namespace http = boost::beast::http;
+        boost::beast::flat_buffer buffer;
+        boost::system::error_code ec;
+        while (!stopping) {
+            http::request<http::string_body> req;
+            http::read(*socket, buffer, req, ec);
+            if (ec) break;
+
+            std::string target = req.target().to_string();
+            std::string query;
+            size_t q = target.find('?');
+            if (q != std::string::npos) {
+                query = target.substr(q + 1);
+                target = target.substr(0, q);
+            }
+            std::string method = target.substr(target.rfind('/') + 1);
+            auto args = parseForm(query);
+            for (auto& kv : parseForm(req.body())) {
+                args[kv.first] = kv.second;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                ++result.requests;
+                ++result.methods[method];
+            }
+
+            http::response<http::string_body> res(http::status::ok, req.version());
+            res.set(http::field::content_type, "application/json");
+            res.keep_alive(req.keep_alive());
+            try {
+                res.body() = handle(method, args);
+            } catch (std::exception& e) {
+                res.result(http::status::bad_request);
+                res.body() = "{\"ok\":false,\"error_code\":400,\"description\":\"" + jsonEscape(e.what()) + "\"}";
+            }
+            res.prepare_payload();
+            http::write(*socket, res, ec);
+            if (ec || !res.keep_alive()) break;
+        }
+        socket->shutdown(tcp::socket::shutdown_both, ec);
+    }
+
+    // 收到 setWebhook 后按 Telegram 的方式推送：每个请求一个 Update，多个连接并发，收到 200 才算送达
+    void startPushing(const std::string& url, const std::string& secret, int maxConnections) {
+        const std::string scheme = "http://";
+        if (url.compare(0, scheme.size(), scheme) != 0 || webhookActive.exchange(true)) return;
+        std::string rest = url.substr(scheme.size());
+        size_t slash = rest.find('/');
+        std::string hostPort = rest.substr(0, slash);
+        std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+        size_t colon = hostPort.rfind(':');
+        std::string host = hostPort.substr(0, colon);
+        std::string port = colon == std::string::npos ? "80" : hostPort.substr(colon + 1);
+
+        int connections = options.webhookConnections > 0 ? options.webhookConnections
+                        : maxConnections > 0 ? maxConnections : 40;
+        std::lock_guard<std::mutex> lock(connMutex);
+        for (int i = 0; i < connections; ++i) {
+            pushThreads.emplace_back(&MockBotApi::pushLoop, this, host, port, path, secret);
+        }
+    }
+
+    void pushLoop(std::string host, std::string port, std::string path, std::string secret) {
+        namespace http = boost::beast::http;
+        std::shared_ptr<tcp::socket> socket;
+        boost::beast::flat_buffer buffer;
+        std::string pending; // 未送达的更新，重连后重发
+
+        while (!stopping && webhookActive) {
+            if (pending.empty()) {
+                std::unique_lock<std::mutex> lock(stateMutex);
+                if (nextSeq >= options.messages) break;
+                auto due = dueAt(nextSeq);
+                if (due > Clock::now()) {
+                    lock.unlock();
+                    std::this_thread::sleep_until(std::min(due, Clock::now() + std::chrono::milliseconds(100)));
+                    continue;
+                }
+                pending = generate().json;
+            }
+
+            boost::system::error_code ec;
+            if (!socket) {
+                socket = std::make_shared<tcp::socket>(io);
+                tcp::resolver resolver(io);
+                boost::asio::connect(*socket, resolver.resolve(host, port, ec), ec);
+                if (ec) {
+                    socket.reset();
+                    {
+                        std::lock_guard<std::mutex> lock(stateMutex);
+                        ++result.pushErrors;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                    continue;
+                }
+                socket->set_option(tcp::no_delay(true), ec);
+                std::lock_guard<std::mutex> lock(connMutex);
+                sockets.push_back(socket);
+            }
+
+            http::request<http::string_body> req(http::verb::post, path, 11);
+            req.set(http::field::host, host);
+            req.set(http::field::content_type, "application/json");
+            if (!secret.empty()) {
+                req.set("X-Telegram-Bot-Api-Secret-Token", secret);
+            }
+            req.keep_alive(true);
+            req.body() = pending;
+            req.prepare_payload();
+
+            http::response<http::string_body> res;
+            http::write(*socket, req, ec);
+            if (!ec) {
+                http::read(*socket, buffer, res, ec);
+            }
+
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (!ec && res.result() == http::status::ok) {
+                ++result.pushed;
+                pending.clear();
+            } else {
+                ++result.pushErrors;
+            }
+            if (ec || !res.keep_alive()) {
+                socket.reset();
+                buffer.clear();
+            }
+        }
+    }
+
+    void acceptLoop() {
+        while (!stopping) {
+            auto socket = std::make_shared<tcp::socket>(io);
+            boost::system::error_code ec;
+            acceptor.accept(*socket, ec);
+            if (ec || stopping) break;
+            socket->set_option(tcp::no_delay(true), ec);
+            std::lock_guard<std::mutex> lock(connMutex);
+            sockets.push_back(socket);
+            connThreads.emplace_back(&MockBotApi::serve, this, socket);
+        }
+    }
+
+public:
+    explicit MockBotApi(const Options& opts) : options(opts), acceptor(io), rng(opts.seed) {
+        if (options.script) options.messages = options.script->size();
+    }
+
+    MockBotApi(const MockBotApi&) = delete;
+    MockBotApi& operator=(const MockBotApi&) = delete;
+
+    ~MockBotApi() { stop(); }
+
+    // 开始监听，返回实际端口
+    unsigned short start() {
+        tcp::endpoint endpoint(boost::asio::ip::make_address(options.address), options.port);
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        acceptor.bind(endpoint);
+        acceptor.listen();
+        unsigned short port = acceptor.local_endpoint().port();
+        acceptThread = std::thread(&MockBotApi::acceptLoop, this);
+        return port;
+    }
+
+    void stop() {
+        if (stopping.exchange(true)) return;
+
+        // 连一下自己让阻塞的 accept 返回
+        boost::system::error_code ec;
+        if (acceptor.is_open()) {
+            tcp::socket wake(io);
+            wake.connect(acceptor.local_endpoint(), ec);
+        }
+        if (acceptThread.joinable()) acceptThread.join();
+        acceptor.close(ec);
+
+        webhookActive = false;
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(connMutex);
+            for (auto& socket : sockets) {
+                socket->shutdown(tcp::socket::shutdown_both, ec);
+            }
+            threads.swap(connThreads);
+            std::move(pushThreads.begin(), pushThreads.end(), std::back_inserter(threads));
+            pushThreads.clear();
+        }
+        // 推送线程重连时需要 connMutex，因此在锁外等待
+        for (auto& t : threads) {
+            t.join();
+        }
+        std::lock_guard<std::mutex> lock(connMutex);
+        sockets.clear();
+    }
+
+    // 等待全部消息完成（不计延迟的只需发出），超时返回 false
+    bool waitDone(std::chrono::seconds timeout) {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        return doneCond.wait_for(lock, timeout, [this] { return allDone(); });
+    }
+
+    // 已发出和已完成（含不计延迟的）的更新数，不复制延迟数据
+    void progress(uint64_t& served, uint64_t& finished) {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        served = result.served;
+        finished = result.completed + result.untracked;
+    }
+
+    Result snapshot() {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        Result r = result;
+        if (r.completed > 0) {
+            r.seconds = std::chrono::duration<double>(lastCompleted - firstServed).count();
+        }
+        std::sort(r.latencies.begin(), r.latencies.end());
+        for (auto& latencies : r.kindLatencies) {
+            std::sort(latencies.begin(), latencies.end());
+        }
+        return r;
+    }
+
+    static double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty()) return 0;
+        size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(i, sorted.size() - 1)];
+    }
+};
@@ -0,0 +1,167 @@
+// 任务队列微基准：MpmcQueue（移动进出、批量出队、IdleParking 停靠）与原先的
+// std::queue + 互斥量 + 条件变量（入队出队各复制一次）对比，生产者和消费者各 N 个线程。
+// 每个任务带两个 shared_ptr 和一段文本，与 MessageTask 的复制开销一致；检查每个任务恰好被消费一次。
+//   ./mpmc_queue_bench [线程数列表，默认 1,2,4,8,16,32,64] [任务数，默认 2000000]
+#include "component_bench.hpp"
+
+#include <queue>
+
+static MessageTask makeTask(uint64_t id, const TgBot::Message::Ptr& message) {
+    MessageTask task;
+    task.type = MessageTask::FORWARD_TO_ADMIN;
+    task.message = message;
+    task.callbackQuery = nullptr;
+    task.targetUserId = static_cast<int64_t>(id);
+    task.adminChatId = 0;
+    task.text = "bench message text long enough to live on the heap";
+    return task;
+}
+
+// 原先的实现：一把锁保护 std::queue，出队时复制 front() 再 pop()
+class LockedQueue {
+private:
+    std::queue<MessageTask> queue;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+
+public:
+    void push(const MessageTask& task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push(task);
+        cv.notify_one();
+    }
+
+    bool pop(MessageTask& out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !queue.empty() || done; });
+        if (queue.empty()) return false;
+        out = queue.front();
+        queue.pop();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cv.notify_all();
+    }
+};
+
+// 与工作线程相同的用法：满时让出，空时停靠，每次最多取 16 个
+class RingQueue {
+private:
+    MpmcQueue<MessageTask> ring;
+    IdleParking parking;
+    std::atomic<bool> done{false};
+
+public:
+    RingQueue() : ring(65536) {}
+
+    void push(MessageTask&& task) {
+        while (!ring.tryPush(std::move(task))) std::this_thread::yield();
+        parking.notifyOne();
+    }
+
+    size_t popBatch(MessageTask* out, size_t max) {
+        while (true) {
+            size_t n = ring.popBatch(out, max);
+            if (n > 0) return n;
+            if (done.load()) return ring.popBatch(out, max);
+            parking.wait([this] { return ring.sizeApprox() > 0 || done.load(); });
+        }
+    }
+
+    void close() {
+        done = true;
+        parking.notifyAll();
+    }
+};
+
+struct Run {
+    double seconds = 0;
+    uint64_t consumed = 0;
+    uint64_t sum = 0;
+};
+
+template <typename Produce, typename Consume, typename Close>
+static Run runThreads(int threads, uint64_t items, Produce produce, Consume consume, Close close) {
+    Run run;
+    std::atomic<uint64_t> consumed{0}, sum{0};
+    std::vector<std::thread> consumers, producers;
+    Stopwatch clock;
+    for (int c = 0; c < threads; ++c) {
+        consumers.emplace_back([&] {
+            uint64_t n = 0, s = 0;
+            consume(n, s);
+            consumed += n;
+            sum += s;
+        });
+    }
+    for (int p = 0; p < threads; ++p) {
+        producers.emplace_back([&, p] {
+            auto message = std::make_shared<TgBot::Message>();
+            for (uint64_t id = p; id < items; id += threads) produce(makeTask(id, message));
+        });
+    }
+    for (auto& t : producers) t.join();
+    close();
+    for (auto& t : consumers) t.join();
+    run.seconds = clock.seconds();
+    run.consumed = consumed;
+    run.sum = sum;
+    return run;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> threadCounts = {1, 2, 4, 8, 16, 32, 64};
+    uint64_t items = 2000000;
+    if (argc > 1) {
+        threadCounts.clear();
+        std::istringstream in(argv[1]);
+        std::string item;
+        while (std::getline(in, item, ',')) threadCounts.push_back(std::atoi(item.c_str()));
+    }
+    if (argc > 2) items = std::strtoull(argv[2], nullptr, 10);
+    const uint64_t expectedSum = items * (items - 1) / 2;
+
+    std::cout << items << " 个任务；N 个生产者 + N 个消费者\n"
+              << std::left << std::setw(8) << "N" << std::setw(20) << "mutex+queue(万/秒)" << std::setw(20)
+              << "MpmcQueue(万/秒)" << "加速比\n" << std::fixed << std::setprecision(1);
+    for (int threads : threadCounts) {
+        BENCH_CHECK(threads > 0);
+        LockedQueue locked;
+        Run baseline = runThreads(
+            threads, items, [&locked](MessageTask&& task) { locked.push(task); },
+            [&locked](uint64_t& n, uint64_t& s) {
+                MessageTask task;
+                while (locked.pop(task)) {
+                    ++n;
+                    s += static_cast<uint64_t>(task.targetUserId);
+                }
+            },
+            [&locked] { locked.close(); });
+
+        RingQueue ring;
+        Run mpmc = runThreads(
+            threads, items, [&ring](MessageTask&& task) { ring.push(std::move(task)); },
+            [&ring](uint64_t& n, uint64_t& s) {
+                MessageTask batch[16];
+                while (size_t got = ring.popBatch(batch, 16)) {
+                    for (size_t i = 0; i < got; ++i) {
+                        ++n;
+                        s += static_cast<uint64_t>(batch[i].targetUserId);
+                    }
+                }
+            },
+            [&ring] { ring.close(); });
+
+        BENCH_CHECK(baseline.consumed == items && baseline.sum == expectedSum);
+        BENCH_CHECK(mpmc.consumed == items && mpmc.sum == expectedSum);
+        double before = items / baseline.seconds / 1e4;
+        double after = items / mpmc.seconds / 1e4;
+        std::cout << std::setw(8) << threads << std::setw(20) << before << std::setw(20) << after
+                  << std::setprecision(2) << after / before << "x\n" << std::setprecision(1);
+    }
+    return 0;
+}
@@ -0,0 +1,107 @@
+// 回复路由缓存基准：ReplyRouteCache 与原先的 std::map<int64_t, pair<int64_t, string>> 对比
+// 插入、查询耗时和常驻内存，并检查容量上限、LRU 淘汰和命中计数。
+//   ./route_cache_bench [条目数，默认 10000000] [不同用户数，默认 100000]
+#include "component_bench.hpp"
+
+struct Measurement {
+    double insertSeconds;
+    double lookupSeconds;
+    long residentKb;
+    uint64_t found;
+};
+
+static std::string displayOf(int64_t user) {
+    return "@user" + std::to_string(user) + " (测试用户 " + std::to_string(user) + ")";
+}
+
+// 与机器人一样，管理员侧消息 ID 递增，同一用户的消息分散在各处
+static int64_t userOf(uint64_t i, uint64_t users) {
+    return static_cast<int64_t>(1000000000 + (i * 2654435761u) % users);
+}
+
+static void checkCache() {
+    ReplyRouteCache cache(1000, 3600);
+    for (int64_t key = 0; key < 3000; ++key) {
+        cache.put(key, userOf(key, 10), displayOf(userOf(key, 10)));
+    }
+    ReplyRouteCache::Stats stats = cache.stats();
+    BENCH_CHECK(stats.size == 1000);
+    BENCH_CHECK(stats.evictions == 2000);
+    BENCH_CHECK(stats.names == 10);
+
+    int64_t user = 0;
+    std::string display;
+    BENCH_CHECK(!cache.get(1999, user));
+    BENCH_CHECK(cache.get(2000, user, &display));
+    BENCH_CHECK(user == userOf(2000, 10) && display == displayOf(user));
+
+    // 刚访问过的 2000 不会被下一次插入淘汰，淘汰的是 2001
+    cache.put(5000, 1, "x");
+    BENCH_CHECK(cache.get(2000, user));
+    BENCH_CHECK(!cache.get(2001, user));
+    stats = cache.stats();
+    BENCH_CHECK(stats.hits == 2 && stats.misses == 2);
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t entries = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    uint64_t users = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+    if (entries == 0 || users == 0) {
+        std::cerr << "用法: " << argv[0] << " [条目数] [不同用户数]" << std::endl;
+        return 1;
+    }
+    checkCache();
+
+    // 查询顺序打乱，避免顺序访问掩盖缓存未命中
+    std::vector<int64_t> probes(std::min<uint64_t>(entries, 1000000));
+    std::mt19937_64 rng(42);
+    for (int64_t& key : probes) key = static_cast<int64_t>(rng() % entries);
+
+    Measurement map = runIsolated<Measurement>([&] {
+        long before = residentKb();
+        std::map<int64_t, std::pair<int64_t, std::string>> cache;
+        Stopwatch insert;
+        for (uint64_t i = 0; i < entries; ++i) {
+            int64_t user = userOf(i, users);
+            cache[static_cast<int64_t>(i)] = {user, displayOf(user)};
+        }
+        Measurement m{insert.seconds(), 0, residentKb() - before, 0};
+        Stopwatch lookup;
+        for (int64_t key : probes) {
+            auto it = cache.find(key);
+            if (it != cache.end()) m.found += static_cast<uint64_t>(it->second.first & 1) + 1;
+        }
+        m.lookupSeconds = lookup.seconds();
+        return m;
+    });
+
+    Measurement lru = runIsolated<Measurement>([&] {
+        long before = residentKb();
+        ReplyRouteCache cache(entries, 86400);
+        Stopwatch insert;
+        for (uint64_t i = 0; i < entries; ++i) {
+            int64_t user = userOf(i, users);
+            cache.put(static_cast<int64_t>(i), user, displayOf(user));
+        }
+        Measurement m{insert.seconds(), 0, residentKb() - before, 0};
+        Stopwatch lookup;
+        int64_t user = 0;
+        for (int64_t key : probes) {
+            if (cache.get(key, user)) m.found += static_cast<uint64_t>(user & 1) + 1;
+        }
+        m.lookupSeconds = lookup.seconds();
+        return m;
+    });
+    BENCH_CHECK(map.found == lru.found);
+
+    std::cout << entries << " 条，" << users << " 个不同用户，" << probes.size() << " 次随机查询\n";
+    std::cout << std::left << std::setw(18) << "" << std::setw(16) << "插入(ns/条)" << std::setw(16) << "查询(ns/次)"
+              << "内存(MB)\n" << std::fixed << std::setprecision(1);
+    const std::pair<const char*, const Measurement*> rows[] = {{"std::map", &map}, {"ReplyRouteCache", &lru}};
+    for (const auto& row : rows) {
+        std::cout << std::setw(18) << row.first << std::setw(16) << row.second->insertSeconds * 1e9 / entries
+                  << std::setw(16) << row.second->lookupSeconds * 1e9 / probes.size()
+                  << row.second->residentKb / 1024.0 << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+// 查看机器人写出的二进制延迟追踪（TRACE_SPANS_FORMAT=binary）：
+// 列出端到端最慢的消息及各阶段耗时、各阶段耗时分布，或转换为 Chrome trace JSON。
+//   ./span_dump spans.bin --top 10
+//   ./span_dump spans.bin --user 123456789
+//   ./span_dump spans.bin --chrome spans.json
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+struct Span {
+    uint64_t trace = 0;
+    int64_t start = 0; // 墙上时间（微秒）
+    int64_t duration = 0;
+    uint64_t thread = 0;
+    int64_t user = 0; // 只有任务本身的 span 带用户
+    std::string name;
+};
+
+struct Trace {
+    uint64_t id = 0;
+    int64_t user = 0;
+    std::string task;
+    int64_t start = INT64_MAX;
+    int64_t end = 0;
+    std::vector<const Span*> spans;
+};
+
+static bool readSpans(const std::string& path, std::vector<Span>& spans) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const std::string magic = "TGSPANS1";
+    if (data.compare(0, magic.size(), magic) != 0) return false;
+
+    size_t pos = magic.size();
+    auto varint = [&data, &pos](uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(data[pos++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    };
+    while (pos < data.size()) {
+        Span span;
+        uint64_t start = 0, duration = 0, user = 0, nameLength = 0;
+        if (!varint(span.trace) || !varint(start) || !varint(duration) || !varint(span.thread) || !varint(user) ||
+            !varint(nameLength) || nameLength > data.size() - pos) {
+            break; // 进程异常退出时最后一批可能不完整
+        }
+        span.start = static_cast<int64_t>(start);
+        span.duration = static_cast<int64_t>(duration);
+        span.user = static_cast<int64_t>(user);
+        span.name = data.substr(pos, nameLength);
+        pos += nameLength;
+        spans.push_back(std::move(span));
+    }
+    return true;
+}
+
+static void writeChrome(const std::vector<Span>& spans, const std::string& path) {
+    std::ofstream out(path);
+    out << "[";
+    bool first = true;
+    for (const Span& span : spans) {
+        out << (first ? "\n" : ",\n") << "{\"name\":\"" << span.name << "\",\"cat\":\"message\",\"ph\":\"X\",\"ts\":"
+            << span.start << ",\"dur\":" << span.duration << ",\"pid\":1,\"tid\":" << span.trace
+            << ",\"args\":{\"thread\":" << span.thread;
+        if (span.user != 0) out << ",\"user\":" << span.user;
+        out << "}}";
+        if (span.user != 0) {
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << span.trace
+                << ",\"args\":{\"name\":\"#" << span.trace << " " << span.name << " " << span.user << "\"}}";
+        }
+        first = false;
+    }
+    out << "\n]\n";
+}
+
+static double percentile(std::vector<int64_t>& values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t i = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[std::min(i, values.size() - 1)] / 1000.0;
+}
+
+static void usage(const char* program) {
+    std::cerr << "用法: " << program << " FILE [选项]\n"
+              << "  --top N        列出端到端最慢的 N 条消息（默认 10）\n"
+              << "  --user ID      只看该用户的消息\n"
+              << "  --chrome OUT   转换为 Chrome trace JSON（可用 chrome://tracing 或 Perfetto 打开）\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string path = argv[1];
+    size_t top = 10;
+    int64_t user = 0;
+    std::string chromePath;
+    for (int i = 2; i < argc; ++i) {
+        std::string key = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (key == "--top") {
+            top = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (key == "--user") {
+            user = std::atoll(value.c_str());
+        } else if (key == "--chrome") {
+            chromePath = value;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Span> spans;
+    if (!readSpans(path, spans)) {
+        std::cerr << path << " 不是二进制追踪文件" << std::endl;
+        return 1;
+    }
+    if (!chromePath.empty()) {
+        writeChrome(spans, chromePath);
+        std::cout << "已写出 " << spans.size() << " 个 span 到 " << chromePath << std::endl;
+        return 0;
+    }
+
+    std::map<uint64_t, Trace> traces;
+    std::map<std::string, std::vector<int64_t>> stages;
+    for (const Span& span : spans) {
+        Trace& trace = traces[span.trace];
+        trace.id = span.trace;
+        if (span.user != 0) {
+            trace.user = span.user;
+            trace.task = span.name;
+        }
+        trace.start = std::min(trace.start, span.start);
+        trace.end = std::max(trace.end, span.start + span.duration);
+        trace.spans.push_back(&span);
+        stages[span.name].push_back(span.duration);
+    }
+
+    std::vector<Trace*> selected;
+    for (auto& item : traces) {
+        if (user == 0 || item.second.user == user) selected.push_back(&item.second);
+    }
+    std::sort(selected.begin(), selected.end(),
+              [](const Trace* a, const Trace* b) { return a->end - a->start > b->end - b->start; });
+    if (selected.size() > top) selected.resize(top);
+
+    std::cout << traces.size() << " 条消息，" << spans.size() << " 个 span\n\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for (const Trace* trace : selected) {
+        std::cout << "#" << trace->id << " " << (trace->task.empty() ? "?" : trace->task) << " 用户 " << trace->user
+                  << " 共 " << (trace->end - trace->start) / 1000.0 << " ms\n";
+        std::vector<const Span*> ordered = trace->spans;
+        // 同时开始时外层（更长）的在前
+        std::sort(ordered.begin(), ordered.end(), [](const Span* a, const Span* b) {
+            return a->start != b->start ? a->start < b->start : a->duration > b->duration;
+        });
+        for (const Span* span : ordered) {
+            std::cout << "  +" << std::setw(10) << (span->start - trace->start) / 1000.0 << " ms  " << std::setw(10)
+                      << span->duration / 1000.0 << " ms  " << span->name << "\n";
+        }
+    }
+
+    std::cout << "\n" << std::left << std::setw(28) << "stage" << std::setw(10) << "count" << std::setw(12) << "p50(ms)"
+              << std::setw(12) << "p99(ms)" << "\n";
+    for (auto& stage : stages) {
+        size_t count = stage.second.size();
+        std::cout << std::setw(28) << stage.first << std::setw(10) << count << std::setw(12)
+                  << percentile(stage.second, 0.5) << std::setw(12) << percentile(stage.second, 0.99) << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+// 延迟追踪测试与基准：检查 SpanTracer 的抽样比例、Scope 嵌套与恢复、短命线程退出后缓冲区被移除，
+// 以及 binary 格式写出后逐字段读回一致；给出 span_dump 路径时再用它读取同一文件，
+// 检查汇总的消息数和 span 数，并且 --chrome 转换的结果与追踪器直接写出的 chrome 格式逐条相同。
+// 输出未追踪和被追踪时每个 Timer 的耗时。
+//   ./span_tracer_bench [span_dump 路径，可省略] [短命线程数，默认 1000]
+#include "component_bench.hpp"
+
+struct ReadSpan {
+    uint64_t trace, start, duration, thread, user;
+    std::string name;
+};
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+static std::vector<ReadSpan> readBinary(const std::string& path) {
+    std::string data = readFile(path);
+    BENCH_CHECK(data.compare(0, 8, "TGSPANS1") == 0);
+    std::vector<ReadSpan> spans;
+    const char* p = data.data() + 8;
+    const char* end = data.data() + data.size();
+    while (p < end) {
+        ReadSpan span;
+        uint64_t length;
+        BENCH_CHECK(getVarint(p, end, span.trace) && getVarint(p, end, span.start) &&
+                    getVarint(p, end, span.duration) && getVarint(p, end, span.thread) &&
+                    getVarint(p, end, span.user) && getVarint(p, end, length));
+        BENCH_CHECK(length <= static_cast<uint64_t>(end - p));
+        span.name.assign(p, length);
+        p += length;
+        spans.push_back(span);
+    }
+    return spans;
+}
+
+// chrome 文件中的各条记录（去掉分隔的逗号），排序后便于比较
+static std::vector<std::string> chromeRecords(const std::string& path) {
+    std::istringstream in(readFile(path));
+    std::vector<std::string> records;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] != '{') continue;
+        if (line.back() == ',') line.pop_back();
+        records.push_back(line);
+    }
+    std::sort(records.begin(), records.end());
+    return records;
+}
+
+static std::string run(const std::string& command) {
+    std::string out;
+    FILE* pipe = ::popen(command.c_str(), "r");
+    BENCH_CHECK(pipe != nullptr);
+    char buf[4096];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), pipe)) > 0) out.append(buf, n);
+    BENCH_CHECK(::pclose(pipe) == 0);
+    return out;
+}
+
+static void checkSampling() {
+    SpanTracer tracer("/dev/null", SpanTracer::BINARY, 0);
+    for (int i = 0; i < 1000; ++i) BENCH_CHECK(tracer.sample() == 0);
+    tracer.setSampleRate(1);
+    for (uint64_t i = 1; i <= 1000; ++i) BENCH_CHECK(tracer.sample() == i);
+    tracer.setSampleRate(0.1);
+    const int draws = 100000;
+    uint64_t hits = 0;
+    for (int i = 0; i < draws; ++i) {
+        if (tracer.sample() != 0) ++hits;
+    }
+    BENCH_CHECK(hits > draws * 0.08 && hits < draws * 0.12);
+    BENCH_CHECK(tracer.traces() == 1000 + hits);
+}
+
+// 记录一组固定的 span：嵌套 Scope 中不追踪的部分不记录，离开后恢复外层的追踪
+static void recordScopes(SpanTracer& tracer) {
+    { SpanTracer::Timer outside("outside"); }
+    {
+        SpanTracer::Scope scope(&tracer, 7);
+        { SpanTracer::Timer task("FORWARD_TO_ADMIN", 123456789); }
+        {
+            SpanTracer::Scope untraced(&tracer, 0);
+            SpanTracer::Timer hidden("hidden");
+        }
+        { SpanTracer::Timer api("api:sendMessage"); }
+        BENCH_CHECK(SpanTracer::context().trace == 7);
+    }
+    BENCH_CHECK(SpanTracer::context().tracer == nullptr);
+    tracer.record(8, "queue", 1700000000000000, 1500);
+    tracer.record(8, "HANDLE_REQ", 1700000000001500, 25000, 42);
+}
+
+int main(int argc, char* argv[]) {
+    std::string spanDump = argc > 1 ? argv[1] : "";
+    int threads = argc > 2 ? std::atoi(argv[2]) : 1000;
+    BENCH_CHECK(threads > 0);
+
+    std::string dir = "/tmp/span_tracer_bench." + std::to_string(getpid());
+    BENCH_CHECK(::mkdir(dir.c_str(), 0755) == 0);
+    checkSampling();
+
+    // binary 逐字段读回
+    std::string binaryPath = dir + "/spans.bin";
+    {
+        SpanTracer tracer(binaryPath, SpanTracer::BINARY, 1);
+        BENCH_CHECK(tracer.open());
+        recordScopes(tracer);
+    }
+    std::vector<ReadSpan> spans = readBinary(binaryPath);
+    BENCH_CHECK(spans.size() == 4);
+    std::map<std::string, const ReadSpan*> byName;
+    for (const ReadSpan& span : spans) byName[span.name] = &span;
+    BENCH_CHECK(byName.size() == 4 && !byName.count("outside") && !byName.count("hidden"));
+    BENCH_CHECK(byName["FORWARD_TO_ADMIN"]->trace == 7 && byName["FORWARD_TO_ADMIN"]->user == 123456789);
+    BENCH_CHECK(byName["api:sendMessage"]->trace == 7 && byName["api:sendMessage"]->user == 0);
+    BENCH_CHECK(byName["api:sendMessage"]->start >= byName["FORWARD_TO_ADMIN"]->start);
+    const ReadSpan& req = *byName["HANDLE_REQ"];
+    BENCH_CHECK(req.trace == 8 && req.start == 1700000000001500 && req.duration == 25000 && req.user == 42);
+    for (const ReadSpan& span : spans) BENCH_CHECK(span.thread == 1);
+
+    // 同样的 span 直接写成 chrome 格式，与 span_dump 的转换结果比较
+    std::string chromePath = dir + "/spans.json";
+    {
+        SpanTracer tracer(chromePath, SpanTracer::CHROME, 1);
+        BENCH_CHECK(tracer.open());
+        recordScopes(tracer);
+    }
+    BENCH_CHECK(readFile(chromePath).compare(0, 2, "[\n") == 0);
+    if (!spanDump.empty()) {
+        std::string summary = run(spanDump + " " + binaryPath + " --top 5");
+        BENCH_CHECK(summary.find("2 条消息，4 个 span") != std::string::npos);
+        BENCH_CHECK(summary.find("#8 HANDLE_REQ 用户 42 共 26.5 ms") != std::string::npos);
+        BENCH_CHECK(run(spanDump + " " + binaryPath + " --user 42").find("#7 ") == std::string::npos);
+        std::string converted = dir + "/converted.json";
+        run(spanDump + " " + binaryPath + " --chrome " + converted);
+        // 时间戳不同（两次记录），只比较时间以外的字段
+        auto strip = [](std::vector<std::string> records) {
+            for (std::string& record : records) {
+                size_t ts = record.find("\"ts\":");
+                if (ts == std::string::npos) continue;
+                size_t args = record.find(",\"pid\"", ts);
+                record.erase(ts, args - ts);
+            }
+            std::sort(records.begin(), records.end());
+            return records;
+        };
+        std::vector<std::string> direct = strip(chromeRecords(chromePath));
+        std::vector<std::string> dumped = strip(chromeRecords(converted));
+        BENCH_CHECK(direct.size() == 6 && direct == dumped); // 4 个 span，另有 2 条给带用户的追踪行命名
+    }
+
+    // 短命线程：每个线程记录一个 span 后退出，收集后它们的缓冲区被移除
+    {
+        SpanTracer tracer(dir + "/threads.bin", SpanTracer::BINARY, 1);
+        BENCH_CHECK(tracer.open());
+        const int batch = 50;
+        for (int t = 0; t < threads; t += batch) {
+            std::vector<std::thread> group;
+            for (int k = t; k < std::min(threads, t + batch); ++k) {
+                group.emplace_back([&tracer, k] {
+                    SpanTracer::Scope scope(&tracer, static_cast<uint64_t>(k + 1));
+                    SpanTracer::Timer task("FORWARD_TO_ADMIN", 1000 + k);
+                });
+            }
+            for (auto& thread : group) thread.join();
+            tracer.flush();
+            BENCH_CHECK(tracer.threadBuffers() == 0);
+        }
+    }
+    std::vector<ReadSpan> threadSpans = readBinary(dir + "/threads.bin");
+    BENCH_CHECK(threadSpans.size() == static_cast<size_t>(threads));
+    std::set<uint64_t> traceIds, threadIds;
+    for (const ReadSpan& span : threadSpans) {
+        BENCH_CHECK(span.user == 1000 + span.trace - 1);
+        traceIds.insert(span.trace);
+        threadIds.insert(span.thread);
+    }
+    BENCH_CHECK(traceIds.size() == static_cast<size_t>(threads) && threadIds.size() == static_cast<size_t>(threads));
+
+    // 每个 Timer 的耗时：未追踪时只有一次判断
+    const int rounds = 1000000;
+    double untracedNs, tracedNs;
+    {
+        SpanTracer tracer("/dev/null", SpanTracer::BINARY, 1);
+        BENCH_CHECK(tracer.open());
+        Stopwatch clock;
+        for (int i = 0; i < rounds; ++i) {
+            SpanTracer::Timer timer("api:sendMessage");
+        }
+        untracedNs = clock.seconds() / rounds * 1e9;
+        SpanTracer::Scope scope(&tracer, 1);
+        Stopwatch tracedClock;
+        for (int i = 0; i < rounds; ++i) {
+            SpanTracer::Timer timer("api:sendMessage");
+            if (i % 10000 == 9999) tracer.flush();
+        }
+        tracedNs = tracedClock.seconds() / rounds * 1e9;
+        BENCH_CHECK(tracer.droppedSpans() == 0);
+    }
+
+    std::cout << std::fixed << std::setprecision(1) << "抽样、Scope、binary 读回" << (spanDump.empty() ? "" : "、span_dump")
+              << " 检查通过；" << threads << " 个短命线程退出后缓冲区全部移除\n"
+              << "每个 Timer: 未追踪 " << untracedNs << " ns，被追踪 " << tracedNs << " ns（含收集写出）\n";
+
+    BENCH_CHECK(std::system(("rm -rf " + dir).c_str()) == 0);
+    return 0;
+}
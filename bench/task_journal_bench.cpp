@@ -0,0 +1,241 @@
+// 任务日志测试与基准：W 个线程模拟工作线程，每条任务编码后 append、处理完 complete，
+// 与只编码不写日志的情况对比每条任务的耗时；另测每 100 条等待一次 commit（长轮询每批更新确认前的组提交）。
+// 另外检查重启后只重放未完成的任务且保持顺序、offset 恢复、分段尾部写了一半的记录被忽略；
+// 用 RLIMIT_FSIZE 模拟磁盘写满，检查写到一半失败时 commit 返回 false、分段截回原长度，恢复后重试写入不丢记录。
+//   ./task_journal_bench [线程数列表，默认 1,4,16] [任务数，默认 200000]
+#include "component_bench.hpp"
+
+#include <csignal>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+static MessageTask sampleTask(uint64_t i) {
+    MessageTask task;
+    task.type = MessageTask::FORWARD_TO_ADMIN;
+    auto message = std::make_shared<TgBot::Message>();
+    message->messageId = static_cast<int32_t>(i);
+    message->date = 1700000000;
+    message->from = std::make_shared<TgBot::User>();
+    message->from->id = 100000 + static_cast<int64_t>(i % 1000);
+    message->from->firstName = "用户";
+    message->from->username = "user" + std::to_string(i % 1000);
+    message->chat = std::make_shared<TgBot::Chat>();
+    message->chat->id = message->from->id;
+    message->chat->type = TgBot::Chat::Type::Private;
+    message->text = "你好，我想咨询一下订单 " + std::to_string(i) + " 的发货进度，已经等了好几天了，麻烦帮忙看一下";
+    task.message = message;
+    return task;
+}
+
+static std::vector<std::string> segmentFiles(const std::string& dir) {
+    std::vector<std::string> files;
+    if (DIR* d = ::opendir(dir.c_str())) {
+        while (struct dirent* entry = ::readdir(d)) {
+            std::string name = entry->d_name;
+            if (name.compare(0, 8, "journal.") == 0) files.push_back(dir + "/" + name);
+        }
+        ::closedir(d);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static void clearDir(const std::string& dir) {
+    for (const std::string& file : segmentFiles(dir)) {
+        std::remove(file.c_str());
+    }
+}
+
+static void checkRecovery(const std::string& dir) {
+    std::string base = dir + "/journal";
+    std::string a, b, c;
+    TaskCodec::encode(sampleTask(1), a);
+    TaskCodec::encode(sampleTask(2), b);
+    TaskCodec::encode(sampleTask(3), c);
+    {
+        TaskJournal journal(base);
+        TaskJournal::Recovered recovered;
+        BENCH_CHECK(journal.open(recovered));
+        BENCH_CHECK(recovered.tasks.empty());
+        journal.append(a);
+        uint64_t second = journal.append(b);
+        journal.append(c);
+        journal.complete(second);
+        journal.recordOffset(42);
+        journal.commit();
+    }
+    // 崩溃时写了一半的记录
+    std::vector<std::string> files = segmentFiles(dir);
+    BENCH_CHECK(files.size() == 1);
+    {
+        std::ofstream out(files.back(), std::ios::binary | std::ios::app);
+        out << std::string("\x20\x00\x00\x00\x01partial", 12);
+    }
+    {
+        TaskJournal journal(base);
+        TaskJournal::Recovered recovered;
+        BENCH_CHECK(journal.open(recovered));
+        BENCH_CHECK(recovered.offset == 42);
+        BENCH_CHECK(recovered.tasks.size() == 2);
+        BENCH_CHECK(recovered.tasks[0] == a && recovered.tasks[1] == c);
+        MessageTask decoded;
+        BENCH_CHECK(TaskCodec::decode(recovered.tasks[1], decoded));
+        BENCH_CHECK(decoded.message && decoded.message->text == sampleTask(3).message->text);
+        // 重新入队后（这里直接标记完成）删除上次的分段
+        journal.releaseRecovered();
+        BENCH_CHECK(segmentFiles(dir).size() == 1);
+    }
+    clearDir(dir);
+}
+
+static off_t fileSize(const std::string& path) {
+    struct stat st;
+    BENCH_CHECK(::stat(path.c_str(), &st) == 0);
+    return st.st_size;
+}
+
+static void checkWriteFailure(const std::string& dir) {
+    std::signal(SIGXFSZ, SIG_IGN); // 超出文件大小限制时 write 返回 EFBIG 而不是终止进程
+    struct rlimit saved;
+    BENCH_CHECK(::getrlimit(RLIMIT_FSIZE, &saved) == 0);
+    std::string a, b, c, d;
+    TaskCodec::encode(sampleTask(1), a);
+    TaskCodec::encode(sampleTask(2), b);
+    TaskCodec::encode(sampleTask(3), c);
+    TaskCodec::encode(sampleTask(4), d);
+
+    std::mutex errorMutex;
+    std::vector<std::string> errors;
+    {
+        TaskJournal journal(dir + "/journal");
+        journal.setErrorHandler([&](const std::string& message) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            errors.push_back(message);
+        });
+        TaskJournal::Recovered recovered;
+        BENCH_CHECK(journal.open(recovered));
+        journal.complete(journal.append(a));
+        BENCH_CHECK(journal.commit());
+        std::string segment = segmentFiles(dir).back();
+        off_t before = fileSize(segment);
+
+        // 下一批只能写入 20 字节：写了一半后失败
+        struct rlimit small = saved;
+        small.rlim_cur = static_cast<rlim_t>(before + 20);
+        BENCH_CHECK(::setrlimit(RLIMIT_FSIZE, &small) == 0);
+        journal.append(b);
+        journal.append(c);
+        journal.recordOffset(7);
+        BENCH_CHECK(!journal.commit());
+        BENCH_CHECK(fileSize(segment) == before); // 写了一半的记录已截去
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            BENCH_CHECK(errors.size() == 1 && errors[0].find("任务日志写入失败") == 0);
+        }
+
+        // 恢复后写线程重试失败的一批，之后追加的记录排在其后
+        BENCH_CHECK(::setrlimit(RLIMIT_FSIZE, &saved) == 0);
+        journal.append(d);
+        BENCH_CHECK(journal.commit());
+        std::lock_guard<std::mutex> lock(errorMutex);
+        BENCH_CHECK(errors.size() == 2 && errors[1] == "任务日志已恢复写入");
+    }
+    {
+        TaskJournal journal(dir + "/journal");
+        TaskJournal::Recovered recovered;
+        BENCH_CHECK(journal.open(recovered));
+        BENCH_CHECK(recovered.offset == 7);
+        BENCH_CHECK(recovered.tasks.size() == 3);
+        BENCH_CHECK(recovered.tasks[0] == b && recovered.tasks[1] == c && recovered.tasks[2] == d);
+    }
+    clearDir(dir);
+}
+
+// 每个线程处理 tasks/threads 条任务；journal 为空时只编码。commitEvery 非 0 时每这么多条等待一次提交
+static double runTasks(TaskJournal* journal, int threads, uint64_t tasks, int commitEvery) {
+    std::vector<MessageTask> samples;
+    for (uint64_t i = 0; i < 64; ++i) samples.push_back(sampleTask(i));
+    std::atomic<uint64_t> bytes{0};
+    std::vector<std::thread> workers;
+    Stopwatch clock;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::string data;
+            uint64_t total = 0;
+            int sinceCommit = 0;
+            for (uint64_t i = t; i < tasks; i += threads) {
+                data.clear();
+                TaskCodec::encode(samples[i % samples.size()], data);
+                total += data.size();
+                if (!journal) continue;
+                uint64_t seq = journal->append(data);
+                journal->complete(seq);
+                if (commitEvery > 0 && ++sinceCommit == commitEvery) {
+                    journal->commit();
+                    sinceCommit = 0;
+                }
+            }
+            bytes += total;
+        });
+    }
+    for (auto& w : workers) w.join();
+    if (journal) journal->commit();
+    BENCH_CHECK(bytes.load() > 0);
+    return clock.seconds();
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<int> threadCounts = {1, 4, 16};
+    uint64_t tasks = 200000;
+    if (argc > 1) {
+        threadCounts.clear();
+        std::istringstream in(argv[1]);
+        std::string item;
+        while (std::getline(in, item, ',')) threadCounts.push_back(std::atoi(item.c_str()));
+    }
+    if (argc > 2) tasks = std::strtoull(argv[2], nullptr, 10);
+    BENCH_CHECK(tasks > 0);
+
+    std::string dir = "/tmp/task_journal_bench." + std::to_string(getpid());
+    BENCH_CHECK(::mkdir(dir.c_str(), 0755) == 0);
+    checkRecovery(dir);
+    checkWriteFailure(dir);
+
+    std::string sample;
+    TaskCodec::encode(sampleTask(0), sample);
+    std::cout << tasks << " 条转发任务，每条编码约 " << sample.size() << " 字节\n"
+              << std::left << std::setw(8) << "线程" << std::setw(18) << "仅编码(ns/条)" << std::setw(18)
+              << "写日志(ns/条)" << "每 100 条提交(ns/条)\n" << std::fixed << std::setprecision(0);
+    for (int threads : threadCounts) {
+        BENCH_CHECK(threads > 0);
+        double encodeOnly = runTasks(nullptr, threads, tasks, 0);
+        double journaled, batched;
+        {
+            TaskJournal journal(dir + "/journal");
+            TaskJournal::Recovered recovered;
+            BENCH_CHECK(journal.open(recovered));
+            journaled = runTasks(&journal, threads, tasks, 0);
+            BENCH_CHECK(journal.segmentCount() >= 1);
+        }
+        clearDir(dir);
+        {
+            TaskJournal journal(dir + "/journal");
+            TaskJournal::Recovered recovered;
+            BENCH_CHECK(journal.open(recovered));
+            batched = runTasks(&journal, threads, tasks, 100);
+        }
+        // 全部任务都已完成，重启后没有需要重放的任务
+        {
+            TaskJournal journal(dir + "/journal");
+            TaskJournal::Recovered recovered;
+            BENCH_CHECK(journal.open(recovered));
+            BENCH_CHECK(recovered.tasks.empty());
+        }
+        clearDir(dir);
+        std::cout << std::setw(8) << threads << std::setw(18) << encodeOnly / tasks * 1e9 << std::setw(18)
+                  << journaled / tasks * 1e9 << batched / tasks * 1e9 << "\n";
+    }
+    ::rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,340 @@
+// 回放录制的更新轨迹（机器人配置 TRACE_RECORD_FILE 录制）：启动本地模拟 Bot API 和机器人，
+// 按原始间隔、N 倍速或不限速发出轨迹中的更新，报告吞吐、各类型端到端延迟和机器人内部的锁争用。
+// 结果可保存为 TSV，下次回放时作为基线对比：
+//   ./trace_replay --trace updates.trace --bot ./telegram_forward_bot --speed max --report run1.tsv
+//   ./trace_replay --trace updates.trace --bot ./telegram_forward_bot --speed max --baseline run1.tsv
+#include "mock_bot_api.hpp"
+#include "update_trace.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct ReplayOptions {
+    MockBotApi::Options mock;
+    std::string tracePath;
+    std::string botPath = "./telegram_forward_bot";
+    int workers = 4;
+    std::string transport = "curl_multi";
+    std::string mode = "polling";
+    bool keepRateLimits = false; // 默认放开出站限速和用户限流，回放加速时不被限流丢弃
+    int idleSeconds = 3; // 全部发出后这么久没有新的完成即结束（部分更新没有可观察的结果）
+    int timeoutSeconds = 600;
+    std::string reportPath;
+    std::string baselinePath;
+
+    bool parse(int argc, char* argv[]) {
+        try {
+            for (int i = 1; i < argc; ++i) {
+                std::string key = argv[i];
+                if (key == "--keep-rate-limits") {
+                    keepRateLimits = true;
+                    continue;
+                }
+                if (i + 1 >= argc) return false;
+                std::string value = argv[++i];
+                if (key == "--trace") {
+                    tracePath = value;
+                } else if (key == "--speed") {
+                    mock.speed = value == "max" ? 0 : std::stod(value);
+                } else if (key == "--bot") {
+                    botPath = value;
+                } else if (key == "--workers") {
+                    workers = std::stoi(value);
+                } else if (key == "--transport") {
+                    transport = value;
+                } else if (key == "--mode") {
+                    mode = value;
+                } else if (key == "--latency-ms") {
+                    mock.latencyMs = std::stoi(value);
+                } else if (key == "--jitter-ms") {
+                    mock.jitterMs = std::stoi(value);
+                } else if (key == "--idle") {
+                    idleSeconds = std::stoi(value);
+                } else if (key == "--timeout") {
+                    timeoutSeconds = std::stoi(value);
+                } else if (key == "--report") {
+                    reportPath = value;
+                } else if (key == "--baseline") {
+                    baselinePath = value;
+                } else {
+                    return false;
+                }
+            }
+        } catch (std::exception&) {
+            return false;
+        }
+        return !tracePath.empty() && mock.speed >= 0 && (mode == "polling" || mode == "webhook");
+    }
+
+    static void usage(const char* program) {
+        std::cerr << "用法: " << program << " --trace FILE [选项]\n"
+                  << "  --trace FILE           录制的轨迹文件（TRACE_RECORD_FILE）\n"
+                  << "  --speed 1|N|max        回放速度：原速、N 倍速或不等待（默认 1）\n"
+                  << "  --bot PATH             机器人可执行文件（默认 ./telegram_forward_bot）\n"
+                  << "  --workers N            WORKER_THREADS（默认 4）\n"
+                  << "  --transport NAME       HTTP_TRANSPORT（默认 curl_multi）\n"
+                  << "  --mode NAME            UPDATE_MODE：polling（默认）或 webhook\n"
+                  << "  --latency-ms N         模拟 API 固定延迟\n"
+                  << "  --jitter-ms N          模拟 API 随机延迟上限\n"
+                  << "  --keep-rate-limits     保留默认出站限速和用户限流（默认放开）\n"
+                  << "  --idle N               全部发出后 N 秒没有新的完成即结束（默认 3）\n"
+                  << "  --timeout N            最长运行秒数（默认 600）\n"
+                  << "  --report FILE          把结果写成 TSV，供以后对比\n"
+                  << "  --baseline FILE        与之前保存的 TSV 对比\n";
+    }
+};
+
+// 指标名 -> 数值，按名称排序输出，保存为 TSV 后可逐项对比
+typedef std::map<std::string, double> Report;
+
+static unsigned short freePort() {
+    boost::asio::io_context io;
+    boost::asio::ip::tcp::acceptor acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), 0));
+    return acceptor.local_endpoint().port();
+}
+
+static void writeConfig(const std::string& path, const std::string& dir, const ReplayOptions& opts,
+                        unsigned short port, unsigned short metricsPort) {
+    std::ofstream out(path);
+    out << "BOT_TOKEN=bench\n"
+        << "ADMIN_ID=" << opts.mock.adminId << "\n"
+        << "WORKER_THREADS=" << opts.workers << "\n"
+        << "API_URL=http://127.0.0.1:" << port << "\n"
+        << "HTTP_TRANSPORT=" << opts.transport << "\n"
+        << "LOG_FILE=" << dir << "/bot.log\n"
+        << "LOG_STDOUT=false\n"
+        << "BANNED_USERS_FILE=" << dir << "/banned_users.txt\n"
+        << "MESSAGE_INDEX_FILE=" << dir << "/message_index.dat\n"
+        << "USER_REGISTRY_FILE=" << dir << "/users.dat\n"
+        << "TASK_JOURNAL_FILE=" << dir << "/task_journal\n"
+        << "TASK_SPILL_FILE=" << dir << "/task_spill\n"
+        << "HISTORY_FILE=" << dir << "/history\n"
+        << "METRICS_LISTEN=127.0.0.1:" << metricsPort << "\n"
+        << "UPDATE_MODE=" << opts.mode << "\n";
+    if (opts.mode == "webhook") {
+        unsigned short webhookPort = freePort();
+        out << "WEBHOOK_LISTEN=127.0.0.1:" << webhookPort << "\n"
+            << "WEBHOOK_URL=http://127.0.0.1:" << webhookPort << "/webhook\n"
+            << "WEBHOOK_SECRET=bench-secret\n";
+    }
+    if (!opts.keepRateLimits) {
+        out << "GLOBAL_RATE_LIMIT=1000000\n"
+            << "CHAT_RATE_LIMIT=1000000\n"
+            << "GROUP_RATE_LIMIT=1000000\n"
+            << "FLOOD_RATE=0\n";
+    }
+}
+
+// 抓取机器人的 /metrics，取出锁争用指标
+static void scrapeLocks(unsigned short port, Report& report) {
+    namespace http = boost::beast::http;
+    boost::asio::io_context io;
+    boost::asio::ip::tcp::socket socket(io);
+    boost::system::error_code ec;
+    socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), port), ec);
+    if (ec) return;
+    http::request<http::empty_body> req(http::verb::get, "/metrics", 11);
+    req.set(http::field::host, "127.0.0.1");
+    http::write(socket, req, ec);
+    boost::beast::flat_buffer buffer;
+    http::response<http::string_body> res;
+    if (!ec) http::read(socket, buffer, res, ec);
+    if (ec) return;
+
+    std::istringstream in(res.body());
+    std::string line;
+    while (std::getline(in, line)) {
+        // bot_lock_contended_total{lock="album"} 12
+        struct Family {
+            const char* prefix;
+            const char* key;
+            double scale;
+        };
+        const Family families[] = {{"bot_lock_contended_total{lock=\"", "lock_contended.", 1},
+                                   {"bot_lock_wait_seconds_total{lock=\"", "lock_wait_ms.", 1000}};
+        for (const Family& family : families) {
+            std::string prefix = family.prefix;
+            if (line.compare(0, prefix.size(), prefix) != 0) continue;
+            size_t quote = line.find('"', prefix.size());
+            size_t space = line.rfind(' ');
+            if (quote == std::string::npos || space == std::string::npos) continue;
+            report[family.key + line.substr(prefix.size(), quote - prefix.size())] =
+                std::atof(line.c_str() + space + 1) * family.scale;
+        }
+    }
+}
+
+static void stopBot(pid_t pid) {
+    kill(pid, SIGTERM);
+    for (int i = 0; i < 200; ++i) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) return;
+        usleep(100 * 1000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+static bool readReport(const std::string& path, Report& report) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) continue;
+        report[line.substr(0, tab)] = std::atof(line.c_str() + tab + 1);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    ReplayOptions opts;
+    if (!opts.parse(argc, argv)) {
+        ReplayOptions::usage(argv[0]);
+        return 1;
+    }
+
+    auto events = std::make_shared<std::vector<TraceEvent>>();
+    std::string error;
+    if (!readTrace(opts.tracePath, *events, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    opts.mock.script = events;
+    double traceSeconds = events->back().atMicros / 1e6;
+    std::cout << "轨迹 " << events->size() << " 条更新，时长 " << std::fixed << std::setprecision(1)
+              << traceSeconds << " 秒，回放速度 "
+              << (opts.mock.speed > 0 ? std::to_string(opts.mock.speed) + "×" : std::string("不限")) << "\n";
+
+    char dirTemplate[] = "/tmp/trace_replay.XXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        std::cerr << "无法创建临时目录" << std::endl;
+        return 1;
+    }
+    std::string dir = dirTemplate;
+
+    MockBotApi mock(opts.mock);
+    unsigned short port = mock.start();
+    unsigned short metricsPort = freePort();
+    std::string configPath = dir + "/bot_config.ini";
+    writeConfig(configPath, dir, opts, port, metricsPort);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork 失败" << std::endl;
+        return 1;
+    }
+    if (pid == 0) {
+        execl(opts.botPath.c_str(), opts.botPath.c_str(), configPath.c_str(), static_cast<char*>(nullptr));
+        perror("execl");
+        _exit(127);
+    }
+
+    // 全部完成，或全部发出后一段时间没有进展即结束：管理员不是回复的消息等没有可观察的结果
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(opts.timeoutSeconds);
+    bool finished = false, exited = false;
+    uint64_t lastFinished = 0;
+    int idle = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (mock.waitDone(std::chrono::seconds(1))) {
+            finished = true;
+            break;
+        }
+        if (waitpid(pid, nullptr, WNOHANG) == pid) {
+            exited = true;
+            std::cerr << "机器人提前退出，日志见 " << dir << "/bot.log" << std::endl;
+            break;
+        }
+        uint64_t served = 0, done = 0;
+        mock.progress(served, done);
+        idle = served == events->size() && done == lastFinished ? idle + 1 : 0;
+        lastFinished = done;
+        if (idle >= opts.idleSeconds) break;
+    }
+
+    Report report;
+    if (!exited) {
+        scrapeLocks(metricsPort, report);
+        stopBot(pid);
+    }
+    mock.stop();
+    MockBotApi::Result r = mock.snapshot();
+
+    report["completed"] = static_cast<double>(r.completed);
+    report["untracked"] = static_cast<double>(r.untracked);
+    report["throughput"] = r.seconds > 0 ? r.completed / r.seconds : 0;
+    report["latency_p50_ms"] = MockBotApi::percentile(r.latencies, 0.5) * 1000;
+    report["latency_p99_ms"] = MockBotApi::percentile(r.latencies, 0.99) * 1000;
+    for (int k = 0; k < MockBotApi::KIND_COUNT; ++k) {
+        if (r.kindLatencies[k].empty()) continue;
+        std::string kind = MockBotApi::kindName(k);
+        report["latency_p50_ms." + kind] = MockBotApi::percentile(r.kindLatencies[k], 0.5) * 1000;
+        report["latency_p99_ms." + kind] = MockBotApi::percentile(r.kindLatencies[k], 0.99) * 1000;
+    }
+
+    std::cout << "\n发出 " << r.served << "，完成 " << r.completed << "，不计延迟 " << r.untracked
+              << (finished ? "" : "（未全部完成）") << "，用时 " << r.seconds << " 秒，吞吐 "
+              << report["throughput"] << " 条/秒，API 调用 " << r.requests << "\n\n";
+    std::cout << std::left << std::setw(10) << "type" << std::setw(10) << "served" << std::setw(10) << "done"
+              << std::setw(12) << "p50(ms)" << std::setw(12) << "p99(ms)" << "max(ms)" << "\n";
+    for (int k = 0; k < MockBotApi::KIND_COUNT; ++k) {
+        if (r.kindServed[k] == 0) continue;
+        const std::vector<double>& latencies = r.kindLatencies[k];
+        std::cout << std::setw(10) << MockBotApi::kindName(k) << std::setw(10) << r.kindServed[k]
+                  << std::setw(10) << latencies.size()
+                  << std::setw(12) << MockBotApi::percentile(latencies, 0.5) * 1000
+                  << std::setw(12) << MockBotApi::percentile(latencies, 0.99) * 1000
+                  << (latencies.empty() ? 0 : latencies.back() * 1000) << "\n";
+    }
+
+    std::cout << "\n" << std::setw(14) << "lock" << std::setw(14) << "contended" << "wait(ms)" << "\n";
+    for (const auto& item : report) {
+        const std::string prefix = "lock_contended.";
+        if (item.first.compare(0, prefix.size(), prefix) != 0) continue;
+        std::string lock = item.first.substr(prefix.size());
+        std::cout << std::setw(14) << lock << std::setw(14) << std::setprecision(0) << item.second
+                  << std::setprecision(1) << report["lock_wait_ms." + lock] << "\n";
+    }
+
+    if (!opts.baselinePath.empty()) {
+        Report baseline;
+        if (!readReport(opts.baselinePath, baseline)) {
+            std::cerr << "无法读取基线 " << opts.baselinePath << std::endl;
+        } else {
+            std::cout << "\n" << std::setw(28) << "metric" << std::setw(14) << "baseline" << std::setw(14) << "current"
+                      << "change" << "\n";
+            for (const auto& item : report) {
+                auto it = baseline.find(item.first);
+                if (it == baseline.end()) continue;
+                std::cout << std::setw(28) << item.first << std::setprecision(1) << std::setw(14) << it->second
+                          << std::setw(14) << item.second;
+                if (it->second != 0) {
+                    std::cout << std::showpos << (item.second - it->second) / std::fabs(it->second) * 100 << "%"
+                              << std::noshowpos;
+                }
+                std::cout << "\n";
+            }
+        }
+    }
+
+    if (!opts.reportPath.empty()) {
+        std::ofstream out(opts.reportPath);
+        out << std::setprecision(6);
+        for (const auto& item : report) {
+            out << item.first << "\t" << item.second << "\n";
+        }
+    }
+
+    if (finished) {
+        std::system(("rm -rf '" + dir + "'").c_str());
+    }
+    return exited ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+// 读取机器人录制的更新轨迹（配置 TRACE_RECORD_FILE 后写出，见 telegram_forward_bot.cpp 中的 UpdateRecorder）。
+// 文件以 "TGTRACE1" 开头，之后每条记录为
+// [varint 距上一条的微秒数][u8 类型][u8 标志][varint 用户][varint 文本长度][u8 媒体][varint 相册][varint 名称长度][名称]
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+    enum Kind { TEXT = 1, COMMAND = 2, MEDIA = 3, CALLBACK = 4 };
+    enum Flag { ADMIN = 1, REPLY = 2 };
+    enum Media { NO_MEDIA, PHOTO, VIDEO, DOCUMENT, AUDIO, VOICE, STICKER, ANIMATION, VIDEO_NOTE, OTHER_MEDIA };
+
+    uint64_t atMicros = 0; // 距第一条的微秒数
+    Kind kind = TEXT;
+    uint8_t flags = 0;
+    uint64_t user = 0; // 用户编号（从 1 开始），带 ADMIN 标志时为管理员池序号
+    uint64_t textLength = 0; // 文本或说明文字的长度（UTF-16 单位）
+    Media media = NO_MEDIA;
+    uint64_t album = 0; // 相册编号，0 为不属于相册
+    std::string name; // 命令名（不带斜杠）或回调动作
+};
+
+inline bool readTrace(const std::string& path, std::vector<TraceEvent>& events, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        error = "无法打开 " + path;
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const std::string magic = "TGTRACE1";
+    if (data.compare(0, magic.size(), magic) != 0) {
+        error = path + " 不是录制轨迹文件";
+        return false;
+    }
+
+    size_t pos = magic.size();
+    auto varint = [&data, &pos](uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(data[pos++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    };
+    auto byte = [&data, &pos](uint8_t& value) {
+        if (pos >= data.size()) return false;
+        value = static_cast<uint8_t>(data[pos++]);
+        return true;
+    };
+
+    uint64_t clock = 0;
+    bool first = true;
+    events.clear();
+    while (pos < data.size()) {
+        TraceEvent e;
+        uint64_t delta = 0, nameLength = 0;
+        uint8_t kind = 0, media = 0;
+        if (!varint(delta) || !byte(kind) || !byte(e.flags) || !varint(e.user) || !varint(e.textLength) ||
+            !byte(media) || !varint(e.album) || !varint(nameLength) || nameLength > data.size() - pos) {
+            break; // 录制中途被终止时最后一条可能不完整
+        }
+        e.name = data.substr(pos, nameLength);
+        pos += nameLength;
+        // 第一条的间隔是录制开始到第一条到达，不计入
+        clock += first ? 0 : delta;
+        first = false;
+        if (kind < TraceEvent::TEXT || kind > TraceEvent::CALLBACK) continue;
+        e.kind = static_cast<TraceEvent::Kind>(kind);
+        e.media = static_cast<TraceEvent::Media>(media);
+        e.atMicros = clock;
+        events.push_back(std::move(e));
+    }
+    if (events.empty()) {
+        error = path + " 中没有记录";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,221 @@
+// 线程伸缩测试与基准：检查 WorkerScaler 在排队且线程都忙时扩容、出站请求受限时不扩容、
+// 连续空闲 SHRINK_AFTER_IDLE_TICKS 次后逐个收缩到下限；重新加载配置时从文件读取新范围，
+// 调低上限后按新范围收缩，调高到启动时的上限以上时截断并报告需要重启。
+// 再模拟一段突发流量（每个线程每秒处理 100 个任务），输出扩容到位、清空积压和收缩回下限所用的检查次数。
+//   ./worker_scaler_bench [突发时每秒到达的任务数，默认 2000] [突发持续秒数，默认 60]
+#include "component_bench.hpp"
+
+static Config workerConfig(int threads, int min, int max, int waitMs = 200) {
+    Config cfg;
+    cfg.workerThreads = threads;
+    cfg.workerMinThreads = min;
+    cfg.workerMaxThreads = max;
+    cfg.workerScaleUpWaitMs = waitMs;
+    return cfg;
+}
+
+// target 个线程都在忙、任务平均排队 waitMs 毫秒
+static WorkerScaler::Load busyLoad(int target, int64_t waitMs) {
+    WorkerScaler::Load load;
+    load.target = target;
+    load.busy = target;
+    load.backlog = 1000;
+    load.waitSamples = 100;
+    load.waitMicros = 100 * waitMs * 1000;
+    load.maxInFlight = 64;
+    return load;
+}
+
+static WorkerScaler::Load idleLoad(int target) {
+    WorkerScaler::Load load;
+    load.target = target;
+    load.maxInFlight = 64;
+    return load;
+}
+
+static int decide(WorkerScaler& scaler, const WorkerScaler::Load& load) {
+    std::string reason;
+    int next = scaler.decide(load, reason);
+    BENCH_CHECK((next == load.target) == reason.empty());
+    return next;
+}
+
+static void checkDecisions() {
+    // 未配置上下限时固定为 WORKER_THREADS
+    {
+        WorkerScaler fixed(workerConfig(4, 0, 0));
+        BENCH_CHECK(fixed.min() == 4 && fixed.max() == 4 && fixed.initial(workerConfig(4, 0, 0)) == 4);
+        BENCH_CHECK(decide(fixed, busyLoad(4, 1000)) == 4);
+    }
+
+    Config cfg = workerConfig(4, 2, 16);
+    WorkerScaler scaler(cfg);
+    BENCH_CHECK(scaler.min() == 2 && scaler.max() == 16 && scaler.maxAtStartup() == 16 && scaler.initial(cfg) == 4);
+
+    // 排队超过阈值且都在忙：每次约加四分之一，至少一个，到上限为止
+    std::vector<int> steps;
+    for (int target = 4; target < 16;) {
+        target = decide(scaler, busyLoad(target, 300));
+        steps.push_back(target);
+    }
+    BENCH_CHECK((steps == std::vector<int>{5, 6, 7, 8, 10, 12, 15, 16}));
+    BENCH_CHECK(decide(scaler, busyLoad(16, 300)) == 16);
+
+    // 排队未超过阈值、有线程空闲、没有积压时不扩容
+    BENCH_CHECK(decide(scaler, busyLoad(4, 199)) == 4);
+    WorkerScaler::Load partial = busyLoad(4, 300);
+    partial.busy = 3;
+    BENCH_CHECK(decide(scaler, partial) == 4);
+    WorkerScaler::Load drained = busyLoad(4, 300);
+    drained.backlog = 0;
+    BENCH_CHECK(decide(scaler, drained) == 4);
+    // 线程都卡在长任务上、这一秒没有开始新任务时按排队处理
+    WorkerScaler::Load stuck = busyLoad(4, 0);
+    stuck.waitSamples = 0;
+    stuck.waitMicros = 0;
+    BENCH_CHECK(decide(scaler, stuck) == 5);
+
+    // 出站请求在限速或 HTTP 并发上限处排队时加线程无济于事
+    WorkerScaler::Load throttled = busyLoad(4, 300);
+    throttled.throttled = 4;
+    BENCH_CHECK(decide(scaler, throttled) == 4);
+    WorkerScaler::Load inFlight = busyLoad(4, 300);
+    inFlight.inFlight = 64;
+    BENCH_CHECK(decide(scaler, inFlight) == 4);
+
+    // 连续空闲 SHRINK_AFTER_IDLE_TICKS 次才收缩一个；中间有一次不空闲则重新计数
+    for (int i = 1; i < WorkerScaler::SHRINK_AFTER_IDLE_TICKS; ++i) {
+        BENCH_CHECK(decide(scaler, idleLoad(8)) == 8);
+    }
+    BENCH_CHECK(decide(scaler, busyLoad(8, 100)) == 8);
+    for (int i = 1; i < WorkerScaler::SHRINK_AFTER_IDLE_TICKS; ++i) {
+        BENCH_CHECK(decide(scaler, idleLoad(8)) == 8);
+    }
+    BENCH_CHECK(decide(scaler, idleLoad(8)) == 7);
+    // 一半以上线程在忙不算空闲
+    WorkerScaler::Load half = idleLoad(8);
+    half.busy = 4;
+    for (int i = 0; i < 2 * WorkerScaler::SHRINK_AFTER_IDLE_TICKS; ++i) {
+        BENCH_CHECK(decide(scaler, half) == 8);
+    }
+    // 不低于下限
+    int target = 7;
+    for (int i = 0; i < 20 * WorkerScaler::SHRINK_AFTER_IDLE_TICKS; ++i) {
+        target = decide(scaler, idleLoad(target));
+    }
+    BENCH_CHECK(target == 2);
+}
+
+static void checkReload(const std::string& path) {
+    auto writeConfig = [&path](const std::string& workerLines) {
+        std::ofstream out(path, std::ios::trunc);
+        out << "BOT_TOKEN=123:abc\nADMIN_ID=42\n" << workerLines;
+    };
+    writeConfig("WORKER_THREADS=4\nWORKER_MIN_THREADS=2\nWORKER_MAX_THREADS=16   # 上限\nWORKER_SCALE_UP_WAIT_MS=200\n");
+    Config cfg;
+    BENCH_CHECK(cfg.loadFromFile(path));
+    WorkerScaler scaler(cfg);
+    BENCH_CHECK(scaler.min() == 2 && scaler.max() == 16);
+
+    // 调低上限：下一次检查时收缩到新上限，之后按新范围伸缩
+    writeConfig("WORKER_THREADS=4\nWORKER_MIN_THREADS=3\nWORKER_MAX_THREADS=8\nWORKER_SCALE_UP_WAIT_MS=500\n");
+    Config lower;
+    BENCH_CHECK(lower.loadFromFile(path));
+    BENCH_CHECK(scaler.configure(lower));
+    BENCH_CHECK(scaler.min() == 3 && scaler.max() == 8 && scaler.maxAtStartup() == 16);
+    std::string reason;
+    BENCH_CHECK(scaler.decide(busyLoad(12, 1000), reason) == 8 && reason == "配置变更");
+    BENCH_CHECK(decide(scaler, busyLoad(8, 1000)) == 8);
+    BENCH_CHECK(decide(scaler, busyLoad(4, 300)) == 4); // 阈值已改为 500 ms
+    BENCH_CHECK(decide(scaler, busyLoad(4, 500)) == 5);
+    BENCH_CHECK(decide(scaler, idleLoad(2)) == 3);
+
+    // 调高到启动时的上限以上：分片数不够，截断到启动时的上限并报告需要重启
+    writeConfig("WORKER_MIN_THREADS=20\nWORKER_MAX_THREADS=32\n");
+    Config higher;
+    BENCH_CHECK(higher.loadFromFile(path));
+    BENCH_CHECK(!scaler.configure(higher));
+    BENCH_CHECK(scaler.min() == 16 && scaler.max() == 16);
+    BENCH_CHECK(decide(scaler, idleLoad(8)) == 16);
+
+    // 回到启动时的范围以内
+    BENCH_CHECK(scaler.configure(cfg));
+    BENCH_CHECK(scaler.min() == 2 && scaler.max() == 16);
+}
+
+struct Simulation {
+    int peak = 0;
+    int ticksToPeak = -1;   // 突发开始后扩容到最大线程数所用的检查次数
+    int ticksToDrain = -1;  // 突发结束后积压清空所用的检查次数
+    int ticksToShrink = -1; // 积压清空后收缩回下限所用的检查次数
+};
+
+// 每次检查代表一秒：每个线程每秒处理 100 个任务，突发期间每秒到达 rate 个，之后每秒 20 个
+static Simulation simulate(int rate, int burstSeconds) {
+    const int perWorker = 100;
+    WorkerScaler scaler(workerConfig(2, 2, 64));
+    Simulation sim;
+    int target = 2;
+    int64_t backlog = 0;
+    int lastChange = 0;
+    for (int tick = 0; tick < burstSeconds + 600; ++tick) {
+        int64_t arrivals = tick < burstSeconds ? rate : 20;
+        int64_t capacity = static_cast<int64_t>(target) * perWorker;
+        int64_t waiting = backlog + arrivals;
+        int64_t processed = std::min(waiting, capacity);
+        WorkerScaler::Load load;
+        load.target = target;
+        load.busy = static_cast<int>(std::min<int64_t>(target, (waiting + perWorker - 1) / perWorker));
+        load.waitSamples = processed;
+        load.waitMicros = processed * (backlog * 1000000 / capacity); // 处理的任务在积压之后排队
+        backlog = waiting - processed;
+        load.backlog = backlog;
+        load.maxInFlight = 1000;
+        std::string reason;
+        int next = scaler.decide(load, reason);
+        if (next != target) lastChange = tick;
+        target = next;
+        if (target > sim.peak) {
+            sim.peak = target;
+            sim.ticksToPeak = tick + 1;
+        }
+        if (tick >= burstSeconds && backlog == 0 && sim.ticksToDrain < 0) sim.ticksToDrain = tick - burstSeconds + 1;
+        if (sim.ticksToDrain >= 0 && target == scaler.min() && sim.ticksToShrink < 0) {
+            sim.ticksToShrink = lastChange - burstSeconds - sim.ticksToDrain + 1;
+        }
+    }
+    BENCH_CHECK(target == scaler.min());
+    return sim;
+}
+
+int main(int argc, char* argv[]) {
+    int rate = argc > 1 ? std::atoi(argv[1]) : 2000;
+    int burstSeconds = argc > 2 ? std::atoi(argv[2]) : 60;
+    BENCH_CHECK(rate > 200 && rate <= 6400 && burstSeconds > 0);
+
+    checkDecisions();
+    std::string path = "/tmp/worker_scaler_bench." + std::to_string(getpid()) + ".ini";
+    checkReload(path);
+    std::remove(path.c_str());
+
+    Simulation sim = simulate(rate, burstSeconds);
+    BENCH_CHECK(sim.peak * 100 >= rate && sim.ticksToDrain >= 0 && sim.ticksToShrink >= 0);
+
+    // 每次决策的耗时
+    WorkerScaler scaler(workerConfig(4, 2, 16));
+    const int rounds = 1000000;
+    int target = 4;
+    Stopwatch clock;
+    for (int i = 0; i < rounds; ++i) {
+        std::string reason;
+        target = scaler.decide(i % 40 < 20 ? busyLoad(target, 300) : idleLoad(target), reason);
+    }
+    double decideNs = clock.seconds() / rounds * 1e9;
+
+    std::cout << std::fixed << std::setprecision(1) << "伸缩决策和重新加载检查通过\n"
+              << "突发每秒 " << rate << " 个任务: " << sim.ticksToPeak << " 次检查扩容到 " << sim.peak
+              << " 个线程，突发结束后 " << sim.ticksToDrain << " 次检查清空积压，再 " << sim.ticksToShrink
+              << " 次检查收缩回下限\n"
+              << "每次决策: " << decideNs << " ns\n";
+    return 0;
+}
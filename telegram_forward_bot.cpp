@@ -1,38 +1,138 @@
 #include <tgbot/tgbot.h>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
 #include <iostream>
 #include <string>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <memory>
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <iterator>
 #include <chrono>
 #include <mutex>
 #include <thread>
-#include <queue>
 #include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
 #include <signal.h>
 #include <atomic>
+#include <random>
+#include <future>
+#include <functional>
+#include <deque>
+#include <cctype>
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#include <dirent.h>
 
 // 全局运行标志
 std::atomic<bool> running(true);
 
+// 收到 SIGHUP 后由监督线程重新加载配置
+std::atomic<bool> reloadRequested(false);
+
 // 信号处理
 void signalHandler(int signal) {
     std::cout << "\n收到信号 " << signal << "，正在关闭..." << std::endl;
     running = false;
 }
 
+void reloadHandler(int) {
+    reloadRequested = true;
+}
+
 // 配置类
 class Config {
 public:
     std::string botToken;
     int64_t adminId;
+    std::vector<int64_t> adminIds; // 其他管理员（私聊或群组），与 ADMIN_ID 一起组成管理员池
+    int adminIdleTimeout = 900; // 有待回复会话却这么久（秒）未回复任何人的管理员，其会话改派他人
+    int conversationTtl = 86400; // 会话无往来多久（秒）后结束，不再计入管理员负载
     bool enableLogging = true;
     std::string logFile = "bot.log";
+    bool logStdout = true; // 是否同时输出到标准输出
+    std::string logLevel = "info"; // debug / info / warn / error
+    size_t logBufferSize = 8192; // 日志环形缓冲区条数
     std::string bannedUsersFile = "banned_users.txt";
-    int workerThreads = 4; // 工作线程数
+    int workerThreads = 4; // 初始工作线程数
+    int workerMinThreads = 0; // 自动伸缩下限，0 表示等于 WORKER_THREADS
+    int workerMaxThreads = 0; // 自动伸缩上限，0 表示等于 WORKER_THREADS（不伸缩）
+    int workerScaleUpWaitMs = 200; // 任务平均排队超过该时长（毫秒）且线程都在忙时扩容
+    std::string apiUrl = "https://api.telegram.org"; // Bot API 地址
+    std::string httpTransport = "curl_multi"; // curl_multi（异步复用）或 boost（库自带同步客户端）
+    size_t httpMaxInFlight = 256; // 同时进行的最大请求数
+    long httpPoolSize = 32; // 到 Bot API 的最大长连接数
+    long httpIdleTimeout = 60; // 空闲连接保留时间（秒）
+    long httpMaxLifetime = 0; // 连接最长使用时间（秒），0 为不限制
+    int maxRetries = 3; // 发送失败最大重试次数
+    int retryDelay = 5; // 重试基础间隔（秒），按指数退避并加抖动
+    double globalRateLimit = 30; // 全局每秒发送上限
+    double chatRateLimit = 1; // 单个私聊每秒发送上限
+    double groupRateLimit = 20; // 单个群组每分钟发送上限
+    size_t replyCacheCapacity = 100000; // 回复路由缓存容量
+    uint32_t replyCacheTtl = 7 * 24 * 3600; // 回复路由空闲过期时间（秒）
+    std::string callbackDedupMode = "query"; // query：按回调 ID 去重；action：按 (消息, 按钮) 去重
+    int callbackDedupTtl = 3600; // 回调去重记录保留时间（秒）
+    size_t taskQueueCapacity = 65536; // 用户消息（转发、请求等）队列容量
+    size_t adminQueueCapacity = 8192; // 管理员操作（回复、回调、管理命令）队列容量
+    size_t backgroundQueueCapacity = 8192; // 后台通知队列容量
+    std::vector<int> taskClassWeights = {8, 2, 1}; // 管理员、用户、后台三类任务的处理权重
+    std::string taskShedPolicy = "spill"; // 队列满时：spill 溢出到磁盘；reject 拒绝并提示稍后重试；wait 阻塞接收
+    std::string taskSpillFile = "task_spill"; // 溢出文件前缀，按优先级加后缀
+    int taskBatchSize = 8; // 工作线程单次持有分片时最多处理的任务数
+    int shardsPerWorker = 4; // 每个工作线程对应的任务分片数
+    std::string messageIndexFile = "message_index.dat"; // 持久化回复路由，留空则禁用
+    uint64_t messageIndexMaxRecords = 0; // 0 表示不限制
+    std::string metricsListen; // 指标端点监听地址（如 127.0.0.1:9464），留空则禁用
+    std::string updateMode = "polling"; // polling：长轮询；webhook：由 Telegram 推送
+    std::string webhookUrl; // 向 Telegram 登记的公网地址，留空则不自动登记
+    std::string webhookListen = "0.0.0.0:8443"; // Webhook 服务监听地址
+    std::string webhookPath = "/webhook"; // Webhook 请求路径
+    std::string webhookSecret; // 校验 X-Telegram-Bot-Api-Secret-Token
+    int webhookThreads = 2; // Webhook 服务网络线程数
+    int webhookMaxConnections = 40; // Telegram 同时推送的最大连接数（1-100）
+    std::string webhookCert; // 证书与私钥都配置时直接提供 HTTPS
+    std::string webhookKey;
+    bool webhookUploadCert = false; // 自签名证书需上传给 Telegram
+    int albumWindowMs = 1000; // 相册收集窗口：最后一张到达后等待多久再整体发送（毫秒）
+    std::string userRegistryFile = "users.dat"; // 用户登记表（广播对象），留空则禁用
+    double broadcastRate = 25; // 广播每秒发送数，应低于 GLOBAL_RATE_LIMIT 给正常消息留出余量
+    std::string taskJournalFile = "task_journal"; // 任务日志（未完成任务和 update offset），留空则禁用
+    int shutdownDrainSeconds = 10; // 停机时等待队列处理完的最长时间，剩余任务重启后继续
+    double floodRate = 1; // 每个用户每秒可持续发送的消息数，0 为不限流
+    int floodBurst = 10; // 每个用户可连续发送的消息数
+    std::string floodAction = "coalesce"; // 超限的文字消息：coalesce 合并后稍后转交；drop 丢弃
+    int floodBanStrikes = 0; // 一轮限流中被拒绝这么多条后临时封禁，0 为不自动封禁
+    int floodBanSeconds = 3600; // 临时封禁时长（秒）
+    size_t floodTableSize = 262144; // 限流状态表槽位数（只需容纳最近几秒内活跃的用户）
+    int coalesceWindowMs = 0; // 连续文字消息合并窗口（毫秒），0 为不合并
+    int coalesceMaxMessages = 10; // 最多合并的消息条数
+    int coalesceMaxDelayMs = 5000; // 第一条消息最多等待多久就转交（毫秒）
+    std::string historyFile; // 会话历史分段文件前缀，留空（默认）则禁用 /history 和 /search
+    size_t historyPerUser = 200; // 每个用户在内存中保留的最近消息数（/history 可查询的上限）
+    uint64_t historyMaxMb = 1024; // 会话历史文件总大小上限（MB），超出后删除最早的分段
+    std::string traceRecordFile; // 录制收到的更新（不含文本）到该文件，供基准回放；留空不录制
+    uint64_t traceRecordMaxMb = 256; // 录制文件大小上限（MB），达到后停止录制
+    std::string traceSpansFile; // 单条消息延迟追踪的输出文件，留空不追踪
+    std::string traceSpansFormat = "chrome"; // chrome（Chrome trace JSON）或 binary
+    double traceSampleRate = 0.01; // 被追踪的任务比例（0-1）
 
     bool loadFromFile(const std::string& filename) {
         std::ifstream file(filename);
@@ -75,10 +175,45 @@ public:
                         std::cerr << "无效的 ADMIN_ID: " << value << std::endl;
                         return false;
                     }
+                } else if (key == "ADMIN_IDS") {
+                    std::istringstream ids(value);
+                    std::string item;
+                    while (std::getline(ids, item, ',')) {
+                        item.erase(0, item.find_first_not_of(" \t"));
+                        if (item.empty()) continue;
+                        try {
+                            adminIds.push_back(std::stoll(item));
+                        } catch (...) {
+                            std::cerr << "无效的 ADMIN_IDS: " << value << std::endl;
+                            return false;
+                        }
+                    }
+                } else if (key == "ADMIN_IDLE_TIMEOUT") {
+                    try {
+                        adminIdleTimeout = std::stoi(value);
+                    } catch (...) {
+                        adminIdleTimeout = 900;
+                    }
+                } else if (key == "CONVERSATION_TTL") {
+                    try {
+                        conversationTtl = std::stoi(value);
+                    } catch (...) {
+                        conversationTtl = 86400;
+                    }
                 } else if (key == "ENABLE_LOGGING") {
                     enableLogging = (value == "true" || value == "1");
                 } else if (key == "LOG_FILE") {
                     logFile = value;
+                } else if (key == "LOG_STDOUT") {
+                    logStdout = (value == "true" || value == "1");
+                } else if (key == "LOG_LEVEL") {
+                    logLevel = value;
+                } else if (key == "LOG_BUFFER_SIZE") {
+                    try {
+                        logBufferSize = std::stoull(value);
+                    } catch (...) {
+                        logBufferSize = 8192;
+                    }
                 } else if (key == "BANNED_USERS_FILE") {
                     bannedUsersFile = value;
                 } else if (key == "WORKER_THREADS") {
@@ -87,6 +222,290 @@ public:
                     } catch (...) {
                         workerThreads = 4;
                     }
+                } else if (key == "API_URL") {
+                    apiUrl = value;
+                } else if (key == "HTTP_TRANSPORT") {
+                    httpTransport = value;
+                } else if (key == "HTTP_MAX_IN_FLIGHT") {
+                    try {
+                        httpMaxInFlight = std::stoull(value);
+                    } catch (...) {
+                        httpMaxInFlight = 256;
+                    }
+                } else if (key == "HTTP_POOL_SIZE") {
+                    try {
+                        httpPoolSize = std::stol(value);
+                    } catch (...) {
+                        httpPoolSize = 32;
+                    }
+                } else if (key == "HTTP_IDLE_TIMEOUT") {
+                    try {
+                        httpIdleTimeout = std::stol(value);
+                    } catch (...) {
+                        httpIdleTimeout = 60;
+                    }
+                } else if (key == "HTTP_MAX_LIFETIME") {
+                    try {
+                        httpMaxLifetime = std::stol(value);
+                    } catch (...) {
+                        httpMaxLifetime = 0;
+                    }
+                } else if (key == "MAX_RETRIES") {
+                    try {
+                        maxRetries = std::stoi(value);
+                    } catch (...) {
+                        maxRetries = 3;
+                    }
+                } else if (key == "RETRY_DELAY") {
+                    try {
+                        retryDelay = std::stoi(value);
+                    } catch (...) {
+                        retryDelay = 5;
+                    }
+                } else if (key == "GLOBAL_RATE_LIMIT") {
+                    try {
+                        globalRateLimit = std::stod(value);
+                    } catch (...) {
+                        globalRateLimit = 30;
+                    }
+                } else if (key == "CHAT_RATE_LIMIT") {
+                    try {
+                        chatRateLimit = std::stod(value);
+                    } catch (...) {
+                        chatRateLimit = 1;
+                    }
+                } else if (key == "GROUP_RATE_LIMIT") {
+                    try {
+                        groupRateLimit = std::stod(value);
+                    } catch (...) {
+                        groupRateLimit = 20;
+                    }
+                } else if (key == "REPLY_CACHE_CAPACITY") {
+                    try {
+                        replyCacheCapacity = std::stoull(value);
+                    } catch (...) {
+                        replyCacheCapacity = 100000;
+                    }
+                } else if (key == "REPLY_CACHE_TTL") {
+                    try {
+                        replyCacheTtl = static_cast<uint32_t>(std::stoul(value));
+                    } catch (...) {
+                        replyCacheTtl = 7 * 24 * 3600;
+                    }
+                } else if (key == "CALLBACK_DEDUP_MODE") {
+                    callbackDedupMode = value;
+                } else if (key == "CALLBACK_DEDUP_TTL") {
+                    try {
+                        callbackDedupTtl = std::stoi(value);
+                    } catch (...) {
+                        callbackDedupTtl = 3600;
+                    }
+                } else if (key == "TASK_QUEUE_CAPACITY") {
+                    try {
+                        taskQueueCapacity = std::stoull(value);
+                    } catch (...) {
+                        taskQueueCapacity = 65536;
+                    }
+                } else if (key == "ADMIN_QUEUE_CAPACITY") {
+                    try {
+                        adminQueueCapacity = std::stoull(value);
+                    } catch (...) {
+                        adminQueueCapacity = 8192;
+                    }
+                } else if (key == "BACKGROUND_QUEUE_CAPACITY") {
+                    try {
+                        backgroundQueueCapacity = std::stoull(value);
+                    } catch (...) {
+                        backgroundQueueCapacity = 8192;
+                    }
+                } else if (key == "TASK_CLASS_WEIGHTS") {
+                    std::vector<int> weights;
+                    std::istringstream list(value);
+                    std::string item;
+                    try {
+                        while (std::getline(list, item, ',')) {
+                            weights.push_back(std::max(1, std::stoi(item)));
+                        }
+                    } catch (...) {
+                        weights.clear();
+                    }
+                    if (weights.size() == 3) taskClassWeights = weights;
+                } else if (key == "TASK_SHED_POLICY") {
+                    taskShedPolicy = value;
+                } else if (key == "TASK_SPILL_FILE") {
+                    taskSpillFile = value;
+                } else if (key == "WORKER_MIN_THREADS") {
+                    try {
+                        workerMinThreads = std::stoi(value);
+                    } catch (...) {
+                        workerMinThreads = 0;
+                    }
+                } else if (key == "WORKER_MAX_THREADS") {
+                    try {
+                        workerMaxThreads = std::stoi(value);
+                    } catch (...) {
+                        workerMaxThreads = 0;
+                    }
+                } else if (key == "WORKER_SCALE_UP_WAIT_MS") {
+                    try {
+                        workerScaleUpWaitMs = std::stoi(value);
+                    } catch (...) {
+                        workerScaleUpWaitMs = 200;
+                    }
+                } else if (key == "TASK_BATCH_SIZE") {
+                    try {
+                        taskBatchSize = std::stoi(value);
+                    } catch (...) {
+                        taskBatchSize = 8;
+                    }
+                } else if (key == "SHARDS_PER_WORKER") {
+                    try {
+                        shardsPerWorker = std::stoi(value);
+                    } catch (...) {
+                        shardsPerWorker = 4;
+                    }
+                } else if (key == "MESSAGE_INDEX_FILE") {
+                    messageIndexFile = value;
+                } else if (key == "MESSAGE_INDEX_MAX_RECORDS") {
+                    try {
+                        messageIndexMaxRecords = std::stoull(value);
+                    } catch (...) {
+                        messageIndexMaxRecords = 0;
+                    }
+                } else if (key == "METRICS_LISTEN") {
+                    metricsListen = value;
+                } else if (key == "UPDATE_MODE") {
+                    updateMode = value;
+                } else if (key == "WEBHOOK_URL") {
+                    webhookUrl = value;
+                } else if (key == "WEBHOOK_LISTEN") {
+                    webhookListen = value;
+                } else if (key == "WEBHOOK_PATH") {
+                    webhookPath = value;
+                } else if (key == "WEBHOOK_SECRET") {
+                    webhookSecret = value;
+                } else if (key == "WEBHOOK_THREADS") {
+                    try {
+                        webhookThreads = std::stoi(value);
+                    } catch (...) {
+                        webhookThreads = 2;
+                    }
+                } else if (key == "WEBHOOK_MAX_CONNECTIONS") {
+                    try {
+                        webhookMaxConnections = std::stoi(value);
+                    } catch (...) {
+                        webhookMaxConnections = 40;
+                    }
+                } else if (key == "WEBHOOK_CERT") {
+                    webhookCert = value;
+                } else if (key == "WEBHOOK_KEY") {
+                    webhookKey = value;
+                } else if (key == "WEBHOOK_UPLOAD_CERT") {
+                    webhookUploadCert = (value == "true" || value == "1");
+                } else if (key == "ALBUM_WINDOW_MS") {
+                    try {
+                        albumWindowMs = std::stoi(value);
+                    } catch (...) {
+                        albumWindowMs = 1000;
+                    }
+                } else if (key == "USER_REGISTRY_FILE") {
+                    userRegistryFile = value;
+                } else if (key == "TASK_JOURNAL_FILE") {
+                    taskJournalFile = value;
+                } else if (key == "SHUTDOWN_DRAIN_SECONDS") {
+                    try {
+                        shutdownDrainSeconds = std::stoi(value);
+                    } catch (...) {
+                        shutdownDrainSeconds = 10;
+                    }
+                } else if (key == "BROADCAST_RATE") {
+                    try {
+                        broadcastRate = std::stod(value);
+                    } catch (...) {
+                        broadcastRate = 25;
+                    }
+                } else if (key == "FLOOD_RATE") {
+                    try {
+                        floodRate = std::stod(value);
+                    } catch (...) {
+                        floodRate = 1;
+                    }
+                } else if (key == "FLOOD_BURST") {
+                    try {
+                        floodBurst = std::stoi(value);
+                    } catch (...) {
+                        floodBurst = 10;
+                    }
+                } else if (key == "FLOOD_ACTION") {
+                    floodAction = value;
+                } else if (key == "FLOOD_BAN_STRIKES") {
+                    try {
+                        floodBanStrikes = std::stoi(value);
+                    } catch (...) {
+                        floodBanStrikes = 0;
+                    }
+                } else if (key == "FLOOD_BAN_SECONDS") {
+                    try {
+                        floodBanSeconds = std::stoi(value);
+                    } catch (...) {
+                        floodBanSeconds = 3600;
+                    }
+                } else if (key == "COALESCE_WINDOW_MS") {
+                    try {
+                        coalesceWindowMs = std::stoi(value);
+                    } catch (...) {
+                        coalesceWindowMs = 0;
+                    }
+                } else if (key == "COALESCE_MAX_MESSAGES") {
+                    try {
+                        coalesceMaxMessages = std::stoi(value);
+                    } catch (...) {
+                        coalesceMaxMessages = 10;
+                    }
+                } else if (key == "COALESCE_MAX_DELAY_MS") {
+                    try {
+                        coalesceMaxDelayMs = std::stoi(value);
+                    } catch (...) {
+                        coalesceMaxDelayMs = 5000;
+                    }
+                } else if (key == "HISTORY_FILE") {
+                    historyFile = value;
+                } else if (key == "HISTORY_PER_USER") {
+                    try {
+                        historyPerUser = std::stoull(value);
+                    } catch (...) {
+                        historyPerUser = 200;
+                    }
+                } else if (key == "HISTORY_MAX_MB") {
+                    try {
+                        historyMaxMb = std::stoull(value);
+                    } catch (...) {
+                        historyMaxMb = 1024;
+                    }
+                } else if (key == "TRACE_RECORD_FILE") {
+                    traceRecordFile = value;
+                } else if (key == "TRACE_RECORD_MAX_MB") {
+                    try {
+                        traceRecordMaxMb = std::stoull(value);
+                    } catch (...) {
+                        traceRecordMaxMb = 256;
+                    }
+                } else if (key == "TRACE_SPANS_FILE") {
+                    traceSpansFile = value;
+                } else if (key == "TRACE_SPANS_FORMAT") {
+                    traceSpansFormat = value;
+                } else if (key == "TRACE_SAMPLE_RATE") {
+                    try {
+                        traceSampleRate = std::stod(value);
+                    } catch (...) {
+                        traceSampleRate = 0.01;
+                    }
+                } else if (key == "FLOOD_TABLE_SIZE") {
+                    try {
+                        floodTableSize = std::stoull(value);
+                    } catch (...) {
+                        floodTableSize = 262144;
+                    }
                 }
             }
         }
@@ -96,303 +515,7508 @@ public:
     }
 };
 
-// 日志类
-class Logger {
+// 有界无锁多生产者多消费者环形队列（Vyukov 算法），元素按移动语义进出
+template <typename T>
+class MpmcQueue {
 private:
-    std::ofstream logFile;
-    std::mutex logMutex;
-    bool enabled;
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> buffer;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> enqueuePos{0};
+    char pad1[64];
+    std::atomic<size_t> dequeuePos{0};
+    char pad2[64];
 
 public:
-    Logger(const std::string& filename, bool enable = true) : enabled(enable) {
-        if (enabled) {
-            logFile.open(filename, std::ios::app);
+    explicit MpmcQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        buffer.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            buffer[i].sequence.store(i, std::memory_order_relaxed);
         }
     }
 
-    ~Logger() {
-        if (logFile.is_open()) {
-            logFile.close();
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    bool tryPush(T&& value) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &buffer[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false; // 已满
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
         }
+        cell->data = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
     }
 
-    void log(const std::string& level, const std::string& message) {
-        if (!enabled) return;
-
-        std::lock_guard<std::mutex> lock(logMutex);
-        
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        
-        std::stringstream ss;
-        ss << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-        ss << " [" << level << "] " << message;
-        
-        std::string logLine = ss.str();
-        
-        if (logFile.is_open()) {
-            logFile << logLine << std::endl;
-            logFile.flush();
+    // 一次 CAS 认领最多 max 个连续就绪的元素
+    size_t popBatch(T* out, size_t max) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        size_t n;
+        while (true) {
+            n = 0;
+            while (n < max) {
+                size_t seq = buffer[(pos + n) & mask].sequence.load(std::memory_order_acquire);
+                if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + n + 1) != 0) break;
+                ++n;
+            }
+            if (n == 0) {
+                size_t seq = buffer[pos & mask].sequence.load(std::memory_order_acquire);
+                if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+                    return 0; // 为空
+                }
+                pos = dequeuePos.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (dequeuePos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) break;
         }
-        
-        std::cout << logLine << std::endl;
+        for (size_t i = 0; i < n; ++i) {
+            Cell& cell = buffer[(pos + i) & mask];
+            out[i] = std::move(cell.data);
+            cell.data = T();
+            cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        return n;
     }
 
-    void info(const std::string& message) { log("INFO", message); }
-    void error(const std::string& message) { log("ERROR", message); }
-    void warning(const std::string& message) { log("WARN", message); }
-};
+    bool tryPop(T& out) {
+        return popBatch(&out, 1) == 1;
+    }
 
-// 消息任务
-struct MessageTask {
-    enum Type { FORWARD_TO_ADMIN, REPLY_TO_USER, HANDLE_CALLBACK, HANDLE_REQUEST };
-    Type type;
-    TgBot::Message::Ptr message;
-    TgBot::CallbackQuery::Ptr callbackQuery;
-    int64_t targetUserId;
-    std::string text;
+    size_t sizeApprox() const {
+        size_t head = dequeuePos.load(std::memory_order_relaxed);
+        size_t tail = enqueuePos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
 };
 
-// 主机器人类
-class ForwardBot {
+// 空闲线程停靠：消费者等待前登记，生产者仅在有人等待时才加锁唤醒。
+// 生产者“发布元素后读 waiters”与消费者“登记后检查元素”两侧各有一道 seq_cst 屏障：
+// 队列本身用 relaxed/release 发布元素，没有屏障时消费者可能看不到新元素而停靠，生产者也看不到登记而不唤醒
+class IdleParking {
 private:
-    std::unique_ptr<TgBot::Bot> bot;
-    int64_t adminId;
-    Config config;
-    std::unique_ptr<Logger> logger;
-    
-    // 消息映射
-    std::map<int64_t, std::pair<int64_t, std::string>> messageCache; // messageId -> (userId, username)
-    std::mutex cacheMutex;
-    
-    // 封禁用户列表
-    std::set<int64_t> bannedUsers;
-    std::mutex bannedMutex;
-    
-    // 回调查询记录
-    std::map<std::string, std::chrono::steady_clock::time_point> processedCallbacks;
-    std::mutex callbackMutex;
-    
-    // 消息队列和工作线程
-    std::queue<MessageTask> taskQueue;
-    std::mutex queueMutex;
-    std::condition_variable queueCV;
-    std::vector<std::thread> workers;
-    std::atomic<bool> stopWorkers{false};
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<int> waiters{0};
 
-    // 加载封禁用户列表
-    void loadBannedUsers() {
-        std::ifstream file(config.bannedUsersFile);
-        if (file.is_open()) {
-            std::lock_guard<std::mutex> lock(bannedMutex);
-            int64_t userId;
-            while (file >> userId) {
-                bannedUsers.insert(userId);
-            }
-            file.close();
-            logger->info("加载了 " + std::to_string(bannedUsers.size()) + " 个封禁用户");
+public:
+    // ready 在登记后和持锁时各检查一次，避免丢失唤醒
+    template <typename Pred>
+    void wait(Pred ready) {
+        waiters.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, ready);
         }
+        waiters.fetch_sub(1);
     }
 
-    // 保存封禁用户列表
-    void saveBannedUsers() {
-        std::ofstream file(config.bannedUsersFile);
-        if (file.is_open()) {
-            std::lock_guard<std::mutex> lock(bannedMutex);
-            for (const auto& userId : bannedUsers) {
-                file << userId << std::endl;
-            }
-            file.close();
+    // 调用前须已发布元素
+    void notifyOne() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load() > 0) {
+            { std::lock_guard<std::mutex> lock(mutex); }
+            cv.notify_one();
         }
     }
 
-    // 检查用户是否被封禁
-    bool isUserBanned(int64_t userId) {
-        std::lock_guard<std::mutex> lock(bannedMutex);
-        return bannedUsers.find(userId) != bannedUsers.end();
+    void notifyAll() {
+        { std::lock_guard<std::mutex> lock(mutex); }
+        cv.notify_all();
     }
+};
 
-    // 封禁用户
-    void banUser(int64_t userId) {
-        {
-            std::lock_guard<std::mutex> lock(bannedMutex);
-            bannedUsers.insert(userId);
-        }
-        saveBannedUsers();
-    }
+// 带争用统计的互斥量：先 try_lock，失败时才计一次争用并记录等待时长，未争用时几乎没有额外开销。
+// 统计通过指标导出（bot_lock_contended_total / bot_lock_wait_seconds_total），用于回放基准中分析锁竞争
+class CountingMutex {
+private:
+    std::mutex mutex;
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> waitNanos{0};
 
-    // 解封用户
-    void unbanUser(int64_t userId) {
-        {
-            std::lock_guard<std::mutex> lock(bannedMutex);
-            bannedUsers.erase(userId);
-        }
-        saveBannedUsers();
+public:
+    void lock() {
+        if (mutex.try_lock()) return;
+        auto start = std::chrono::steady_clock::now();
+        mutex.lock();
+        auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        contended.fetch_add(1, std::memory_order_relaxed);
+        waitNanos.fetch_add(static_cast<uint64_t>(waited.count()), std::memory_order_relaxed);
     }
 
-    // 工作线程函数
-    void workerThread() {
-        while (!stopWorkers) {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            queueCV.wait(lock, [this] { return !taskQueue.empty() || stopWorkers; });
-            
-            if (stopWorkers) break;
-            
-            if (!taskQueue.empty()) {
-                MessageTask task = taskQueue.front();
-                taskQueue.pop();
-                lock.unlock();
-                
-                // 处理任务
-                processTask(task);
+    bool try_lock() { return mutex.try_lock(); }
+    void unlock() { mutex.unlock(); }
+
+    uint64_t contentions() const { return contended.load(std::memory_order_relaxed); }
+    double waitSeconds() const { return waitNanos.load(std::memory_order_relaxed) / 1e9; }
+};
+
+// 定时队列：单个后台线程按到期时间执行回调，回调应尽快返回（通常只是入队任务）
+class TimerQueue {
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::multimap<std::chrono::steady_clock::time_point, std::function<void()>> timers;
+    bool stopping = false;
+    std::thread thread;
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            if (timers.empty()) {
+                cv.wait(lock);
+                continue;
             }
+            auto due = timers.begin()->first;
+            if (std::chrono::steady_clock::now() < due) {
+                cv.wait_until(lock, due);
+                continue;
+            }
+            std::function<void()> fn = std::move(timers.begin()->second);
+            timers.erase(timers.begin());
+            lock.unlock();
+            try {
+                fn();
+            } catch (...) {
+            }
+            lock.lock();
         }
     }
 
-    // 处理任务
-    void processTask(const MessageTask& task) {
-        try {
-            switch (task.type) {
-                case MessageTask::FORWARD_TO_ADMIN:
-                    processForwardToAdmin(task.message);
-                    break;
-                case MessageTask::REPLY_TO_USER:
-                    processReplyToUser(task.targetUserId, task.text);
-                    break;
-                case MessageTask::HANDLE_CALLBACK:
-                    processCallbackQuery(task.callbackQuery);
-                    break;
-                case MessageTask::HANDLE_REQUEST:
-                    processRequestCommand(task.message);
-                    break;
-            }
-        } catch (std::exception& e) {
-            logger->error("处理任务失败: " + std::string(e.what()));
+public:
+    TimerQueue() : thread(&TimerQueue::loop, this) {}
+
+    TimerQueue(const TimerQueue&) = delete;
+    TimerQueue& operator=(const TimerQueue&) = delete;
+
+    void schedule(std::chrono::steady_clock::time_point when, std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            timers.emplace(when, std::move(fn));
         }
+        cv.notify_one();
     }
 
-    // 添加任务到队列
-    void addTask(const MessageTask& task) {
-        std::lock_guard<std::mutex> lock(queueMutex);
-        taskQueue.push(task);
-        queueCV.notify_one();
+    // 停止后未到期的回调不再执行
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        if (thread.joinable()) thread.join();
     }
 
-public:
-    ForwardBot(const Config& cfg)
-        : config(cfg), adminId(cfg.adminId), stopWorkers(false) {
-        bot = std::make_unique<TgBot::Bot>(cfg.botToken);
-        logger = std::make_unique<Logger>(cfg.logFile, cfg.enableLogging);
-        
-        // 加载封禁用户
-        loadBannedUsers();
-        
-        // 启动工作线程
-        for (int i = 0; i < cfg.workerThreads; ++i) {
-            workers.emplace_back(&ForwardBot::workerThread, this);
+    ~TimerQueue() { stop(); }
+};
+
+// 日志级别
+enum class LogLevel { DEBUG = 0, INFO = 1, WARN = 2, ERROR = 3 };
+
+// 编译期最低日志级别：低于该级别的调用在 isEnabled 中按常量比较直接返回，不进入缓冲区。
+// 消息参数仍由调用方求值，拼接代价高的调试日志应先检查 isEnabled
+#ifndef BOT_MIN_LOG_LEVEL
+#define BOT_MIN_LOG_LEVEL 0
+#endif
+
+// 日志类：调用方把消息写入预分配的无锁环形缓冲区后立即返回，
+// 后台线程批量格式化并用 write(2) 写出；时间戳字符串每秒只生成一次。
+// 超出记录内联长度的部分另行分配，随记录经同一缓冲区传递，与其他日志的先后顺序不变
+class Logger {
+private:
+    struct Record {
+        LogLevel level;
+        time_t time;
+        uint32_t length;
+        char text[480];
+        std::string* rest; // 超出 text 的部分，为空表示没有；由写出线程（或丢弃时由调用方）释放
+    };
+
+    enum { NO_PENDING_FD = -2 };
+    enum { MAX_MESSAGE = 65536 }; // 单条日志上限（字节），超出部分截断并注明原长度
+
+    int fd = -1; // 只由写出线程访问
+    std::atomic<int> pendingFd{NO_PENDING_FD}; // reconfigure 打开的新文件，由写出线程切换
+    std::atomic<bool> enabled;
+    std::atomic<bool> echoStdout;
+    std::atomic<int> minLevel;
+    std::mutex configMutex;
+    MpmcQueue<Record> buffer;
+    IdleParking parking;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> dropped{0};
+    std::thread writer;
+
+    static const char* levelName(LogLevel level) {
+        switch (level) {
+            case LogLevel::DEBUG: return "DEBUG";
+            case LogLevel::INFO: return "INFO";
+            case LogLevel::WARN: return "WARN";
+            default: return "ERROR";
         }
     }
 
-    ~ForwardBot() {
-        // 停止工作线程
-        stopWorkers = true;
-        queueCV.notify_all();
-        for (auto& worker : workers) {
-            if (worker.joinable()) {
-                worker.join();
+    static void writeAll(int target, const std::string& data) {
+        size_t offset = 0;
+        while (offset < data.size()) {
+            ssize_t n = ::write(target, data.data() + offset, data.size() - offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return;
             }
+            offset += static_cast<size_t>(n);
         }
     }
 
-    void start() {
-        logger->info("机器人启动中...");
-        logger->info("Admin ID: " + std::to_string(adminId));
-        logger->info("工作线程数: " + std::to_string(config.workerThreads));
+    void writerLoop() {
+        std::vector<Record> batch(256);
+        std::string out;
+        time_t cachedSecond = 0;
+        char stamp[32] = {0};
+        uint64_t reportedDrops = 0;
 
-        // /start 命令
-        bot->getEvents().onCommand("start", [this](TgBot::Message::Ptr message) {
-            if (isUserBanned(message->from->id)) {
-                return; // 忽略被封禁用户
+        while (true) {
+            int next = pendingFd.exchange(NO_PENDING_FD);
+            if (next != NO_PENDING_FD) {
+                if (fd >= 0) {
+                    ::fdatasync(fd);
+                    ::close(fd);
+                }
+                fd = next;
             }
-            
-            bot->getApi().sendMessage(message->chat->id,
-                "🤖 欢迎使用消息转发机器人！\n\n"
-                "📝 使用说明:\n"
-                "• 直接发送消息 - 转发给管理员\n"
-                "• /req <内容> - 发送带按钮的请求\n"
-                "• /help - 查看帮助\n\n"
-                "管理员会尽快回复您的消息！");
-            
-            logger->info("用户 " + std::to_string(message->from->id) + " 启动了机器人");
-        });
 
-        // /help 命令
-        bot->getEvents().onCommand("help", [this](TgBot::Message::Ptr message) {
-            if (isUserBanned(message->from->id)) {
-                return;
+            size_t n = buffer.popBatch(batch.data(), batch.size());
+            if (n == 0) {
+                if (stopping) break;
+                parking.wait([this] { return buffer.sizeApprox() > 0 || stopping.load(); });
+                continue;
             }
-            
-            bot->getApi().sendMessage(message->chat->id,
-                "📋 帮助信息\n\n"
-                "可用命令:\n"
-                "/start - 开始使用\n"
-                "/help - 显示帮助\n"
-                "/req - 发送请求\n\n"
-                "使用示例:\n"
-                "/req 我需要帮助解决一个问题");
-        });
 
-        // /req 命令
+            out.clear();
+            for (size_t i = 0; i < n; ++i) {
+                const Record& r = batch[i];
+                if (r.time != cachedSecond) {
+                    struct tm local;
+                    localtime_r(&r.time, &local);
+                    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+                    cachedSecond = r.time;
+                }
+                out.append(stamp);
+                out.append(" [");
+                out.append(levelName(r.level));
+                out.append("] ");
+                out.append(r.text, r.length);
+                if (r.rest) {
+                    out.append(*r.rest);
+                    delete r.rest;
+                }
+                out.push_back('\n');
+            }
+
+            uint64_t drops = dropped.load();
+            if (drops != reportedDrops) {
+                out.append(stamp);
+                out.append(" [WARN] 日志缓冲区已满，丢弃 " + std::to_string(drops - reportedDrops) + " 条日志\n");
+                reportedDrops = drops;
+            }
+
+            if (fd >= 0) writeAll(fd, out);
+            if (echoStdout) writeAll(STDOUT_FILENO, out);
+        }
+
+        if (fd >= 0) ::fdatasync(fd);
+    }
+
+    // 不超过 limit 字节、且不落在多字节 UTF-8 字符中间的前缀长度
+    static size_t utf8Prefix(const std::string& text, size_t limit) {
+        if (text.size() <= limit) return text.size();
+        size_t length = limit;
+        while (length > 0 && (static_cast<unsigned char>(text[length]) & 0xC0) == 0x80) --length;
+        return length;
+    }
+
+public:
+    Logger(const std::string& filename, bool enable = true, bool echo = true,
+           LogLevel level = LogLevel::INFO, size_t capacity = 8192)
+        : enabled(enable), echoStdout(echo), minLevel(static_cast<int>(level)), buffer(capacity) {
+        if (enabled) {
+            fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            writer = std::thread(&Logger::writerLoop, this);
+        }
+    }
+
+    // 析构时写出缓冲区中剩余的全部日志
+    ~Logger() {
+        if (writer.joinable()) {
+            stopping = true;
+            parking.notifyAll();
+            writer.join();
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        int next = pendingFd.exchange(NO_PENDING_FD);
+        if (next >= 0) {
+            ::close(next);
+        }
+    }
+
+    // 运行中更换日志文件和输出方式（重新加载配置时调用）。新文件打开成功后由写出线程切换，
+    // 切换前已缓冲的日志写入旧文件；打开失败时保持原文件并返回 false
+    bool reconfigure(const std::string& filename, bool enable, bool echo) {
+        std::lock_guard<std::mutex> lock(configMutex);
+        echoStdout = echo;
+        if (enable) {
+            int next = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (next < 0) return false;
+            int old = pendingFd.exchange(next);
+            if (old >= 0) ::close(old);
+            if (!writer.joinable()) {
+                writer = std::thread(&Logger::writerLoop, this);
+            }
+        }
+        enabled = enable;
+        return true;
+    }
+
+    static LogLevel parseLevel(const std::string& name) {
+        if (name == "debug" || name == "DEBUG") return LogLevel::DEBUG;
+        if (name == "warn" || name == "WARN" || name == "warning") return LogLevel::WARN;
+        if (name == "error" || name == "ERROR") return LogLevel::ERROR;
+        return LogLevel::INFO;
+    }
+
+    void setLevel(LogLevel level) { minLevel = static_cast<int>(level); }
+
+    // 缓冲区满时丢弃的日志条数
+    uint64_t droppedCount() const { return dropped.load(); }
+
+    bool isEnabled(LogLevel level) const {
+        return enabled && static_cast<int>(level) >= BOT_MIN_LOG_LEVEL && static_cast<int>(level) >= minLevel.load();
+    }
+
+    void log(LogLevel level, const std::string& message) {
+        if (!isEnabled(level)) return;
+
+        Record r;
+        r.level = level;
+        r.time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        size_t total = utf8Prefix(message, MAX_MESSAGE);
+        size_t length = utf8Prefix(message, sizeof(r.text));
+        r.length = static_cast<uint32_t>(length);
+        std::memcpy(r.text, message.data(), length);
+        r.rest = nullptr;
+        if (total < message.size()) {
+            r.rest = new std::string(message, length, total - length);
+            r.rest->append("…（已截断，共 " + std::to_string(message.size()) + " 字节）");
+        } else if (length < total) {
+            r.rest = new std::string(message, length);
+        }
+
+        // 缓冲区满时警告和错误等待写出线程腾出空间，其余级别短暂重试后丢弃
+        int attempts = 0;
+        while (!buffer.tryPush(std::move(r))) {
+            if (level < LogLevel::WARN && ++attempts > 64) {
+                ++dropped;
+                delete r.rest;
+                return;
+            }
+            parking.notifyOne();
+            std::this_thread::yield();
+        }
+        parking.notifyOne();
+    }
+
+    void debug(const std::string& message) { log(LogLevel::DEBUG, message); }
+    void info(const std::string& message) { log(LogLevel::INFO, message); }
+    void error(const std::string& message) { log(LogLevel::ERROR, message); }
+    void warning(const std::string& message) { log(LogLevel::WARN, message); }
+};
+
+// 显示名称驻留表（相同名称只保存一份，按引用计数回收）
+class NameTable {
+private:
+    std::unordered_map<std::string, uint32_t> index;
+    std::vector<const std::string*> names; // id -> index 中的键
+    std::vector<uint32_t> refs;
+    std::vector<uint32_t> freeIds;
+
+public:
+    uint32_t acquire(const std::string& name) {
+        auto it = index.find(name);
+        if (it != index.end()) {
+            ++refs[it->second];
+            return it->second;
+        }
+
+        uint32_t id;
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        } else {
+            id = static_cast<uint32_t>(names.size());
+            names.push_back(nullptr);
+            refs.push_back(0);
+        }
+        it = index.emplace(name, id).first;
+        names[id] = &it->first;
+        refs[id] = 1;
+        return id;
+    }
+
+    void release(uint32_t id) {
+        if (--refs[id] == 0) {
+            index.erase(*names[id]);
+            names[id] = nullptr;
+            freeIds.push_back(id);
+        }
+    }
+
+    const std::string& get(uint32_t id) const {
+        return *names[id];
+    }
+
+    size_t size() const { return index.size(); }
+};
+
+// 回复路由缓存：管理员侧消息键（管理员下标 + 消息 ID）-> (用户 ID, 显示名称)
+// 开放寻址哈希 + 侵入式 LRU 链表，容量和空闲过期时间有上限。
+// 访问会刷新过期时间，因此 LRU 尾部总是最早过期的条目。
+// 非线程安全，由调用方加锁。
+class ReplyRouteCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t expirations = 0;
+        size_t size = 0;
+        size_t capacity = 0;
+        size_t names = 0;
+    };
+
+private:
+    enum : uint32_t { NIL = 0xFFFFFFFFu };
+
+    struct Entry {
+        int64_t key;
+        int64_t userId;
+        uint32_t nameId;
+        uint32_t expiresAt; // 相对 epoch 的秒数
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<uint32_t> slots; // 哈希槽 -> entries 下标
+    size_t slotMask;
+    uint32_t freeHead = NIL;
+    uint32_t used = 0;
+    uint32_t lruHead = NIL; // 最近使用
+    uint32_t lruTail = NIL; // 最久未使用
+    size_t count = 0;
+    uint32_t ttlSeconds;
+    std::chrono::steady_clock::time_point epoch;
+    NameTable nameTable;
+    Stats counters;
+
+    static uint64_t hashKey(int64_t key) {
+        uint64_t h = static_cast<uint64_t>(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    uint32_t now() const {
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - epoch).count());
+    }
+
+    size_t findSlot(int64_t key) const {
+        size_t pos = hashKey(key) & slotMask;
+        while (slots[pos] != NIL) {
+            if (entries[slots[pos]].key == key) {
+                return pos;
+            }
+            pos = (pos + 1) & slotMask;
+        }
+        return pos;
+    }
+
+    void lruUnlink(uint32_t idx) {
+        Entry& e = entries[idx];
+        if (e.prev != NIL) entries[e.prev].next = e.next; else lruHead = e.next;
+        if (e.next != NIL) entries[e.next].prev = e.prev; else lruTail = e.prev;
+    }
+
+    void lruPushFront(uint32_t idx) {
+        Entry& e = entries[idx];
+        e.prev = NIL;
+        e.next = lruHead;
+        if (lruHead != NIL) entries[lruHead].prev = idx;
+        lruHead = idx;
+        if (lruTail == NIL) lruTail = idx;
+    }
+
+    // 删除槽位并做反向移位，保持线性探测链连续（无墓碑）
+    void eraseSlot(size_t pos) {
+        size_t hole = pos;
+        size_t next = (pos + 1) & slotMask;
+        while (slots[next] != NIL) {
+            size_t home = hashKey(entries[slots[next]].key) & slotMask;
+            if (((next - home) & slotMask) >= ((next - hole) & slotMask)) {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+            next = (next + 1) & slotMask;
+        }
+        slots[hole] = NIL;
+    }
+
+    void removeEntry(uint32_t idx) {
+        Entry& e = entries[idx];
+        eraseSlot(findSlot(e.key));
+        lruUnlink(idx);
+        nameTable.release(e.nameId);
+        e.next = freeHead;
+        freeHead = idx;
+        --count;
+    }
+
+    void purgeExpired(uint32_t t) {
+        while (lruTail != NIL && entries[lruTail].expiresAt <= t) {
+            removeEntry(lruTail);
+            ++counters.expirations;
+        }
+    }
+
+public:
+    ReplyRouteCache(size_t capacity, uint32_t ttl)
+        : ttlSeconds(ttl), epoch(std::chrono::steady_clock::now()) {
+        if (capacity == 0) capacity = 1;
+        if (capacity > NIL - 1) capacity = NIL - 1;
+        size_t slotCount = 1;
+        while (slotCount < capacity * 2) slotCount <<= 1;
+        slots.assign(slotCount, NIL);
+        slotMask = slotCount - 1;
+        entries.resize(capacity);
+        counters.capacity = capacity;
+    }
+
+    void put(int64_t key, int64_t userId, const std::string& display) {
+        uint32_t t = now();
+        purgeExpired(t);
+
+        size_t pos = findSlot(key);
+        uint32_t idx = slots[pos];
+        if (idx != NIL) {
+            Entry& e = entries[idx];
+            uint32_t nameId = nameTable.acquire(display);
+            nameTable.release(e.nameId);
+            e.nameId = nameId;
+            e.userId = userId;
+            e.expiresAt = t + ttlSeconds;
+            lruUnlink(idx);
+            lruPushFront(idx);
+            return;
+        }
+
+        if (count == entries.size()) {
+            removeEntry(lruTail);
+            ++counters.evictions;
+            pos = findSlot(key);
+        }
+
+        if (freeHead != NIL) {
+            idx = freeHead;
+            freeHead = entries[idx].next;
+        } else {
+            idx = used++;
+        }
+
+        Entry& e = entries[idx];
+        e.key = key;
+        e.userId = userId;
+        e.nameId = nameTable.acquire(display);
+        e.expiresAt = t + ttlSeconds;
+        slots[pos] = idx;
+        lruPushFront(idx);
+        ++count;
+    }
+
+    bool get(int64_t key, int64_t& userId, std::string* display = nullptr) {
+        size_t pos = findSlot(key);
+        uint32_t idx = slots[pos];
+        if (idx == NIL) {
+            ++counters.misses;
+            return false;
+        }
+
+        uint32_t t = now();
+        Entry& e = entries[idx];
+        if (e.expiresAt <= t) {
+            removeEntry(idx);
+            ++counters.expirations;
+            ++counters.misses;
+            return false;
+        }
+
+        e.expiresAt = t + ttlSeconds;
+        lruUnlink(idx);
+        lruPushFront(idx);
+        ++counters.hits;
+
+        userId = e.userId;
+        if (display) {
+            *display = nameTable.get(e.nameId);
+        }
+        return true;
+    }
+
+    Stats stats() const {
+        Stats s = counters;
+        s.size = count;
+        s.names = nameTable.size();
+        return s;
+    }
+};
+
+// 过期去重集合：按时间分代的哈希集合，最近 ttl 内插入过的键视为重复。
+// 每代覆盖 ttl/(代数-1)，轮转时整代清空，插入、查询、过期均摊 O(1)。
+// 非线程安全，由调用方加锁。
+class ExpiringSet {
+private:
+    std::vector<std::unordered_set<std::string>> generations;
+    size_t current = 0;
+    std::chrono::steady_clock::duration span;
+    std::chrono::steady_clock::time_point currentStart;
+
+    void rotate(std::chrono::steady_clock::time_point now) {
+        size_t steps = 0;
+        while (now - currentStart >= span && steps < generations.size()) {
+            current = (current + 1) % generations.size();
+            generations[current].clear();
+            currentStart += span;
+            ++steps;
+        }
+        if (now - currentStart >= span) {
+            // 长时间空闲，所有代都已过期
+            currentStart = now;
+        }
+    }
+
+public:
+    ExpiringSet(std::chrono::seconds ttl, size_t generationCount = 8)
+        : generations(std::max<size_t>(2, generationCount)),
+          span(std::max<std::chrono::steady_clock::duration>(
+              std::chrono::milliseconds(1),
+              std::chrono::steady_clock::duration(ttl) / static_cast<int64_t>(generations.size() - 1))),
+          currentStart(std::chrono::steady_clock::now()) {}
+
+    // 键未出现过时插入并返回 true，重复时返回 false
+    bool insert(const std::string& key) {
+        rotate(std::chrono::steady_clock::now());
+        for (const auto& generation : generations) {
+            if (generation.count(key)) return false;
+        }
+        generations[current].insert(key);
+        return true;
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& generation : generations) total += generation.size();
+        return total;
+    }
+};
+
+// 读侧临界区（两相计数）：读者无锁进入，写者替换数据后等待旧相读者退出再回收
+class ReadEpoch {
+private:
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<int64_t> readers[2];
+
+public:
+    class Guard {
+    private:
+        ReadEpoch* owner;
+        int phase;
+
+    public:
+        Guard(ReadEpoch* o, int p) : owner(o), phase(p) {}
+        Guard(Guard&& other) : owner(other.owner), phase(other.phase) { other.owner = nullptr; }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        ~Guard() {
+            if (owner) owner->readers[phase].fetch_sub(1);
+        }
+    };
+
+    ReadEpoch() {
+        readers[0] = 0;
+        readers[1] = 0;
+    }
+
+    Guard enter() {
+        while (true) {
+            uint64_t e = epoch.load();
+            int phase = static_cast<int>(e & 1);
+            readers[phase].fetch_add(1);
+            if (epoch.load() == e) {
+                return Guard(this, phase);
+            }
+            readers[phase].fetch_sub(1);
+        }
+    }
+
+    // 调用前须已发布新数据；返回后旧数据不再被任何读者引用
+    void synchronize() {
+        uint64_t e = epoch.fetch_add(1);
+        while (readers[e & 1].load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+// 持久化消息索引：管理员侧消息 ID -> (用户 ID, 显示名称)
+// 记录以定长格式追加到 mmap 文件，启动时只需映射文件，无需解析。
+// 管理员会话中的消息 ID 单调递增，因此记录基本有序：有序前缀二分查找，
+// 乱序尾部（并发发送导致，很少见）线性扫描，尾部过长或容量用尽时压缩重写。
+// 显示名称追加到独立的名称文件，记录中保存其 32 位偏移，读取用 pread。
+// 压缩时名称文件随记录一起重写，只保留仍被引用的名称；新名称文件按代号命名，
+// 索引头记录当前代号，索引文件重命名即同时切换两者。
+// 读者无锁；写者之间互斥。
+class MessageIndex {
+private:
+    static const char* magic() { return "TGFWIDX1"; }
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint64_t capacity;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sortedCount;
+        uint64_t namesGeneration; // 0 为旧版的 <索引>.names
+        char reserved[16];
+    };
+
+    struct Record {
+        int32_t messageId;
+        uint32_t nameOffset;
+        int64_t userId;
+    };
+
+    struct Mapping {
+        void* base = nullptr;
+        size_t length = 0;
+        Header* header = nullptr;
+        Record* records = nullptr;
+        int namesFd = -1;
+    };
+
+    std::string path;
+    uint64_t maxRecords;
+    uint64_t namesSize = 0;
+    std::unordered_map<std::string, uint32_t> nameOffsets; // 当前名称文件中的名称，压缩时重建
+
+    std::atomic<Mapping*> current{nullptr};
+    ReadEpoch readEpoch;
+    std::mutex writeMutex;
+
+    enum : uint64_t { INITIAL_CAPACITY = 1 << 20, UNSORTED_LIMIT = 4096, MAX_NAMES_SIZE = 0xFFFFFFFFu };
+
+    std::string namesPath(uint64_t generation) const {
+        return generation == 0 ? path + ".names" : path + ".names." + std::to_string(generation);
+    }
+
+    static Mapping* mapFile(const std::string& file, uint64_t capacity, bool create) {
+        int fd = ::open(file.c_str(), O_RDWR | (create ? (O_CREAT | O_TRUNC) : 0), 0644);
+        if (fd < 0) return nullptr;
+
+        size_t length = sizeof(Header) + capacity * sizeof(Record);
+        if (create) {
+            if (::ftruncate(fd, static_cast<off_t>(length)) != 0) {
+                ::close(fd);
+                return nullptr;
+            }
+        } else {
+            struct stat st;
+            if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+                ::close(fd);
+                return nullptr;
+            }
+            length = static_cast<size_t>(st.st_size);
+        }
+
+        void* base = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) return nullptr;
+
+        Mapping* m = new Mapping();
+        m->base = base;
+        m->length = length;
+        m->header = static_cast<Header*>(base);
+        m->records = reinterpret_cast<Record*>(static_cast<char*>(base) + sizeof(Header));
+
+        if (create) {
+            std::memcpy(m->header->magic, magic(), 8);
+            m->header->version = 1;
+            m->header->recordSize = sizeof(Record);
+            m->header->capacity = capacity;
+            m->header->count.store(0);
+            m->header->sortedCount.store(0);
+            m->header->namesGeneration = 0;
+        } else if (std::memcmp(m->header->magic, magic(), 8) != 0 ||
+                   m->header->recordSize != sizeof(Record) ||
+                   sizeof(Header) + m->header->capacity * sizeof(Record) > length ||
+                   m->header->count.load() > m->header->capacity) {
+            unmap(m);
+            return nullptr;
+        }
+        return m;
+    }
+
+    static void unmap(Mapping* m) {
+        if (m) {
+            ::munmap(m->base, m->length);
+            if (m->namesFd >= 0) ::close(m->namesFd);
+            delete m;
+        }
+    }
+
+    static std::string encodeName(const std::string& name) {
+        uint16_t len = static_cast<uint16_t>(std::min<size_t>(name.size(), 0xFFFF));
+        std::string buf(reinterpret_cast<const char*>(&len), sizeof(len));
+        buf.append(name, 0, len);
+        return buf;
+    }
+
+    // 扫描名称文件重建 nameOffsets；中途被截断的最后一项丢弃（没有记录引用它）
+    void loadNames(int fd) {
+        nameOffsets.clear();
+        namesSize = 0;
+        struct stat st;
+        if (::fstat(fd, &st) != 0) return;
+        std::string data(static_cast<size_t>(st.st_size), '\0');
+        if (!data.empty() && ::pread(fd, &data[0], data.size(), 0) != static_cast<ssize_t>(data.size())) return;
+
+        size_t pos = 0;
+        while (pos + sizeof(uint16_t) <= data.size() && pos <= MAX_NAMES_SIZE) {
+            uint16_t len;
+            std::memcpy(&len, data.data() + pos, sizeof(len));
+            if (pos + sizeof(len) + len > data.size()) break;
+            nameOffsets[data.substr(pos + sizeof(len), len)] = static_cast<uint32_t>(pos);
+            pos += sizeof(len) + len;
+        }
+        namesSize = pos;
+    }
+
+    // 名称文件超出 32 位偏移或写入失败时返回 false
+    bool internName(Mapping* m, const std::string& name, uint32_t& offset) {
+        auto it = nameOffsets.find(name);
+        if (it != nameOffsets.end()) {
+            offset = it->second;
+            return true;
+        }
+
+        std::string buf = encodeName(name);
+        if (namesSize + buf.size() > MAX_NAMES_SIZE) return false;
+        if (::pwrite(m->namesFd, buf.data(), buf.size(), static_cast<off_t>(namesSize)) !=
+            static_cast<ssize_t>(buf.size())) {
+            return false;
+        }
+        offset = static_cast<uint32_t>(namesSize);
+        namesSize += buf.size();
+        nameOffsets.emplace(name, offset);
+        return true;
+    }
+
+    static std::string readName(const Mapping* m, uint32_t offset) {
+        uint16_t len = 0;
+        if (::pread(m->namesFd, &len, sizeof(len), offset) != sizeof(len)) return "";
+        std::string name(len, '\0');
+        if (len > 0 && ::pread(m->namesFd, &name[0], len, offset + sizeof(len)) != len) return "";
+        return name;
+    }
+
+    // 有序前缀与排序后的尾部归并去重（尾部较新者优先），按 maxRecords 保留最新的记录。
+    // 容量按保留的记录数确定（留一半余量），名称文件只写入保留记录引用的名称；
+    // 两者写入新文件后原子替换。额外内存只与尾部长度和名称数有关。
+    bool compact() {
+        Mapping* old = current.load();
+        uint64_t n = old->header->count.load();
+        uint64_t sorted = std::min(n, old->header->sortedCount.load());
+
+        std::vector<std::pair<int32_t, uint64_t>> tail; // (messageId, 位置)
+        tail.reserve(n - sorted);
+        for (uint64_t i = sorted; i < n; ++i) {
+            tail.emplace_back(old->records[i].messageId, i);
+        }
+        std::sort(tail.begin(), tail.end());
+
+        // 按 messageId 顺序依次给出去重后的记录
+        auto merge = [&](const std::function<void(const Record&)>& emit) {
+            uint64_t i = 0;
+            size_t j = 0;
+            while (i < sorted || j < tail.size()) {
+                // 同一 ID 在尾部出现多次时只保留最后一次
+                if (j + 1 < tail.size() && tail[j + 1].first == tail[j].first) {
+                    ++j;
+                    continue;
+                }
+                if (j == tail.size() || (i < sorted && old->records[i].messageId < tail[j].first)) {
+                    emit(old->records[i++]);
+                } else {
+                    if (i < sorted && old->records[i].messageId == tail[j].first) ++i;
+                    emit(old->records[tail[j++].second]);
+                }
+            }
+        };
+        uint64_t total = 0;
+        merge([&total](const Record&) { ++total; });
+        uint64_t keep = maxRecords > 0 ? std::min(total, maxRecords) : total;
+        uint64_t skip = total - keep;
+
+        uint64_t capacity = INITIAL_CAPACITY;
+        while (capacity < keep + keep / 2 + 1) capacity *= 2;
+
+        uint64_t generation = old->header->namesGeneration + 1;
+        std::string tmpPath = path + ".tmp";
+        std::string namesTmpPath = namesPath(generation) + ".tmp";
+        Mapping* fresh = mapFile(tmpPath, capacity, true);
+        if (!fresh) return false;
+        fresh->header->namesGeneration = generation;
+
+        std::unordered_map<uint32_t, uint32_t> remap; // 旧偏移 -> 新偏移
+        std::unordered_map<std::string, uint32_t> freshOffsets;
+        std::string names;
+        uint64_t seen = 0, out = 0;
+        bool ok = true;
+        merge([&](const Record& r) {
+            if (seen++ < skip || !ok) return;
+            auto it = remap.find(r.nameOffset);
+            if (it == remap.end()) {
+                std::string name = readName(old, r.nameOffset);
+                auto known = freshOffsets.find(name);
+                if (known == freshOffsets.end()) {
+                    known = freshOffsets.emplace(name, static_cast<uint32_t>(names.size())).first;
+                    names += encodeName(name);
+                    ok = names.size() <= MAX_NAMES_SIZE;
+                }
+                it = remap.emplace(r.nameOffset, known->second).first;
+            }
+            Record& copy = fresh->records[out++];
+            copy = r;
+            copy.nameOffset = it->second;
+        });
+        fresh->header->count.store(out);
+        fresh->header->sortedCount.store(out);
+
+        int namesFd = ok ? ::open(namesTmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : -1;
+        ok = namesFd >= 0 && ::pwrite(namesFd, names.data(), names.size(), 0) == static_cast<ssize_t>(names.size()) &&
+             ::fsync(namesFd) == 0 && ::rename(namesTmpPath.c_str(), namesPath(generation).c_str()) == 0;
+        fresh->namesFd = namesFd;
+        ::msync(fresh->base, fresh->length, MS_SYNC);
+        if (!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            unmap(fresh);
+            ::unlink(tmpPath.c_str());
+            ::unlink(namesTmpPath.c_str());
+            ::unlink(namesPath(generation).c_str());
+            return false;
+        }
+
+        current.store(fresh);
+        readEpoch.synchronize();
+        ::unlink(namesPath(generation - 1).c_str());
+        unmap(old);
+        nameOffsets.swap(freshOffsets);
+        namesSize = names.size();
+        return true;
+    }
+
+public:
+    MessageIndex(const std::string& file, uint64_t maxRecordCount)
+        : path(file), maxRecords(maxRecordCount) {}
+
+    ~MessageIndex() {
+        Mapping* m = current.load();
+        if (m) {
+            ::msync(m->base, m->length, MS_SYNC);
+            unmap(m);
+        }
+    }
+
+    bool open() {
+        Mapping* m = mapFile(path, 0, false);
+        bool created = false;
+        if (!m) {
+            m = mapFile(path, INITIAL_CAPACITY, true);
+            created = true;
+        }
+        if (!m) return false;
+
+        // 新建索引时旧名称文件已无记录引用，清空
+        uint64_t generation = m->header->namesGeneration;
+        m->namesFd = ::open(namesPath(generation).c_str(), O_RDWR | O_CREAT | (created ? O_TRUNC : 0), 0644);
+        if (m->namesFd < 0) {
+            unmap(m);
+            return false;
+        }
+        // 压缩中途退出时可能留下上一代或未启用的下一代名称文件
+        if (generation > 0) ::unlink(namesPath(generation - 1).c_str());
+        ::unlink(namesPath(generation + 1).c_str());
+        loadNames(m->namesFd);
+        current.store(m);
+        return true;
+    }
+
+    uint64_t size() const {
+        Mapping* m = current.load();
+        return m ? m->header->count.load() : 0;
+    }
+
+    // 写入失败（磁盘错误，或压缩后名称文件仍超出 32 位偏移）时返回 false
+    bool append(int32_t messageId, int64_t userId, const std::string& name) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        Mapping* m = current.load();
+        if (!m) return false;
+
+        uint32_t nameOffset = 0;
+        if (!internName(m, name, nameOffset)) {
+            // 只有名称文件写满时才值得压缩回收不再引用的名称
+            if (namesSize + encodeName(name).size() <= MAX_NAMES_SIZE || !compact()) return false;
+            m = current.load();
+            if (!internName(m, name, nameOffset)) return false;
+        }
+
+        uint64_t n = m->header->count.load();
+        if (n == m->header->capacity) {
+            // 压缩会重写名称文件，本条的名称须重新写入
+            if (!compact()) return false;
+            m = current.load();
+            n = m->header->count.load();
+            if (!internName(m, name, nameOffset)) return false;
+        }
+
+        Record& r = m->records[n];
+        r.messageId = messageId;
+        r.userId = userId;
+        r.nameOffset = nameOffset;
+
+        uint64_t sorted = m->header->sortedCount.load();
+        m->header->count.store(n + 1, std::memory_order_release);
+        if (sorted == n && (n == 0 || m->records[n - 1].messageId < messageId)) {
+            m->header->sortedCount.store(n + 1, std::memory_order_release);
+        } else if (n + 1 - sorted > UNSORTED_LIMIT) {
+            compact();
+        }
+        return true;
+    }
+
+    bool find(int32_t messageId, int64_t& userId, std::string& name) {
+        ReadEpoch::Guard guard = readEpoch.enter();
+        Mapping* m = current.load();
+        if (!m) return false;
+
+        uint64_t n = m->header->count.load(std::memory_order_acquire);
+        uint64_t sorted = std::min(n, m->header->sortedCount.load(std::memory_order_acquire));
+        const Record* found = nullptr;
+
+        // 乱序尾部较新，优先从后往前查
+        for (uint64_t i = n; i > sorted; --i) {
+            if (m->records[i - 1].messageId == messageId) {
+                found = &m->records[i - 1];
+                break;
+            }
+        }
+        if (!found) {
+            const Record* begin = m->records;
+            const Record* end = m->records + sorted;
+            const Record* it = std::lower_bound(begin, end, messageId,
+                [](const Record& r, int32_t id) { return r.messageId < id; });
+            if (it != end && it->messageId == messageId) {
+                found = it;
+            }
+        }
+        if (!found) return false;
+
+        userId = found->userId;
+        name = readName(m, found->nameOffset);
+        return true;
+    }
+};
+
+// 封禁列表：变更以 "+id"/"-id" 追加到日志文件并 fdatasync，
+// 日志过长时把完整列表写入临时文件、fsync 后原子重命名为快照，再清空日志。
+// 读者通过不可变的有序快照查询，无锁；写者替换快照后等待旧读者退出再回收。
+class BanList {
+private:
+    typedef std::vector<int64_t> Snapshot;
+
+    std::string snapshotPath;
+    std::string journalPath;
+    int journalFd = -1;
+    size_t journalEntries = 0;
+    std::atomic<const Snapshot*> current;
+    ReadEpoch readEpoch;
+    std::mutex writeMutex;
+
+    enum { COMPACT_THRESHOLD = 1024 };
+
+    static bool writeFully(int fd, const std::string& data) {
+        size_t offset = 0;
+        while (offset < data.size()) {
+            ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            offset += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    static void syncDirectory(const std::string& file) {
+        size_t slash = file.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : file.substr(0, slash + 1);
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    void publish(Snapshot* next) {
+        const Snapshot* old = current.exchange(next);
+        readEpoch.synchronize();
+        delete old;
+    }
+
+    bool appendJournal(char op, int64_t userId) {
+        std::string line = op + std::to_string(userId) + "\n";
+        if (journalFd < 0 || !writeFully(journalFd, line) || ::fdatasync(journalFd) != 0) {
+            return false;
+        }
+        ++journalEntries;
+        return true;
+    }
+
+    // 写入完整快照并清空日志；中途崩溃时重放日志结果不变
+    bool compact(const Snapshot& snapshot) {
+        std::string tmpPath = snapshotPath + ".tmp";
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+
+        std::string data;
+        data.reserve(snapshot.size() * 12);
+        for (int64_t userId : snapshot) {
+            data += std::to_string(userId);
+            data.push_back('\n');
+        }
+        bool ok = writeFully(fd, data) && ::fsync(fd) == 0;
+        ::close(fd);
+        if (!ok || ::rename(tmpPath.c_str(), snapshotPath.c_str()) != 0) {
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+        syncDirectory(snapshotPath);
+
+        if (::ftruncate(journalFd, 0) == 0) {
+            ::fdatasync(journalFd);
+            journalEntries = 0;
+        }
+        return true;
+    }
+
+    // 已是目标状态时不写日志；日志写入失败时状态不变，返回 false
+    bool update(char op, int64_t userId) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        const Snapshot* snapshot = current.load();
+        bool present = std::binary_search(snapshot->begin(), snapshot->end(), userId);
+        if ((op == '+') == present) return true;
+
+        if (!appendJournal(op, userId)) {
+            return false;
+        }
+
+        Snapshot* next = new Snapshot();
+        next->reserve(snapshot->size() + 1);
+        if (op == '+') {
+            auto pos = std::lower_bound(snapshot->begin(), snapshot->end(), userId);
+            next->insert(next->end(), snapshot->begin(), pos);
+            next->push_back(userId);
+            next->insert(next->end(), pos, snapshot->end());
+        } else {
+            std::remove_copy(snapshot->begin(), snapshot->end(), std::back_inserter(*next), userId);
+        }
+        publish(next);
+
+        if (journalEntries >= COMPACT_THRESHOLD) {
+            compact(*next);
+        }
+        return true;
+    }
+
+public:
+    explicit BanList(const std::string& file)
+        : snapshotPath(file), journalPath(file + ".journal"), current(new Snapshot()) {}
+
+    ~BanList() {
+        if (journalFd >= 0) ::close(journalFd);
+        delete current.load();
+    }
+
+    // 读取快照并重放日志，返回是否成功打开日志
+    bool load() {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        std::set<int64_t> ids;
+
+        std::ifstream snapshotFile(snapshotPath);
+        int64_t userId;
+        while (snapshotFile >> userId) {
+            ids.insert(userId);
+        }
+
+        // 只重放以换行结尾的完整记录：崩溃时写了一半的最后一条（如 "+12"）不能当作 "+123" 生效
+        std::ifstream journal(journalPath, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(journal)), std::istreambuf_iterator<char>());
+        size_t complete = data.rfind('\n') == std::string::npos ? 0 : data.rfind('\n') + 1;
+        size_t replayed = 0;
+        for (size_t pos = 0; pos < complete;) {
+            size_t end = data.find('\n', pos);
+            std::string line = data.substr(pos, end - pos);
+            pos = end + 1;
+            if (line.size() < 2 || (line[0] != '+' && line[0] != '-')) continue;
+            try {
+                size_t parsed = 0;
+                int64_t id = std::stoll(line.substr(1), &parsed);
+                if (parsed != line.size() - 1) continue;
+                if (line[0] == '+') ids.insert(id);
+                else ids.erase(id);
+                ++replayed;
+            } catch (...) {
+            }
+        }
+
+        publish(new Snapshot(ids.begin(), ids.end()));
+
+        // 截掉不完整的尾部，之后追加的记录不会与它拼成一行
+        if (complete < data.size() && ::truncate(journalPath.c_str(), static_cast<off_t>(complete)) != 0) {
+            return false;
+        }
+        journalFd = ::open(journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        journalEntries = replayed;
+        if (journalFd >= 0 && replayed > 0) {
+            compact(*current.load());
+        }
+        return journalFd >= 0;
+    }
+
+    bool contains(int64_t userId) {
+        ReadEpoch::Guard guard = readEpoch.enter();
+        const Snapshot* snapshot = current.load();
+        return std::binary_search(snapshot->begin(), snapshot->end(), userId);
+    }
+
+    // 返回 false 表示无法写入日志（未能打开或写入失败），封禁状态未改变
+    bool add(int64_t userId) { return update('+', userId); }
+    bool remove(int64_t userId) { return update('-', userId); }
+
+    std::vector<int64_t> list() {
+        ReadEpoch::Guard guard = readEpoch.enter();
+        return *current.load();
+    }
+
+    size_t size() {
+        ReadEpoch::Guard guard = readEpoch.enter();
+        return current.load()->size();
+    }
+};
+
+// 用户登记表：与机器人对话过的会话 ID，供 /broadcast 使用。
+// 文件是定长 8 字节记录的追加日志（id*2 表示加入，id*2+1 表示移除，Telegram 的 ID 不超过 52 位），
+// 启动时重放；移除记录占比过高时重写文件。内存中按分片保存在开放寻址哈希表里，每个 ID 约 16 字节。
+class UserRegistry {
+private:
+    // 线性探测哈希集合，删除时回移后续元素，不留墓碑
+    class IdSet {
+    private:
+        enum : int64_t { EMPTY = INT64_MIN };
+        std::vector<int64_t> slots;
+        size_t count = 0;
+
+        size_t slotOf(int64_t id) const {
+            uint64_t h = static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ULL;
+            return static_cast<size_t>(h >> 32) & (slots.size() - 1);
+        }
+
+        size_t find(int64_t id) const {
+            size_t i = slotOf(id);
+            while (slots[i] != EMPTY && slots[i] != id) {
+                i = (i + 1) & (slots.size() - 1);
+            }
+            return i;
+        }
+
+        void grow() {
+            std::vector<int64_t> old(slots.size() * 2, EMPTY);
+            old.swap(slots);
+            for (int64_t id : old) {
+                if (id != EMPTY) slots[find(id)] = id;
+            }
+        }
+
+    public:
+        IdSet() : slots(16, EMPTY) {}
+
+        bool insert(int64_t id) {
+            if ((count + 1) * 2 > slots.size()) grow();
+            size_t i = find(id);
+            if (slots[i] == id) return false;
+            slots[i] = id;
+            ++count;
+            return true;
+        }
+
+        bool erase(int64_t id) {
+            size_t i = find(id);
+            if (slots[i] != id) return false;
+            size_t mask = slots.size() - 1;
+            for (size_t j = (i + 1) & mask; slots[j] != EMPTY; j = (j + 1) & mask) {
+                // 后续元素的理想位置不在 (i, j] 区间内时前移填补空位
+                size_t k = slotOf(slots[j]);
+                bool between = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+                if (!between) {
+                    slots[i] = slots[j];
+                    i = j;
+                }
+            }
+            slots[i] = EMPTY;
+            --count;
+            return true;
+        }
+
+        bool contains(int64_t id) const { return slots[find(id)] == id; }
+
+        size_t size() const { return count; }
+
+        template <typename F>
+        void forEach(F fn) const {
+            for (int64_t id : slots) {
+                if (id != EMPTY) fn(id);
+            }
+        }
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        IdSet ids;
+    };
+
+    enum { SHARDS = 16 };
+    enum { COMPACT_MIN_RECORDS = 4096 };
+
+    std::string path;
+    Shard shards[SHARDS];
+    std::atomic<size_t> count{0};
+    int fd = -1;
+    uint64_t records = 0; // 文件中的记录数
+    std::mutex fileMutex;
+
+    Shard& shardOf(int64_t id) {
+        return shards[(static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ULL) >> 60];
+    }
+
+    static bool writeFully(int fd, const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = ::write(fd, p, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // 每次变更先改内存再追加记录，重写文件时持有 fileMutex，
+    // 因此尚未落盘的变更要么已包含在新文件中，要么在重写之后追加，重放结果一致
+    void appendRecord(int64_t id, bool removed) {
+        int64_t record = id * 2 + (removed ? 1 : 0);
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (fd < 0) return;
+        if (writeFully(fd, &record, sizeof(record))) {
+            ++records;
+        }
+        if (records > COMPACT_MIN_RECORDS && records > count.load() * 2) {
+            compact();
+        }
+    }
+
+    // 调用方持有 fileMutex
+    bool compact() {
+        std::vector<int64_t> data;
+        data.reserve(count.load());
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.ids.forEach([&data](int64_t id) { data.push_back(id * 2); });
+        }
+
+        std::string tmpPath = path + ".tmp";
+        int tmp = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (tmp < 0) return false;
+        bool ok = writeFully(tmp, data.data(), data.size() * sizeof(int64_t)) && ::fsync(tmp) == 0;
+        ::close(tmp);
+        if (!ok || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            ::unlink(tmpPath.c_str());
+            return false;
+        }
+
+        int next = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (next < 0) return false;
+        ::close(fd);
+        fd = next;
+        records = data.size();
+        return true;
+    }
+
+public:
+    explicit UserRegistry(const std::string& file) : path(file) {}
+
+    ~UserRegistry() {
+        if (fd >= 0) {
+            ::fdatasync(fd);
+            ::close(fd);
+        }
+    }
+
+    // 重放文件，返回是否可以写入
+    bool load() {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in >= 0) {
+            std::vector<int64_t> buffer(8192);
+            ssize_t n;
+            while ((n = ::read(in, buffer.data(), buffer.size() * sizeof(int64_t))) > 0) {
+                // 崩溃时写了一半的最后一条记录被忽略
+                size_t complete = static_cast<size_t>(n) / sizeof(int64_t);
+                for (size_t i = 0; i < complete; ++i) {
+                    int64_t record = buffer[i];
+                    int64_t id = (record - (record & 1)) / 2;
+                    Shard& shard = shardOf(id);
+                    if (record & 1) {
+                        if (shard.ids.erase(id)) --count;
+                    } else if (shard.ids.insert(id)) {
+                        ++count;
+                    }
+                }
+                records += complete;
+                if (static_cast<size_t>(n) % sizeof(int64_t) != 0) break;
+            }
+            ::close(in);
+        }
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        // 截掉半条记录，或在移除较多时重写
+        if (records > count.load() * 2 || ::lseek(fd, 0, SEEK_END) != static_cast<off_t>(records * sizeof(int64_t))) {
+            compact();
+        }
+        return true;
+    }
+
+    // 返回是否为新用户
+    bool add(int64_t id) {
+        Shard& shard = shardOf(id);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!shard.ids.insert(id)) return false;
+        }
+        ++count;
+        appendRecord(id, false);
+        return true;
+    }
+
+    bool remove(int64_t id) {
+        Shard& shard = shardOf(id);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (!shard.ids.erase(id)) return false;
+        }
+        --count;
+        appendRecord(id, true);
+        return true;
+    }
+
+    bool contains(int64_t id) {
+        Shard& shard = shardOf(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.ids.contains(id);
+    }
+
+    size_t size() const { return count.load(); }
+
+    // 升序排列的全部 ID
+    std::vector<int64_t> list() {
+        std::vector<int64_t> ids;
+        ids.reserve(count.load());
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.ids.forEach([&ids](int64_t id) { ids.push_back(id); });
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    void sync() {
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (fd >= 0) ::fdatasync(fd);
+    }
+};
+
+// 广播任务：按用户 ID 升序发送，进度定期写入状态文件，重启后从 cursor 之后继续。
+// cursor 只推进到所有更小 ID 都已完成的位置，崩溃时最多重发一个发送窗口内的用户。
+struct BroadcastJob {
+    int64_t fromChatId = 0; // 非 0 时用 copyMessage 复制该消息，否则发送 text
+    int32_t messageId = 0;
+    std::string text;
+    int64_t cursor = INT64_MIN; // 不大于 cursor 的用户已处理
+    uint64_t total = 0;
+    uint64_t sent = 0;
+    uint64_t failed = 0;
+    uint64_t removed = 0; // 屏蔽了机器人或已注销而移出登记表的用户
+    int64_t reportChatId = 0; // 发起广播的管理员会话
+    int32_t progressMessageId = 0; // 该会话中的进度消息
+    bool cancelled = false;
+
+    // 第一行为数字字段，其余为文本；先写临时文件再改名
+    bool save(const std::string& path) const {
+        std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::trunc);
+            out << fromChatId << ' ' << messageId << ' ' << cursor << ' ' << total << ' ' << sent << ' '
+                << failed << ' ' << removed << ' ' << progressMessageId << ' ' << (cancelled ? 1 : 0) << ' '
+                << reportChatId << '\n'
+                << text;
+            out.flush();
+            if (!out) return false;
+        }
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+        return ::rename(tmpPath.c_str(), path.c_str()) == 0;
+    }
+
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        std::string header;
+        if (!std::getline(in, header)) return false;
+        std::istringstream fields(header);
+        int cancelledFlag = 0;
+        if (!(fields >> fromChatId >> messageId >> cursor >> total >> sent >> failed >> removed
+                     >> progressMessageId >> cancelledFlag)) {
+            return false;
+        }
+        cancelled = cancelledFlag != 0;
+        fields >> reportChatId; // 旧状态文件没有此字段
+        text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return true;
+    }
+};
+
+// 按用户限流（GCRA：令牌桶的等价形式，每个用户只记一个"理论到达时间" tat）。
+// 速率 rate 条/秒、突发 burst 条：消息到达时若 tat - now 超过 (burst - 1) / rate 则拒绝，否则 tat 前进 1 / rate。
+// tat 不晚于当前时间的用户与从未出现过等价，其槽位可直接复用，因此表容量固定，
+// 只需容纳最近几秒内活跃的用户；探测窗口内没有可用槽位时淘汰 tat 最早（欠额最少）的用户。
+class FloodGate {
+public:
+    struct Verdict {
+        bool allowed = true;
+        bool firstReject = false; // 本轮限流的第一次拒绝（用于只提示一次）
+        bool ban = false;         // 拒绝次数刚达到封禁阈值
+        std::chrono::microseconds retryAfter{0}; // 拒绝时，多久后可再次放行
+    };
+
+private:
+    struct Entry {
+        int64_t userId = 0; // 0 为空槽
+        int64_t tat = 0;    // 理论到达时间（微秒，相对 epoch）
+        uint32_t strikes = 0; // 本轮限流中被拒绝的次数，tat 过期后清零
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Entry> entries;
+    };
+
+    enum { SHARDS = 16, PROBE = 8 };
+
+    Shard shards[SHARDS];
+    size_t mask;
+    std::atomic<int64_t> interval; // 1 / rate（微秒）
+    std::atomic<int64_t> tolerance; // (burst - 1) / rate（微秒）
+    std::atomic<uint32_t> banStrikes; // 0 为不自动封禁
+    std::chrono::steady_clock::time_point epoch;
+    std::atomic<uint64_t> evictions{0};
+
+    int64_t sinceEpoch(std::chrono::steady_clock::time_point at) const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(at - epoch).count();
+    }
+
+    static uint64_t hashOf(int64_t userId) {
+        return static_cast<uint64_t>(userId) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    // 查找用户的槽位；不存在时选一个空槽、过期槽或 tat 最早的槽并重置
+    Entry& slot(Shard& shard, int64_t userId, int64_t t) {
+        size_t start = static_cast<size_t>(hashOf(userId) >> 20) & mask;
+        Entry* victim = nullptr;
+        for (size_t i = 0; i < PROBE; ++i) {
+            Entry& e = shard.entries[(start + i) & mask];
+            if (e.userId == userId) return e;
+            if (!victim || victim->tat > e.tat) victim = &e;
+        }
+        if (victim->userId != 0 && victim->tat > t) {
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        victim->userId = userId;
+        victim->tat = 0;
+        victim->strikes = 0;
+        return *victim;
+    }
+
+public:
+    // capacity 为总槽位数（向上取整到 2 的幂，分到各分片）
+    FloodGate(double rate, int burst, int banStrikes, size_t capacity) : epoch(std::chrono::steady_clock::now()) {
+        configure(rate, burst, banStrikes);
+        size_t perShard = PROBE;
+        while (perShard * SHARDS < capacity) perShard <<= 1;
+        mask = perShard - 1;
+        for (auto& shard : shards) {
+            shard.entries.resize(perShard);
+        }
+    }
+
+    FloodGate(const FloodGate&) = delete;
+    FloodGate& operator=(const FloodGate&) = delete;
+
+    // 调整速率、突发和封禁阈值，已有用户的状态保留（重新加载配置时调用）
+    void configure(double rate, int burst, int strikes) {
+        int64_t step = static_cast<int64_t>(1e6 / std::max(rate, 1e-3));
+        interval = step;
+        tolerance = step * std::max(0, burst - 1);
+        banStrikes = static_cast<uint32_t>(std::max(0, strikes));
+    }
+
+    Verdict admit(int64_t userId) {
+        return admit(userId, std::chrono::steady_clock::now());
+    }
+
+    // 以 at 为当前时间判断（测试用；at 不早于构造时间，同一用户的 at 不早于上一次）
+    Verdict admit(int64_t userId, std::chrono::steady_clock::time_point at) {
+        Verdict v;
+        int64_t interval = this->interval.load(std::memory_order_relaxed);
+        int64_t tolerance = this->tolerance.load(std::memory_order_relaxed);
+        uint32_t banStrikes = this->banStrikes.load(std::memory_order_relaxed);
+        Shard& shard = shards[hashOf(userId) >> 60];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        int64_t t = sinceEpoch(at);
+        Entry& e = slot(shard, userId, t);
+        if (e.tat <= t) {
+            e.tat = t;
+            e.strikes = 0;
+        }
+        if (e.tat - t > tolerance) {
+            ++e.strikes;
+            v.allowed = false;
+            v.firstReject = e.strikes == 1;
+            v.ban = banStrikes > 0 && e.strikes == banStrikes;
+            v.retryAfter = std::chrono::microseconds(e.tat - tolerance - t);
+            return v;
+        }
+        e.tat += interval;
+        return v;
+    }
+
+    // 仍有欠额被淘汰的次数；持续增长说明容量偏小
+    uint64_t evictionCount() const { return evictions.load(std::memory_order_relaxed); }
+
+    size_t capacity() const { return (mask + 1) * SHARDS; }
+};
+
+// 管理员池：每个会话（用户）粘性分配给一位管理员（私聊或群组）。
+// 新会话分给负载最低者，负载 = (未结束会话数 + 1) × (60 秒 + 平均响应时间)，响应时间取指数滑动平均；
+// 有待回复会话却超过 idleTimeout 未回复任何人的管理员视为空闲，其会话改派给其他管理员。
+// 管理员列表构造后不变，slotOf 只读查询无需加锁。
+class AdminPool {
+public:
+    // 空闲管理员的待回复会话改派结果
+    struct Handoff {
+        int64_t userId;
+        std::string display;
+        int64_t fromChat;
+        int64_t toChat;
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Admin {
+        int64_t chatId;
+        size_t open = 0;    // 未结束的会话数
+        size_t waiting = 0; // 其中等待回复的会话数
+        double avgResponse = 0; // 秒
+        bool measured = false;
+        Clock::time_point activeAt; // 最近一次回复，或开始有待回复会话的时间
+    };
+
+    struct Conversation {
+        size_t admin;
+        std::string display;
+        bool waiting = false;
+        Clock::time_point waitingSince;
+        Clock::time_point lastActivity;
+    };
+
+    std::vector<Admin> admins;
+    std::unordered_map<int64_t, size_t> slots; // chatId -> admins 下标
+    std::unordered_map<int64_t, Conversation> conversations; // userId -> 会话
+    Clock::duration idleTimeout;
+    Clock::duration conversationTtl;
+    mutable CountingMutex mutex;
+
+    bool isIdle(const Admin& admin, Clock::time_point now) const {
+        return admin.waiting > 0 && now - admin.activeAt > idleTimeout;
+    }
+
+    double load(const Admin& admin) const {
+        return static_cast<double>(admin.open + 1) * (60.0 + admin.avgResponse);
+    }
+
+    // 负载最低的非空闲管理员；全部空闲时在所有人中选
+    size_t leastLoaded(Clock::time_point now, size_t exclude) const {
+        size_t best = admins.size();
+        for (int pass = 0; pass < 2 && best == admins.size(); ++pass) {
+            for (size_t i = 0; i < admins.size(); ++i) {
+                if (i == exclude || (pass == 0 && isIdle(admins[i], now))) continue;
+                if (best == admins.size() || load(admins[i]) < load(admins[best])) best = i;
+            }
+        }
+        return best == admins.size() ? 0 : best;
+    }
+
+    static void addWaiting(Admin& admin, Clock::time_point now) {
+        if (admin.waiting++ == 0) admin.activeAt = now;
+    }
+
+    void setWaiting(Conversation& c, bool waiting, Clock::time_point now) {
+        if (c.waiting == waiting) return;
+        c.waiting = waiting;
+        c.waitingSince = now;
+        if (waiting) {
+            addWaiting(admins[c.admin], now);
+        } else {
+            --admins[c.admin].waiting;
+        }
+    }
+
+    void move(Conversation& c, size_t to, Clock::time_point now) {
+        Admin& from = admins[c.admin];
+        --from.open;
+        if (c.waiting) --from.waiting;
+        c.admin = to;
+        ++admins[to].open;
+        if (c.waiting) addWaiting(admins[to], now);
+    }
+
+public:
+    AdminPool(const std::vector<int64_t>& chatIds, std::chrono::seconds idle, std::chrono::seconds ttl)
+        : idleTimeout(idle), conversationTtl(ttl) {
+        Clock::time_point now = Clock::now();
+        for (int64_t chatId : chatIds) {
+            if (slots.count(chatId)) continue;
+            slots.emplace(chatId, admins.size());
+            Admin admin;
+            admin.chatId = chatId;
+            admin.activeAt = now;
+            admins.push_back(admin);
+        }
+    }
+
+    size_t size() const { return admins.size(); }
+
+    const CountingMutex& lockStats() const { return mutex; }
+
+    int64_t chatAt(size_t slot) const { return admins[slot].chatId; }
+
+    // 管理员会话在池中的下标，不是管理员时返回 -1
+    int slotOf(int64_t chatId) const {
+        auto it = slots.find(chatId);
+        return it == slots.end() ? -1 : static_cast<int>(it->second);
+    }
+
+    // 用户发来消息：返回负责该会话的管理员，必要时新分配或从空闲管理员处改派。
+    // 改派时 movedFrom 置为原管理员，否则置 0
+    int64_t assign(int64_t userId, const std::string& display, int64_t* movedFrom = nullptr) {
+        std::lock_guard<CountingMutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+        if (movedFrom) *movedFrom = 0;
+        auto it = conversations.find(userId);
+        if (it == conversations.end()) {
+            Conversation c;
+            c.admin = leastLoaded(now, admins.size());
+            ++admins[c.admin].open;
+            it = conversations.emplace(userId, c).first;
+        } else if (admins.size() > 1 && isIdle(admins[it->second.admin], now)) {
+            size_t to = leastLoaded(now, it->second.admin);
+            if (!isIdle(admins[to], now)) {
+                if (movedFrom) *movedFrom = admins[it->second.admin].chatId;
+                move(it->second, to, now);
+            }
+        }
+        Conversation& c = it->second;
+        c.display = display;
+        c.lastActivity = now;
+        setWaiting(c, true, now);
+        return admins[c.admin].chatId;
+    }
+
+    // 负责该用户的管理员，不改变会话状态；没有会话时为当前负载最低者
+    int64_t ownerOf(int64_t userId) const {
+        std::lock_guard<CountingMutex> lock(mutex);
+        auto it = conversations.find(userId);
+        return admins[it != conversations.end() ? it->second.admin : leastLoaded(Clock::now(), admins.size())].chatId;
+    }
+
+    // 管理员回复了用户：更新响应时间；由其他管理员回复时会话随之转给回复者
+    void recordReply(int64_t adminChat, int64_t userId) {
+        std::lock_guard<CountingMutex> lock(mutex);
+        auto slot = slots.find(adminChat);
+        if (slot == slots.end()) return;
+        Clock::time_point now = Clock::now();
+        Admin& admin = admins[slot->second];
+        admin.activeAt = now;
+
+        auto it = conversations.find(userId);
+        if (it == conversations.end()) return;
+        Conversation& c = it->second;
+        if (c.waiting) {
+            double sample = std::chrono::duration<double>(now - c.waitingSince).count();
+            admin.avgResponse = admin.measured ? admin.avgResponse * 0.8 + sample * 0.2 : sample;
+            admin.measured = true;
+        }
+        if (c.admin != slot->second) move(c, slot->second, now);
+        setWaiting(c, false, now);
+        c.lastActivity = now;
+    }
+
+    // 定期调用：结束长时间无往来的会话，把空闲管理员的待回复会话改派出去
+    std::vector<Handoff> rebalance() {
+        std::lock_guard<CountingMutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+        std::vector<Handoff> handoffs;
+        for (auto it = conversations.begin(); it != conversations.end();) {
+            Conversation& c = it->second;
+            if (now - c.lastActivity > conversationTtl) {
+                setWaiting(c, false, now);
+                --admins[c.admin].open;
+                it = conversations.erase(it);
+                continue;
+            }
+            if (c.waiting && admins.size() > 1 && isIdle(admins[c.admin], now)) {
+                size_t to = leastLoaded(now, c.admin);
+                if (!isIdle(admins[to], now)) {
+                    Handoff h;
+                    h.userId = it->first;
+                    h.display = c.display;
+                    h.fromChat = admins[c.admin].chatId;
+                    h.toChat = admins[to].chatId;
+                    move(c, to, now);
+                    handoffs.push_back(h);
+                }
+            }
+            ++it;
+        }
+        return handoffs;
+    }
+};
+
+// 变长整数编码（LEB128），任务日志和任务编码共用
+static void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static bool getVarint(const char*& p, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// 任务日志：入队的任务、完成标记和已确认的 update offset 追加到分段文件，重启时重放未完成的任务。
+// 记录格式 [u32 长度][u8 类型][载荷][u32 校验和]，崩溃时写了一半的尾部记录校验失败后被忽略。
+// 追加只复制到内存缓冲区；写线程每隔几毫秒或有人等待提交时批量 write + fdatasync（组提交），
+// 工作线程上每条任务只多一次编码和两次加锁拷贝（任务和完成标记），开销见 bench/task_journal_bench。
+// 写入或 fdatasync 失败（如磁盘已满）时把分段截回本批之前的长度，这一批留在内存中每秒重试，
+// 期间 commit 返回 false，调用方不得确认 update offset。
+// 分段超过 SEGMENT_BYTES 后切换新分段，旧分段中的任务全部完成后删除。
+class TaskJournal {
+public:
+    // 重放结果：上次确认的 offset 和未完成任务（按入队顺序）
+    struct Recovered {
+        int32_t offset = 0;
+        std::vector<std::string> tasks;
+    };
+
+private:
+    enum : uint8_t { RECORD_TASK = 1, RECORD_DONE = 2, RECORD_OFFSET = 3 };
+    enum : uint64_t { SEGMENT_BYTES = 64 << 20 };
+    enum { FLUSH_INTERVAL_MS = 20 };
+    enum { RETRY_INTERVAL_MS = 1000 };
+
+    struct Segment {
+        uint64_t id;
+        std::string path;
+        int64_t outstanding = 0; // 尚未完成的任务数
+        uint64_t bytes = 0;
+    };
+
+    std::string basePath;
+    std::map<uint64_t, Segment> segments; // 首个序号 -> 分段；最后一个是当前写入的分段
+    std::vector<std::string> recoveredPaths; // 上次运行留下的分段，任务重新入队并提交后删除
+    int fd = -1;
+    uint64_t nextSeq = 1;
+    uint64_t nextSegmentId = 1;
+    int32_t lastOffset = 0;
+
+    std::string buffer;
+    uint64_t appended = 0; // 已追加的字节数（累计）
+    uint64_t durable = 0;  // 已落盘的字节数（累计）
+    uint64_t failures = 0; // 写入失败的次数（累计），commit 据此得知等待的记录未能落盘
+    std::function<void(const std::string&)> onError;
+    bool commitWaiting = false;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable writerCv;
+    std::condition_variable durableCv;
+    std::thread writer;
+
+    static uint32_t checksum(const char* data, size_t size) {
+        uint32_t h = 2166136261u; // FNV-1a
+        for (size_t i = 0; i < size; ++i) {
+            h = (h ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+        return h;
+    }
+
+    // 调用方持有 mutex
+    void appendRecord(uint8_t type, const std::string& payload) {
+        uint32_t length = static_cast<uint32_t>(payload.size() + 1);
+        size_t start = buffer.size();
+        buffer.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        buffer.push_back(static_cast<char>(type));
+        buffer.append(payload);
+        uint32_t sum = checksum(buffer.data() + start + sizeof(length), length);
+        buffer.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+        appended += buffer.size() - start;
+        if (buffer.size() >= (1 << 20)) writerCv.notify_one();
+    }
+
+    std::string offsetPayload() const {
+        std::string payload;
+        putVarint(payload, static_cast<uint32_t>(lastOffset));
+        return payload;
+    }
+
+    // 调用方持有 mutex；新分段以当前 offset 开头，旧分段删除后 offset 也不会丢失
+    bool openSegment() {
+        Segment segment;
+        segment.id = nextSegmentId++;
+        segment.path = basePath + "." + std::to_string(segment.id);
+        int next = ::open(segment.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (next < 0) return false;
+        if (fd >= 0) ::close(fd);
+        fd = next;
+        segments.emplace(nextSeq, segment);
+        appendRecord(RECORD_OFFSET, offsetPayload());
+        return true;
+    }
+
+    // 调用方持有 mutex
+    void retireIfDone(std::map<uint64_t, Segment>::iterator it) {
+        if (it->second.outstanding > 0 || std::next(it) == segments.end()) return;
+        ::unlink(it->second.path.c_str());
+        segments.erase(it);
+    }
+
+    static bool writeFully(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void writerLoop() {
+        std::string batch; // 正在写入的一批；写入失败时保留，重试成功前不写后续的记录
+        uint64_t upTo = 0;
+        uint64_t base = 0; // 本批写入前分段的长度，失败时截回
+        int target = -1;
+        bool rotated = false;
+        bool failing = false;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (batch.empty()) {
+                writerCv.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS),
+                                  [this] { return stopping || commitWaiting || buffer.size() >= (1 << 20); });
+                if (buffer.empty()) {
+                    if (stopping) break;
+                    continue;
+                }
+                batch.swap(buffer);
+                upTo = appended;
+                target = fd;
+                Segment& current = std::prev(segments.end())->second;
+                base = current.bytes;
+                current.bytes += batch.size();
+                rotated = current.bytes >= SEGMENT_BYTES;
+                if (rotated) {
+                    // 先提交本批到旧分段，之后追加的记录（序号 >= nextSeq）属于新分段
+                    target = ::dup(fd);
+                    if (!openSegment()) {
+                        ::close(target);
+                        target = fd;
+                        rotated = false;
+                    }
+                }
+            } else {
+                writerCv.wait_for(lock, std::chrono::milliseconds(RETRY_INTERVAL_MS), [this] { return stopping; });
+            }
+            commitWaiting = false;
+            lock.unlock();
+
+            bool ok = writeFully(target, batch.data(), batch.size()) && ::fdatasync(target) == 0;
+            std::string error = ok ? "" : std::strerror(errno);
+            // 写了一半的记录会让重放停在这里，截掉后重试时从本批开头重新写
+            bool truncated = ok || ::ftruncate(target, static_cast<off_t>(base)) == 0;
+
+            lock.lock();
+            if (ok) {
+                if (rotated) ::close(target);
+                batch.clear();
+                durable = upTo;
+                if (rotated) {
+                    // 切换前已全部完成的旧分段可以直接删除
+                    auto it = std::prev(segments.end(), 2);
+                    retireIfDone(it);
+                }
+                if (failing && onError) onError("任务日志已恢复写入");
+                failing = false;
+            } else {
+                ++failures;
+                if (!failing && onError) {
+                    onError("任务日志写入失败: " + error + (truncated ? "，稍后重试" : "，且无法截去写了一半的记录"));
+                }
+                failing = true;
+                if (stopping) {
+                    if (rotated) ::close(target);
+                    durableCv.notify_all();
+                    break;
+                }
+            }
+            durableCv.notify_all();
+        }
+    }
+
+    // 读取一个分段，任务按序号记入 tasks，完成标记记入 done
+    void replaySegment(const std::string& path, std::map<uint64_t, std::string>& tasks,
+                       std::unordered_set<uint64_t>& done, Recovered& out) {
+        std::ifstream in(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const char* p = data.data();
+        const char* end = p + data.size();
+        while (end - p >= static_cast<ptrdiff_t>(sizeof(uint32_t) * 2 + 1)) {
+            uint32_t length;
+            std::memcpy(&length, p, sizeof(length));
+            if (length == 0 || static_cast<size_t>(end - p) < sizeof(length) + length + sizeof(uint32_t)) break;
+            const char* body = p + sizeof(length);
+            uint32_t sum;
+            std::memcpy(&sum, body + length, sizeof(sum));
+            if (sum != checksum(body, length)) break;
+            p = body + length + sizeof(sum);
+
+            uint8_t type = static_cast<uint8_t>(body[0]);
+            const char* q = body + 1;
+            const char* recordEnd = body + length;
+            uint64_t value;
+            if (!getVarint(q, recordEnd, value)) continue;
+            if (type == RECORD_TASK) {
+                tasks[value].assign(q, recordEnd);
+                nextSeq = std::max(nextSeq, value + 1);
+            } else if (type == RECORD_DONE) {
+                done.insert(value);
+            } else if (type == RECORD_OFFSET) {
+                out.offset = static_cast<int32_t>(value);
+            }
+        }
+    }
+
+public:
+    explicit TaskJournal(const std::string& path) : basePath(path) {}
+
+    ~TaskJournal() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        writerCv.notify_one();
+        if (writer.joinable()) writer.join();
+        if (fd >= 0) ::close(fd);
+    }
+
+    // 重放已有分段并开始新分段
+    bool open(Recovered& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t slash = basePath.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : basePath.substr(0, slash);
+        std::string prefix = (slash == std::string::npos ? basePath : basePath.substr(slash + 1)) + ".";
+
+        std::map<uint64_t, std::string> found; // 分段编号 -> 路径
+        if (DIR* d = ::opendir(dir.c_str())) {
+            while (struct dirent* entry = ::readdir(d)) {
+                std::string name = entry->d_name;
+                if (name.compare(0, prefix.size(), prefix) != 0) continue;
+                std::string suffix = name.substr(prefix.size());
+                if (suffix.empty() || suffix.find_first_not_of("0123456789") != std::string::npos) continue;
+                found.emplace(std::stoull(suffix), dir + "/" + name);
+            }
+            ::closedir(d);
+        }
+
+        std::map<uint64_t, std::string> tasks;
+        std::unordered_set<uint64_t> done;
+        for (const auto& segment : found) {
+            replaySegment(segment.second, tasks, done, out);
+            recoveredPaths.push_back(segment.second);
+            nextSegmentId = segment.first + 1;
+        }
+        for (auto& task : tasks) {
+            if (!done.count(task.first)) out.tasks.push_back(std::move(task.second));
+        }
+        lastOffset = out.offset;
+
+        if (!openSegment()) return false;
+        writer = std::thread(&TaskJournal::writerLoop, this);
+        return true;
+    }
+
+    // 写线程上报写入失败和恢复，open 之前设置
+    void setErrorHandler(std::function<void(const std::string&)> handler) { onError = std::move(handler); }
+
+    // 重放的任务已重新入队并提交后调用，删除上次运行的分段；提交失败时保留
+    void releaseRecovered() {
+        if (!commit()) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::string& path : recoveredPaths) {
+            ::unlink(path.c_str());
+        }
+        recoveredPaths.clear();
+    }
+
+    // 追加一个已编码的任务，返回序号
+    uint64_t append(const std::string& task) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t seq = nextSeq++;
+        std::string payload;
+        payload.reserve(task.size() + 10);
+        putVarint(payload, seq);
+        payload.append(task);
+        appendRecord(RECORD_TASK, payload);
+        ++std::prev(segments.end())->second.outstanding;
+        return seq;
+    }
+
+    void complete(uint64_t seq) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string payload;
+        putVarint(payload, seq);
+        appendRecord(RECORD_DONE, payload);
+
+        auto it = segments.upper_bound(seq);
+        if (it == segments.begin()) return;
+        --it;
+        --it->second.outstanding;
+        retireIfDone(it);
+    }
+
+    void recordOffset(int32_t offset) {
+        std::lock_guard<std::mutex> lock(mutex);
+        lastOffset = offset;
+        appendRecord(RECORD_OFFSET, offsetPayload());
+    }
+
+    // 等待此前追加的记录全部落盘；写入失败时返回 false（记录仍在内存中，写线程会重试）
+    bool commit() {
+        std::unique_lock<std::mutex> lock(mutex);
+        uint64_t target = appended;
+        if (durable >= target) return true;
+        uint64_t seenFailures = failures;
+        commitWaiting = true;
+        writerCv.notify_one();
+        durableCv.wait(lock, [this, target, seenFailures] { return durable >= target || failures != seenFailures; });
+        return durable >= target;
+    }
+
+    size_t segmentCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return segments.size();
+    }
+};
+
+// 会话历史：转交给管理员的用户消息和管理员的回复追加到分段文件（HISTORY_FILE.<编号>），
+// 记录格式 [u32 长度][载荷][u32 校验和]，载荷为 varint 用户 ID、varint 时间、u8 方向、文本。
+// 内存中只保存索引：消息号 -> 文件位置、每个用户最近 perUser 条消息号的环形缓冲区，
+// 以及文本的倒排索引（词 -> 递增消息号，按块差值 varint 编码，每块首个消息号单独保存以便跳跃查找）。
+// 拉丁字母和数字按词小写索引；汉字、假名、谚文没有空格分词，按单字和相邻两字索引。
+// 查询取各词倒排表的交集，从最新的消息向前逐条读出原文，确认包含全部关键词后返回。
+// 追加只把记录放进待写列表；后台线程批量写文件、分词并更新索引，转发路径不做分词和磁盘 I/O。
+// 总大小超过 maxBytes 时删除最早的分段，并从倒排表和每用户的环形缓冲区中清除其中的消息。
+class MessageHistory {
+public:
+    enum Direction : uint8_t { FROM_USER = 0, FROM_ADMIN = 1 };
+
+    struct Entry {
+        int64_t userId = 0;
+        int64_t time = 0; // Unix 秒
+        Direction direction = FROM_USER;
+        std::string text;
+    };
+
+private:
+    enum : uint64_t { SEGMENT_BYTES = 64 << 20 };
+    enum { FLUSH_INTERVAL_MS = 50 };
+    enum { FLUSH_BATCH = 256 };
+    enum { MAX_TEXT_BYTES = 4096 };
+    enum { MAX_TERM_BYTES = 32 };
+    enum { POSTING_BLOCK = 128 };
+    enum { MAX_VERIFY = 4096 }; // 单次查询最多读出确认的候选消息数
+    enum { OFFSET_BITS = 40 };
+
+    struct Posting {
+        std::string deltas; // 块内除首个外各消息号与前一个的差值
+        std::vector<std::pair<uint32_t, uint32_t>> blocks; // 每块首个消息号和它在 deltas 中的起点
+        uint32_t last = 0;
+        uint32_t count = 0;
+
+        void add(uint32_t id) {
+            if (count % POSTING_BLOCK == 0) {
+                blocks.emplace_back(id, static_cast<uint32_t>(deltas.size()));
+            } else {
+                putVarint(deltas, id - last);
+            }
+            last = id;
+            ++count;
+        }
+
+        void decodeBlock(size_t block, std::vector<uint32_t>& out) const {
+            out.clear();
+            uint32_t id = blocks[block].first;
+            out.push_back(id);
+            const char* p = deltas.data() + blocks[block].second;
+            const char* end = deltas.data() + (block + 1 < blocks.size() ? blocks[block + 1].second : deltas.size());
+            uint64_t delta;
+            while (p < end && getVarint(p, end, delta)) {
+                id += static_cast<uint32_t>(delta);
+                out.push_back(id);
+            }
+        }
+    };
+
+    // 按消息号递减顺序探测倒排表，缓存最近解码的块
+    struct Cursor {
+        const Posting* posting;
+        size_t block = static_cast<size_t>(-1);
+        std::vector<uint32_t> ids;
+
+        bool contains(uint32_t id) {
+            auto it = std::upper_bound(posting->blocks.begin(), posting->blocks.end(), id,
+                                       [](uint32_t v, const std::pair<uint32_t, uint32_t>& b) { return v < b.first; });
+            if (it == posting->blocks.begin()) return false;
+            size_t b = static_cast<size_t>(it - posting->blocks.begin()) - 1;
+            if (b != block) {
+                posting->decodeBlock(b, ids);
+                block = b;
+            }
+            return std::binary_search(ids.begin(), ids.end(), id);
+        }
+    };
+
+    // 每个用户最近的消息号：未满时追加，满后从 next 处覆盖
+    struct Ring {
+        std::vector<uint32_t> ids;
+        size_t next = 0;
+    };
+
+    struct Segment {
+        std::string path;
+        int readFd = -1;
+        uint64_t bytes = 0;
+        uint32_t firstMessage = 0;
+    };
+
+    std::string basePath;
+    size_t perUser;
+    uint64_t maxBytes;
+
+    // 待写记录，由 pendingMutex 保护
+    std::vector<Entry> pending;
+    bool stopping = false;
+    std::mutex pendingMutex;
+    std::condition_variable pendingCv;
+    std::thread writer;
+
+    // 以下只在写线程上修改；查询持 indexMutex 读取
+    std::mutex indexMutex;
+    std::map<uint64_t, Segment> segments; // 编号 -> 分段，最后一个是当前写入的分段
+    std::deque<uint64_t> positions; // 消息号 firstLive 起 -> (分段编号 << OFFSET_BITS) | 偏移
+    uint32_t firstLive = 0; // 更早的消息所在分段已删除
+    uint32_t nextMessage = 0;
+    uint64_t totalBytes = 0;
+    std::unordered_map<int64_t, Ring> rings;
+    std::unordered_map<std::string, Posting> terms;
+    int writeFd = -1; // 只由写线程访问
+    uint64_t nextSegmentId = 1;
+    std::map<uint64_t, std::string> existing; // 打开时已有的分段：编号 -> 路径，由写线程加载
+    std::atomic<bool> loaded{false};
+
+    static uint32_t checksum(const char* data, size_t size) {
+        uint32_t h = 2166136261u; // FNV-1a
+        for (size_t i = 0; i < size; ++i) {
+            h = (h ^ static_cast<unsigned char>(data[i])) * 16777619u;
+        }
+        return h;
+    }
+
+    // 解码一个 UTF-8 字符，返回码点；非法字节按单字节返回 0xFFFD
+    static uint32_t nextCodePoint(const std::string& s, size_t& i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        size_t n = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+        if (n == 0 || i + n > s.size()) {
+            ++i;
+            return 0xFFFD;
+        }
+        uint32_t cp = n == 1 ? c : c & (0xFF >> (n + 1));
+        for (size_t k = 1; k < n; ++k) {
+            cp = (cp << 6) | (static_cast<unsigned char>(s[i + k]) & 0x3F);
+        }
+        i += n;
+        return cp;
+    }
+
+    static void appendUtf8(std::string& out, uint32_t cp) {
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    // 全角字母数字转半角，ASCII 字母转小写
+    static uint32_t fold(uint32_t cp) {
+        if (cp >= 0xFF01 && cp <= 0xFF5E) cp -= 0xFEE0;
+        if (cp >= 'A' && cp <= 'Z') cp += 'a' - 'A';
+        return cp;
+    }
+
+    static bool isCjk(uint32_t cp) {
+        return (cp >= 0x3040 && cp <= 0x30FF) || (cp >= 0x3400 && cp <= 0x4DBF) || (cp >= 0x4E00 && cp <= 0x9FFF) ||
+               (cp >= 0xAC00 && cp <= 0xD7AF) || (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0x20000 && cp <= 0x2FFFF);
+    }
+
+    // 组成单词的字符：ASCII 字母数字，以及标点、符号和表情以外的其他文字（西里尔、拉丁扩展等）
+    static bool isWordChar(uint32_t cp) {
+        if (cp < 0x80) return std::isalnum(static_cast<int>(cp)) || cp == '_';
+        if (cp < 0xC0 || cp == 0xD7 || cp == 0xF7) return false;
+        if (cp >= 0x2000 && cp <= 0x2BFF) return false;  // 标点、符号、箭头、几何图形
+        if (cp >= 0x3000 && cp <= 0x303F) return false;  // CJK 标点
+        if (cp >= 0xFE00 && cp <= 0xFE6F) return false;  // 变体选择符、竖排和小写标点
+        if (cp >= 0xFF00 && cp <= 0xFFEF) return false;  // 全角标点（字母数字已在 fold 中转为 ASCII）
+        if (cp >= 0x1F000) return cp >= 0x20000 && cp <= 0x3FFFF; // 表情符号；扩展汉字区除外
+        return true;
+    }
+
+public:
+    // 把文本切分为索引词（去重）
+    static std::vector<std::string> tokenize(const std::string& text) {
+        std::vector<std::string> out;
+        std::string word;
+        std::string prevCjk;
+        auto endWord = [&out, &word] {
+            if (!word.empty() && word.size() <= MAX_TERM_BYTES) out.push_back(word);
+            word.clear();
+        };
+        for (size_t i = 0; i < text.size();) {
+            uint32_t cp = fold(nextCodePoint(text, i));
+            if (isCjk(cp)) {
+                endWord();
+                std::string current;
+                appendUtf8(current, cp);
+                out.push_back(current);
+                if (!prevCjk.empty()) out.push_back(prevCjk + current);
+                prevCjk.swap(current);
+            } else if (isWordChar(cp)) {
+                prevCjk.clear();
+                appendUtf8(word, cp);
+            } else {
+                prevCjk.clear();
+                endWord();
+            }
+        }
+        endWord();
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+        return out;
+    }
+
+    // 与 tokenize 相同的归一化（全角转半角、字母小写），用于确认原文包含关键词
+    static std::string normalize(const std::string& text) {
+        std::string out;
+        out.reserve(text.size());
+        for (size_t i = 0; i < text.size();) {
+            appendUtf8(out, fold(nextCodePoint(text, i)));
+        }
+        return out;
+    }
+
+    // 截断到 maxBytes 以内的完整 UTF-8 字符
+    static std::string clip(const std::string& text, size_t maxBytes) {
+        if (text.size() <= maxBytes) return text;
+        size_t end = maxBytes;
+        while (end > 0 && (static_cast<unsigned char>(text[end]) & 0xC0) == 0x80) --end;
+        return text.substr(0, end);
+    }
+
+private:
+    static void encode(const Entry& entry, std::string& out) {
+        size_t start = out.size();
+        out.append(sizeof(uint32_t), '\0');
+        putVarint(out, static_cast<uint64_t>(entry.userId));
+        putVarint(out, static_cast<uint64_t>(entry.time));
+        out.push_back(static_cast<char>(entry.direction));
+        out.append(entry.text);
+        uint32_t length = static_cast<uint32_t>(out.size() - start - sizeof(uint32_t));
+        std::memcpy(&out[start], &length, sizeof(length));
+        uint32_t sum = checksum(out.data() + start + sizeof(uint32_t), length);
+        out.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+    }
+
+    static bool decode(const char* p, size_t length, Entry& entry) {
+        const char* end = p + length;
+        uint64_t userId, time;
+        if (!getVarint(p, end, userId) || !getVarint(p, end, time) || p >= end) return false;
+        entry.userId = static_cast<int64_t>(userId);
+        entry.time = static_cast<int64_t>(time);
+        entry.direction = static_cast<Direction>(*p++);
+        entry.text.assign(p, end);
+        return true;
+    }
+
+    // 调用方持有 indexMutex
+    bool readEntry(uint32_t id, Entry& entry) const {
+        if (id < firstLive || id >= nextMessage) return false;
+        uint64_t position = positions[id - firstLive];
+        auto it = segments.find(position >> OFFSET_BITS);
+        if (it == segments.end() || it->second.readFd < 0) return false;
+        off_t offset = static_cast<off_t>(position & ((uint64_t(1) << OFFSET_BITS) - 1));
+
+        uint32_t length;
+        if (::pread(it->second.readFd, &length, sizeof(length), offset) != static_cast<ssize_t>(sizeof(length)) ||
+            length > MAX_TEXT_BYTES + 64) {
+            return false;
+        }
+        std::string record(length + sizeof(uint32_t), '\0');
+        if (::pread(it->second.readFd, &record[0], record.size(), offset + static_cast<off_t>(sizeof(length))) !=
+            static_cast<ssize_t>(record.size())) {
+            return false;
+        }
+        uint32_t sum;
+        std::memcpy(&sum, record.data() + length, sizeof(sum));
+        return sum == checksum(record.data(), length) && decode(record.data(), length, entry);
+    }
+
+    // 调用方持有 indexMutex
+    void indexEntry(const Entry& entry, uint64_t position, const std::vector<std::string>& words) {
+        uint32_t id = nextMessage++;
+        positions.push_back(position);
+        Ring& ring = rings[entry.userId];
+        if (ring.ids.size() < perUser) {
+            ring.ids.push_back(id);
+        } else {
+            ring.ids[ring.next] = id;
+            ring.next = (ring.next + 1) % ring.ids.size();
+        }
+        for (const std::string& word : words) {
+            terms[word].add(id);
+        }
+    }
+
+    bool openSegment() {
+        uint64_t id = nextSegmentId++;
+        Segment segment;
+        segment.path = basePath + "." + std::to_string(id);
+        int fd = ::open(segment.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        segment.readFd = ::open(segment.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (segment.readFd < 0) {
+            ::close(fd);
+            return false;
+        }
+        if (writeFd >= 0) ::close(writeFd);
+        writeFd = fd;
+        std::lock_guard<std::mutex> lock(indexMutex);
+        segment.firstMessage = nextMessage;
+        segments.emplace(id, segment);
+        return true;
+    }
+
+    // 调用方持有 indexMutex；总大小超限时删除最早的分段（至少保留当前分段）
+    void enforceRetention() {
+        bool removed = false;
+        while (totalBytes > maxBytes && segments.size() > 1) {
+            auto oldest = segments.begin();
+            uint32_t nextFirst = std::next(oldest)->second.firstMessage;
+            while (firstLive < nextFirst && !positions.empty()) {
+                positions.pop_front();
+                ++firstLive;
+            }
+            totalBytes -= oldest->second.bytes;
+            if (oldest->second.readFd >= 0) ::close(oldest->second.readFd);
+            ::unlink(oldest->second.path.c_str());
+            segments.erase(oldest);
+            removed = true;
+        }
+        if (removed) pruneIndex();
+    }
+
+    // 调用方持有 indexMutex；清除 firstLive 之前的消息号。每删除一个分段（SEGMENT_BYTES）才执行一次
+    void pruneIndex() {
+        for (auto it = rings.begin(); it != rings.end();) {
+            Ring& ring = it->second;
+            size_t n = ring.ids.size();
+            if (ring.ids[ring.next] >= firstLive) { // 最早的一条仍有效
+                ++it;
+                continue;
+            }
+            std::vector<uint32_t> live;
+            for (size_t k = 0; k < n; ++k) {
+                uint32_t id = ring.ids[(ring.next + k) % n];
+                if (id >= firstLive) live.push_back(id);
+            }
+            if (live.empty()) {
+                it = rings.erase(it);
+                continue;
+            }
+            ring.ids.swap(live); // 从旧到新排列，未满
+            ring.next = 0;
+            ++it;
+        }
+
+        // 整块都早于 firstLive 的块（下一块的首个消息号不大于 firstLive）删除；部分过期的块留给查询时跳过
+        for (auto it = terms.begin(); it != terms.end();) {
+            Posting& posting = it->second;
+            if (posting.last < firstLive) {
+                it = terms.erase(it);
+                continue;
+            }
+            size_t drop = 0;
+            while (drop + 1 < posting.blocks.size() && posting.blocks[drop + 1].first <= firstLive) {
+                ++drop;
+            }
+            if (drop > 0) {
+                // 除最后一块外每块都是满的，删除后 count 仍按 POSTING_BLOCK 对齐
+                uint32_t start = posting.blocks[drop].second;
+                posting.deltas.erase(0, start);
+                posting.blocks.erase(posting.blocks.begin(), posting.blocks.begin() + drop);
+                for (auto& block : posting.blocks) {
+                    block.second -= start;
+                }
+                posting.count -= static_cast<uint32_t>(drop * POSTING_BLOCK);
+            }
+            ++it;
+        }
+    }
+
+    // 调用方持有 indexMutex；把 load 在锁外解码、分词的一批记录加入索引
+    void indexLoaded(std::vector<Entry>& batch, std::vector<uint64_t>& offsets,
+                     std::vector<std::vector<std::string>>& words) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            indexEntry(batch[i], offsets[i], words[i]);
+        }
+        batch.clear();
+        offsets.clear();
+        words.clear();
+    }
+
+    // 重建已有分段的索引，新写入的分段排在它们之后。与 writeBatch 相同，解码和分词在锁外进行，
+    // 每 FLUSH_BATCH 条持锁加入索引一次，重建期间查询和 /history 不会被长时间阻塞
+    void load() {
+        std::map<uint64_t, Segment> current;
+        {
+            std::lock_guard<std::mutex> lock(indexMutex);
+            current.swap(segments);
+        }
+        std::vector<Entry> batch;
+        std::vector<uint64_t> offsets;
+        std::vector<std::vector<std::string>> words;
+        for (const auto& file : existing) {
+            std::ifstream in(file.second, std::ios::binary);
+            std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (data.empty()) {
+                ::unlink(file.second.c_str()); // 上次运行未写入任何消息的分段
+                continue;
+            }
+            Segment segment;
+            segment.path = file.second;
+            segment.readFd = ::open(file.second.c_str(), O_RDONLY | O_CLOEXEC);
+            segment.bytes = data.size();
+            if (segment.readFd < 0) continue;
+            {
+                std::lock_guard<std::mutex> lock(indexMutex);
+                segment.firstMessage = nextMessage;
+                totalBytes += segment.bytes;
+                segments.emplace(file.first, segment);
+            }
+
+            const char* p = data.data();
+            const char* end = p + data.size();
+            while (end - p >= static_cast<ptrdiff_t>(sizeof(uint32_t) * 2)) {
+                uint32_t length;
+                std::memcpy(&length, p, sizeof(length));
+                if (static_cast<size_t>(end - p) < sizeof(length) + length + sizeof(uint32_t)) break;
+                const char* body = p + sizeof(length);
+                uint32_t sum;
+                std::memcpy(&sum, body + length, sizeof(sum));
+                Entry entry;
+                if (sum != checksum(body, length) || !decode(body, length, entry)) break; // 写了一半的尾部
+                offsets.push_back((file.first << OFFSET_BITS) | static_cast<uint64_t>(p - data.data()));
+                words.push_back(tokenize(entry.text));
+                batch.push_back(std::move(entry));
+                p = body + length + sizeof(sum);
+                if (batch.size() >= FLUSH_BATCH) {
+                    std::lock_guard<std::mutex> lock(indexMutex);
+                    indexLoaded(batch, offsets, words);
+                }
+            }
+            std::lock_guard<std::mutex> lock(indexMutex);
+            indexLoaded(batch, offsets, words);
+        }
+        existing.clear();
+
+        // 加载期间新消息暂存在待写列表中，写入的分段此时还是空的
+        std::lock_guard<std::mutex> lock(indexMutex);
+        for (auto& segment : current) {
+            segment.second.firstMessage = nextMessage;
+            segments.insert(segment);
+        }
+        enforceRetention();
+    }
+
+    // 写入 [first, last) 并更新索引；每批不超过 FLUSH_BATCH 条，索引锁不会被长时间占用
+    void writeBatch(std::vector<Entry>::const_iterator first, std::vector<Entry>::const_iterator last) {
+        std::string data;
+        std::vector<uint64_t> offsets;
+        std::vector<std::vector<std::string>> words;
+        uint64_t segmentId = std::prev(segments.end())->first;
+        uint64_t base = std::prev(segments.end())->second.bytes;
+        for (auto it = first; it != last; ++it) {
+            const Entry& entry = *it;
+            offsets.push_back(base + data.size());
+            encode(entry, data);
+            words.push_back(tokenize(entry.text));
+        }
+
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = ::write(writeFd, data.data() + written, data.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "会话历史写入失败: " << std::strerror(errno) << std::endl;
+                return;
+            }
+            written += static_cast<size_t>(n);
+        }
+
+        bool rotate;
+        {
+            std::lock_guard<std::mutex> lock(indexMutex);
+            for (size_t i = 0; i < offsets.size(); ++i) {
+                indexEntry(first[i], (segmentId << OFFSET_BITS) | offsets[i], words[i]);
+            }
+            Segment& current = std::prev(segments.end())->second;
+            current.bytes += data.size();
+            totalBytes += data.size();
+            rotate = current.bytes >= SEGMENT_BYTES;
+            enforceRetention();
+        }
+        if (rotate && !openSegment()) {
+            std::cerr << "无法创建会话历史分段: " << std::strerror(errno) << std::endl;
+        }
+    }
+
+    void writerLoop() {
+        load();
+        loaded = true;
+        std::vector<Entry> batch;
+        std::unique_lock<std::mutex> lock(pendingMutex);
+        while (true) {
+            pendingCv.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS),
+                               [this] { return stopping || pending.size() >= FLUSH_BATCH; });
+            if (pending.empty()) {
+                if (stopping) break;
+                continue;
+            }
+            batch.swap(pending);
+            lock.unlock();
+            for (size_t i = 0; i < batch.size(); i += FLUSH_BATCH) {
+                writeBatch(batch.begin() + i, batch.begin() + std::min(batch.size(), i + FLUSH_BATCH));
+            }
+            batch.clear();
+            lock.lock();
+        }
+    }
+
+public:
+    MessageHistory(const std::string& path, size_t perUserLimit, uint64_t maxTotalBytes)
+        : basePath(path), perUser(std::max<size_t>(1, perUserLimit)), maxBytes(maxTotalBytes) {}
+
+    ~MessageHistory() {
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            stopping = true;
+        }
+        pendingCv.notify_one();
+        if (writer.joinable()) writer.join();
+        if (writeFd >= 0) ::close(writeFd);
+        for (auto& segment : segments) {
+            if (segment.second.readFd >= 0) ::close(segment.second.readFd);
+        }
+    }
+
+    MessageHistory(const MessageHistory&) = delete;
+    MessageHistory& operator=(const MessageHistory&) = delete;
+
+    // 创建新分段并在后台重建已有分段的索引（重建期间查询只能看到已加载的部分）
+    bool open() {
+        size_t slash = basePath.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : basePath.substr(0, slash);
+        std::string prefix = (slash == std::string::npos ? basePath : basePath.substr(slash + 1)) + ".";
+        if (DIR* d = ::opendir(dir.c_str())) {
+            while (struct dirent* entry = ::readdir(d)) {
+                std::string name = entry->d_name;
+                if (name.compare(0, prefix.size(), prefix) != 0) continue;
+                std::string suffix = name.substr(prefix.size());
+                if (suffix.empty() || suffix.find_first_not_of("0123456789") != std::string::npos) continue;
+                existing.emplace(std::stoull(suffix), dir + "/" + name);
+            }
+            ::closedir(d);
+        }
+        if (!existing.empty()) {
+            nextSegmentId = std::prev(existing.end())->first + 1;
+        }
+        if (!openSegment()) return false;
+        writer = std::thread(&MessageHistory::writerLoop, this);
+        return true;
+    }
+
+    void append(int64_t userId, Direction direction, const std::string& text) {
+        Entry entry;
+        entry.userId = userId;
+        entry.time = static_cast<int64_t>(std::time(nullptr));
+        entry.direction = direction;
+        entry.text = clip(text, MAX_TEXT_BYTES);
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending.push_back(std::move(entry));
+        if (pending.size() >= FLUSH_BATCH) pendingCv.notify_one();
+    }
+
+    // 用户最近的 limit 条消息，从新到旧
+    std::vector<Entry> recent(int64_t userId, size_t limit) {
+        std::vector<Entry> out;
+        std::lock_guard<std::mutex> lock(indexMutex);
+        auto it = rings.find(userId);
+        if (it == rings.end()) return out;
+        const Ring& ring = it->second;
+        size_t n = ring.ids.size();
+        for (size_t k = 0; k < n && out.size() < limit; ++k) {
+            // 未满时 next 为 0，最新的在末尾；满后最新的在 next 之前
+            uint32_t id = ring.ids[(ring.next + n - 1 - k) % n];
+            Entry entry;
+            if (readEntry(id, entry)) out.push_back(std::move(entry));
+        }
+        return out;
+    }
+
+    // 包含全部关键词（空白分隔）的消息，从新到旧最多 limit 条；userId 非 0 时只查该用户
+    std::vector<Entry> search(const std::string& query, size_t limit, int64_t userId = 0) {
+        std::vector<Entry> out;
+        std::vector<std::string> keywords;
+        std::istringstream in(normalize(query));
+        std::string keyword;
+        while (in >> keyword) {
+            keywords.push_back(keyword);
+        }
+        std::vector<std::string> words = tokenize(query);
+        if (words.empty()) return out;
+
+        std::lock_guard<std::mutex> lock(indexMutex);
+        std::vector<Cursor> cursors;
+        for (const std::string& word : words) {
+            auto it = terms.find(word);
+            if (it == terms.end()) return out;
+            Cursor cursor;
+            cursor.posting = &it->second;
+            cursors.push_back(std::move(cursor));
+        }
+        std::sort(cursors.begin(), cursors.end(),
+                  [](const Cursor& a, const Cursor& b) { return a.posting->count < b.posting->count; });
+
+        // 从最短的倒排表的最新一块往前，逐个在其他表中确认
+        const Posting& shortest = *cursors.front().posting;
+        std::vector<uint32_t> block;
+        size_t verified = 0;
+        for (size_t b = shortest.blocks.size(); b-- > 0 && out.size() < limit && verified < MAX_VERIFY;) {
+            shortest.decodeBlock(b, block);
+            for (auto id = block.rbegin(); id != block.rend() && out.size() < limit && verified < MAX_VERIFY; ++id) {
+                if (*id < firstLive) return out;
+                bool all = true;
+                for (size_t k = 1; k < cursors.size() && all; ++k) {
+                    all = cursors[k].contains(*id);
+                }
+                if (!all) continue;
+
+                Entry entry;
+                ++verified;
+                if (!readEntry(*id, entry) || (userId != 0 && entry.userId != userId)) continue;
+                std::string text = normalize(entry.text);
+                bool matched = true;
+                for (const std::string& k : keywords) {
+                    if (text.find(k) == std::string::npos) {
+                        matched = false;
+                        break;
+                    }
+                }
+                if (matched) out.push_back(std::move(entry));
+            }
+        }
+        return out;
+    }
+
+    bool isLoaded() const { return loaded.load(); }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        return nextMessage - firstLive;
+    }
+
+    struct Stats {
+        size_t terms = 0;        // 倒排表中的词数
+        uint64_t postings = 0;   // 各倒排表中的消息号合计
+        uint64_t postingBytes = 0;
+        size_t users = 0;        // 有环形缓冲区的用户数
+    };
+
+    Stats stats() {
+        Stats stats;
+        std::lock_guard<std::mutex> lock(indexMutex);
+        stats.terms = terms.size();
+        for (const auto& term : terms) {
+            stats.postings += term.second.count;
+            stats.postingBytes += term.second.deltas.size() + term.second.blocks.size() * sizeof(term.second.blocks[0]);
+        }
+        stats.users = rings.size();
+        return stats;
+    }
+};
+
+// 入口更新录制：把收到的消息和回调按到达时间写成紧凑的二进制轨迹，供 bench/trace_replay 回放。
+// 不保存文本和真实 ID：用户、相册按首次出现的顺序编号，管理员记为管理员池中的序号，
+// 文本只记长度，命令只记命令名，回调只记动作前缀。
+// 文件以 "TGTRACE1" 开头，之后每条记录为
+// [varint 距上一条的微秒数][u8 类型][u8 标志][varint 用户][varint 文本长度][u8 媒体][varint 相册][varint 名称长度][名称]
+class UpdateRecorder {
+public:
+    enum Kind { TEXT = 1, COMMAND = 2, MEDIA = 3, CALLBACK = 4 };
+    enum Flag { ADMIN = 1, REPLY = 2 };
+    enum Media { NO_MEDIA, PHOTO, VIDEO, DOCUMENT, AUDIO, VOICE, STICKER, ANIMATION, VIDEO_NOTE, OTHER_MEDIA };
+
+private:
+    enum { FLUSH_BYTES = 64 * 1024, MAX_ALBUMS = 65536 };
+
+    std::string path;
+    uint64_t maxBytes;
+    int fd = -1;
+
+    std::mutex mutex;
+    std::string buffer;
+    uint64_t written = 0;
+    bool full = false;
+    std::chrono::steady_clock::time_point last;
+    std::unordered_map<int64_t, uint64_t> users;
+    std::unordered_map<std::string, uint64_t> albums;
+    uint64_t nextAlbum = 1;
+
+    static bool writeFully(int fd, const std::string& data) {
+        size_t offset = 0;
+        while (offset < data.size()) {
+            ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            offset += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // 调用方持有 mutex
+    void flushLocked() {
+        if (buffer.empty() || fd < 0) return;
+        if (!writeFully(fd, buffer)) full = true;
+        written += buffer.size();
+        buffer.clear();
+    }
+
+public:
+    UpdateRecorder(const std::string& file, uint64_t maxTotalBytes) : path(file), maxBytes(maxTotalBytes) {}
+
+    ~UpdateRecorder() {
+        std::lock_guard<std::mutex> lock(mutex);
+        flushLocked();
+        if (fd >= 0) ::close(fd);
+    }
+
+    UpdateRecorder(const UpdateRecorder&) = delete;
+    UpdateRecorder& operator=(const UpdateRecorder&) = delete;
+
+    // 覆盖已有文件，每次启动录制一段新轨迹
+    bool open() {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        buffer = "TGTRACE1";
+        last = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    // user 为管理员池序号（带 ADMIN 标志时）或真实用户 ID；albumId 为空表示不属于相册
+    void record(Kind kind, uint8_t flags, int64_t user, size_t textLength, Media media,
+                const std::string& albumId, const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (full) return;
+        size_t mark = buffer.size();
+        auto now = std::chrono::steady_clock::now();
+        putVarint(buffer, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - last).count()));
+        last = now;
+        buffer.push_back(static_cast<char>(kind));
+        buffer.push_back(static_cast<char>(flags));
+        if (flags & ADMIN) {
+            putVarint(buffer, static_cast<uint64_t>(user));
+        } else {
+            putVarint(buffer, users.emplace(user, users.size() + 1).first->second);
+        }
+        putVarint(buffer, textLength);
+        buffer.push_back(static_cast<char>(media));
+        uint64_t album = 0;
+        if (!albumId.empty()) {
+            // 相册只在几秒内陆续到达，旧的编号可以丢弃；新编号继续递增，不会与旧的混淆
+            if (albums.size() >= MAX_ALBUMS) albums.clear();
+            auto inserted = albums.emplace(albumId, nextAlbum);
+            if (inserted.second) ++nextAlbum;
+            album = inserted.first->second;
+        }
+        putVarint(buffer, album);
+        putVarint(buffer, name.size());
+        buffer += name;
+
+        if (written + buffer.size() > maxBytes) {
+            buffer.resize(mark); // 超出上限的这条不写入，之前缓冲的在下次 flush 时写出
+            full = true;
+            return;
+        }
+        if (buffer.size() >= FLUSH_BYTES) flushLocked();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        flushLocked();
+    }
+
+    // 达到大小上限（或写入失败）后不再录制
+    bool stopped() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return full;
+    }
+
+    static Media mediaOf(const TgBot::Message::Ptr& message) {
+        if (!message->photo.empty()) return PHOTO;
+        if (message->video) return VIDEO;
+        if (message->document) return DOCUMENT;
+        if (message->audio) return AUDIO;
+        if (message->animation) return ANIMATION;
+        if (message->voice) return VOICE;
+        if (message->sticker) return STICKER;
+        if (message->videoNote) return VIDEO_NOTE;
+        return OTHER_MEDIA;
+    }
+};
+
+// 运行指标：计数器和直方图按线程分片，每个线程只写自己的分片（relaxed 读改写，无锁无竞争），
+// 抓取时汇总所有分片输出 Prometheus 文本格式。指标须在启动阶段注册，注册后 ID 固定。
+class Metrics {
+public:
+    typedef size_t Id;
+    typedef std::function<double()> Sampler;
+
+    enum { MAX_COUNTERS = 256, MAX_HISTOGRAMS = 96, BUCKETS = 16 };
+
+private:
+    // 直方图桶上界（秒），最后一个桶为 +Inf
+    static const double* bounds() {
+        static const double b[BUCKETS - 1] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25,
+                                              0.5, 1, 2.5, 5, 10, 30, 60};
+        return b;
+    }
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[BUCKETS];
+        std::atomic<uint64_t> sumNanos;
+    };
+
+    struct Slot {
+        std::atomic<uint64_t> counters[MAX_COUNTERS];
+        Histogram histograms[MAX_HISTOGRAMS];
+        std::atomic<bool> exited{false}; // 所属线程已退出：下次有线程注册或抓取时并入 retired 后释放
+
+        Slot() {
+            for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+            for (auto& h : histograms) {
+                for (auto& b : h.buckets) b.store(0, std::memory_order_relaxed);
+                h.sumNanos.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // 线程当前使用的分片。线程退出或改用另一个 Metrics 时把分片标记为已退出；
+    // 分片由线程和 Metrics 共同持有，两者谁先结束都不会访问已释放的对象
+    struct Registration {
+        uint64_t owner = 0;
+        std::shared_ptr<Slot> slot;
+
+        void release() {
+            if (slot) slot->exited.store(true, std::memory_order_release);
+        }
+        ~Registration() { release(); }
+    };
+
+    struct Series {
+        std::string labels; // 形如 method="sendMessage"，可为空
+        Id id;
+        Sampler sampler;
+    };
+
+    struct Family {
+        std::string name;
+        std::string type; // counter / gauge / histogram
+        std::string help;
+        std::vector<Series> series;
+    };
+
+    const uint64_t instance;
+    mutable std::mutex registryMutex; // 保护注册表、分片列表和 retired，只在注册、首次写入和抓取时使用
+    std::vector<Family> families;
+    // 抓取时也会并入已退出线程的分片，因此可在 const 的 render() 中修改
+    mutable std::vector<std::shared_ptr<Slot>> slots;
+    mutable Slot retired; // 已退出线程的计数合计
+    size_t counterCount = 0;
+    size_t histogramCount = 0;
+
+    static uint64_t nextInstance() {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    // 当前线程的分片，首次写入时创建；线程退出后计数并入 retired，不会回退
+    Slot& local() {
+        static thread_local Registration registration;
+        if (registration.owner != instance) {
+            registration.release();
+            std::shared_ptr<Slot> slot = std::make_shared<Slot>();
+            std::lock_guard<std::mutex> lock(registryMutex);
+            retireExited();
+            slots.push_back(slot);
+            registration.owner = instance;
+            registration.slot = std::move(slot);
+        }
+        return *registration.slot;
+    }
+
+    static void bump(std::atomic<uint64_t>& cell, uint64_t n) {
+        cell.store(cell.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // 把已退出线程的分片并入 retired 后移除，调用方持有 registryMutex。
+    // 线程退出前的写入先于 exited 标记，读到标记后分片不会再变
+    void retireExited() const {
+        for (size_t i = 0; i < slots.size();) {
+            const Slot& slot = *slots[i];
+            if (!slot.exited.load(std::memory_order_acquire)) {
+                ++i;
+                continue;
+            }
+            for (size_t c = 0; c < counterCount; ++c) {
+                bump(retired.counters[c], slot.counters[c].load(std::memory_order_relaxed));
+            }
+            for (size_t h = 0; h < histogramCount; ++h) {
+                for (size_t b = 0; b < BUCKETS; ++b) {
+                    bump(retired.histograms[h].buckets[b], slot.histograms[h].buckets[b].load(std::memory_order_relaxed));
+                }
+                bump(retired.histograms[h].sumNanos, slot.histograms[h].sumNanos.load(std::memory_order_relaxed));
+            }
+            slots[i] = std::move(slots.back());
+            slots.pop_back();
+        }
+    }
+
+    Family& family(const std::string& name, const std::string& type, const std::string& help) {
+        for (auto& f : families) {
+            if (f.name == name) return f;
+        }
+        Family f;
+        f.name = name;
+        f.type = type;
+        f.help = help;
+        families.push_back(f);
+        return families.back();
+    }
+
+    static std::string formatValue(double value) {
+        std::ostringstream out;
+        out.precision(12);
+        out << value;
+        return out.str();
+    }
+
+    static std::string seriesName(const std::string& name, const std::string& labels, const std::string& extra = "") {
+        if (labels.empty() && extra.empty()) return name;
+        std::string result = name + "{" + labels;
+        if (!labels.empty() && !extra.empty()) result += ",";
+        return result + extra + "}";
+    }
+
+public:
+    Metrics() : instance(nextInstance()) {}
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    Id counter(const std::string& name, const std::string& labels, const std::string& help) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if (counterCount >= MAX_COUNTERS) throw std::runtime_error("计数器数量超出上限: " + name);
+        Series s;
+        s.labels = labels;
+        s.id = counterCount++;
+        family(name, "counter", help).series.push_back(s);
+        return s.id;
+    }
+
+    Id histogram(const std::string& name, const std::string& labels, const std::string& help) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if (histogramCount >= MAX_HISTOGRAMS) throw std::runtime_error("直方图数量超出上限: " + name);
+        Series s;
+        s.labels = labels;
+        s.id = histogramCount++;
+        family(name, "histogram", help).series.push_back(s);
+        return s.id;
+    }
+
+    // 抓取时采样的指标（队列深度、连接池统计等已由其他组件维护的值）
+    void sample(const std::string& name, const std::string& type, const std::string& help, Sampler sampler) {
+        sample(name, type, "", help, std::move(sampler));
+    }
+
+    void sample(const std::string& name, const std::string& type, const std::string& labels, const std::string& help,
+                Sampler sampler) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        Series s;
+        s.labels = labels;
+        s.id = 0;
+        s.sampler = std::move(sampler);
+        family(name, type, help).series.push_back(s);
+    }
+
+    void add(Id id, uint64_t n = 1) {
+        bump(local().counters[id], n);
+    }
+
+    void observe(Id id, std::chrono::steady_clock::duration elapsed) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        const double* b = bounds();
+        size_t bucket = std::lower_bound(b, b + BUCKETS - 1, seconds) - b;
+        Histogram& h = local().histograms[id];
+        bump(h.buckets[bucket], 1);
+        bump(h.sumNanos, static_cast<uint64_t>(std::max<int64_t>(0,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())));
+    }
+
+    // 计时器：析构时把经过的时间记入直方图
+    class Timer {
+        Metrics& metrics;
+        Id id;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        Timer(Metrics& m, Id histogramId) : metrics(m), id(histogramId), start(std::chrono::steady_clock::now()) {}
+        ~Timer() { metrics.observe(id, std::chrono::steady_clock::now() - start); }
+    };
+
+    // 仍在使用的线程分片数（已退出线程的分片在此并入合计）
+    size_t threadSlots() const {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        retireExited();
+        return slots.size();
+    }
+
+    // Prometheus 文本格式
+    std::string render() const {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        retireExited();
+        std::ostringstream out;
+        for (const auto& f : families) {
+            out << "# HELP " << f.name << " " << f.help << "\n";
+            out << "# TYPE " << f.name << " " << f.type << "\n";
+            for (const auto& s : f.series) {
+                if (s.sampler) {
+                    out << seriesName(f.name, s.labels) << " " << formatValue(s.sampler()) << "\n";
+                } else if (f.type == "histogram") {
+                    uint64_t buckets[BUCKETS];
+                    for (size_t i = 0; i < BUCKETS; ++i) {
+                        buckets[i] = retired.histograms[s.id].buckets[i].load(std::memory_order_relaxed);
+                    }
+                    uint64_t sumNanos = retired.histograms[s.id].sumNanos.load(std::memory_order_relaxed);
+                    for (const auto& slot : slots) {
+                        const Histogram& h = slot->histograms[s.id];
+                        for (size_t i = 0; i < BUCKETS; ++i) {
+                            buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+                        }
+                        sumNanos += h.sumNanos.load(std::memory_order_relaxed);
+                    }
+                    uint64_t cumulative = 0;
+                    for (size_t i = 0; i < BUCKETS; ++i) {
+                        cumulative += buckets[i];
+                        std::string le = i + 1 < BUCKETS ? formatValue(bounds()[i]) : "+Inf";
+                        out << seriesName(f.name + "_bucket", s.labels, "le=\"" + le + "\"") << " " << cumulative << "\n";
+                    }
+                    out << seriesName(f.name + "_sum", s.labels) << " " << formatValue(sumNanos / 1e9) << "\n";
+                    out << seriesName(f.name + "_count", s.labels) << " " << cumulative << "\n";
+                } else {
+                    uint64_t total = retired.counters[s.id].load(std::memory_order_relaxed);
+                    for (const auto& slot : slots) {
+                        total += slot->counters[s.id].load(std::memory_order_relaxed);
+                    }
+                    out << seriesName(f.name, s.labels) << " " << total << "\n";
+                }
+            }
+        }
+        return out.str();
+    }
+};
+
+// 单条消息的延迟追踪：按 TRACE_SAMPLE_RATE 抽样，被抽中的任务从收到更新到处理完成的各阶段
+// （到达入队前的等待、写任务日志、排队、每次 Bot API 调用和限速等待、回复路由读写、整个任务）各记一个 span。
+// 当前线程正在处理的追踪保存在线程局部变量中，下层的 HTTP 客户端据此记录，未抽中时只多一次判断。
+// span 写入各线程自己的缓冲区，由定时线程每秒收集写入 TRACE_SPANS_FILE，线程退出后其缓冲区在下次收集时移除：
+// chrome 格式可直接用 chrome://tracing 或 Perfetto 打开（每条消息一行）；
+// binary 格式为 "TGSPANS1" 之后每条 [varint 追踪][varint 开始微秒][varint 时长微秒][varint 线程][varint 用户][varint 名称长度][名称]，
+// 用 bench/span_dump 查看或转换
+class SpanTracer {
+public:
+    enum Format { CHROME, BINARY };
+
+    struct Context {
+        SpanTracer* tracer;
+        uint64_t trace;
+    };
+
+    // 作用域内把当前线程标记为处理某条追踪，trace 为 0 时标记为不追踪
+    class Scope {
+    private:
+        Context saved;
+
+    public:
+        Scope(SpanTracer* tracer, uint64_t trace) : saved(context()) {
+            context() = Context{trace != 0 ? tracer : nullptr, trace};
+        }
+        ~Scope() { context() = saved; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // 计时当前线程所处追踪中的一个 span，析构时记录
+    class Timer {
+    private:
+        Context current;
+        const char* name;
+        int64_t user;
+        int64_t start;
+
+    public:
+        explicit Timer(const char* spanName, int64_t userId = 0)
+            : current(context()), name(spanName), user(userId), start(current.tracer ? nowMicros() : 0) {}
+        ~Timer() {
+            if (current.tracer) current.tracer->record(current.trace, name, start, nowMicros() - start, user);
+        }
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+    };
+
+    static Context& context() {
+        static thread_local Context current = {nullptr, 0};
+        return current;
+    }
+
+    // 墙上时间（微秒），与 Telegram 消息的 date 可比
+    static int64_t nowMicros() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static int64_t wallMicros(std::chrono::steady_clock::time_point at) {
+        return nowMicros() - std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - at).count();
+    }
+
+private:
+    struct Span {
+        uint64_t trace;
+        std::string name;
+        int64_t start;
+        int64_t duration;
+        int64_t user;
+        uint32_t thread;
+    };
+
+    struct Buffer {
+        std::mutex mutex; // 只与收集线程竞争
+        std::vector<Span> spans;
+        uint32_t thread;
+        bool exited = false; // 线程已退出：收集完剩余的 span 后从列表中移除（由 mutex 保护）
+    };
+
+    // 线程当前使用的缓冲区。线程退出或改用另一个追踪器时把缓冲区标记为已退出；
+    // 缓冲区由线程和追踪器共同持有，两者谁先结束都不会访问已释放的对象
+    struct Registration {
+        uint64_t owner = 0;
+        std::shared_ptr<Buffer> buffer;
+
+        void release() {
+            if (!buffer) return;
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            buffer->exited = true;
+        }
+        ~Registration() { release(); }
+    };
+
+    enum { MAX_BUFFERED = 65536 }; // 每个线程缓冲的 span 上限，超出丢弃
+
+    const uint64_t instance;
+    std::string path;
+    Format format;
+    int fd = -1;
+    bool first = true;
+    std::atomic<double> sampleRate;
+    std::atomic<uint64_t> nextTrace{0};
+    std::atomic<uint64_t> dropped{0};
+    std::mutex registryMutex; // 保护缓冲区列表，只在线程首次记录和收集时使用
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    uint32_t nextThread = 1;
+    std::mutex fileMutex;
+
+    static uint64_t nextInstance() {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    Buffer& local() {
+        static thread_local Registration registration;
+        if (registration.owner != instance) {
+            registration.release();
+            std::shared_ptr<Buffer> buffer = std::make_shared<Buffer>();
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffer->thread = nextThread++;
+            buffers.push_back(buffer);
+            registration.owner = instance;
+            registration.buffer = std::move(buffer);
+        }
+        return *registration.buffer;
+    }
+
+    static bool writeFully(int fd, const std::string& data) {
+        size_t offset = 0;
+        while (offset < data.size()) {
+            ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            offset += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // chrome 格式中每条追踪一行（tid 为追踪编号），根 span 带上用户并给该行命名
+    void encodeChrome(const Span& span, std::string& out) {
+        out += first ? "\n" : ",\n";
+        first = false;
+        out += "{\"name\":\"" + span.name + "\",\"cat\":\"message\",\"ph\":\"X\",\"ts\":" +
+               std::to_string(span.start) + ",\"dur\":" + std::to_string(span.duration) + ",\"pid\":1,\"tid\":" +
+               std::to_string(span.trace) + ",\"args\":{\"thread\":" + std::to_string(span.thread);
+        if (span.user != 0) out += ",\"user\":" + std::to_string(span.user);
+        out += "}}";
+        if (span.user != 0) {
+            out += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(span.trace) +
+                   ",\"args\":{\"name\":\"#" + std::to_string(span.trace) + " " + span.name + " " +
+                   std::to_string(span.user) + "\"}}";
+        }
+    }
+
+    static void encodeBinary(const Span& span, std::string& out) {
+        putVarint(out, span.trace);
+        putVarint(out, static_cast<uint64_t>(span.start));
+        putVarint(out, static_cast<uint64_t>(std::max<int64_t>(0, span.duration)));
+        putVarint(out, span.thread);
+        putVarint(out, static_cast<uint64_t>(span.user));
+        putVarint(out, span.name.size());
+        out += span.name;
+    }
+
+public:
+    SpanTracer(const std::string& file, Format fmt, double rate)
+        : instance(nextInstance()), path(file), format(fmt), sampleRate(rate) {}
+
+    ~SpanTracer() {
+        flush();
+        if (fd >= 0) {
+            if (format == CHROME) writeFully(fd, "\n]\n");
+            ::close(fd);
+        }
+    }
+
+    SpanTracer(const SpanTracer&) = delete;
+    SpanTracer& operator=(const SpanTracer&) = delete;
+
+    // 覆盖已有文件。chrome 格式的结尾 ] 在退出时补上，进程异常退出时文件仍可打开
+    bool open() {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        return writeFully(fd, format == CHROME ? "[" : "TGSPANS1");
+    }
+
+    void setSampleRate(double rate) { sampleRate.store(rate, std::memory_order_relaxed); }
+
+    // 抽样：返回新的追踪编号，未抽中返回 0
+    uint64_t sample() {
+        double rate = sampleRate.load(std::memory_order_relaxed);
+        if (rate <= 0) return 0;
+        static thread_local std::mt19937 rng(std::random_device{}());
+        if (rate < 1 && std::uniform_real_distribution<double>(0, 1)(rng) >= rate) return 0;
+        return nextTrace.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    void record(uint64_t trace, const std::string& name, int64_t start, int64_t duration, int64_t user = 0) {
+        Buffer& buffer = local();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        if (buffer.spans.size() >= MAX_BUFFERED) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer.spans.push_back(Span{trace, name, start, duration, user, buffer.thread});
+    }
+
+    // 收集各线程的缓冲区写入文件，由定时线程调用
+    void flush() {
+        std::vector<Span> batch;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            for (size_t i = 0; i < buffers.size();) {
+                bool exited;
+                {
+                    Buffer& buffer = *buffers[i];
+                    std::lock_guard<std::mutex> bufferLock(buffer.mutex);
+                    std::move(buffer.spans.begin(), buffer.spans.end(), std::back_inserter(batch));
+                    buffer.spans.clear();
+                    exited = buffer.exited;
+                }
+                if (exited) {
+                    buffers[i] = std::move(buffers.back());
+                    buffers.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+        }
+        if (batch.empty()) return;
+
+        std::lock_guard<std::mutex> lock(fileMutex);
+        if (fd < 0) return;
+        std::string out;
+        for (const Span& span : batch) {
+            if (format == CHROME) {
+                encodeChrome(span, out);
+            } else {
+                encodeBinary(span, out);
+            }
+        }
+        writeFully(fd, out);
+    }
+
+    uint64_t traces() const { return nextTrace.load(std::memory_order_relaxed); }
+    uint64_t droppedSpans() const { return dropped.load(std::memory_order_relaxed); }
+
+    // 仍在登记的线程缓冲区数（已退出的线程在下次收集后移除）
+    size_t threadBuffers() {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        return buffers.size();
+    }
+};
+
+// 指标 HTTP 端点：单线程处理 GET /metrics，供 Prometheus 抓取
+class MetricsServer {
+private:
+    const Metrics& metrics;
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    static bool writeAll(int fd, const std::string& data) {
+        size_t off = 0;
+        while (off < data.size()) {
+            ssize_t n = ::send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            off += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void serve(int fd) {
+        // 只需要请求行，读到头部结束或超时为止
+        struct timeval timeout = {2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char buf[1024];
+        while (request.size() < 8192 && request.find("\r\n\r\n") == std::string::npos) {
+            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            request.append(buf, static_cast<size_t>(n));
+        }
+
+        std::string status = "200 OK";
+        std::string body;
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 14, "GET /metrics?") == 0) {
+            body = metrics.render();
+        } else {
+            status = "404 Not Found";
+            body = "not found\n";
+        }
+        writeAll(fd, "HTTP/1.1 " + status + "\r\n"
+                     "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                     "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                     "Connection: close\r\n\r\n" + body);
+    }
+
+    void loop() {
+        while (!stopping) {
+            struct pollfd pfd = {listenFd, POLLIN, 0};
+            if (::poll(&pfd, 1, 200) <= 0) continue;
+            int fd = ::accept(listenFd, nullptr, nullptr);
+            if (fd < 0) continue;
+            serve(fd);
+            ::close(fd);
+        }
+    }
+
+public:
+    explicit MetricsServer(const Metrics& m) : metrics(m) {}
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    // address 形如 127.0.0.1:9464 或 [::1]:9464
+    bool start(const std::string& address) {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos) return false;
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+
+        struct addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        struct addrinfo* res = nullptr;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res) != 0) return false;
+
+        for (struct addrinfo* ai = res; ai && listenFd < 0; ai = ai->ai_next) {
+            int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (fd < 0) continue;
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, 16) == 0) {
+                listenFd = fd;
+            } else {
+                ::close(fd);
+            }
+        }
+        freeaddrinfo(res);
+        if (listenFd < 0) return false;
+
+        thread = std::thread(&MetricsServer::loop, this);
+        return true;
+    }
+
+    ~MetricsServer() {
+        stopping = true;
+        if (thread.joinable()) thread.join();
+        if (listenFd >= 0) ::close(listenFd);
+    }
+};
+
+// Webhook 服务：Beast 异步 HTTP(S) 服务运行在线程池上，每个连接一个 strand。
+// 校验路径和 X-Telegram-Bot-Api-Secret-Token 后把请求体交给回调，随即应答 200。
+// 回调在网络线程上执行，只应做解析和入队。
+class WebhookServer {
+public:
+    struct Options {
+        std::string address = "0.0.0.0";
+        unsigned short port = 8443;
+        std::string path = "/webhook";
+        std::string secretToken; // 为空时不校验
+        int threads = 2;
+        std::string certFile; // 证书和私钥都配置时启用 HTTPS
+        std::string keyFile;
+        size_t maxBodySize = 1 << 20;
+    };
+
+    typedef std::function<bool (const std::string& body)> Handler; // 返回 false 时响应 503，Telegram 稍后重发
+
+private:
+    typedef boost::asio::ip::tcp tcp;
+    typedef boost::beast::http::request<boost::beast::http::string_body> Request;
+    typedef boost::beast::http::response<boost::beast::http::string_body> Response;
+
+    template <typename Stream>
+    class Session : public std::enable_shared_from_this<Session<Stream>> {
+        Stream stream;
+        WebhookServer& server;
+        boost::beast::flat_buffer buffer;
+        std::unique_ptr<boost::beast::http::request_parser<boost::beast::http::string_body>> parser;
+        Response response;
+
+        void read() {
+            parser.reset(new boost::beast::http::request_parser<boost::beast::http::string_body>());
+            parser->body_limit(server.options.maxBodySize);
+            boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(60));
+            auto self = this->shared_from_this();
+            boost::beast::http::async_read(stream, buffer, *parser,
+                [self](boost::beast::error_code ec, size_t) {
+                    if (ec) {
+                        self->close();
+                        return;
+                    }
+                    self->response = self->server.respond(self->parser->get());
+                    self->write();
+                });
+        }
+
+        void write() {
+            boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+            auto self = this->shared_from_this();
+            boost::beast::http::async_write(stream, response,
+                [self](boost::beast::error_code ec, size_t) {
+                    if (ec || !self->response.keep_alive()) {
+                        self->close();
+                        return;
+                    }
+                    self->read();
+                });
+        }
+
+        void handshake(boost::beast::tcp_stream&) { read(); }
+
+        void handshake(boost::beast::ssl_stream<boost::beast::tcp_stream>& s) {
+            boost::beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+            auto self = this->shared_from_this();
+            s.async_handshake(boost::asio::ssl::stream_base::server, [self](boost::beast::error_code ec) {
+                if (!ec) self->read();
+            });
+        }
+
+        void shutdown(boost::beast::tcp_stream& s) {
+            boost::beast::error_code ec;
+            s.socket().shutdown(tcp::socket::shutdown_send, ec);
+        }
+
+        void shutdown(boost::beast::ssl_stream<boost::beast::tcp_stream>& s) {
+            boost::beast::get_lowest_layer(s).expires_after(std::chrono::seconds(5));
+            auto self = this->shared_from_this();
+            s.async_shutdown([self](boost::beast::error_code) {});
+        }
+
+        void close() { shutdown(stream); }
+
+    public:
+        template <typename... Args>
+        Session(WebhookServer& owner, Args&&... args) : stream(std::forward<Args>(args)...), server(owner) {}
+
+        void run() { handshake(stream); }
+    };
+
+    Options options;
+    Handler handler;
+    boost::asio::io_context io;
+    std::unique_ptr<boost::asio::ssl::context> ssl;
+    tcp::acceptor acceptor;
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> rejected{0};
+
+    // 常数时间比较，避免通过响应时间猜测密钥
+    static bool secretMatches(const std::string& expected, const boost::beast::string_view& actual) {
+        if (expected.size() != actual.size()) return false;
+        unsigned char diff = 0;
+        for (size_t i = 0; i < expected.size(); ++i) {
+            diff |= static_cast<unsigned char>(expected[i] ^ actual[i]);
+        }
+        return diff == 0;
+    }
+
+    Response respond(const Request& req) {
+        namespace http = boost::beast::http;
+        Response res(http::status::ok, req.version());
+        res.keep_alive(req.keep_alive());
+        res.set(http::field::content_type, "application/json");
+
+        std::string target = req.target().to_string();
+        target = target.substr(0, target.find('?'));
+        if (req.method() != http::verb::post || target != options.path) {
+            res.result(http::status::not_found);
+        } else if (!options.secretToken.empty() &&
+                   !secretMatches(options.secretToken, req["X-Telegram-Bot-Api-Secret-Token"])) {
+            ++rejected;
+            res.result(http::status::unauthorized);
+        } else {
+            ++accepted;
+            if (!handler(req.body())) {
+                res.result(http::status::service_unavailable);
+            }
+        }
+        res.prepare_payload();
+        return res;
+    }
+
+    void accept() {
+        acceptor.async_accept(boost::asio::make_strand(io), [this](boost::beast::error_code ec, tcp::socket socket) {
+            if (ec) {
+                if (ec == boost::asio::error::operation_aborted) return;
+            } else {
+                boost::beast::error_code ignored;
+                socket.set_option(tcp::no_delay(true), ignored);
+                if (ssl) {
+                    std::make_shared<Session<boost::beast::ssl_stream<boost::beast::tcp_stream>>>(
+                        *this, std::move(socket), *ssl)->run();
+                } else {
+                    std::make_shared<Session<boost::beast::tcp_stream>>(*this, std::move(socket))->run();
+                }
+            }
+            accept();
+        });
+    }
+
+public:
+    WebhookServer(const Options& opts, Handler h)
+        : options(opts), handler(std::move(h)), io(std::max(1, opts.threads)), acceptor(io) {}
+
+    WebhookServer(const WebhookServer&) = delete;
+    WebhookServer& operator=(const WebhookServer&) = delete;
+
+    bool start(std::string& error) {
+        try {
+            if (!options.certFile.empty() && !options.keyFile.empty()) {
+                ssl.reset(new boost::asio::ssl::context(boost::asio::ssl::context::tls_server));
+                ssl->set_options(boost::asio::ssl::context::default_workarounds |
+                                 boost::asio::ssl::context::no_sslv2 | boost::asio::ssl::context::no_sslv3 |
+                                 boost::asio::ssl::context::no_tlsv1 | boost::asio::ssl::context::no_tlsv1_1);
+                ssl->use_certificate_chain_file(options.certFile);
+                ssl->use_private_key_file(options.keyFile, boost::asio::ssl::context::pem);
+            }
+
+            tcp::endpoint endpoint(boost::asio::ip::make_address(options.address), options.port);
+            acceptor.open(endpoint.protocol());
+            acceptor.set_option(tcp::acceptor::reuse_address(true));
+            acceptor.bind(endpoint);
+            acceptor.listen(boost::asio::socket_base::max_listen_connections);
+        } catch (std::exception& e) {
+            error = e.what();
+            return false;
+        }
+
+        accept();
+        for (int i = 0; i < std::max(1, options.threads); ++i) {
+            threads.emplace_back([this] { io.run(); });
+        }
+        return true;
+    }
+
+    bool secure() const { return ssl != nullptr; }
+
+    uint64_t acceptedCount() const { return accepted.load(); }
+    uint64_t rejectedCount() const { return rejected.load(); }
+
+    ~WebhookServer() {
+        io.stop();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+};
+
+// 支持异步提交的 HttpClient：回调在传输线程上执行，应尽快返回
+class AsyncHttpClient : public TgBot::HttpClient {
+public:
+    typedef std::function<void (const std::string& response, std::exception_ptr error)> Callback;
+
+    virtual void submit(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args, Callback callback,
+                        std::chrono::steady_clock::time_point notBefore = std::chrono::steady_clock::time_point()) const = 0;
+
+    std::future<std::string> makeRequestAsync(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const {
+        auto promise = std::make_shared<std::promise<std::string>>();
+        submit(url, args, [promise](const std::string& response, std::exception_ptr error) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(response);
+            }
+        });
+        return promise->get_future();
+    }
+
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override {
+        return makeRequestAsync(url, args).get();
+    }
+};
+
+// 基于 libcurl multi 的异步传输：一个事件循环线程复用连接并发执行大量请求
+// 连接池由 multi 句柄维护（长连接、空闲淘汰、复用前存活检查），
+// TLS 会话通过共享句柄缓存，新建连接时可以恢复会话而不必完整握手
+class CurlMultiHttpClient : public AsyncHttpClient {
+public:
+    struct Options {
+        size_t maxInFlight = 256;
+        long maxHostConnections = 32; // 每个主机的最大连接数（连接池大小）
+        long idleTimeout = 60; // 连接空闲超过该秒数后不再复用
+        long maxLifetime = 0; // 连接最长使用时间（秒），0 为不限制
+    };
+
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t newConnections = 0;
+        uint64_t reusedConnections = 0;
+        double handshakeSeconds = 0; // 新连接 TCP+TLS 建立耗时累计
+    };
+
+private:
+    struct Request {
+        CURL* easy = nullptr;
+        curl_mime* mime = nullptr;
+        std::string response;
+        Callback callback;
+
+        ~Request() {
+            if (mime) curl_mime_free(mime);
+            if (easy) curl_easy_cleanup(easy);
+        }
+    };
+
+    CURLM* multi;
+    CURLSH* share;
+    std::mutex shareLocks[CURL_LOCK_DATA_LAST]; // 共享句柄按数据类别加锁
+    Options options;
+    size_t maxInFlight;
+    std::unordered_set<Request*> active; // 仅事件循环线程访问
+    mutable std::vector<CURL*> idleHandles; // 可复用的 easy 句柄，受 pendingMutex 保护
+    std::atomic<uint64_t> requestCount{0};
+    std::atomic<uint64_t> newConnections{0};
+    std::atomic<uint64_t> reusedConnections{0};
+    std::atomic<uint64_t> handshakeMicros{0};
+    mutable std::mutex pendingMutex;
+    mutable std::multimap<std::chrono::steady_clock::time_point, std::unique_ptr<Request>> pending;
+    bool closed = false; // 事件循环已退出，不再接受请求；受 pendingMutex 保护
+    std::atomic<bool> stopping{false};
+    std::thread loopThread;
+
+    static size_t writeCallback(char* data, size_t size, size_t count, void* userdata) {
+        static_cast<std::string*>(userdata)->append(data, size * count);
+        return size * count;
+    }
+
+    static std::string urlString(const TgBot::Url& url) {
+        std::string result = url.protocol + "://" + url.host + url.path;
+        if (!url.query.empty()) {
+            result += "?" + url.query;
+        }
+        return result;
+    }
+
+    static void lockShare(CURL*, curl_lock_data data, curl_lock_access, void* client) {
+        static_cast<CurlMultiHttpClient*>(client)->shareLocks[data].lock();
+    }
+
+    static void unlockShare(CURL*, curl_lock_data data, void* client) {
+        static_cast<CurlMultiHttpClient*>(client)->shareLocks[data].unlock();
+    }
+
+    static void finish(Request& req, std::exception_ptr error) {
+        try {
+            req.callback(req.response, error);
+        } catch (...) {
+        }
+    }
+
+    void recordConnection(CURL* easy) {
+        long connects = 0;
+        double connected = 0;
+        curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+        curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME, &connected);
+        ++requestCount;
+        if (connects > 0) {
+            ++newConnections;
+            if (connected <= 0) {
+                curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME, &connected);
+            }
+            handshakeMicros += static_cast<uint64_t>(connected * 1e6);
+        } else {
+            ++reusedConnections;
+        }
+    }
+
+    // 归还 easy 句柄供后续请求复用
+    void recycle(Request& req) {
+        if (req.mime) {
+            curl_mime_free(req.mime);
+            req.mime = nullptr;
+        }
+        curl_easy_reset(req.easy);
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        if (idleHandles.size() < maxInFlight) {
+            idleHandles.push_back(req.easy);
+            req.easy = nullptr;
+        }
+    }
+
+    CURL* takeHandle() const {
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (!idleHandles.empty()) {
+                CURL* easy = idleHandles.back();
+                idleHandles.pop_back();
+                return easy;
+            }
+        }
+        return curl_easy_init();
+    }
+
+    // 把到期的请求加入 multi 句柄，返回距下一个请求到期的毫秒数
+    int admit() {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        auto now = std::chrono::steady_clock::now();
+        while (!pending.empty() && active.size() < maxInFlight && pending.begin()->first <= now) {
+            Request* req = pending.begin()->second.release();
+            pending.erase(pending.begin());
+            curl_multi_add_handle(multi, req->easy);
+            active.insert(req);
+        }
+        if (pending.empty() || active.size() >= maxInFlight) return 1000;
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(pending.begin()->first - now).count();
+        return static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(wait, 1000)));
+    }
+
+    void loop() {
+        while (!stopping) {
+            int timeoutMs = admit();
+
+            int running = 0;
+            curl_multi_perform(multi, &running);
+
+            int left = 0;
+            CURLMsg* msg;
+            while ((msg = curl_multi_info_read(multi, &left)) != nullptr) {
+                if (msg->msg != CURLMSG_DONE) continue;
+                CURL* easy = msg->easy_handle;
+                CURLcode result = msg->data.result;
+                Request* raw = nullptr;
+                curl_easy_getinfo(easy, CURLINFO_PRIVATE, &raw);
+                curl_multi_remove_handle(multi, easy);
+                active.erase(raw);
+
+                std::unique_ptr<Request> req(raw);
+                recordConnection(easy);
+                recycle(*req);
+                if (result == CURLE_OK) {
+                    finish(*req, nullptr);
+                } else {
+                    finish(*req, std::make_exception_ptr(
+                        std::runtime_error(std::string("curl: ") + curl_easy_strerror(result))));
+                }
+            }
+
+            curl_multi_poll(multi, nullptr, 0, timeoutMs, nullptr);
+        }
+    }
+
+public:
+    explicit CurlMultiHttpClient(const Options& opts)
+        : options(opts), maxInFlight(std::max<size_t>(1, opts.maxInFlight)) {
+        static std::once_flag globalInit;
+        std::call_once(globalInit, [] { curl_global_init(CURL_GLOBAL_ALL); });
+
+        multi = curl_multi_init();
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, options.maxHostConnections);
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, options.maxHostConnections * 2);
+        curl_multi_setopt(multi, CURLMOPT_PIPELINING, static_cast<long>(CURLPIPE_MULTIPLEX));
+
+        // submit 在调用方线程上把 easy 句柄挂到共享句柄（CURLOPT_SHARE），传输在事件循环线程上，
+        // 两边会同时访问共享数据，因此须提供加锁回调
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, &CurlMultiHttpClient::lockShare);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, &CurlMultiHttpClient::unlockShare);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+
+        loopThread = std::thread(&CurlMultiHttpClient::loop, this);
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.requests = requestCount.load();
+        s.newConnections = newConnections.load();
+        s.reusedConnections = reusedConnections.load();
+        s.handshakeSeconds = handshakeMicros.load() / 1e6;
+        return s;
+    }
+
+    ~CurlMultiHttpClient() {
+        stop();
+        for (CURL* easy : idleHandles) {
+            curl_easy_cleanup(easy);
+        }
+        idleHandles.clear();
+        curl_multi_cleanup(multi);
+        curl_share_cleanup(share);
+    }
+
+    // 停止事件循环，未完成的请求以错误结束，避免等待方永久阻塞；此后的 submit 抛出异常
+    void stop() {
+        if (stopping.exchange(true)) return;
+        curl_multi_wakeup(multi);
+        loopThread.join();
+
+        std::multimap<std::chrono::steady_clock::time_point, std::unique_ptr<Request>> left;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            closed = true;
+            left.swap(pending);
+        }
+        auto stopped = std::make_exception_ptr(std::runtime_error("HTTP 传输已停止"));
+        for (Request* req : active) {
+            curl_multi_remove_handle(multi, req->easy);
+            finish(*req, stopped);
+            delete req;
+        }
+        active.clear();
+        for (auto& entry : left) {
+            finish(*entry.second, stopped);
+        }
+        left.clear();
+    }
+
+    // 停止后提交的请求不会再被执行，抛出 std::runtime_error，callback 不会被调用
+    void submit(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args, Callback callback,
+                std::chrono::steady_clock::time_point notBefore = std::chrono::steady_clock::time_point()) const override {
+        if (stopping) {
+            throw std::runtime_error("HTTP 传输已停止");
+        }
+
+        std::unique_ptr<Request> req(new Request());
+        req->callback = std::move(callback);
+        req->easy = takeHandle();
+        if (!req->easy) {
+            throw std::runtime_error("curl_easy_init 失败");
+        }
+
+        std::string target = urlString(url);
+        curl_easy_setopt(req->easy, CURLOPT_URL, target.c_str());
+        curl_easy_setopt(req->easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(req->easy, CURLOPT_SHARE, share);
+        curl_easy_setopt(req->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(req->easy, CURLOPT_TCP_KEEPIDLE, 30L);
+        curl_easy_setopt(req->easy, CURLOPT_TCP_KEEPINTVL, 15L);
+        curl_easy_setopt(req->easy, CURLOPT_MAXAGE_CONN, options.idleTimeout);
+        if (options.maxLifetime > 0) {
+            curl_easy_setopt(req->easy, CURLOPT_MAXLIFETIME_CONN, options.maxLifetime);
+        }
+        curl_easy_setopt(req->easy, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+        curl_easy_setopt(req->easy, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(req->easy, CURLOPT_TIMEOUT, static_cast<long>(_timeout));
+        curl_easy_setopt(req->easy, CURLOPT_WRITEFUNCTION, &CurlMultiHttpClient::writeCallback);
+        curl_easy_setopt(req->easy, CURLOPT_WRITEDATA, &req->response);
+        curl_easy_setopt(req->easy, CURLOPT_PRIVATE, req.get());
+
+        bool hasFile = false;
+        for (const auto& arg : args) {
+            hasFile = hasFile || arg.isFile;
+        }
+
+        if (hasFile) {
+            req->mime = curl_mime_init(req->easy);
+            for (const auto& arg : args) {
+                curl_mimepart* part = curl_mime_addpart(req->mime);
+                curl_mime_name(part, arg.name.c_str());
+                curl_mime_data(part, arg.value.data(), arg.value.size());
+                if (arg.isFile) {
+                    curl_mime_filename(part, arg.fileName.c_str());
+                    curl_mime_type(part, arg.mimeType.c_str());
+                }
+            }
+            curl_easy_setopt(req->easy, CURLOPT_MIMEPOST, req->mime);
+        } else if (!args.empty()) {
+            std::string body = TgBot::HttpParser().generateWwwFormUrlencoded(args);
+            curl_easy_setopt(req->easy, CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
+            curl_easy_setopt(req->easy, CURLOPT_COPYPOSTFIELDS, body.c_str());
+        } else {
+            curl_easy_setopt(req->easy, CURLOPT_HTTPGET, 1L);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (closed) {
+                throw std::runtime_error("HTTP 传输已停止");
+            }
+            pending.emplace(notBefore, std::move(req));
+        }
+        curl_multi_wakeup(multi);
+    }
+};
+
+// 出站发送调度：包装底层 HttpClient，对发送类方法按全局与会话令牌桶限速，
+// 遇到 429 按 retry_after 等待、网络错误按抖动指数退避重试
+class RateLimitedHttpClient : public AsyncHttpClient {
+public:
+    struct Limits {
+        double globalPerSecond = 30;
+        double chatPerSecond = 1;
+        double groupPerMinute = 20;
+        int maxRetries = 3;
+        int retryDelaySeconds = 1;
+    };
+
+    struct Stats {
+        int64_t queued = 0;  // 正在等待配额的发送
+        uint64_t delayed = 0; // 因限速或重试被推迟的发送
+        uint64_t dropped = 0; // 重试耗尽后放弃的发送
+    };
+
+private:
+    struct Bucket {
+        double tokens;
+        double rate;  // 每秒补充
+        double burst;
+        std::chrono::steady_clock::time_point last;
+        std::chrono::steady_clock::time_point blockedUntil;
+    };
+
+    TgBot::HttpClient& inner;
+    const AsyncHttpClient* asyncInner; // 底层支持异步时非空
+    Limits limits;
+    mutable CountingMutex bucketMutex;
+    mutable Bucket global;
+    mutable std::unordered_map<int64_t, Bucket> chats;
+    mutable std::atomic<int64_t> queued{0};
+    mutable std::atomic<uint64_t> delayed{0};
+    mutable std::atomic<uint64_t> dropped{0};
+    std::atomic<int> maxRetries; // 重试参数不在 bucketMutex 下读取，单独保存
+    std::atomic<int> retryDelaySeconds;
+
+    enum { MAX_IDLE_CHATS = 10000 };
+
+    static Bucket makeBucket(double rate, double burst) {
+        Bucket b;
+        b.tokens = burst;
+        b.rate = rate;
+        b.burst = burst;
+        b.last = std::chrono::steady_clock::now();
+        b.blockedUntil = b.last;
+        return b;
+    }
+
+    static std::string methodOf(const TgBot::Url& url) {
+        size_t pos = url.path.rfind('/');
+        return pos == std::string::npos ? url.path : url.path.substr(pos + 1);
+    }
+
+    static bool isThrottled(const std::string& method) {
+        return method.compare(0, 4, "send") == 0 || method.compare(0, 4, "copy") == 0 ||
+               method.compare(0, 7, "forward") == 0 || method.compare(0, 4, "edit") == 0;
+    }
+
+    static bool chatIdOf(const std::vector<TgBot::HttpReqArg>& args, int64_t& chatId) {
+        for (const auto& arg : args) {
+            if (arg.name == "chat_id") {
+                try {
+                    chatId = std::stoll(arg.value);
+                } catch (...) {
+                    chatId = static_cast<int64_t>(std::hash<std::string>()(arg.value));
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 预约一个令牌（允许透支），返回需要等待的时长
+    static std::chrono::steady_clock::duration reserve(Bucket& b, std::chrono::steady_clock::time_point now) {
+        double elapsed = std::chrono::duration<double>(now - b.last).count();
+        b.tokens = std::min(b.burst, b.tokens + elapsed * b.rate);
+        b.last = now;
+        b.tokens -= 1;
+
+        std::chrono::steady_clock::duration wait(0);
+        if (b.tokens < 0) {
+            wait = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(-b.tokens / b.rate));
+        }
+        if (b.blockedUntil > now) {
+            wait = std::max(wait, b.blockedUntil - now);
+        }
+        return wait;
+    }
+
+    std::chrono::steady_clock::duration acquire(bool hasChat, int64_t chatId) const {
+        std::lock_guard<CountingMutex> lock(bucketMutex);
+        auto now = std::chrono::steady_clock::now();
+        auto wait = reserve(global, now);
+        if (!hasChat) return wait;
+
+        auto it = chats.find(chatId);
+        if (it == chats.end()) {
+            if (chats.size() >= MAX_IDLE_CHATS) {
+                pruneIdle(now);
+            }
+            // 群组按每分钟限额，私聊按每秒限额
+            Bucket b = chatId < 0 ? makeBucket(limits.groupPerMinute / 60.0, 1)
+                                  : makeBucket(limits.chatPerSecond, 1);
+            it = chats.emplace(chatId, b).first;
+        }
+        return std::max(wait, reserve(it->second, now));
+    }
+
+    void pruneIdle(std::chrono::steady_clock::time_point now) const {
+        for (auto it = chats.begin(); it != chats.end();) {
+            double idle = std::chrono::duration<double>(now - it->second.last).count();
+            if (it->second.tokens + idle * it->second.rate >= it->second.burst && it->second.blockedUntil <= now) {
+                it = chats.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void block(bool hasChat, int64_t chatId, int seconds) const {
+        std::lock_guard<CountingMutex> lock(bucketMutex);
+        auto until = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+        Bucket& b = hasChat && chats.count(chatId) ? chats[chatId] : global;
+        b.blockedUntil = std::max(b.blockedUntil, until);
+    }
+
+    // Telegram 的 429 响应形如 {"ok":false,"error_code":429,...,"parameters":{"retry_after":5}}
+    static int retryAfterOf(const std::string& response) {
+        if (response.find("\"error_code\":429") == std::string::npos) return -1;
+        size_t pos = response.find("\"retry_after\":");
+        if (pos == std::string::npos) return 1;
+        try {
+            return std::max(1, std::stoi(response.substr(pos + 14)));
+        } catch (...) {
+            return 1;
+        }
+    }
+
+    void submitAttempt(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args, Callback callback,
+                       int attempt, std::chrono::steady_clock::time_point notBefore) const {
+        if (!asyncInner) {
+            // 底层只支持同步时在调用线程上完成
+            std::string response;
+            std::exception_ptr error;
+            try {
+                response = makeRequest(url, args);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            callback(response, error);
+            return;
+        }
+
+        if (!isThrottled(methodOf(url))) {
+            asyncInner->submit(url, args, std::move(callback), notBefore);
+            return;
+        }
+
+        int64_t chatId = 0;
+        bool hasChat = chatIdOf(args, chatId);
+        auto now = std::chrono::steady_clock::now();
+        auto due = std::max(notBefore, now + acquire(hasChat, chatId));
+        bool waiting = due > now;
+        if (waiting) {
+            ++delayed;
+            ++queued;
+        }
+
+        // 底层传输已停止时 submit 抛出异常，撤回上面的排队计数后交给调用方
+        struct QueuedGuard {
+            std::atomic<int64_t>* queued;
+            ~QueuedGuard() {
+                if (queued) --*queued;
+            }
+        } guard{waiting ? &queued : nullptr};
+        asyncInner->submit(url, args,
+            [this, url, args, callback, attempt, hasChat, chatId, waiting](const std::string& response, std::exception_ptr error) {
+                if (waiting) --queued;
+
+                if (!error) {
+                    int retryAfter = retryAfterOf(response);
+                    if (retryAfter < 0) {
+                        callback(response, nullptr);
+                    } else if (attempt >= maxRetries.load()) {
+                        ++dropped;
+                        callback(response, nullptr);
+                    } else {
+                        block(hasChat, chatId, retryAfter);
+                        retry(url, args, callback, attempt + 1, std::chrono::steady_clock::now());
+                    }
+                } else if (attempt >= maxRetries.load()) {
+                    ++dropped;
+                    callback(response, error);
+                } else {
+                    ++delayed;
+                    retry(url, args, callback, attempt + 1, std::chrono::steady_clock::now() + backoff(attempt));
+                }
+            }, due);
+        guard.queued = nullptr;
+    }
+
+    // 在传输线程上重新提交；传输已停止时以该错误结束，不让调用方的回调落空
+    void retry(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args, const Callback& callback,
+               int attempt, std::chrono::steady_clock::time_point notBefore) const {
+        try {
+            submitAttempt(url, args, callback, attempt, notBefore);
+        } catch (...) {
+            ++dropped;
+            callback("", std::current_exception());
+        }
+    }
+
+    std::chrono::milliseconds backoff(int attempt) const {
+        static thread_local std::mt19937 rng(std::random_device{}());
+        std::uniform_real_distribution<double> jitter(0.5, 1.5);
+        double base = retryDelaySeconds.load() * 1000.0 * (1 << std::min(attempt, 6));
+        return std::chrono::milliseconds(static_cast<int64_t>(base * jitter(rng)));
+    }
+
+public:
+    RateLimitedHttpClient(TgBot::HttpClient& client, const Limits& l)
+        : inner(client), asyncInner(dynamic_cast<const AsyncHttpClient*>(&client)), limits(l),
+          global(makeBucket(l.globalPerSecond, l.globalPerSecond)), maxRetries(l.maxRetries),
+          retryDelaySeconds(l.retryDelaySeconds) {}
+
+    const CountingMutex& lockStats() const { return bucketMutex; }
+
+    // 运行中调整限额（重新加载配置时调用），已有令牌桶按新速率继续补充
+    void setLimits(const Limits& next) {
+        std::lock_guard<CountingMutex> lock(bucketMutex);
+        limits = next;
+        global.rate = next.globalPerSecond;
+        global.burst = next.globalPerSecond;
+        global.tokens = std::min(global.tokens, global.burst);
+        for (auto& chat : chats) {
+            chat.second.rate = chat.first < 0 ? next.groupPerMinute / 60.0 : next.chatPerSecond;
+        }
+        maxRetries = next.maxRetries;
+        retryDelaySeconds = next.retryDelaySeconds;
+    }
+
+    // 重试由本类负责，不再让 Api 层重复重试
+    int getRequestMaxRetries() const override { return 0; }
+
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override {
+        inner._timeout = _timeout;
+
+        std::string method = methodOf(url);
+        if (!isThrottled(method)) {
+            return inner.makeRequest(url, args);
+        }
+
+        int64_t chatId = 0;
+        bool hasChat = chatIdOf(args, chatId);
+
+        for (int attempt = 0;; ++attempt) {
+            auto wait = acquire(hasChat, chatId);
+            if (wait.count() > 0) {
+                SpanTracer::Timer span("rate_limit_wait");
+                ++delayed;
+                ++queued;
+                std::this_thread::sleep_for(wait);
+                --queued;
+            }
+
+            try {
+                std::string response = inner.makeRequest(url, args);
+                int retryAfter = retryAfterOf(response);
+                if (retryAfter < 0) {
+                    return response;
+                }
+                if (attempt >= maxRetries.load()) {
+                    ++dropped;
+                    return response;
+                }
+                block(hasChat, chatId, retryAfter);
+            } catch (...) {
+                if (attempt >= maxRetries.load()) {
+                    ++dropped;
+                    throw;
+                }
+                SpanTracer::Timer span("retry_backoff");
+                ++delayed;
+                ++queued;
+                std::this_thread::sleep_for(backoff(attempt));
+                --queued;
+            }
+        }
+    }
+
+    // 异步发送：限速等待和重试都交给底层传输的延迟提交，不占用调用线程
+    void submit(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args, Callback callback,
+                std::chrono::steady_clock::time_point notBefore = std::chrono::steady_clock::time_point()) const override {
+        submitAttempt(url, args, std::move(callback), 0, notBefore);
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.queued = queued.load();
+        s.delayed = delayed.load();
+        s.dropped = dropped.load();
+        return s;
+    }
+};
+
+// 调用计量：包装底层 HttpClient，按 Bot API 方法记录每次请求的耗时和失败次数。
+// 放在限速层之下，因此测得的是单次实际请求，不含排队等待和重试间隔。
+class InstrumentedHttpClient : public AsyncHttpClient {
+private:
+    struct MethodIds {
+        Metrics::Id latency;
+        Metrics::Id errors;
+        std::string span; // 延迟追踪中的名称
+    };
+
+    TgBot::HttpClient& inner;
+    const AsyncHttpClient* asyncInner; // 底层支持异步时非空
+    Metrics& metrics;
+    std::unordered_map<std::string, MethodIds> methods; // 构造后只读，查询无需加锁
+    MethodIds other;
+    mutable std::atomic<int64_t> inFlight{0}; // 已发出、尚未完成的请求（含长轮询）
+
+    MethodIds registerMethod(const std::string& method) {
+        std::string labels = "method=\"" + method + "\"";
+        MethodIds ids;
+        ids.latency = metrics.histogram("bot_api_request_duration_seconds", labels, "Bot API 单次请求耗时");
+        ids.errors = metrics.counter("bot_api_errors_total", labels, "Bot API 请求失败次数（网络错误或 ok=false）");
+        ids.span = "api:" + method;
+        return ids;
+    }
+
+    const MethodIds& idsFor(const TgBot::Url& url) const {
+        size_t pos = url.path.rfind('/');
+        auto it = methods.find(pos == std::string::npos ? url.path : url.path.substr(pos + 1));
+        return it == methods.end() ? other : it->second;
+    }
+
+    // traced 为发起请求的线程当时所处的追踪
+    void record(const MethodIds& ids, std::chrono::steady_clock::time_point start,
+                const std::string& response, bool failed, const SpanTracer::Context& traced) const {
+        inFlight.fetch_sub(1, std::memory_order_relaxed);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        metrics.observe(ids.latency, elapsed);
+        if (traced.tracer) {
+            traced.tracer->record(traced.trace, ids.span, SpanTracer::wallMicros(start),
+                                  std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+        }
+        if (failed || response.find("\"ok\":true") == std::string::npos) {
+            metrics.add(ids.errors);
+        }
+    }
+
+public:
+    InstrumentedHttpClient(TgBot::HttpClient& client, Metrics& m)
+        : inner(client), asyncInner(dynamic_cast<const AsyncHttpClient*>(&client)), metrics(m) {
+        static const char* const known[] = {
+            "getUpdates", "getMe", "sendMessage", "copyMessage", "forwardMessage", "editMessageText",
+            "editMessageReplyMarkup", "answerCallbackQuery", "sendMediaGroup", "sendPhoto", "sendVideo",
+            "sendDocument", "sendAudio", "sendVoice", "sendSticker", "sendChatAction", "setWebhook",
+            "deleteWebhook"};
+        for (const char* method : known) {
+            methods.emplace(method, registerMethod(method));
+        }
+        other = registerMethod("other");
+    }
+
+    int getRequestMaxRetries() const override { return inner.getRequestMaxRetries(); }
+
+    int64_t inFlightRequests() const { return inFlight.load(std::memory_order_relaxed); }
+
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override {
+        inner._timeout = _timeout;
+        const MethodIds& ids = idsFor(url);
+        SpanTracer::Context traced = SpanTracer::context();
+        auto start = std::chrono::steady_clock::now();
+        inFlight.fetch_add(1, std::memory_order_relaxed);
+        try {
+            std::string response = inner.makeRequest(url, args);
+            record(ids, start, response, false, traced);
+            return response;
+        } catch (...) {
+            record(ids, start, "", true, traced);
+            throw;
+        }
+    }
+
+    void submit(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args, Callback callback,
+                std::chrono::steady_clock::time_point notBefore = std::chrono::steady_clock::time_point()) const override {
+        if (!asyncInner) {
+            // 底层只支持同步时在调用线程上等到 notBefore（限速层的配额）再发送
+            if (notBefore > std::chrono::steady_clock::now()) {
+                SpanTracer::Timer span("rate_limit_wait");
+                std::this_thread::sleep_until(notBefore);
+            }
+            std::string response;
+            std::exception_ptr error;
+            try {
+                response = makeRequest(url, args);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            callback(response, error);
+            return;
+        }
+
+        // 延迟提交的请求从到期时刻开始计时
+        const MethodIds& ids = idsFor(url);
+        SpanTracer::Context traced = SpanTracer::context();
+        auto start = std::max(notBefore, std::chrono::steady_clock::now());
+        inFlight.fetch_add(1, std::memory_order_relaxed);
+        try {
+            asyncInner->submit(url, args,
+                [this, &ids, start, traced, callback](const std::string& response, std::exception_ptr error) {
+                    record(ids, start, response, static_cast<bool>(error), traced);
+                    callback(response, error);
+                }, notBefore);
+        } catch (...) {
+            inFlight.fetch_sub(1, std::memory_order_relaxed);
+            throw;
+        }
+    }
+};
+
+// 消息任务：接收线程只解码并派发任务，所有 Bot API 调用都在工作线程上进行
+struct MessageTask {
+    enum Type {
+        FORWARD_TO_ADMIN, REPLY_TO_USER, HANDLE_CALLBACK, HANDLE_REQUEST,
+        HANDLE_START, HANDLE_HELP, HANDLE_BAN, HANDLE_UNBAN, HANDLE_BANLIST,
+        SEND_TEXT, // 向 targetUserId 发送 text
+        FORWARD_ALBUM, // 把用户的相册（album）整体转发给管理员
+        REPLY_ALBUM, // 把管理员回复的相册整体发给 targetUserId
+        HANDLE_BROADCAST, HANDLE_BROADCAST_STOP,
+        HANDOFF_CONVERSATION, // 把 targetUserId 的会话转交给 adminChatId，text 为用户显示名称
+        HANDLE_HISTORY, HANDLE_SEARCH
+    };
+    enum { TYPE_COUNT = HANDLE_SEARCH + 1 };
+    // 优先级：管理员操作先于用户消息处理，后台通知最后；按权重轮询，低优先级仍能前进
+    enum Priority { PRIORITY_ADMIN, PRIORITY_USER, PRIORITY_BACKGROUND };
+    enum { PRIORITY_COUNT = PRIORITY_BACKGROUND + 1 };
+    Type type;
+    TgBot::Message::Ptr message;
+    TgBot::CallbackQuery::Ptr callbackQuery;
+    int64_t targetUserId = 0;
+    int64_t adminChatId = 0;
+    std::string text;
+    std::vector<TgBot::Message::Ptr> album; // 同一 media_group_id 的消息，按到达顺序
+    std::chrono::steady_clock::time_point enqueuedAt;
+    uint64_t journalSeq = 0; // 任务日志中的序号，0 表示未记录
+    uint64_t traceId = 0; // 延迟追踪编号，0 表示未被抽中
+
+    static const char* typeName(Type type) {
+        switch (type) {
+            case FORWARD_TO_ADMIN: return "forward_to_admin";
+            case REPLY_TO_USER: return "reply_to_user";
+            case HANDLE_CALLBACK: return "handle_callback";
+            case HANDLE_REQUEST: return "handle_request";
+            case HANDLE_START: return "handle_start";
+            case HANDLE_HELP: return "handle_help";
+            case HANDLE_BAN: return "handle_ban";
+            case HANDLE_UNBAN: return "handle_unban";
+            case HANDLE_BANLIST: return "handle_banlist";
+            case SEND_TEXT: return "send_text";
+            case FORWARD_ALBUM: return "forward_album";
+            case REPLY_ALBUM: return "reply_album";
+            case HANDLE_BROADCAST: return "handle_broadcast";
+            case HANDLE_BROADCAST_STOP: return "handle_broadcast_stop";
+            case HANDOFF_CONVERSATION: return "handoff_conversation";
+            case HANDLE_HISTORY: return "handle_history";
+            case HANDLE_SEARCH: return "handle_search";
+        }
+        return "unknown";
+    }
+
+    static Priority priorityOf(Type type) {
+        switch (type) {
+            case REPLY_TO_USER:
+            case REPLY_ALBUM:
+            case HANDLE_CALLBACK:
+            case HANDLE_BAN:
+            case HANDLE_UNBAN:
+            case HANDLE_BANLIST:
+            case HANDLE_BROADCAST:
+            case HANDLE_BROADCAST_STOP:
+            case HANDOFF_CONVERSATION:
+            case HANDLE_HISTORY:
+            case HANDLE_SEARCH:
+                return PRIORITY_ADMIN;
+            case SEND_TEXT:
+                return PRIORITY_BACKGROUND;
+            default:
+                return PRIORITY_USER;
+        }
+    }
+
+    static const char* priorityName(Priority priority) {
+        switch (priority) {
+            case PRIORITY_ADMIN: return "admin";
+            case PRIORITY_USER: return "user";
+            case PRIORITY_BACKGROUND: return "background";
+        }
+        return "unknown";
+    }
+};
+
+// 任务的二进制编码，用于任务日志。只保存处理任务时用到的字段：
+// 用户、会话、文本、说明文字、相册 ID、媒体（类型和 file_id）、被回复消息（一层）、回调查询。
+class TaskCodec {
+private:
+    enum Media : uint8_t { NONE, PHOTO, VIDEO, DOCUMENT, AUDIO, ANIMATION, VOICE, STICKER, VIDEO_NOTE };
+
+    static void putSigned(std::string& out, int64_t value) {
+        putVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63)); // zigzag
+    }
+
+    static void putString(std::string& out, const std::string& value) {
+        putVarint(out, value.size());
+        out.append(value);
+    }
+
+    struct Reader {
+        const char* p;
+        const char* end;
+        bool ok = true;
+
+        uint64_t varint() {
+            uint64_t value = 0;
+            if (ok && !getVarint(p, end, value)) ok = false;
+            return value;
+        }
+
+        int64_t signedVarint() {
+            uint64_t value = varint();
+            return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+        }
+
+        std::string string() {
+            uint64_t size = varint();
+            if (!ok || size > static_cast<uint64_t>(end - p)) {
+                ok = false;
+                return std::string();
+            }
+            std::string value(p, static_cast<size_t>(size));
+            p += size;
+            return value;
+        }
+    };
+
+    static void putUser(std::string& out, const TgBot::User::Ptr& user) {
+        putVarint(out, user ? 1 : 0);
+        if (!user) return;
+        putSigned(out, user->id);
+        putVarint(out, user->isBot ? 1 : 0);
+        putString(out, user->firstName);
+        putString(out, user->lastName);
+        putString(out, user->username);
+    }
+
+    static TgBot::User::Ptr getUser(Reader& in) {
+        if (!in.varint()) return nullptr;
+        auto user = std::make_shared<TgBot::User>();
+        user->id = in.signedVarint();
+        user->isBot = in.varint() != 0;
+        user->firstName = in.string();
+        user->lastName = in.string();
+        user->username = in.string();
+        return user;
+    }
+
+    static void putMedia(std::string& out, const TgBot::Message::Ptr& message) {
+        Media type = NONE;
+        std::string fileId;
+        std::string fileName;
+        if (!message->photo.empty()) {
+            type = PHOTO;
+            fileId = message->photo.back()->fileId;
+        } else if (message->video) {
+            type = VIDEO;
+            fileId = message->video->fileId;
+        } else if (message->document) {
+            type = DOCUMENT;
+            fileId = message->document->fileId;
+            fileName = message->document->fileName;
+        } else if (message->audio) {
+            type = AUDIO;
+            fileId = message->audio->fileId;
+        } else if (message->animation) {
+            type = ANIMATION;
+            fileId = message->animation->fileId;
+        } else if (message->voice) {
+            type = VOICE;
+            fileId = message->voice->fileId;
+        } else if (message->sticker) {
+            type = STICKER;
+            fileId = message->sticker->fileId;
+        } else if (message->videoNote) {
+            type = VIDEO_NOTE;
+            fileId = message->videoNote->fileId;
+        }
+        putVarint(out, type);
+        if (type == NONE) return;
+        putString(out, fileId);
+        if (type == DOCUMENT) putString(out, fileName);
+    }
+
+    template <typename T>
+    static std::shared_ptr<T> withFileId(const std::string& fileId) {
+        auto media = std::make_shared<T>();
+        media->fileId = fileId;
+        return media;
+    }
+
+    static void getMedia(Reader& in, TgBot::Message& message) {
+        uint64_t type = in.varint();
+        if (type == NONE) return;
+        std::string fileId = in.string();
+        switch (type) {
+            case PHOTO: message.photo.push_back(withFileId<TgBot::PhotoSize>(fileId)); break;
+            case VIDEO: message.video = withFileId<TgBot::Video>(fileId); break;
+            case DOCUMENT:
+                message.document = withFileId<TgBot::Document>(fileId);
+                message.document->fileName = in.string();
+                break;
+            case AUDIO: message.audio = withFileId<TgBot::Audio>(fileId); break;
+            case ANIMATION: message.animation = withFileId<TgBot::Animation>(fileId); break;
+            case VOICE: message.voice = withFileId<TgBot::Voice>(fileId); break;
+            case STICKER: message.sticker = withFileId<TgBot::Sticker>(fileId); break;
+            case VIDEO_NOTE: message.videoNote = withFileId<TgBot::VideoNote>(fileId); break;
+            default: in.ok = false; break;
+        }
+    }
+
+    static void putMessage(std::string& out, const TgBot::Message::Ptr& message, bool withReply = true) {
+        putVarint(out, message ? 1 : 0);
+        if (!message) return;
+        putSigned(out, message->messageId);
+        putVarint(out, message->date);
+        putSigned(out, message->chat->id);
+        putVarint(out, static_cast<uint8_t>(message->chat->type));
+        putUser(out, message->from);
+        putString(out, message->text);
+        putString(out, message->caption);
+        putString(out, message->mediaGroupId);
+        putMedia(out, message);
+        putMessage(out, withReply ? message->replyToMessage : nullptr, false);
+    }
+
+    static TgBot::Message::Ptr getMessage(Reader& in) {
+        if (!in.varint()) return nullptr;
+        auto message = std::make_shared<TgBot::Message>();
+        message->messageId = static_cast<int32_t>(in.signedVarint());
+        message->date = static_cast<uint32_t>(in.varint());
+        message->chat = std::make_shared<TgBot::Chat>();
+        message->chat->id = in.signedVarint();
+        message->chat->type = static_cast<TgBot::Chat::Type>(in.varint());
+        message->from = getUser(in);
+        message->text = in.string();
+        message->caption = in.string();
+        message->mediaGroupId = in.string();
+        getMedia(in, *message);
+        if (in.ok) message->replyToMessage = getMessage(in);
+        return message;
+    }
+
+public:
+    static void encode(const MessageTask& task, std::string& out) {
+        putVarint(out, task.type);
+        putSigned(out, task.targetUserId);
+        putSigned(out, task.adminChatId);
+        putString(out, task.text);
+        putMessage(out, task.message);
+        putVarint(out, task.callbackQuery ? 1 : 0);
+        if (task.callbackQuery) {
+            putString(out, task.callbackQuery->id);
+            putUser(out, task.callbackQuery->from);
+            putString(out, task.callbackQuery->data);
+            putMessage(out, task.callbackQuery->message);
+        }
+        putVarint(out, task.album.size());
+        for (const auto& item : task.album) {
+            putMessage(out, item);
+        }
+    }
+
+    static bool decode(const std::string& data, MessageTask& task) {
+        Reader in{data.data(), data.data() + data.size()};
+        uint64_t type = in.varint();
+        if (type >= MessageTask::TYPE_COUNT) return false;
+        task.type = static_cast<MessageTask::Type>(type);
+        task.targetUserId = in.signedVarint();
+        task.adminChatId = in.signedVarint();
+        task.text = in.string();
+        task.message = getMessage(in);
+        if (in.varint()) {
+            task.callbackQuery = std::make_shared<TgBot::CallbackQuery>();
+            task.callbackQuery->id = in.string();
+            task.callbackQuery->from = getUser(in);
+            task.callbackQuery->data = in.string();
+            task.callbackQuery->message = getMessage(in);
+        }
+        uint64_t albumSize = in.varint();
+        for (uint64_t i = 0; i < albumSize && in.ok; ++i) {
+            task.album.push_back(getMessage(in));
+        }
+        return in.ok;
+    }
+};
+
+// 任务溢出文件：某个分片某一优先级的队列已满时，该分片该优先级的后续任务按顺序追加到文件（各分片共用一个文件），
+// 队列回落后由工作线程按顺序读回。文件只在本次运行内有效（启动时清空），
+// 启用任务日志时溢出的任务同样记录在日志中，崩溃后可恢复。
+// 不给文件名时记录暂存在内存中：TASK_SHED_POLICY=wait（或溢出文件无法创建）时，接收线程以外的线程不能等待，
+// 它们产生的任务放在这里。
+// 记录格式：[u32 长度][u64 日志序号][i64 入队时间][TaskCodec 编码]
+class SpillQueue {
+private:
+    std::string path; // 为空时记录保存在内存中
+    int fd = -1;
+    std::string memory;
+    uint64_t readOffset = 0;
+    uint64_t writeOffset = 0;
+    std::atomic<size_t> count{0};
+
+    enum { HEADER_BYTES = 20 };
+
+    static bool preadFully(int fd, char* data, size_t size, uint64_t offset) {
+        while (size > 0) {
+            ssize_t n = ::pread(fd, data, size, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+    static bool pwriteFully(int fd, const char* data, size_t size, uint64_t offset) {
+        while (size > 0) {
+            ssize_t n = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+        return true;
+    }
+
+    bool readAt(char* data, size_t size, uint64_t offset) {
+        if (inMemory()) {
+            if (offset + size > memory.size()) return false;
+            std::memcpy(data, memory.data() + offset, size);
+            return true;
+        }
+        return preadFully(fd, data, size, offset);
+    }
+
+    bool writeAt(const std::string& record, uint64_t offset) {
+        if (inMemory()) {
+            memory.resize(offset);
+            memory += record;
+            return true;
+        }
+        return pwriteFully(fd, record.data(), record.size(), offset);
+    }
+
+    void clear() {
+        readOffset = writeOffset = 0;
+        if (inMemory()) {
+            std::string().swap(memory);
+        } else if (::ftruncate(fd, 0) != 0) {
+            // 截断失败只影响磁盘占用，之后从头覆盖写入
+        }
+    }
+
+public:
+    // 追加、读回和"是否有溢出任务"的判断在同一把锁下进行，保证同一优先级内的顺序
+    std::mutex mutex;
+
+    // file 为空时不写磁盘，记录暂存在内存中
+    explicit SpillQueue(const std::string& file) : path(file) {}
+
+    SpillQueue(const SpillQueue&) = delete;
+    SpillQueue& operator=(const SpillQueue&) = delete;
+
+    ~SpillQueue() {
+        if (fd >= 0) {
+            ::close(fd);
+            ::unlink(path.c_str());
+        }
+    }
+
+    bool open() {
+        if (inMemory()) return true;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return fd >= 0;
+    }
+
+    bool inMemory() const { return path.empty(); }
+
+    size_t size() const { return count.load(); }
+
+    // 以下调用方持有 mutex
+    bool push(const MessageTask& task) {
+        std::string record(HEADER_BYTES, '\0');
+        TaskCodec::encode(task, record);
+        uint32_t length = static_cast<uint32_t>(record.size() - 4);
+        int64_t enqueuedAt = task.enqueuedAt.time_since_epoch().count();
+        std::memcpy(&record[0], &length, 4);
+        std::memcpy(&record[4], &task.journalSeq, 8);
+        std::memcpy(&record[12], &enqueuedAt, 8);
+        if (!writeAt(record, writeOffset)) return false;
+        writeOffset += record.size();
+        count.fetch_add(1);
+        return true;
+    }
+
+    // 读出最早的任务但不移除，成功放入队列后再以 recordBytes 调用 pop；无法解码的记录直接跳过
+    bool front(MessageTask& task, uint64_t& recordBytes) {
+        while (readOffset < writeOffset) {
+            char header[HEADER_BYTES];
+            uint32_t length = 0;
+            if (!readAt(header, sizeof(header), readOffset)) return false;
+            std::memcpy(&length, header, 4);
+            if (length + 4 < HEADER_BYTES || readOffset + length + 4 > writeOffset) {
+                // 长度损坏，之后的记录无法定位，全部丢弃
+                count.store(0);
+                clear();
+                return false;
+            }
+            std::string data(length + 4 - HEADER_BYTES, '\0');
+            if (readAt(&data[0], data.size(), readOffset + HEADER_BYTES) && TaskCodec::decode(data, task)) {
+                int64_t enqueuedAt;
+                std::memcpy(&task.journalSeq, header + 4, 8);
+                std::memcpy(&enqueuedAt, header + 12, 8);
+                task.enqueuedAt = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(enqueuedAt));
+                recordBytes = length + 4;
+                return true;
+            }
+            pop(length + 4);
+        }
+        return false;
+    }
+
+    void pop(uint64_t recordBytes) {
+        readOffset += recordBytes;
+        count.fetch_sub(1);
+        if (readOffset >= writeOffset) {
+            // 全部读回后清空
+            clear();
+        }
+    }
+};
+
+// 发出了异步请求的任务（见 ForwardBot::requestAsync）。处理它的工作线程和每个未完成的请求各持有一份，
+// 全部释放后任务才算完成；请求完成后的续体回到工作线程上执行
+struct AsyncTask {
+    uint64_t journalSeq = 0;
+    uint64_t traceId = 0;
+    std::atomic<int> holds{1};
+};
+
+// 任务分片：同一会话的任务总是进入同一分片，分片同一时刻只被一个工作线程持有，
+// 因此会话内按入队顺序处理；工作线程优先处理自己的分片，空闲时认领其他分片。
+// 每个优先级各有一个队列，持有分片时按权重轮询（赤字轮询）取任务。
+// 任务的异步请求未完成时分片暂停：工作线程放下分片去处理别的分片，
+// 最后一个请求完成时分片重新可认领，认领者先执行续体和暂存的任务，再取新任务
+struct TaskShard {
+    std::unique_ptr<MpmcQueue<MessageTask>> queues[MessageTask::PRIORITY_COUNT];
+    std::atomic<bool> owned{false};
+    // 轮询状态，只由持有分片的线程访问
+    int cursor = 0;
+    int deficit[MessageTask::PRIORITY_COUNT] = {};
+    // 暂停中的任务和同批取出、排在它之后的任务，只由持有分片的线程访问
+    std::unique_ptr<AsyncTask> waiting;
+    std::deque<MessageTask> deferred;
+    std::atomic<size_t> deferredCount{0};
+    // 已完成请求的续体，由 HTTP 线程加入
+    std::mutex resumeMutex;
+    std::vector<std::function<void()>> resumed;
+    std::atomic<size_t> resumedCount{0};
+    // 各优先级溢出到文件、尚未读回的本分片任务数；非 0 时本分片的新任务也进溢出文件，排在其后
+    std::atomic<size_t> spilled[MessageTask::PRIORITY_COUNT] = {};
+
+    explicit TaskShard(const size_t* capacities) {
+        for (int p = 0; p < MessageTask::PRIORITY_COUNT; ++p) {
+            queues[p].reset(new MpmcQueue<MessageTask>(capacities[p]));
+        }
+    }
+
+    bool tryClaim() {
+        bool expected = false;
+        return !owned.load() && owned.compare_exchange_strong(expected, true);
+    }
+
+    void release() { owned.store(false); }
+
+    size_t sizeApprox() const {
+        size_t total = deferredCount.load() + resumedCount.load();
+        for (const auto& queue : queues) {
+            total += queue->sizeApprox();
+        }
+        return total;
+    }
+
+    // 每个优先级每轮最多取 weights[p] 个；批次取满时停在当前优先级，下次继续用完剩余额度
+    size_t popWeighted(MessageTask* out, size_t max, const int* weights) {
+        size_t n = 0;
+        int empty = 0; // 连续取不到任务的优先级数
+        while (n < max && empty < MessageTask::PRIORITY_COUNT) {
+            if (deficit[cursor] <= 0) deficit[cursor] += weights[cursor];
+            size_t want = std::min(static_cast<size_t>(deficit[cursor]), max - n);
+            size_t got = queues[cursor]->popBatch(out + n, want);
+            n += got;
+            if (got < want) {
+                // 队列已空，不保留额度
+                deficit[cursor] = 0;
+                empty = got == 0 ? empty + 1 : 0;
+                cursor = (cursor + 1) % MessageTask::PRIORITY_COUNT;
+                continue;
+            }
+            empty = 0;
+            deficit[cursor] -= static_cast<int>(got);
+            if (deficit[cursor] > 0) break;
+            cursor = (cursor + 1) % MessageTask::PRIORITY_COUNT;
+        }
+        return n;
+    }
+};
+
+// 全部任务分片和各优先级的溢出队列，会话键决定任务进入哪个分片。某个分片某一优先级的队列满时：
+// 有溢出队列（spill 的溢出文件，wait 时内存中的暂存）就把该分片该优先级的后续任务按顺序放进去，
+// 队列回落后由 refill 读回；没有溢出队列（reject）时拒绝。
+// wait 时接收线程不放入暂存而是等待（push 返回 FULL），其他线程不能等待，否则工作线程和定时线程可能互相等待
+struct TaskQueues {
+    enum Result {
+        QUEUED,
+        SPILLED,
+        FULL, // 接收线程稍后重试
+        REJECTED, // 队列已满且没有溢出队列
+        SPILL_FAILED, // 写入溢出文件失败
+    };
+
+    std::vector<std::unique_ptr<TaskShard>> shards;
+    std::atomic<int64_t> pending{0};
+    std::atomic<int64_t> pendingByPriority[MessageTask::PRIORITY_COUNT] = {};
+    size_t capacity[MessageTask::PRIORITY_COUNT] = {};
+    int weight[MessageTask::PRIORITY_COUNT] = {};
+    std::unique_ptr<SpillQueue> spills[MessageTask::PRIORITY_COUNT];
+
+    // 会话键：同一用户/会话的任务映射到同一分片
+    static int64_t taskKey(const MessageTask& task) {
+        switch (task.type) {
+            case MessageTask::REPLY_TO_USER:
+            case MessageTask::SEND_TEXT:
+            case MessageTask::REPLY_ALBUM:
+            case MessageTask::HANDOFF_CONVERSATION:
+                return task.targetUserId;
+            case MessageTask::HANDLE_CALLBACK:
+                // 按钮对应的用户在接收时已查出，与该用户的其他任务同一分片
+                if (task.targetUserId != 0) {
+                    return task.targetUserId;
+                }
+                if (task.callbackQuery->message) {
+                    return task.callbackQuery->message->messageId;
+                }
+                return static_cast<int64_t>(std::hash<std::string>()(task.callbackQuery->id));
+            default:
+                return task.message->from ? task.message->from->id : task.message->chat->id;
+        }
+    }
+
+    TaskShard& shardFor(const MessageTask& task) {
+        uint64_t h = static_cast<uint64_t>(taskKey(task)) * 0x9E3779B97F4A7C15ULL;
+        return *shards[(h >> 32) % shards.size()];
+    }
+
+    // 放入任务所在分片的队列；intake 为接收线程。只有 QUEUED 和 SPILLED 时取走了 task
+    Result push(MessageTask& task, bool intake) {
+        MessageTask::Priority priority = MessageTask::priorityOf(task.type);
+        TaskShard& shard = shardFor(task);
+        MpmcQueue<MessageTask>& queue = *shard.queues[priority];
+        SpillQueue* spill = spills[priority].get();
+        if (!spill) {
+            if (!queue.tryPush(std::move(task))) return REJECTED;
+        } else if (intake && spill->inMemory()) {
+            // 排在分片中暂存的任务之后
+            std::lock_guard<std::mutex> lock(spill->mutex);
+            if (shard.spilled[priority].load() > 0 || !queue.tryPush(std::move(task))) return FULL;
+        } else if (shard.spilled[priority].load() > 0 || !queue.tryPush(std::move(task))) {
+            // 只有目标分片已满才溢出；该分片已有溢出任务时新任务排在其后，保持会话内的顺序。
+            // 其他分片的任务照常入队，不受一个繁忙会话的影响
+            std::lock_guard<std::mutex> lock(spill->mutex);
+            if (shard.spilled[priority].load() > 0 || !queue.tryPush(std::move(task))) {
+                if (!spill->push(task)) return SPILL_FAILED;
+                shard.spilled[priority].fetch_add(1);
+                return SPILLED;
+            }
+        }
+        pending.fetch_add(1);
+        pendingByPriority[priority].fetch_add(1);
+        return QUEUED;
+    }
+
+    // 队列回落到容量一半以下时，把溢出的任务按顺序读回，返回读回的任务数
+    size_t refill() {
+        size_t moved = 0;
+        for (int p = 0; p < MessageTask::PRIORITY_COUNT; ++p) {
+            SpillQueue* spill = spills[p].get();
+            if (!spill || spill->size() == 0) continue;
+            std::unique_lock<std::mutex> lock(spill->mutex, std::try_to_lock);
+            if (!lock.owns_lock()) continue;
+
+            MessageTask task;
+            uint64_t recordBytes = 0;
+            while (pendingByPriority[p].load() < static_cast<int64_t>(capacity[p] / 2) &&
+                   spill->front(task, recordBytes)) {
+                TaskShard& shard = shardFor(task);
+                if (!shard.queues[p]->tryPush(std::move(task))) break;
+                spill->pop(recordBytes);
+                shard.spilled[p].fetch_sub(1);
+                pending.fetch_add(1);
+                pendingByPriority[p].fetch_add(1);
+                ++moved;
+            }
+            if (spill->size() == 0) {
+                // 无法解码而跳过的记录不会逐个扣减计数，溢出文件读空时统一清零
+                for (const auto& shard : shards) {
+                    shard->spilled[p].store(0);
+                }
+            }
+        }
+        return moved;
+    }
+
+    size_t spilled() const {
+        size_t total = 0;
+        for (const auto& spill : spills) {
+            if (spill) total += spill->size();
+        }
+        return total;
+    }
+};
+
+// 按 Telegram 的计数方式（UTF-16 码元）估算长度
+static size_t telegramLength(const std::string& text) {
+    size_t length = 0;
+    for (unsigned char c : text) {
+        if ((c & 0xC0) != 0x80) ++length;
+        if ((c & 0xF8) == 0xF0) ++length; // 四字节字符占两个码元
+    }
+    return length;
+}
+
+// 收集中的相册和连续文字消息：相册按 chatId:media_group_id 收集，文字（COALESCE_WINDOW_MS > 0）按用户合并。
+// 只保存状态和判断规则，不加锁也不读时钟：调用方持锁传入当前时间，把 ready 中的任务依次入队，
+// 并在返回的时刻再次检查。同一会话内保持到达顺序：收集文字前先送出该会话的相册，
+// 新相册或不能合并的消息到达前先送出此前的相册和文字（flushChat）
+class MessageCoalescer {
+public:
+    typedef std::chrono::steady_clock Clock;
+    enum { MAX_ALBUM_ITEMS = 10 }; // sendMediaGroup 一次最多 10 项
+    enum { MAX_MERGED_LENGTH = 3500 }; // 合并后的文字长度上限，为消息头留出余量（单条消息最多 4096 字符）
+
+    struct Limits {
+        int albumWindowMs = 1000; // 相册最后一项到达后等待多久
+        int windowMs = 0; // 连续文字的合并窗口
+        int maxDelayMs = 5000; // 第一条文字最多等待多久
+        int maxMessages = 10; // 最多合并的文字条数
+    };
+
+    // 收集完成、可以入队的任务
+    struct Ready {
+        MessageTask task;
+        size_t count = 0; // 合并的文字条数或相册项数
+        std::vector<uint64_t> journalSeqs; // 各条消息单独写入任务日志的序号，任务入队后标记完成
+    };
+
+    // 每条消息收集时以单条任务写入任务日志，返回序号（0 为未写入）
+    typedef std::function<uint64_t (const MessageTask& task)> Journal;
+
+    explicit MessageCoalescer(const Limits& limits, Journal journal = Journal())
+        : limits(limits), journal(std::move(journal)) {}
+
+    static std::string albumKey(const TgBot::Message::Ptr& message) {
+        return std::to_string(message->chat->id) + ":" + message->mediaGroupId;
+    }
+
+    // 收集相册中的一项：同一会话的上一个相册先放入 ready，收满 MAX_ALBUM_ITEMS 项时整个相册放入 ready。
+    // 返回 true 表示这是新相册的第一项，调用方应在 albumWindowMs 后 flushAlbum
+    bool addAlbumItem(TgBot::Message::Ptr message, int64_t targetUserId, Clock::time_point now,
+                      std::vector<Ready>& ready) {
+        int64_t chatId = message->chat->id;
+        std::string key = albumKey(message);
+        auto chat = chatAlbums.find(chatId);
+        if (chat != chatAlbums.end() && chat->second != key) {
+            flushAlbum(chat->second, now, true, ready);
+        }
+        PendingAlbum& album = pendingAlbums[key];
+        bool first = album.items.empty();
+        if (first) {
+            chatAlbums[chatId] = key;
+            album.targetUserId = targetUserId;
+        }
+        appendAlbumItem(album, std::move(message), now);
+        if (album.items.size() >= MAX_ALBUM_ITEMS) {
+            flushAlbum(key, now, true, ready);
+            return false;
+        }
+        return first;
+    }
+
+    // 把一项并入正在收集的同一相册（沿用相册的接收者），相册不存在时返回 false
+    bool joinAlbum(TgBot::Message::Ptr message, Clock::time_point now, std::vector<Ready>& ready) {
+        std::string key = albumKey(message);
+        auto it = pendingAlbums.find(key);
+        if (it == pendingAlbums.end()) return false;
+        appendAlbumItem(it->second, std::move(message), now);
+        if (it->second.items.size() >= MAX_ALBUM_ITEMS) {
+            flushAlbum(key, now, true, ready);
+        }
+        return true;
+    }
+
+    // 把文字并入用户正在收集的连续消息，会话中收集的相册先放入 ready。合并后超过 MAX_MERGED_LENGTH 时
+    // 先放入已收集的部分，条数达到 maxMessages 时整批放入 ready。
+    // 返回 true 表示开始了新的一批，调用方应在 windowMs 后 flushBurst
+    bool addText(TgBot::Message::Ptr message, Clock::time_point now, std::vector<Ready>& ready) {
+        int64_t userId = message->from->id;
+        flushChatAlbum(message->chat->id, ready);
+        auto it = bursts.find(userId);
+        if (it != bursts.end() && telegramLength(mergeText(it->second.text, message->text)) > MAX_MERGED_LENGTH) {
+            flushBurst(userId, now, true, ready);
+            it = bursts.end();
+        }
+        bool first = it == bursts.end();
+        if (first) {
+            it = bursts.emplace(userId, PendingBurst()).first;
+            it->second.firstItem = now;
+        }
+        PendingBurst& burst = it->second;
+        MessageTask single;
+        single.type = MessageTask::FORWARD_TO_ADMIN;
+        single.message = message;
+        record(burst.journalSeqs, single);
+        burst.text = mergeText(burst.text, message->text);
+        burst.last = std::move(message);
+        burst.lastItem = now;
+        ++burst.count;
+        if (burst.count >= static_cast<size_t>(std::max(1, limits.maxMessages))) {
+            flushBurst(userId, now, true, ready);
+            return false;
+        }
+        return first;
+    }
+
+    // 相册最后一项到达后 albumWindowMs 内没有新项时放入 ready，否则返回下次检查的时刻；force 时立即放入。
+    // 相册已不存在或已放入时返回 Clock::time_point()
+    Clock::time_point flushAlbum(const std::string& key, Clock::time_point now, bool force, std::vector<Ready>& ready) {
+        auto it = pendingAlbums.find(key);
+        if (it == pendingAlbums.end()) return Clock::time_point();
+        auto quietUntil = it->second.lastItem + std::chrono::milliseconds(limits.albumWindowMs);
+        if (!force && now < quietUntil) return quietUntil;
+
+        Ready out;
+        out.task.type = it->second.targetUserId != 0 ? MessageTask::REPLY_ALBUM : MessageTask::FORWARD_ALBUM;
+        out.task.targetUserId = it->second.targetUserId;
+        out.task.album = std::move(it->second.items);
+        out.task.message = out.task.album.front();
+        out.count = out.task.album.size();
+        out.journalSeqs = std::move(it->second.journalSeqs);
+        pendingAlbums.erase(it);
+        auto chat = chatAlbums.find(out.task.message->chat->id);
+        if (chat != chatAlbums.end() && chat->second == key) {
+            chatAlbums.erase(chat);
+        }
+        ready.push_back(std::move(out));
+        return Clock::time_point();
+    }
+
+    // 窗口内没有新消息、或第一条已等待 maxDelayMs 时合并放入 ready，否则返回下次检查的时刻；force 时立即放入
+    Clock::time_point flushBurst(int64_t userId, Clock::time_point now, bool force, std::vector<Ready>& ready) {
+        auto it = bursts.find(userId);
+        if (it == bursts.end()) return Clock::time_point();
+        auto quietUntil = std::min(it->second.lastItem + std::chrono::milliseconds(limits.windowMs),
+                                   it->second.firstItem + std::chrono::milliseconds(limits.maxDelayMs));
+        if (!force && now < quietUntil) return quietUntil;
+
+        Ready out;
+        out.task = mergedForward(it->second.last, std::move(it->second.text), it->second.count);
+        out.count = it->second.count;
+        out.journalSeqs = std::move(it->second.journalSeqs);
+        bursts.erase(it);
+        ready.push_back(std::move(out));
+        return Clock::time_point();
+    }
+
+    void flushChatAlbum(int64_t chatId, std::vector<Ready>& ready) {
+        auto chat = chatAlbums.find(chatId);
+        if (chat != chatAlbums.end()) {
+            std::string key = chat->second;
+            flushAlbum(key, Clock::time_point(), true, ready);
+        }
+    }
+
+    // 会话中收集的相册和用户收集的文字立即放入 ready，随后的消息排在它们之后。
+    // 相册总是早于收集中的文字（addText 先送出相册），所以先放相册
+    void flushChat(int64_t chatId, int64_t userId, std::vector<Ready>& ready) {
+        flushChatAlbum(chatId, ready);
+        flushBurst(userId, Clock::time_point(), true, ready);
+    }
+
+    // 停机时全部放入 ready
+    void flushAll(std::vector<Ready>& ready) {
+        while (!pendingAlbums.empty()) {
+            std::string key = pendingAlbums.begin()->first;
+            flushAlbum(key, Clock::time_point(), true, ready);
+        }
+        while (!bursts.empty()) {
+            flushBurst(bursts.begin()->first, Clock::time_point(), true, ready);
+        }
+    }
+
+    size_t albumCount() const { return pendingAlbums.size(); }
+    size_t burstCount() const { return bursts.size(); }
+
+    // 合并的文字消息之间的分隔，每条消息各占一段
+    static std::string mergeText(const std::string& merged, const std::string& text) {
+        return merged.empty() ? text : merged + "\n💭 " + text;
+    }
+
+    // 多条文字消息合并后的转交任务，沿用最后一条的发送者和会话
+    static MessageTask mergedForward(const TgBot::Message::Ptr& last, std::string text, size_t count) {
+        MessageTask task;
+        task.type = MessageTask::FORWARD_TO_ADMIN;
+        if (count == 1 && text == last->text) {
+            task.message = last;
+        } else {
+            auto merged = std::make_shared<TgBot::Message>(*last);
+            merged->text = std::move(text);
+            task.message = std::move(merged);
+        }
+        return task;
+    }
+
+private:
+    struct PendingAlbum {
+        std::vector<TgBot::Message::Ptr> items;
+        int64_t targetUserId = 0; // 管理员回复的相册发给谁；用户相册为 0
+        Clock::time_point lastItem;
+        std::vector<uint64_t> journalSeqs;
+    };
+
+    struct PendingBurst {
+        TgBot::Message::Ptr last; // 最后一条，合并后沿用其发送者和会话
+        std::string text;
+        size_t count = 0;
+        Clock::time_point firstItem;
+        Clock::time_point lastItem;
+        std::vector<uint64_t> journalSeqs;
+    };
+
+    void record(std::vector<uint64_t>& journalSeqs, const MessageTask& single) {
+        if (!journal) return;
+        uint64_t seq = journal(single);
+        if (seq != 0) journalSeqs.push_back(seq);
+    }
+
+    void appendAlbumItem(PendingAlbum& album, TgBot::Message::Ptr message, Clock::time_point now) {
+        MessageTask single;
+        single.type = album.targetUserId != 0 ? MessageTask::REPLY_ALBUM : MessageTask::FORWARD_ALBUM;
+        single.targetUserId = album.targetUserId;
+        single.message = message;
+        single.album.push_back(message);
+        record(album.journalSeqs, single);
+        album.items.push_back(std::move(message));
+        album.lastItem = now;
+    }
+
+    Limits limits;
+    Journal journal;
+    std::unordered_map<std::string, PendingAlbum> pendingAlbums;
+    std::unordered_map<int64_t, std::string> chatAlbums; // 会话 -> 正在收集的相册，每个会话同时至多一个
+    std::unordered_map<int64_t, PendingBurst> bursts; // userId -> 窗口内收到的文字
+};
+
+// 工作线程数的伸缩决策，本身不启动线程：定时线程每秒把负载交给 decide()，按返回的目标数增减线程。
+// 任务分片在启动时按线程数上限创建，运行中重新加载配置只能在启动时的上限以内调整范围
+class WorkerScaler {
+public:
+    enum { SHRINK_AFTER_IDLE_TICKS = 10 }; // 连续这么多次检查都空闲才收缩一个线程
+
+    struct Load {
+        int target = 0;          // 当前线程数
+        int busy = 0;            // 正在处理任务的线程数
+        int64_t backlog = 0;     // 排队（含溢出）的任务数
+        int64_t waitMicros = 0;  // 上次检查以来开始处理的任务的排队时间合计
+        int64_t waitSamples = 0;
+        int64_t inFlight = 0;    // 进行中的 Bot API 请求数
+        int64_t throttled = 0;   // 在出站限速处排队的请求数
+        int64_t maxInFlight = 0; // HTTP_MAX_IN_FLIGHT
+    };
+
+    explicit WorkerScaler(const Config& cfg) {
+        bounds(cfg, low, high);
+        ceiling = high;
+        threshold = std::max(1, cfg.workerScaleUpWaitMs);
+    }
+
+    // 未配置上下限时固定为 WORKER_THREADS
+    static void bounds(const Config& cfg, int& lower, int& upper) {
+        int initial = std::max(1, cfg.workerThreads);
+        lower = cfg.workerMinThreads > 0 ? cfg.workerMinThreads : initial;
+        upper = cfg.workerMaxThreads > 0 ? cfg.workerMaxThreads : initial;
+        upper = std::max(upper, lower);
+    }
+
+    // 重新加载配置时调整范围；超过启动时上限的部分截断到上限，返回 false 表示需要重启才能完全生效
+    bool configure(const Config& cfg) {
+        int nextLow, nextHigh;
+        bounds(cfg, nextLow, nextHigh);
+        threshold = std::max(1, cfg.workerScaleUpWaitMs);
+        low = std::min(nextLow, ceiling);
+        high = std::min(nextHigh, ceiling);
+        idleTicks = 0;
+        return nextHigh <= ceiling;
+    }
+
+    int min() const { return low; }
+    int max() const { return high; }
+    int maxAtStartup() const { return ceiling; }
+
+    // 启动时的线程数
+    int initial(const Config& cfg) const {
+        return std::max(low, std::min(high, std::max(1, cfg.workerThreads)));
+    }
+
+    // 返回新的目标线程数，与 load.target 相同表示不调整；调整时 reason 为写入日志的原因。
+    // 任务排队超过阈值且线程都在忙时扩容，持续空闲时逐个收缩；
+    // 出站请求在限速或 HTTP 并发上限处排队时，加线程只会让更多线程等待，不扩容
+    int decide(const Load& load, std::string& reason) {
+        int target = load.target;
+        if (target < low || target > high) {
+            idleTicks = 0;
+            reason = "配置变更";
+            return std::max(low, std::min(high, target));
+        }
+        if (low == high) return target;
+
+        int64_t avgWaitMs = load.waitSamples > 0 ? load.waitMicros / load.waitSamples / 1000 : 0;
+        bool saturated = load.backlog > 0 && load.busy >= target && (avgWaitMs >= threshold || load.waitSamples == 0);
+        bool apiBound = load.throttled >= target || load.inFlight >= load.maxInFlight;
+        if (saturated && !apiBound && target < high) {
+            idleTicks = 0;
+            reason = "排队 " + std::to_string(load.backlog) + " 个任务，平均等待 " + std::to_string(avgWaitMs) +
+                     " ms，进行中请求 " + std::to_string(load.inFlight);
+            return std::min(high, target + std::max(1, target / 4));
+        }
+
+        bool idle = avgWaitMs * 10 < threshold && load.busy * 2 < target;
+        idleTicks = idle ? idleTicks + 1 : 0;
+        if (idleTicks >= SHRINK_AFTER_IDLE_TICKS && target > low) {
+            idleTicks = 0;
+            reason = "空闲，忙碌线程 " + std::to_string(load.busy);
+            return target - 1;
+        }
+        return target;
+    }
+
+private:
+    int low = 1;
+    int high = 1;
+    int ceiling = 1; // 启动时的上限，任务分片按它创建
+    int64_t threshold = 1; // WORKER_SCALE_UP_WAIT_MS
+    int idleTicks = 0;
+};
+
+// 主机器人类
+class ForwardBot {
+private:
+    // 运行指标（须先于使用它的组件构造、后于它们析构）
+    Metrics metrics;
+    Metrics::Id taskWait[MessageTask::TYPE_COUNT];
+    Metrics::Id taskDuration[MessageTask::TYPE_COUNT];
+    Metrics::Id priorityWait[MessageTask::PRIORITY_COUNT];
+    Metrics::Id shedRejected[MessageTask::PRIORITY_COUNT];
+    Metrics::Id shedSpilled[MessageTask::PRIORITY_COUNT];
+    Metrics::Id pollCycle;
+    Metrics::Id webhookDispatch;
+    Metrics::Id intakeHandler;
+    std::atomic<int> busyWorkers{0};
+    std::unique_ptr<MetricsServer> metricsServer;
+    std::unique_ptr<WebhookServer> webhookServer;
+
+    // 异步请求完成时可能还要记录 span，因此放在 HTTP 客户端之前，最后释放
+    std::unique_ptr<SpanTracer> tracer;
+    Metrics::Id tracesSampled;
+
+    std::unique_ptr<TgBot::HttpClient> baseHttpClient;
+    std::unique_ptr<InstrumentedHttpClient> instrumentedHttpClient;
+    std::unique_ptr<RateLimitedHttpClient> httpClient;
+    std::unique_ptr<TgBot::Bot> bot;
+    int64_t adminId;
+    int64_t botUserId; // 机器人自身的用户 ID，即令牌冒号前的数字
+    Config config;
+    std::unique_ptr<Logger> logger;
+    
+    // 管理员池：会话分配和负载
+    AdminPool adminPool;
+
+    // 消息映射
+    ReplyRouteCache messageCache; // (管理员下标, messageId) -> (userId, username)
+    CountingMutex cacheMutex;
+    // 重启后仍可用的回复路由，按管理员下标各一个文件（各会话的消息 ID 独立递增，分开存放才保持有序）
+    std::vector<std::unique_ptr<MessageIndex>> messageIndexes;
+    
+    // 封禁用户列表
+    BanList bannedUsers;
+
+    // 用户登记表和广播
+    std::unique_ptr<UserRegistry> userRegistry;
+    std::string broadcastStatePath;
+    std::unique_ptr<BroadcastJob> broadcastJob; // 进行中的广播，由 broadcastMutex 保护
+    std::set<int64_t> broadcastInFlight; // 已提交、尚未完成的广播对象
+    std::vector<int64_t> broadcastUnreachable; // 待移出登记表的用户，由广播线程写文件，不占用 HTTP 事件循环
+    std::atomic<uint64_t> broadcastSent{0};
+    std::atomic<uint64_t> broadcastFailed{0};
+    std::atomic<uint64_t> broadcastRemoved{0};
+    std::mutex broadcastMutex;
+    std::mutex broadcastStartMutex; // 同时只处理一条 /broadcast
+    std::condition_variable broadcastCv;
+    std::thread broadcaster;
+    
+    // 按用户限流；coalesce 模式下超限的文字消息暂存，限流解除时合并为一条转交
+    std::unique_ptr<FloodGate> floodGate;
+    struct HeldMessages {
+        TgBot::Message::Ptr last; // 最后一条，合并后沿用其发送者和会话
+        std::string text;
+        size_t count = 0;
+        std::vector<uint64_t> journalSeqs; // 各条消息在任务日志中的序号，合并转交后标记完成
+    };
+    std::unordered_map<int64_t, HeldMessages> heldMessages;
+    enum { MAX_HELD_USERS = 4096 };
+    CountingMutex heldMutex;
+
+    // 正在收集的相册和连续文字消息（COALESCE_WINDOW_MS > 0 时合并）
+    std::unique_ptr<MessageCoalescer> coalescer;
+    CountingMutex coalesceMutex;
+    Metrics::Id burstMerged;
+    // 自动临时封禁：userId -> 解封时间（Unix 秒），保存在 BANNED_USERS_FILE.flood
+    std::map<int64_t, int64_t> floodBans;
+    CountingMutex floodBanMutex;
+    Metrics::Id floodDropped;
+    Metrics::Id floodCoalesced;
+    Metrics::Id floodBanned;
+    
+    // 回调查询记录
+    ExpiringSet processedCallbacks;
+    CountingMutex callbackMutex;
+
+    // 队列满被拒绝时已提示过的会话，每个会话每分钟最多提示一次
+    ExpiringSet busyNotices;
+    CountingMutex busyNoticeMutex;
+    
+    enum { MAX_CAPTION_LENGTH = 1024 }; // 媒体说明文字长度上限
+    TimerQueue timers;
+
+    // 会话历史和全文索引，供 /history 和 /search 查询
+    std::unique_ptr<MessageHistory> history;
+    Metrics::Id historyQuery;
+    std::unique_ptr<UpdateRecorder> recorder;
+    bool recorderStopNoted = false; // 只在定时线程上访问
+
+    // 任务日志：停机或崩溃后从中恢复未完成任务和长轮询 offset
+    std::unique_ptr<TaskJournal> taskJournal;
+    TaskJournal::Recovered recovered;
+
+    // 消息队列和工作线程
+    TaskQueues taskQueues;
+    IdleParking idleWorkers;
+    std::atomic<bool> stopWorkers{false};
+
+    // 工作线程池在 WorkerScaler 给出的范围内伸缩；下标不小于 workerTarget 的线程处理完手头一批后退出
+    struct WorkerSlot {
+        std::thread thread;
+        bool exited = false; // 线程函数已返回，可以 join 后复用该下标
+    };
+    std::vector<WorkerSlot> workerSlots; // 由 scaleMutex 保护
+    std::atomic<int> workerTarget{0};
+    std::mutex scaleMutex;
+    std::atomic<int64_t> waitMicros{0}; // 上次伸缩检查以来开始处理的任务的排队时间合计
+    std::atomic<int64_t> waitSamples{0};
+    Metrics::Id scaledUp;
+    Metrics::Id scaledDown;
+    Metrics::Id configReloads;
+
+    // 以下只在定时线程上访问（workerScaler 在构造时创建）
+    std::string configPath;
+    Config activeConfig; // 最近一次生效的配置，重新加载时与新配置比较
+    std::unique_ptr<WorkerScaler> workerScaler;
+
+    // 打开持久化消息索引：主管理员（ADMIN_ID）沿用 MESSAGE_INDEX_FILE，其他管理员在文件名后加会话 ID
+    void openMessageIndex() {
+        messageIndexes.resize(adminPool.size());
+        if (config.messageIndexFile.empty()) return;
+
+        for (size_t slot = 0; slot < adminPool.size(); ++slot) {
+            std::string file = config.messageIndexFile;
+            if (slot > 0) {
+                file += "." + std::to_string(adminPool.chatAt(slot));
+            }
+            auto index = std::make_unique<MessageIndex>(file, config.messageIndexMaxRecords);
+            if (!index->open()) {
+                logger->error("无法打开消息索引 " + file + "，重启后将无法回复旧消息");
+                continue;
+            }
+            logger->info("消息索引 " + file + " 已加载 " + std::to_string(index->size()) + " 条记录");
+            messageIndexes[slot] = std::move(index);
+        }
+    }
+
+    // 管理员会话中的消息在缓存中的键：高 32 位为管理员下标
+    static int64_t routeKey(int slot, int32_t messageId) {
+        return (static_cast<int64_t>(slot) << 32) | static_cast<uint32_t>(messageId);
+    }
+
+    // 管理员池：ADMIN_ID 在前，其后为 ADMIN_IDS
+    static std::vector<int64_t> adminChats(const Config& cfg) {
+        std::vector<int64_t> chats = {cfg.adminId};
+        chats.insert(chats.end(), cfg.adminIds.begin(), cfg.adminIds.end());
+        return chats;
+    }
+
+    bool isAdminChat(int64_t chatId) const {
+        return adminPool.slotOf(chatId) >= 0;
+    }
+
+    // 记录回复路由：adminChat 中的 messageId 对应 userId
+    void rememberReplyRoute(int64_t adminChat, int32_t messageId, int64_t userId, const std::string& username) {
+        SpanTracer::Timer span("reply_route_update");
+        int slot = adminPool.slotOf(adminChat);
+        if (slot < 0) return;
+        {
+            std::lock_guard<CountingMutex> lock(cacheMutex);
+            messageCache.put(routeKey(slot, messageId), userId, username);
+        }
+        if (messageIndexes[slot] && !messageIndexes[slot]->append(messageId, userId, username)) {
+            logger->warning("写入消息索引失败，重启后将无法回复消息 " + std::to_string(messageId));
+        }
+    }
+
+    // 查找回复路由，缓存未命中时查持久化索引并回填
+    bool lookupReplyRoute(int64_t adminChat, int32_t messageId, int64_t& userId, std::string* username = nullptr) {
+        SpanTracer::Timer span("reply_route_lookup");
+        int slot = adminPool.slotOf(adminChat);
+        if (slot < 0) return false;
+        {
+            std::lock_guard<CountingMutex> lock(cacheMutex);
+            if (messageCache.get(routeKey(slot, messageId), userId, username)) {
+                return true;
+            }
+        }
+
+        std::string name;
+        if (!messageIndexes[slot] || !messageIndexes[slot]->find(messageId, userId, name)) {
+            return false;
+        }
+
+        std::lock_guard<CountingMutex> lock(cacheMutex);
+        messageCache.put(routeKey(slot, messageId), userId, name);
+        if (username) {
+            *username = name;
+        }
+        return true;
+    }
+
+    // 打开任务日志，上次未完成的任务在工作线程启动后重新入队
+    void openTaskJournal() {
+        if (config.taskJournalFile.empty()) return;
+
+        auto journal = std::make_unique<TaskJournal>(config.taskJournalFile);
+        journal->setErrorHandler([this](const std::string& message) { logger->error(message); });
+        if (!journal->open(recovered)) {
+            logger->error("无法打开任务日志 " + config.taskJournalFile + "，停机时未处理的任务将丢失");
+            return;
+        }
+        taskJournal = std::move(journal);
+        logger->info("任务日志已打开，上次确认的 update offset " + std::to_string(recovered.offset) +
+                     "，待恢复任务 " + std::to_string(recovered.tasks.size()) + " 个");
+    }
+
+    void resumeJournaledTasks() {
+        if (!taskJournal) return;
+        size_t resumed = 0;
+        for (const std::string& data : recovered.tasks) {
+            MessageTask task;
+            if (!TaskCodec::decode(data, task)) {
+                logger->warning("跳过无法解析的任务日志记录");
+                continue;
+            }
+            addTask(std::move(task));
+            ++resumed;
+        }
+        recovered.tasks.clear();
+        taskJournal->releaseRecovered();
+        if (resumed > 0) {
+            logger->info("已恢复上次未完成的任务 " + std::to_string(resumed) + " 个");
+        }
+    }
+
+    // 加载封禁用户列表
+    void loadBannedUsers() {
+        if (!bannedUsers.load()) {
+            logger->error("无法打开封禁日志 " + config.bannedUsersFile + ".journal，封禁变更将无法保存");
+        }
+        logger->info("加载了 " + std::to_string(bannedUsers.size()) + " 个封禁用户");
+    }
+
+    // TASK_SHED_POLICY=spill：每个优先级一个溢出文件；无法创建时该优先级退回为等待。
+    // 等待只发生在接收线程上，工作线程、定时线程等产生的任务暂存在内存中，见 addTask
+    void openSpillQueues() {
+        if (config.taskShedPolicy == "reject") return;
+        for (int p = 0; p < MessageTask::PRIORITY_COUNT; ++p) {
+            if (config.taskShedPolicy == "spill") {
+                std::string file = config.taskSpillFile + "." +
+                                   MessageTask::priorityName(static_cast<MessageTask::Priority>(p));
+                taskQueues.spills[p] = std::make_unique<SpillQueue>(file);
+                if (taskQueues.spills[p]->open()) continue;
+                logger->error("无法创建溢出文件 " + file + "，该类任务队列满时将等待");
+            }
+            taskQueues.spills[p] = std::make_unique<SpillQueue>("");
+        }
+    }
+
+    // 接收更新的线程（长轮询、Webhook 服务线程）：队列满时只有它们可以等待，把压力传回 Telegram
+    static bool& intakeThread() {
+        static thread_local bool intake = false;
+        return intake;
+    }
+
+    // 加载用户登记表；未完成的广播在工作线程启动后继续
+    void openUserRegistry() {
+        if (config.userRegistryFile.empty()) return;
+
+        auto registry = std::make_unique<UserRegistry>(config.userRegistryFile);
+        if (!registry->load()) {
+            logger->error("无法打开用户登记表 " + config.userRegistryFile + "，新用户将不会保存");
+        }
+        logger->info("用户登记表已加载 " + std::to_string(registry->size()) + " 个用户");
+        userRegistry = std::move(registry);
+        broadcastStatePath = config.userRegistryFile + ".broadcast";
+
+        auto job = std::make_unique<BroadcastJob>();
+        if (job->load(broadcastStatePath)) {
+            if (job->reportChatId == 0) {
+                job->reportChatId = adminId;
+            }
+            logger->info("继续未完成的广播，已处理 " +
+                         std::to_string(job->sent + job->failed + job->removed) + "/" + std::to_string(job->total));
+            broadcastJob = std::move(job);
+        }
+    }
+
+    void openHistory() {
+        if (config.historyFile.empty()) return;
+
+        auto store = std::make_unique<MessageHistory>(config.historyFile, config.historyPerUser,
+                                                      config.historyMaxMb << 20);
+        if (!store->open()) {
+            logger->error("无法打开会话历史 " + config.historyFile + "，/history 和 /search 不可用");
+            return;
+        }
+        history = std::move(store);
+    }
+
+    void recordHistory(int64_t userId, MessageHistory::Direction direction, const std::string& text) {
+        if (history) history->append(userId, direction, text);
+    }
+
+    void openRecorder() {
+        if (config.traceRecordFile.empty()) return;
+
+        auto store = std::make_unique<UpdateRecorder>(config.traceRecordFile, config.traceRecordMaxMb << 20);
+        if (!store->open()) {
+            logger->error("无法创建录制文件 " + config.traceRecordFile);
+            return;
+        }
+        logger->info("正在录制收到的更新到 " + config.traceRecordFile);
+        recorder = std::move(store);
+    }
+
+    void openTracer() {
+        if (config.traceSpansFile.empty()) return;
+
+        SpanTracer::Format format = SpanTracer::CHROME;
+        if (config.traceSpansFormat == "binary") {
+            format = SpanTracer::BINARY;
+        } else if (config.traceSpansFormat != "chrome") {
+            logger->warning("未知的 TRACE_SPANS_FORMAT: " + config.traceSpansFormat + "，使用 chrome");
+        }
+        auto store = std::make_unique<SpanTracer>(config.traceSpansFile, format, config.traceSampleRate);
+        if (!store->open()) {
+            logger->error("无法创建追踪文件 " + config.traceSpansFile);
+            return;
+        }
+        logger->info("延迟追踪已开启，抽样比例 " + std::to_string(config.traceSampleRate) + "，输出到 " +
+                     config.traceSpansFile);
+        tracer = std::move(store);
+    }
+
+    // 任务所属的用户：用户发来的消息为发送者，发给用户的为目标用户
+    static int64_t traceUserOf(const MessageTask& task) {
+        if (task.callbackQuery && task.callbackQuery->from) return task.callbackQuery->from->id;
+        if (task.message && task.message->from) return task.message->from->id;
+        if (!task.album.empty() && task.album.front()->from) return task.album.front()->from->id;
+        return task.targetUserId;
+    }
+
+    // 在接收线程上录制一条消息（包括命令和被封禁用户的消息），只记类型、长度和编号
+    void recordIntake(const TgBot::Message::Ptr& message) {
+        if (!recorder || !message->from) return;
+        int slot = adminPool.slotOf(message->chat->id);
+        uint8_t flags = (slot >= 0 ? UpdateRecorder::ADMIN : 0) | (message->replyToMessage ? UpdateRecorder::REPLY : 0);
+        int64_t user = slot >= 0 ? slot : message->from->id;
+        if (!message->text.empty() && message->text[0] == '/') {
+            // 只保留命令名，去掉参数和 @机器人名
+            std::string name = message->text.substr(1, message->text.find_first_of(" @\n") - 1);
+            recorder->record(UpdateRecorder::COMMAND, flags, user, telegramLength(message->text),
+                             UpdateRecorder::NO_MEDIA, "", name);
+        } else if (!message->text.empty()) {
+            recorder->record(UpdateRecorder::TEXT, flags, user, telegramLength(message->text),
+                             UpdateRecorder::NO_MEDIA, "", "");
+        } else {
+            recorder->record(UpdateRecorder::MEDIA, flags, user, telegramLength(message->caption),
+                             UpdateRecorder::mediaOf(message), message->mediaGroupId, "");
+        }
+    }
+
+    void recordIntake(const TgBot::CallbackQuery::Ptr& query) {
+        if (!recorder || !query->from) return;
+        int64_t chatId = query->message ? query->message->chat->id : query->from->id;
+        int slot = adminPool.slotOf(chatId);
+        recorder->record(UpdateRecorder::CALLBACK, slot >= 0 ? UpdateRecorder::ADMIN : 0,
+                         slot >= 0 ? slot : query->from->id, 0, UpdateRecorder::NO_MEDIA, "",
+                         query->data.substr(0, query->data.find('_')));
+    }
+
+    // 检查用户是否被封禁（无锁）
+    bool isUserBanned(int64_t userId) {
+        return bannedUsers.contains(userId);
+    }
+
+    // 封禁用户（管理员手动封禁为永久封禁，覆盖自动临时封禁）；无法写入封禁日志时返回 false
+    bool banUser(int64_t userId) {
+        if (!bannedUsers.add(userId)) return false;
+        forgetFloodBan(userId);
+        return true;
+    }
+
+    // 解封用户；无法写入封禁日志时返回 false
+    bool unbanUser(int64_t userId) {
+        if (!bannedUsers.remove(userId)) return false;
+        forgetFloodBan(userId);
+        return true;
+    }
+
+    std::string floodBansPath() const {
+        return config.bannedUsersFile + ".flood";
+    }
+
+    // 调用方持有 floodBanMutex
+    void saveFloodBans() {
+        std::string tmp = floodBansPath() + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            for (const auto& ban : floodBans) {
+                out << ban.first << " " << ban.second << "\n";
+            }
+            if (!out) {
+                logger->error("无法保存临时封禁列表 " + floodBansPath());
+                return;
+            }
+        }
+        std::rename(tmp.c_str(), floodBansPath().c_str());
+    }
+
+    void forgetFloodBan(int64_t userId) {
+        std::lock_guard<CountingMutex> lock(floodBanMutex);
+        if (floodBans.erase(userId) > 0) {
+            saveFloodBans();
+        }
+    }
+
+    // 加载上次运行留下的临时封禁：已到期的立即解封，其余按剩余时间安排解封
+    void loadFloodBans() {
+        std::ifstream in(floodBansPath());
+        if (!in) return;
+        int64_t now = static_cast<int64_t>(std::time(nullptr));
+        int64_t userId;
+        int64_t until;
+        std::lock_guard<CountingMutex> lock(floodBanMutex);
+        while (in >> userId >> until) {
+            if (until <= now) {
+                if (!bannedUsers.remove(userId)) {
+                    logger->error("无法写入封禁日志，临时封禁到期的用户 " + std::to_string(userId) + " 未能解封");
+                }
+                continue;
+            }
+            floodBans[userId] = until;
+            scheduleFloodUnban(userId, until - now);
+        }
+        saveFloodBans();
+        if (!floodBans.empty()) {
+            logger->info("恢复了 " + std::to_string(floodBans.size()) + " 个临时封禁");
+        }
+    }
+
+    void scheduleFloodUnban(int64_t userId, int64_t seconds) {
+        timers.schedule(std::chrono::steady_clock::now() + std::chrono::seconds(seconds),
+                        [this, userId] { liftFloodBan(userId); });
+    }
+
+    // 到期解封；期间被手动解封、改为永久封禁或再次延长的跳过
+    void liftFloodBan(int64_t userId) {
+        {
+            std::lock_guard<CountingMutex> lock(floodBanMutex);
+            auto it = floodBans.find(userId);
+            if (it == floodBans.end() || it->second > static_cast<int64_t>(std::time(nullptr))) return;
+            floodBans.erase(it);
+            saveFloodBans();
+        }
+        if (!bannedUsers.remove(userId)) {
+            logger->error("无法写入封禁日志，临时封禁到期的用户 " + std::to_string(userId) + " 未能解封");
+            return;
+        }
+        logger->info("临时封禁到期，已解封用户 " + std::to_string(userId));
+    }
+
+    // 刷屏用户临时封禁，沿用封禁列表拦截，到期自动解封
+    void floodBan(int64_t userId, int64_t chatId) {
+        int seconds = std::max(1, config.floodBanSeconds);
+        if (!bannedUsers.add(userId)) {
+            logger->error("无法写入封禁日志，刷屏用户 " + std::to_string(userId) + " 未能临时封禁");
+            return;
+        }
+        {
+            std::lock_guard<CountingMutex> lock(floodBanMutex);
+            floodBans[userId] = static_cast<int64_t>(std::time(nullptr)) + seconds;
+            saveFloodBans();
+        }
+        scheduleFloodUnban(userId, seconds);
+        std::vector<uint64_t> dropped;
+        {
+            std::lock_guard<CountingMutex> lock(heldMutex);
+            auto it = heldMessages.find(userId);
+            if (it != heldMessages.end()) {
+                dropped = std::move(it->second.journalSeqs);
+                heldMessages.erase(it);
+            }
+        }
+        completeHeld(dropped); // 暂存的消息随封禁丢弃
+        metrics.add(floodBanned);
+
+        std::string duration = seconds >= 60 ? std::to_string(seconds / 60) + " 分钟" : std::to_string(seconds) + " 秒";
+        logger->warning("用户 " + std::to_string(userId) + " 刷屏，自动封禁 " + duration);
+        sendText(chatId, "🚫 您发送消息过于频繁，已被暂时限制 " + duration);
+        sendText(adminPool.ownerOf(userId), "🚫 用户 " + std::to_string(userId) + " 刷屏，已自动封禁 " + duration +
+                          "\n可用 /unban " + std::to_string(userId) + " 提前解封");
+    }
+
+    // 接收线程上的限流检查，放行返回 true。超限时按 FLOOD_ACTION 暂存（holdable 的文字消息）或丢弃，
+    // 每轮限流只提示用户一次；拒绝次数达到 FLOOD_BAN_STRIKES 时临时封禁
+    bool admitUserMessage(const TgBot::Message::Ptr& message, bool holdable) {
+        if (!floodGate) return true;
+        int64_t userId = message->from->id;
+        FloodGate::Verdict verdict = floodGate->admit(userId);
+        if (verdict.ban) {
+            floodBan(userId, message->chat->id);
+            return false;
+        }
+        // 已有暂存消息时，放行的文字消息也排在其后一起合并，保持顺序
+        bool coalesce = holdable && config.floodAction == "coalesce";
+        if (coalesce && holdMessage(message, !verdict.allowed, verdict.retryAfter)) {
+            if (!verdict.allowed && verdict.firstReject) {
+                sendText(message->chat->id, "⏳ 您发送消息过快，后续消息将合并后转交管理员");
+            }
+            return false;
+        }
+        if (verdict.allowed) {
+            flushHeld(userId); // 媒体等不能合并的消息放行前，先送出此前暂存的文字
+            return true;
+        }
+        metrics.add(floodDropped);
+        if (verdict.firstReject) {
+            sendText(message->chat->id, "⏳ 您发送消息过快，请稍后再发");
+        }
+        return false;
+    }
+
+    // 并入用户的暂存消息；没有暂存时仅在 create 为真时新建，并在 delay 后合并转交。返回是否已接管该消息
+    bool holdMessage(const TgBot::Message::Ptr& message, bool create, std::chrono::microseconds delay) {
+        int64_t userId = message->from->id;
+        std::lock_guard<CountingMutex> lock(heldMutex);
+        auto it = heldMessages.find(userId);
+        if (it == heldMessages.end()) {
+            if (!create || heldMessages.size() >= MAX_HELD_USERS) return false;
+            it = heldMessages.emplace(userId, HeldMessages()).first;
+            timers.schedule(std::chrono::steady_clock::now() + delay, [this, userId] { flushHeld(userId); });
+        }
+        HeldMessages& held = it->second;
+        std::string text = MessageCoalescer::mergeText(held.text, message->text);
+        if (telegramLength(text) > MessageCoalescer::MAX_MERGED_LENGTH) {
+            metrics.add(floodDropped); // 超出长度上限的部分丢弃
+            if (held.count == 0) heldMessages.erase(it);
+            return true;
+        }
+        held.text = std::move(text);
+        held.last = message;
+        ++held.count;
+        MessageTask single;
+        single.type = MessageTask::FORWARD_TO_ADMIN;
+        single.message = message;
+        uint64_t seq = journalHeld(single);
+        if (seq != 0) held.journalSeqs.push_back(seq);
+        metrics.add(floodCoalesced);
+        return true;
+    }
+
+    // 把用户的暂存消息合并为一条转交任务入队
+    void flushHeld(int64_t userId) {
+        MessageTask task;
+        size_t count;
+        std::vector<uint64_t> journalSeqs;
+        {
+            std::lock_guard<CountingMutex> lock(heldMutex);
+            auto it = heldMessages.find(userId);
+            if (it == heldMessages.end()) return;
+            task = MessageCoalescer::mergedForward(it->second.last, std::move(it->second.text), it->second.count);
+            count = it->second.count;
+            journalSeqs = std::move(it->second.journalSeqs);
+            heldMessages.erase(it);
+        }
+        flushPending(task.message); // 限流前收集的相册和连续消息先送出
+        addTask(std::move(task));
+        completeHeld(journalSeqs);
+        if (logger->isEnabled(LogLevel::DEBUG)) {
+            logger->debug("用户 " + std::to_string(userId) + " 限流期间的 " + std::to_string(count) + " 条消息已合并转交");
+        }
+    }
+
+    // 暂存中（限流合并、连续消息合并、相册收集）的消息接收时就以单条任务写入任务日志：它们所在更新的
+    // offset 随本批确认，崩溃时重启后逐条重放（不再合并）。合并后的任务入队（写入日志）后再标记这些记录完成
+    uint64_t journalHeld(const MessageTask& task) {
+        if (!taskJournal) return 0;
+        std::string data;
+        TaskCodec::encode(task, data);
+        return taskJournal->append(data);
+    }
+
+    void completeHeld(const std::vector<uint64_t>& journalSeqs) {
+        for (uint64_t seq : journalSeqs) {
+            completeJournal(seq);
+        }
+    }
+
+    // 把收集完成的相册和合并后的文字按顺序入队，随后标记其中各条消息的单条日志记录完成
+    void enqueueCoalesced(std::vector<MessageCoalescer::Ready>& ready) {
+        for (MessageCoalescer::Ready& item : ready) {
+            if (item.task.type == MessageTask::FORWARD_TO_ADMIN && item.count > 1) {
+                metrics.add(burstMerged, item.count - 1);
+            }
+            addTask(std::move(item.task));
+            completeHeld(item.journalSeqs);
+        }
+    }
+
+    // 把文字消息并入用户正在收集的连续消息，会话中此前收集的相册先入队。窗口内没有新消息、
+    // 第一条已等待 COALESCE_MAX_DELAY_MS、或条数达到 COALESCE_MAX_MESSAGES 时合并为一条转交；
+    // 合并后过长时先送出已收集的部分
+    void collectBurst(const TgBot::Message::Ptr& message) {
+        int64_t userId = message->from->id;
+        auto now = std::chrono::steady_clock::now();
+        std::vector<MessageCoalescer::Ready> ready;
+        bool first;
+        {
+            std::lock_guard<CountingMutex> lock(coalesceMutex);
+            first = coalescer->addText(message, now, ready);
+        }
+        enqueueCoalesced(ready);
+        if (first) {
+            timers.schedule(now + std::chrono::milliseconds(config.coalesceWindowMs),
+                            [this, userId] { flushBurst(userId); });
+        }
+    }
+
+    // 窗口内仍有新消息时顺延（不超过第一条到达后 COALESCE_MAX_DELAY_MS），否则合并入队；force 时立即入队
+    void flushBurst(int64_t userId, bool force = false) {
+        std::vector<MessageCoalescer::Ready> ready;
+        {
+            std::lock_guard<CountingMutex> lock(coalesceMutex);
+            auto next = coalescer->flushBurst(userId, std::chrono::steady_clock::now(), force, ready);
+            if (next != MessageCoalescer::Clock::time_point()) {
+                timers.schedule(next, [this, userId] { flushBurst(userId); });
+            }
+        }
+        enqueueCoalesced(ready);
+    }
+
+    // 用户此前仍在收集的相册和连续文字立即入队，随后的消息排在它们之后
+    void flushPending(const TgBot::Message::Ptr& message) {
+        std::vector<MessageCoalescer::Ready> ready;
+        {
+            std::lock_guard<CountingMutex> lock(coalesceMutex);
+            coalescer->flushChat(message->chat->id, message->from->id, ready);
+        }
+        enqueueCoalesced(ready);
+    }
+
+    // 停机时把收集中的相册和连续消息全部入队
+    void flushAllCoalesced() {
+        std::vector<MessageCoalescer::Ready> ready;
+        {
+            std::lock_guard<CountingMutex> lock(coalesceMutex);
+            coalescer->flushAll(ready);
+        }
+        enqueueCoalesced(ready);
+    }
+
+    // 停机时把暂存消息全部入队
+    void flushAllHeld() {
+        std::vector<int64_t> users;
+        {
+            std::lock_guard<CountingMutex> lock(heldMutex);
+            for (const auto& held : heldMessages) {
+                users.push_back(held.first);
+            }
+        }
+        for (int64_t userId : users) {
+            flushHeld(userId);
+        }
+    }
+
+    // 是否有未被持有且非空的分片
+    bool hasClaimableShard() {
+        if (taskQueues.pending.load() <= 0) return false;
+        for (const auto& shard : taskQueues.shards) {
+            if (!shard->owned.load() && shard->sizeApprox() > 0) return true;
+        }
+        return false;
+    }
+
+    // 持有分片并处理一批任务，返回处理的任务数；adminOnly 时只取管理员操作。
+    // 分片上有暂停后恢复的任务时先把它和暂存的任务做完；任务又暂停时放下分片但不释放
+    size_t drainShard(TaskShard& shard, std::vector<MessageTask>& batch, bool adminOnly = false) {
+        if (!shard.tryClaim()) return 0;
+
+        busyWorkers.fetch_add(1, std::memory_order_relaxed);
+        size_t processed = 0;
+        bool suspended = !resumeShard(shard, processed);
+        size_t n = 0;
+        if (!suspended && !stopWorkers) {
+            n = adminOnly ? shard.queues[MessageTask::PRIORITY_ADMIN]->popBatch(batch.data(), batch.size())
+                          : shard.popWeighted(batch.data(), batch.size(), taskQueues.weight);
+            taskQueues.pending.fetch_sub(static_cast<int64_t>(n));
+            for (size_t i = 0; i < n; ++i) {
+                taskQueues.pendingByPriority[MessageTask::priorityOf(batch[i].type)].fetch_sub(1);
+            }
+        }
+        for (size_t i = 0; i < n && !stopWorkers; ++i) {
+            // 处理任务；停机时未处理的任务留在任务日志中
+            ++processed;
+            if (!runTask(shard, batch[i], batch.data() + i + 1, n - i - 1)) {
+                suspended = true;
+                break;
+            }
+            if (!shard.deferred.empty()) {
+                // 其后的任务已移入暂存队列，而暂停的任务随即完成，接着从暂存队列处理
+                suspended = !resumeShard(shard, processed);
+                break;
+            }
+        }
+        busyWorkers.fetch_sub(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < n; ++i) {
+            batch[i] = MessageTask();
+        }
+
+        if (suspended) return processed; // 由最后完成的请求释放分片（resumeLater）
+        shard.release();
+        if (shard.sizeApprox() > 0) {
+            idleWorkers.notifyOne();
+        }
+        return processed;
+    }
+
+    // 当前工作线程正在执行的任务（或续体）所在分片，requestAsync 据此挂起任务
+    struct AsyncContext {
+        TaskShard* shard;
+        const MessageTask* task;
+        AsyncTask* async; // 任务发出第一个异步请求时创建
+    };
+
+    static AsyncContext*& currentAsync() {
+        static thread_local AsyncContext* context = nullptr;
+        return context;
+    }
+
+    void completeJournal(uint64_t journalSeq) {
+        if (journalSeq != 0) {
+            taskJournal->complete(journalSeq);
+        }
+    }
+
+    // 处理一个任务，任务完成时返回 true。任务的异步请求未完成时暂停分片：
+    // rest（同批其后的 restCount 个任务）移入暂存队列，返回 false
+    bool runTask(TaskShard& shard, MessageTask& task, MessageTask* rest, size_t restCount) {
+        AsyncContext context{&shard, &task, nullptr};
+        currentAsync() = &context;
+        processTask(task);
+        currentAsync() = nullptr;
+        if (!context.async) {
+            completeJournal(task.journalSeq);
+            return true;
+        }
+
+        shard.waiting.reset(context.async);
+        taskQueues.pending.fetch_add(1); // 暂停的任务仍算作待处理，停机时等它完成
+        if (!releaseHold(shard, rest, restCount)) return false;
+        return continueWaiting(shard, rest, restCount);
+    }
+
+    // 放下本线程对暂停任务的持有，是最后一份时返回 true。还有请求未完成时先把 rest 移入暂存队列：
+    // 请求可能随即在其他线程上完成并释放分片。只有本线程持有时（底层为同步传输，请求已在本线程上完成）不必移动
+    bool releaseHold(TaskShard& shard, MessageTask*& rest, size_t& restCount) {
+        std::atomic<int>& holds = shard.waiting->holds;
+        if (holds.load() != 1 && restCount > 0) {
+            for (size_t i = 0; i < restCount; ++i) {
+                taskQueues.pendingByPriority[MessageTask::priorityOf(rest[i].type)].fetch_add(1);
+                shard.deferred.push_back(std::move(rest[i]));
+            }
+            taskQueues.pending.fetch_add(static_cast<int64_t>(restCount));
+            shard.deferredCount.fetch_add(restCount);
+            rest = nullptr;
+            restCount = 0;
+        }
+        return holds.fetch_sub(1) == 1;
+    }
+
+    // 暂停任务的请求都已完成：执行续体（续体可以再发请求，此时继续暂停），全部完成后结束任务
+    bool continueWaiting(TaskShard& shard, MessageTask* rest = nullptr, size_t restCount = 0) {
+        AsyncTask* async = shard.waiting.get();
+        while (true) {
+            std::vector<std::function<void()>> ready;
+            {
+                std::lock_guard<std::mutex> lock(shard.resumeMutex);
+                ready.swap(shard.resumed);
+            }
+            if (ready.empty()) break;
+            shard.resumedCount.fetch_sub(ready.size());
+
+            async->holds.store(1);
+            AsyncContext context{&shard, nullptr, async};
+            currentAsync() = &context;
+            {
+                SpanTracer::Scope scope(tracer.get(), async->traceId);
+                for (auto& next : ready) {
+                    try {
+                        next();
+                    } catch (std::exception& e) {
+                        logger->error("处理任务失败: " + std::string(e.what()));
+                    }
+                }
+            }
+            currentAsync() = nullptr;
+            if (!releaseHold(shard, rest, restCount)) return false;
+        }
+        completeJournal(async->journalSeq);
+        shard.waiting.reset();
+        taskQueues.pending.fetch_sub(1);
+        return true;
+    }
+
+    // 先完成分片上暂停的任务，再按顺序处理暂存的任务；又暂停时返回 false
+    bool resumeShard(TaskShard& shard, size_t& processed) {
+        if (shard.waiting && !continueWaiting(shard)) return false;
+        while (!shard.deferred.empty() && !stopWorkers) {
+            MessageTask task = std::move(shard.deferred.front());
+            shard.deferred.pop_front();
+            shard.deferredCount.fetch_sub(1);
+            taskQueues.pending.fetch_sub(1);
+            taskQueues.pendingByPriority[MessageTask::priorityOf(task.type)].fetch_sub(1);
+            ++processed;
+            if (!runTask(shard, task, nullptr, 0)) return false;
+        }
+        return true;
+    }
+
+    // 异步请求完成（在 HTTP 线程上）：续体交给分片；是最后一份持有时恢复分片，由工作线程认领后执行
+    void resumeLater(TaskShard& shard, AsyncTask& async, std::function<void()> next) {
+        {
+            std::lock_guard<std::mutex> lock(shard.resumeMutex);
+            shard.resumed.push_back(std::move(next));
+        }
+        shard.resumedCount.fetch_add(1);
+        if (async.holds.fetch_sub(1) == 1) {
+            shard.release();
+            idleWorkers.notifyOne();
+        }
+    }
+
+    // 队列回落到容量一半以下时，把溢出的任务按顺序读回
+    void refillSpilled() {
+        if (taskQueues.refill() > 0) {
+            idleWorkers.notifyAll();
+        }
+    }
+
+    // 工作线程函数
+    void workerThread(size_t workerIndex) {
+        std::vector<MessageTask> batch(std::max(1, config.taskBatchSize));
+        size_t shardCount = taskQueues.shards.size();
+
+        while (!stopWorkers) {
+            size_t workerCount = static_cast<size_t>(std::max(1, workerTarget.load()));
+            if (workerIndex >= workerCount && retireWorker(workerIndex)) return;
+
+            size_t processed = 0;
+            refillSpilled();
+
+            // 有管理员操作排队时先在所有分片中处理，不等各分片的持有者轮到它
+            if (taskQueues.pendingByPriority[MessageTask::PRIORITY_ADMIN].load() > 0) {
+                for (size_t k = 0; k < shardCount && !stopWorkers; ++k) {
+                    processed += drainShard(*taskQueues.shards[(workerIndex + k) % shardCount], batch, true);
+                }
+            }
+
+            // 再处理自己的分片
+            for (size_t i = workerIndex; i < shardCount && !stopWorkers; i += workerCount) {
+                processed += drainShard(*taskQueues.shards[i], batch);
+            }
+
+            // 自己的分片为空时从其他分片窃取
+            if (processed == 0) {
+                for (size_t k = 1; k < shardCount && processed == 0 && !stopWorkers; ++k) {
+                    size_t i = (workerIndex + k) % shardCount;
+                    if (i % workerCount == workerIndex % workerCount) continue;
+                    processed += drainShard(*taskQueues.shards[i], batch);
+                }
+            }
+
+            if (processed == 0) {
+                idleWorkers.wait([this, workerIndex] {
+                    return hasClaimableShard() || (taskQueues.pending.load() <= 0 && taskQueues.spilled() > 0) ||
+                           stopWorkers || workerIndex >= static_cast<size_t>(workerTarget.load());
+                });
+            }
+        }
+    }
+
+    // 缩容后多出的线程退出；持锁再检查一次，期间目标可能又被调高
+    bool retireWorker(size_t workerIndex) {
+        std::lock_guard<std::mutex> lock(scaleMutex);
+        if (stopWorkers) return true;
+        if (workerIndex < static_cast<size_t>(workerTarget.load())) return false;
+        workerSlots[workerIndex].exited = true;
+        return true;
+    }
+
+    // 调整工作线程数：扩容时启动空闲下标上的线程（已退出的先 join），尚未退出的线程直接继续工作
+    void setWorkerTarget(int next, const std::string& reason) {
+        int current;
+        {
+            std::lock_guard<std::mutex> lock(scaleMutex);
+            current = workerTarget.load();
+            if (next == current) return;
+            if (workerSlots.size() < static_cast<size_t>(next)) {
+                workerSlots.resize(next);
+            }
+            for (int i = current; i < next; ++i) {
+                WorkerSlot& slot = workerSlots[i];
+                if (slot.thread.joinable()) {
+                    if (!slot.exited) continue;
+                    slot.thread.join();
+                }
+                slot.exited = false;
+                slot.thread = std::thread(&ForwardBot::workerThread, this, static_cast<size_t>(i));
+            }
+            workerTarget = next;
+        }
+        // 唤醒空闲线程：多出的线程据此退出
+        idleWorkers.notifyAll();
+
+        if (current == 0) return; // 启动时的初始线程
+        metrics.add(next > current ? scaledUp : scaledDown);
+        logger->info("工作线程 " + std::to_string(current) + " -> " + std::to_string(next) + "（" + reason + "）");
+    }
+
+    // 每秒检查一次负载，按 WorkerScaler 的决策调整线程数
+    void autoscale() {
+        WorkerScaler::Load load;
+        load.waitSamples = waitSamples.exchange(0);
+        load.waitMicros = waitMicros.exchange(0);
+        load.target = workerTarget.load();
+        load.busy = busyWorkers.load(std::memory_order_relaxed);
+        load.backlog = taskQueues.pending.load() + static_cast<int64_t>(taskQueues.spilled());
+        load.inFlight = instrumentedHttpClient->inFlightRequests();
+        load.throttled = httpClient->stats().queued;
+        load.maxInFlight = static_cast<int64_t>(config.httpMaxInFlight);
+        std::string reason;
+        int next = workerScaler->decide(load, reason);
+        if (next != load.target) {
+            setWorkerTarget(next, reason);
+        }
+    }
+
+    // 重新读取配置文件，能在运行中生效的设置立即应用，其余的提示需要重启
+    void reloadConfig() {
+        Config next;
+        if (!next.loadFromFile(configPath)) {
+            logger->error("重新加载配置失败: 无法读取 " + configPath + " 或缺少 BOT_TOKEN/ADMIN_ID，沿用当前配置");
+            return;
+        }
+        metrics.add(configReloads);
+        const Config& old = activeConfig;
+        std::vector<std::string> applied;
+        std::vector<std::string> restart;
+        auto note = [](std::vector<std::string>& list, bool changed, const char* key) {
+            if (changed) list.push_back(key);
+        };
+
+        // 日志
+        if (next.logFile != old.logFile || next.enableLogging != old.enableLogging ||
+            next.logStdout != old.logStdout) {
+            if (logger->reconfigure(next.logFile, next.enableLogging, next.logStdout)) {
+                applied.push_back("LOG_FILE/ENABLE_LOGGING/LOG_STDOUT");
+            } else {
+                logger->error("无法打开日志文件 " + next.logFile + "，继续使用原日志文件");
+                next.logFile = old.logFile;
+                next.enableLogging = old.enableLogging;
+                next.logStdout = old.logStdout;
+            }
+        }
+        if (next.logLevel != old.logLevel) {
+            logger->setLevel(Logger::parseLevel(next.logLevel));
+            applied.push_back("LOG_LEVEL");
+        }
+
+        // 出站限速和重试
+        if (next.globalRateLimit != old.globalRateLimit || next.chatRateLimit != old.chatRateLimit ||
+            next.groupRateLimit != old.groupRateLimit || next.maxRetries != old.maxRetries ||
+            next.retryDelay != old.retryDelay) {
+            RateLimitedHttpClient::Limits limits;
+            limits.globalPerSecond = next.globalRateLimit;
+            limits.chatPerSecond = next.chatRateLimit;
+            limits.groupPerMinute = next.groupRateLimit;
+            limits.maxRetries = next.maxRetries;
+            limits.retryDelaySeconds = next.retryDelay;
+            httpClient->setLimits(limits);
+            applied.push_back("GLOBAL_RATE_LIMIT/CHAT_RATE_LIMIT/GROUP_RATE_LIMIT/MAX_RETRIES/RETRY_DELAY");
+        }
+
+        // 按用户限流：启动时已开启的才能在运行中调整，开关本身需要重启
+        if (next.floodRate != old.floodRate || next.floodBurst != old.floodBurst ||
+            next.floodBanStrikes != old.floodBanStrikes) {
+            if (floodGate && next.floodRate > 0) {
+                floodGate->configure(next.floodRate, next.floodBurst, next.floodBanStrikes);
+                applied.push_back("FLOOD_RATE/FLOOD_BURST/FLOOD_BAN_STRIKES");
+            } else {
+                restart.push_back("FLOOD_RATE");
+            }
+        }
+
+        // 追踪抽样比例：启动时已开启追踪的才能在运行中调整
+        if (next.traceSampleRate != old.traceSampleRate) {
+            if (tracer) {
+                tracer->setSampleRate(next.traceSampleRate);
+                applied.push_back("TRACE_SAMPLE_RATE");
+            } else {
+                restart.push_back("TRACE_SAMPLE_RATE");
+            }
+        }
+
+        // 工作线程范围，下一次伸缩检查时按新范围调整；任务分片数按启动时的上限固定，调高上限需要重启
+        if (next.workerThreads != old.workerThreads || next.workerMinThreads != old.workerMinThreads ||
+            next.workerMaxThreads != old.workerMaxThreads || next.workerScaleUpWaitMs != old.workerScaleUpWaitMs) {
+            if (workerScaler->configure(next)) {
+                applied.push_back("WORKER_THREADS/WORKER_MIN_THREADS/WORKER_MAX_THREADS/WORKER_SCALE_UP_WAIT_MS");
+            } else {
+                applied.push_back("WORKER_THREADS/WORKER_MIN_THREADS/WORKER_SCALE_UP_WAIT_MS（线程数上限暂按启动时的 " +
+                                  std::to_string(workerScaler->maxAtStartup()) + "）");
+                restart.push_back("WORKER_MAX_THREADS 超过启动时的上限");
+            }
+        }
+
+        note(restart, next.botToken != old.botToken, "BOT_TOKEN");
+        note(restart, next.adminId != old.adminId || next.adminIds != old.adminIds, "ADMIN_ID/ADMIN_IDS");
+        note(restart, next.logBufferSize != old.logBufferSize, "LOG_BUFFER_SIZE");
+        note(restart, next.bannedUsersFile != old.bannedUsersFile, "BANNED_USERS_FILE");
+        note(restart, next.apiUrl != old.apiUrl || next.httpTransport != old.httpTransport ||
+                      next.httpMaxInFlight != old.httpMaxInFlight || next.httpPoolSize != old.httpPoolSize ||
+                      next.httpIdleTimeout != old.httpIdleTimeout || next.httpMaxLifetime != old.httpMaxLifetime,
+             "API_URL/HTTP_*");
+        note(restart, next.replyCacheCapacity != old.replyCacheCapacity || next.replyCacheTtl != old.replyCacheTtl,
+             "REPLY_CACHE_*");
+        note(restart, next.taskQueueCapacity != old.taskQueueCapacity ||
+                      next.adminQueueCapacity != old.adminQueueCapacity ||
+                      next.backgroundQueueCapacity != old.backgroundQueueCapacity ||
+                      next.taskClassWeights != old.taskClassWeights || next.taskShedPolicy != old.taskShedPolicy ||
+                      next.taskSpillFile != old.taskSpillFile || next.taskBatchSize != old.taskBatchSize ||
+                      next.shardsPerWorker != old.shardsPerWorker,
+             "任务队列（容量、权重、溢出、分片）");
+        note(restart, next.messageIndexFile != old.messageIndexFile || next.userRegistryFile != old.userRegistryFile ||
+                      next.taskJournalFile != old.taskJournalFile,
+             "MESSAGE_INDEX_FILE/USER_REGISTRY_FILE/TASK_JOURNAL_FILE");
+        note(restart, next.historyFile != old.historyFile || next.historyPerUser != old.historyPerUser ||
+                      next.historyMaxMb != old.historyMaxMb, "HISTORY_*");
+        note(restart, next.traceRecordFile != old.traceRecordFile || next.traceRecordMaxMb != old.traceRecordMaxMb,
+             "TRACE_RECORD_*");
+        note(restart, next.traceSpansFile != old.traceSpansFile || next.traceSpansFormat != old.traceSpansFormat,
+             "TRACE_SPANS_FILE/TRACE_SPANS_FORMAT");
+        note(restart, next.metricsListen != old.metricsListen, "METRICS_LISTEN");
+        note(restart, next.updateMode != old.updateMode || next.webhookUrl != old.webhookUrl ||
+                      next.webhookListen != old.webhookListen || next.webhookPath != old.webhookPath ||
+                      next.webhookSecret != old.webhookSecret, "UPDATE_MODE/WEBHOOK_*");
+        note(restart, next.floodAction != old.floodAction || next.floodBanSeconds != old.floodBanSeconds ||
+                      next.floodTableSize != old.floodTableSize, "FLOOD_ACTION/FLOOD_BAN_SECONDS/FLOOD_TABLE_SIZE");
+        note(restart, next.coalesceWindowMs != old.coalesceWindowMs || next.albumWindowMs != old.albumWindowMs ||
+                      next.broadcastRate != old.broadcastRate, "COALESCE_*/ALBUM_WINDOW_MS/BROADCAST_RATE");
+
+        activeConfig = next;
+        auto join = [](const std::vector<std::string>& keys) {
+            std::string out;
+            for (const std::string& key : keys) {
+                if (!out.empty()) out += ", ";
+                out += key;
+            }
+            return out;
+        };
+        logger->info("已重新加载配置 " + configPath + (applied.empty() ? "，无可在运行中生效的变更" : "，已生效: " + join(applied)));
+        if (!restart.empty()) {
+            logger->warning("以下配置变更需要重启才能生效: " + join(restart));
+        }
+    }
+
+    // 伸缩检查和 SIGHUP 重新加载都在定时线程上进行
+    void scheduleSupervision() {
+        timers.schedule(std::chrono::steady_clock::now() + std::chrono::seconds(1), [this] {
+            if (reloadRequested.exchange(false)) {
+                reloadConfig();
+            }
+            autoscale();
+            if (tracer) {
+                tracer->flush();
+            }
+            if (recorder) {
+                recorder->flush();
+                if (!recorderStopNoted && recorder->stopped()) {
+                    recorderStopNoted = true;
+                    logger->warning("录制文件已达到 TRACE_RECORD_MAX_MB 上限或写入失败，已停止录制");
+                }
+            }
+            scheduleSupervision();
+        });
+    }
+
+    // 处理任务
+    void processTask(const MessageTask& task) {
+        auto waited = std::chrono::steady_clock::now() - task.enqueuedAt;
+        waitMicros.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(waited).count(),
+                             std::memory_order_relaxed);
+        waitSamples.fetch_add(1, std::memory_order_relaxed);
+        metrics.observe(taskWait[task.type], waited);
+        metrics.observe(priorityWait[MessageTask::priorityOf(task.type)], waited);
+        Metrics::Timer timer(metrics, taskDuration[task.type]);
+        if (task.traceId != 0) {
+            tracer->record(task.traceId, "queue", SpanTracer::wallMicros(task.enqueuedAt),
+                           std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+        }
+        SpanTracer::Scope scope(tracer.get(), task.traceId);
+        SpanTracer::Timer span(MessageTask::typeName(task.type), traceUserOf(task));
+        try {
+            switch (task.type) {
+                case MessageTask::FORWARD_TO_ADMIN:
+                    processForwardToAdmin(task.message);
+                    break;
+                case MessageTask::REPLY_TO_USER:
+                    processReplyToUser(task.targetUserId, task.message);
+                    break;
+                case MessageTask::HANDLE_CALLBACK:
+                    processCallbackQuery(task.callbackQuery, task.targetUserId);
+                    break;
+                case MessageTask::HANDLE_REQUEST:
+                    processRequestCommand(task.message);
+                    break;
+                case MessageTask::HANDLE_START:
+                    processStartCommand(task.message);
+                    break;
+                case MessageTask::HANDLE_HELP:
+                    processHelpCommand(task.message);
+                    break;
+                case MessageTask::HANDLE_BAN:
+                    handleBanCommand(task.message);
+                    break;
+                case MessageTask::HANDLE_UNBAN:
+                    handleUnbanCommand(task.message);
+                    break;
+                case MessageTask::HANDLE_BANLIST:
+                    showBannedList(task.message->chat->id);
+                    break;
+                case MessageTask::SEND_TEXT:
+                    bot->getApi().sendMessage(task.targetUserId, task.text);
+                    break;
+                case MessageTask::FORWARD_ALBUM:
+                    processForwardAlbum(task.album);
+                    break;
+                case MessageTask::REPLY_ALBUM:
+                    processReplyAlbum(task.targetUserId, task.album);
+                    break;
+                case MessageTask::HANDLE_BROADCAST:
+                    processBroadcastCommand(task.message);
+                    break;
+                case MessageTask::HANDLE_BROADCAST_STOP:
+                    processBroadcastStop(task.message->chat->id);
+                    break;
+                case MessageTask::HANDOFF_CONVERSATION:
+                    processHandoff(task.targetUserId, task.text, task.adminChatId);
+                    break;
+                case MessageTask::HANDLE_HISTORY:
+                    processHistoryCommand(task.message);
+                    break;
+                case MessageTask::HANDLE_SEARCH:
+                    processSearchCommand(task.message);
+                    break;
+            }
+        } catch (std::exception& e) {
+            logger->error("处理任务失败: " + std::string(e.what()));
+        }
+    }
+
+    // 异步调用 Bot API，不阻塞工作线程；结果只记录日志
+    void callApiAsync(const std::string& method, const std::vector<TgBot::HttpReqArg>& args) {
+        TgBot::Url url(config.apiUrl + "/bot" + config.botToken + "/" + method);
+        try {
+            httpClient->submit(url, args, [this, method](const std::string& response, std::exception_ptr error) {
+                if (error) {
+                    try {
+                        std::rethrow_exception(error);
+                    } catch (std::exception& e) {
+                        logger->error("异步调用 " + method + " 失败: " + std::string(e.what()));
+                    }
+                } else if (response.find("\"ok\":true") == std::string::npos) {
+                    logger->error("异步调用 " + method + " 失败: " + response);
+                }
+            });
+        } catch (std::exception& e) {
+            logger->error("异步调用 " + method + " 失败: " + std::string(e.what()));
+        }
+    }
+
+    // 异步请求完成后的处理：成功时 error 为空，response 为响应正文
+    typedef std::function<void (const std::string& response, const std::string& error)> ApiContinuation;
+
+    // 在任务中异步调用 Bot API，不阻塞工作线程：请求完成前任务所在分片暂停，同一会话的后续任务不会越过它，
+    // 工作线程转去处理其他分片；then 之后回到工作线程上执行（不在 HTTP 线程上做文件读写）。
+    // 不在任务中调用时 then 直接在完成请求的线程上执行
+    void requestAsync(const std::string& method, const std::vector<TgBot::HttpReqArg>& args, ApiContinuation then) {
+        AsyncContext* context = currentAsync();
+        TaskShard* shard = context ? context->shard : nullptr;
+        AsyncTask* async = nullptr;
+        if (context) {
+            if (!context->async) {
+                context->async = new AsyncTask();
+                context->async->journalSeq = context->task->journalSeq;
+                context->async->traceId = context->task->traceId;
+            }
+            async = context->async;
+            async->holds.fetch_add(1);
+        }
+
+        auto done = [this, shard, async, then](const std::string& response, std::exception_ptr error) {
+            std::string failure = apiErrorOf(response, error);
+            if (!async) {
+                then(response, failure);
+                return;
+            }
+            resumeLater(*shard, *async, [then, response, failure] { then(response, failure); });
+        };
+        TgBot::Url url(config.apiUrl + "/bot" + config.botToken + "/" + method);
+        try {
+            httpClient->submit(url, args, done);
+        } catch (...) {
+            done("", std::current_exception());
+        }
+    }
+
+    // 失败原因：传输错误，或 ok=false 时响应中的 description；成功时为空
+    static std::string apiErrorOf(const std::string& response, std::exception_ptr error) {
+        if (error) {
+            try {
+                std::rethrow_exception(error);
+            } catch (std::exception& e) {
+                return e.what();
+            } catch (...) {
+                return "未知错误";
+            }
+        }
+        if (response.find("\"ok\":true") != std::string::npos) return "";
+        try {
+            std::string description = TgBot::TgTypeParser().parseJson(response).get<std::string>("description", "");
+            if (!description.empty()) return description;
+        } catch (...) {
+        }
+        return response.empty() ? "空响应" : response;
+    }
+
+    // sendMessage/copyMessage 响应中的消息 ID，解析失败时为 0
+    static int32_t messageIdOf(const std::string& response) {
+        try {
+            return TgBot::TgTypeParser().parseJson(response).get<int32_t>("result.message_id", 0);
+        } catch (...) {
+            return 0;
+        }
+    }
+
+    // copyMessage 的参数；caption 非空时替换原说明文字
+    static std::vector<TgBot::HttpReqArg> copyArgs(int64_t chatId, const TgBot::Message::Ptr& message,
+                                                   const std::string& caption = "") {
+        std::vector<TgBot::HttpReqArg> args = {TgBot::HttpReqArg("chat_id", chatId),
+                                               TgBot::HttpReqArg("from_chat_id", message->chat->id),
+                                               TgBot::HttpReqArg("message_id", message->messageId)};
+        if (!caption.empty()) {
+            args.push_back(TgBot::HttpReqArg("caption", caption));
+        }
+        return args;
+    }
+
+    void sendMessageAsync(int64_t chatId, const std::string& text) {
+        callApiAsync("sendMessage", {TgBot::HttpReqArg("chat_id", chatId), TgBot::HttpReqArg("text", text)});
+    }
+
+    void answerCallbackAsync(const std::string& queryId, const std::string& text) {
+        callApiAsync("answerCallbackQuery", {TgBot::HttpReqArg("callback_query_id", queryId),
+                                             TgBot::HttpReqArg("text", text)});
+    }
+
+    // 添加任务到队列
+    void addTask(MessageTask task) {
+        task.enqueuedAt = std::chrono::steady_clock::now();
+        if (tracer && task.traceId == 0 && (task.traceId = tracer->sample()) != 0) {
+            metrics.add(tracesSampled);
+            // 从用户发出（Telegram 的 date，精确到秒）到入队：长轮询、接收线程和相册/合并等待
+            const TgBot::Message::Ptr& origin = task.message ? task.message : task.album.empty() ? nullptr : task.album.front();
+            int64_t now = SpanTracer::nowMicros();
+            if (origin && origin->date > 0 && origin->date * 1000000LL <= now) {
+                tracer->record(task.traceId, "receive", origin->date * 1000000LL, now - origin->date * 1000000LL);
+            }
+        }
+        if (taskJournal) {
+            SpanTracer::Scope scope(tracer.get(), task.traceId);
+            SpanTracer::Timer span("journal_append");
+            std::string data;
+            TaskCodec::encode(task, data);
+            task.journalSeq = taskJournal->append(data);
+        }
+        MessageTask::Priority priority = MessageTask::priorityOf(task.type);
+        bool intake = intakeThread();
+        bool warned = false;
+        while (true) {
+            switch (taskQueues.push(task, intake)) {
+                case TaskQueues::QUEUED:
+                    idleWorkers.notifyOne();
+                    return;
+                case TaskQueues::SPILLED:
+                    metrics.add(shedSpilled[priority]);
+                    idleWorkers.notifyOne();
+                    return;
+                case TaskQueues::REJECTED:
+                    rejectTask(task, priority);
+                    return;
+                case TaskQueues::SPILL_FAILED:
+                    logger->error("写入溢出文件失败");
+                    rejectTask(task, priority);
+                    idleWorkers.notifyOne();
+                    return;
+                case TaskQueues::FULL:
+                    break;
+            }
+            // TASK_SHED_POLICY=wait：接收线程等待分片中暂存的任务读回、队列有空位
+            if (stopWorkers) return; // 留在任务日志中，重启后继续
+            if (!warned) {
+                logger->warning("任务队列已满，等待工作线程处理");
+                warned = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // 队列已满且 TASK_SHED_POLICY=reject：丢弃任务，提示发送方稍后重试（每个会话每分钟最多一次）。
+    // 内部产生的通知类任务直接丢弃
+    void rejectTask(const MessageTask& task, MessageTask::Priority priority) {
+        if (task.journalSeq != 0) {
+            taskJournal->complete(task.journalSeq);
+        }
+        metrics.add(shedRejected[priority]);
+        if (task.callbackQuery) {
+            answerCallbackAsync(task.callbackQuery->id, "⏳ 机器人繁忙，请稍后重试");
+            return;
+        }
+        if (!task.message || !task.message->chat) return;
+
+        int64_t chatId = task.message->chat->id;
+        {
+            std::lock_guard<CountingMutex> lock(busyNoticeMutex);
+            if (!busyNotices.insert(std::to_string(chatId))) return;
+        }
+        logger->warning(std::string("任务队列已满，拒绝 ") + MessageTask::typeName(task.type) +
+                        " 任务（会话 " + std::to_string(chatId) + "）");
+        sendMessageAsync(chatId, priority == MessageTask::PRIORITY_ADMIN ? "⚠️ 机器人繁忙，该操作未能处理，请稍后重试"
+                                                                         : "⏳ 当前消息较多，您的消息未能送达，请稍后再发");
+    }
+
+    void dispatch(MessageTask::Type type, TgBot::Message::Ptr message) {
+        MessageTask task;
+        task.type = type;
+        task.message = std::move(message);
+        addTask(std::move(task));
+    }
+
+    // 由工作线程发送一条文本消息
+    void sendText(int64_t chatId, const std::string& text) {
+        MessageTask task;
+        task.type = MessageTask::SEND_TEXT;
+        task.targetUserId = chatId;
+        task.text = text;
+        addTask(std::move(task));
+    }
+
+    // 收集相册中的一条消息；第一条到达时安排定时发送，收满 10 条立即发送。
+    // 同一会话的上一个相册先入队，两个相册按到达顺序送出
+    void collectAlbumItem(TgBot::Message::Ptr message, int64_t targetUserId) {
+        std::string key = MessageCoalescer::albumKey(message);
+        auto now = std::chrono::steady_clock::now();
+        std::vector<MessageCoalescer::Ready> ready;
+        bool first;
+        {
+            std::lock_guard<CountingMutex> lock(coalesceMutex);
+            first = coalescer->addAlbumItem(std::move(message), targetUserId, now, ready);
+        }
+        enqueueCoalesced(ready);
+        if (first) {
+            timers.schedule(now + std::chrono::milliseconds(config.albumWindowMs), [this, key] { flushAlbum(key); });
+        }
+    }
+
+    // 把消息并入正在收集的同一相册，相册不存在时返回 false
+    bool joinAlbum(TgBot::Message::Ptr message) {
+        std::vector<MessageCoalescer::Ready> ready;
+        bool joined;
+        {
+            std::lock_guard<CountingMutex> lock(coalesceMutex);
+            joined = coalescer->joinAlbum(std::move(message), std::chrono::steady_clock::now(), ready);
+        }
+        enqueueCoalesced(ready);
+        return joined;
+    }
+
+    // 窗口内仍有新消息到达时顺延，否则把整个相册作为一个任务入队
+    void flushAlbum(const std::string& key) {
+        std::vector<MessageCoalescer::Ready> ready;
+        {
+            std::lock_guard<CountingMutex> lock(coalesceMutex);
+            auto next = coalescer->flushAlbum(key, std::chrono::steady_clock::now(), false, ready);
+            if (next != MessageCoalescer::Clock::time_point()) {
+                timers.schedule(next, [this, key] { flushAlbum(key); });
+            }
+        }
+        enqueueCoalesced(ready);
+    }
+
+    // 会话中仍在收集的相册立即入队，该会话随后的消息不会先于相册送出
+    void flushChatAlbum(int64_t chatId) {
+        std::vector<MessageCoalescer::Ready> ready;
+        {
+            std::lock_guard<CountingMutex> lock(coalesceMutex);
+            coalescer->flushChatAlbum(chatId, ready);
+        }
+        enqueueCoalesced(ready);
+    }
+
+    // 定期结束过期会话，并把空闲管理员的待回复会话转交给其他管理员
+    void scheduleRebalance() {
+        auto period = std::chrono::seconds(std::max(10, std::min(60, config.adminIdleTimeout / 4)));
+        timers.schedule(std::chrono::steady_clock::now() + period, [this] {
+            for (const AdminPool::Handoff& h : adminPool.rebalance()) {
+                logger->info("管理员 " + std::to_string(h.fromChat) + " 空闲，用户 " + std::to_string(h.userId) +
+                             " 的会话转交给 " + std::to_string(h.toChat));
+                MessageTask task;
+                task.type = MessageTask::HANDOFF_CONVERSATION;
+                task.targetUserId = h.userId;
+                task.adminChatId = h.toChat;
+                task.text = h.display;
+                addTask(std::move(task));
+                notifyHandedOff(h.fromChat, h.userId, h.display);
+            }
+            scheduleRebalance();
+        });
+    }
+
+    // 告知原管理员会话已转交，之后该用户的消息不再发给他
+    void notifyHandedOff(int64_t fromChat, int64_t userId, const std::string& display) {
+        sendText(fromChat, "↪️ 您长时间未回复，用户 " + display + "（ID " + std::to_string(userId) +
+                           "）的会话已转交给其他管理员");
+    }
+
+    // 分配负责该用户的管理员；从空闲管理员处改派时告知原管理员
+    int64_t assignAdmin(int64_t userId, const std::string& display) {
+        int64_t movedFrom = 0;
+        int64_t adminChat = adminPool.assign(userId, display, &movedFrom);
+        if (movedFrom != 0) {
+            logger->info("管理员 " + std::to_string(movedFrom) + " 空闲，用户 " + std::to_string(userId) +
+                         " 的会话转交给 " + std::to_string(adminChat));
+            notifyHandedOff(movedFrom, userId, display);
+        }
+        return adminChat;
+    }
+
+    // 注册运行指标；工作线程启动前调用
+    void registerMetrics() {
+        for (int i = 0; i < MessageTask::TYPE_COUNT; ++i) {
+            std::string labels = "type=\"" + std::string(MessageTask::typeName(static_cast<MessageTask::Type>(i))) + "\"";
+            taskWait[i] = metrics.histogram("bot_task_queue_wait_seconds", labels, "任务从入队到开始处理的等待时间");
+            taskDuration[i] = metrics.histogram("bot_task_duration_seconds", labels, "任务处理耗时");
+        }
+        for (int p = 0; p < MessageTask::PRIORITY_COUNT; ++p) {
+            std::string labels = "class=\"" +
+                                 std::string(MessageTask::priorityName(static_cast<MessageTask::Priority>(p))) + "\"";
+            priorityWait[p] = metrics.histogram("bot_task_class_queue_wait_seconds", labels, "各优先级任务从入队到开始处理的等待时间");
+            shedRejected[p] = metrics.counter("bot_task_shed_total", labels + ",action=\"rejected\"",
+                                              "队列满时被拒绝或溢出到磁盘的任务");
+            shedSpilled[p] = metrics.counter("bot_task_shed_total", labels + ",action=\"spilled\"",
+                                             "队列满时被拒绝或溢出到磁盘的任务");
+            metrics.sample("bot_task_class_queue_depth", "gauge", labels, "各优先级排队中的任务数（含溢出到磁盘的）", [this, p] {
+                const SpillQueue* spill = taskQueues.spills[p].get();
+                return static_cast<double>(taskQueues.pendingByPriority[p].load() + (spill ? spill->size() : 0));
+            });
+        }
+        pollCycle = metrics.histogram("bot_long_poll_cycle_seconds", "", "一轮 getUpdates 长轮询及分发耗时");
+        webhookDispatch = metrics.histogram("bot_webhook_dispatch_seconds", "", "Webhook 更新解析及分发耗时");
+        intakeHandler = metrics.histogram("bot_intake_handler_seconds", "", "接收线程上单个更新处理函数的耗时（接收停顿）");
+
+        metrics.sample("bot_task_queue_depth", "gauge", "排队中的任务数", [this] {
+            return static_cast<double>(taskQueues.pending.load());
+        });
+        metrics.sample("bot_workers", "gauge", "工作线程数", [this] {
+            return static_cast<double>(workerTarget.load());
+        });
+        scaledUp = metrics.counter("bot_worker_scale_total", "direction=\"up\"", "工作线程池自动扩容/收缩次数");
+        scaledDown = metrics.counter("bot_worker_scale_total", "direction=\"down\"", "工作线程池自动扩容/收缩次数");
+        configReloads = metrics.counter("bot_config_reloads_total", "", "收到 SIGHUP 后重新加载配置的次数");
+        historyQuery = metrics.histogram("bot_history_query_seconds", "", "/history 和 /search 的查询耗时（不含发送）");
+        if (history) {
+            metrics.sample("bot_history_messages", "gauge", "会话历史中可查询的消息数", [this] {
+                return static_cast<double>(history->size());
+            });
+        }
+        metrics.sample("bot_api_in_flight", "gauge", "进行中的 Bot API 请求数（含长轮询）", [this] {
+            return static_cast<double>(instrumentedHttpClient->inFlightRequests());
+        });
+        tracesSampled = metrics.counter("bot_traces_sampled_total", "", "被抽中做延迟追踪的任务数");
+        if (tracer) {
+            metrics.sample("bot_trace_spans_dropped_total", "counter", "线程缓冲区已满而丢弃的追踪 span", [this] {
+                return static_cast<double>(tracer->droppedSpans());
+            });
+        }
+        // 锁争用：只统计 try_lock 失败后的等待，未争用的加锁不计
+        const std::pair<const char*, const CountingMutex*> locks[] = {
+            {"reply_cache", &cacheMutex}, {"callback", &callbackMutex}, {"held", &heldMutex},
+            {"coalesce", &coalesceMutex}, {"flood_ban", &floodBanMutex},
+            {"busy_notice", &busyNoticeMutex}, {"admin_pool", &adminPool.lockStats()},
+            {"rate_limit", &httpClient->lockStats()},
+        };
+        for (const auto& lock : locks) {
+            const CountingMutex* mutex = lock.second;
+            std::string labels = std::string("lock=\"") + lock.first + "\"";
+            metrics.sample("bot_lock_contended_total", "counter", labels, "加锁时发生争用的次数", [mutex] {
+                return static_cast<double>(mutex->contentions());
+            });
+            metrics.sample("bot_lock_wait_seconds_total", "counter", labels, "争用时等待锁的累计时长", [mutex] {
+                return mutex->waitSeconds();
+            });
+        }
+        metrics.sample("bot_workers_busy", "gauge", "正在处理任务的工作线程数", [this] {
+            return static_cast<double>(busyWorkers.load(std::memory_order_relaxed));
+        });
+        metrics.sample("bot_send_queued", "gauge", "等待限速配额的发送数", [this] {
+            return static_cast<double>(httpClient->stats().queued);
+        });
+        metrics.sample("bot_send_delayed_total", "counter", "因限速或重试被推迟的发送", [this] {
+            return static_cast<double>(httpClient->stats().delayed);
+        });
+        metrics.sample("bot_send_dropped_total", "counter", "重试耗尽后放弃的发送", [this] {
+            return static_cast<double>(httpClient->stats().dropped);
+        });
+        if (auto curlClient = dynamic_cast<CurlMultiHttpClient*>(baseHttpClient.get())) {
+            metrics.sample("bot_http_connections_total", "counter", "新建的 HTTP 连接数", [curlClient] {
+                return static_cast<double>(curlClient->stats().newConnections);
+            });
+            metrics.sample("bot_http_reused_connections_total", "counter", "复用已有连接的请求数", [curlClient] {
+                return static_cast<double>(curlClient->stats().reusedConnections);
+            });
+        }
+        metrics.sample("bot_reply_cache_size", "gauge", "回复路由缓存条目数", [this] {
+            std::lock_guard<CountingMutex> lock(cacheMutex);
+            return static_cast<double>(messageCache.stats().size);
+        });
+        metrics.sample("bot_banned_users", "gauge", "封禁用户数", [this] {
+            return static_cast<double>(bannedUsers.size());
+        });
+        floodDropped = metrics.counter("bot_flood_rejected_total", "action=\"dropped\"", "因发送过快被拦截的用户消息");
+        floodCoalesced = metrics.counter("bot_flood_rejected_total", "action=\"coalesced\"", "因发送过快被拦截的用户消息");
+        floodBanned = metrics.counter("bot_flood_bans_total", "", "因刷屏自动临时封禁的次数");
+        burstMerged = metrics.counter("bot_coalesced_messages_total", "", "并入同一用户前一条消息一起转交的消息数（节省的发送次数）");
+        metrics.sample("bot_flood_held_users", "gauge", "有暂存待合并消息的用户数", [this] {
+            std::lock_guard<CountingMutex> lock(heldMutex);
+            return static_cast<double>(heldMessages.size());
+        });
+        if (floodGate) {
+            metrics.sample("bot_flood_evictions_total", "counter", "限流状态表满时淘汰的未过期用户数（持续增长应调大 FLOOD_TABLE_SIZE）",
+                           [this] { return static_cast<double>(floodGate->evictionCount()); });
+        }
+        metrics.sample("bot_registered_users", "gauge", "用户登记表中的用户数", [this] {
+            return static_cast<double>(userRegistry ? userRegistry->size() : 0);
+        });
+        metrics.sample("bot_broadcast_in_flight", "gauge", "已提交尚未完成的广播发送", [this] {
+            std::lock_guard<std::mutex> lock(broadcastMutex);
+            return static_cast<double>(broadcastInFlight.size());
+        });
+    }
+
+public:
+    ForwardBot(const Config& cfg, const std::string& cfgPath)
+        : adminId(cfg.adminId), botUserId(std::strtoll(cfg.botToken.c_str(), nullptr, 10)), config(cfg),
+          adminPool(adminChats(cfg), std::chrono::seconds(cfg.adminIdleTimeout),
+                    std::chrono::seconds(cfg.conversationTtl)),
+          messageCache(cfg.replyCacheCapacity, cfg.replyCacheTtl),
+          bannedUsers(cfg.bannedUsersFile),
+          processedCallbacks(std::chrono::seconds(cfg.callbackDedupTtl)),
+          busyNotices(std::chrono::seconds(60)),
+          stopWorkers(false), configPath(cfgPath), activeConfig(cfg) {
+        RateLimitedHttpClient::Limits limits;
+        limits.globalPerSecond = cfg.globalRateLimit;
+        limits.chatPerSecond = cfg.chatRateLimit;
+        limits.groupPerMinute = cfg.groupRateLimit;
+        limits.maxRetries = cfg.maxRetries;
+        limits.retryDelaySeconds = cfg.retryDelay;
+        if (cfg.httpTransport == "boost") {
+            baseHttpClient = std::make_unique<TgBot::BoostHttpOnlySslClient>();
+        } else {
+            CurlMultiHttpClient::Options options;
+            options.maxInFlight = cfg.httpMaxInFlight;
+            options.maxHostConnections = cfg.httpPoolSize;
+            options.idleTimeout = cfg.httpIdleTimeout;
+            options.maxLifetime = cfg.httpMaxLifetime;
+            baseHttpClient = std::make_unique<CurlMultiHttpClient>(options);
+        }
+        instrumentedHttpClient = std::make_unique<InstrumentedHttpClient>(*baseHttpClient, metrics);
+        httpClient = std::make_unique<RateLimitedHttpClient>(*instrumentedHttpClient, limits);
+        bot = std::make_unique<TgBot::Bot>(cfg.botToken, *httpClient, cfg.apiUrl);
+        logger = std::make_unique<Logger>(cfg.logFile, cfg.enableLogging, cfg.logStdout,
+                                          Logger::parseLevel(cfg.logLevel), cfg.logBufferSize);
+        
+        // 加载封禁用户
+        loadBannedUsers();
+        loadFloodBans();
+        if (cfg.floodRate > 0) {
+            floodGate = std::make_unique<FloodGate>(cfg.floodRate, cfg.floodBurst, cfg.floodBanStrikes,
+                                                    cfg.floodTableSize);
+        }
+
+        // 加载消息索引
+        openMessageIndex();
+
+        // 加载用户登记表
+        openUserRegistry();
+
+        // 打开会话历史（索引在后台重建）
+        openHistory();
+
+        // 录制收到的更新
+        openRecorder();
+
+        // 单条消息延迟追踪
+        openTracer();
+
+        // 打开任务日志
+        openTaskJournal();
+
+        // 相册收集和连续消息合并，收集的每条消息先单独写入任务日志
+        MessageCoalescer::Limits coalesceLimits;
+        coalesceLimits.albumWindowMs = cfg.albumWindowMs;
+        coalesceLimits.windowMs = cfg.coalesceWindowMs;
+        coalesceLimits.maxDelayMs = cfg.coalesceMaxDelayMs;
+        coalesceLimits.maxMessages = cfg.coalesceMaxMessages;
+        coalescer = std::make_unique<MessageCoalescer>(coalesceLimits,
+                                                       [this](const MessageTask& task) { return journalHeld(task); });
+        
+        // 创建任务分片：按线程数上限分片，每个优先级的容量平均分到各分片
+        workerScaler = std::make_unique<WorkerScaler>(cfg);
+        size_t shardCount = static_cast<size_t>(workerScaler->maxAtStartup()) *
+                            static_cast<size_t>(std::max(1, cfg.shardsPerWorker));
+        taskQueues.capacity[MessageTask::PRIORITY_ADMIN] = cfg.adminQueueCapacity;
+        taskQueues.capacity[MessageTask::PRIORITY_USER] = cfg.taskQueueCapacity;
+        taskQueues.capacity[MessageTask::PRIORITY_BACKGROUND] = cfg.backgroundQueueCapacity;
+        size_t shardCapacity[MessageTask::PRIORITY_COUNT];
+        for (int p = 0; p < MessageTask::PRIORITY_COUNT; ++p) {
+            shardCapacity[p] = std::max<size_t>(64, taskQueues.capacity[p] / shardCount);
+            taskQueues.weight[p] = cfg.taskClassWeights[p];
+        }
+        for (size_t i = 0; i < shardCount; ++i) {
+            taskQueues.shards.emplace_back(new TaskShard(shardCapacity));
+        }
+        openSpillQueues();
+
+        registerMetrics();
+
+        // 启动工作线程
+        setWorkerTarget(workerScaler->initial(cfg), "");
+        scheduleSupervision();
+        if (userRegistry) {
+            broadcaster = std::thread(&ForwardBot::broadcastThread, this);
+        }
+        resumeJournaledTasks();
+
+        if (!cfg.metricsListen.empty()) {
+            metricsServer = std::make_unique<MetricsServer>(metrics);
+            if (metricsServer->start(cfg.metricsListen)) {
+                logger->info("指标端点已启动: http://" + cfg.metricsListen + "/metrics");
+            } else {
+                logger->error("无法监听指标端点 " + cfg.metricsListen);
+                metricsServer.reset();
+            }
+        }
+    }
+
+    ~ForwardBot() {
+        // 先停入口和指标端点，它们的回调会访问下面要释放的组件
+        webhookServer.reset();
+        metricsServer.reset();
+
+        // 收集中的相册立即入队，在期限内处理完队列；剩余任务留在任务日志中，重启后继续
+        flushAllCoalesced();
+        flushAllHeld();
+        timers.stop();
+        drainTasks(std::chrono::seconds(std::max(0, config.shutdownDrainSeconds)));
+        stopWorkers = true;
+        idleWorkers.notifyAll();
+        std::vector<WorkerSlot> slots;
+        {
+            std::lock_guard<std::mutex> lock(scaleMutex);
+            slots.swap(workerSlots);
+        }
+        for (auto& slot : slots) {
+            if (slot.thread.joinable()) {
+                slot.thread.join();
+            }
+        }
+        // 广播线程保存进度后退出，下次启动时继续
+        broadcastCv.notify_all();
+        if (broadcaster.joinable()) {
+            broadcaster.join();
+        }
+        if (taskJournal && !taskJournal->commit()) {
+            logger->error("停机时任务日志未能写入，尚未确认的更新将在下次启动时重新接收");
+        }
+
+        ReplyRouteCache::Stats stats;
+        {
+            std::lock_guard<CountingMutex> lock(cacheMutex);
+            stats = messageCache.stats();
+        }
+        RateLimitedHttpClient::Stats sendStats = httpClient->stats();
+        logger->info("出站发送: 仍在等待配额 " + std::to_string(sendStats.queued) +
+                     " 推迟 " + std::to_string(sendStats.delayed) +
+                     " 放弃 " + std::to_string(sendStats.dropped));
+        if (auto curlClient = dynamic_cast<CurlMultiHttpClient*>(baseHttpClient.get())) {
+            CurlMultiHttpClient::Stats poolStats = curlClient->stats();
+            char handshake[32];
+            snprintf(handshake, sizeof(handshake), "%.3f", poolStats.handshakeSeconds);
+            logger->info("HTTP 连接池: 请求 " + std::to_string(poolStats.requests) +
+                         " 新建连接 " + std::to_string(poolStats.newConnections) +
+                         " 复用连接 " + std::to_string(poolStats.reusedConnections) +
+                         " 新建连接握手共 " + handshake + " 秒");
+        }
+        logger->info("回复路由缓存: " + std::to_string(stats.size) + "/" + std::to_string(stats.capacity) +
+                     " 命中 " + std::to_string(stats.hits) + " 未命中 " + std::to_string(stats.misses) +
+                     " 淘汰 " + std::to_string(stats.evictions) + " 过期 " + std::to_string(stats.expirations));
+
+        // 先停底层传输，未完成请求的回调仍需要限速层和日志
+        bot.reset();
+        baseHttpClient.reset();
+        instrumentedHttpClient.reset();
+        httpClient.reset();
+    }
+
+    // 等待队列和正在处理的任务完成，最多等待 timeout
+    void drainTasks(std::chrono::seconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while ((taskQueues.pending.load() > 0 || taskQueues.spilled() > 0 || busyWorkers.load() > 0) &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        int64_t left = taskQueues.pending.load() + static_cast<int64_t>(taskQueues.spilled());
+        if (left > 0) {
+            logger->warning("停机时仍有 " + std::to_string(left) + " 个任务未处理" +
+                            (taskJournal ? "，已保存在任务日志中，重启后继续" : "，将被丢弃"));
+        }
+    }
+
+    void start() {
+        logger->info("机器人启动中...");
+        logger->info("Admin ID: " + std::to_string(adminId));
+        if (adminPool.size() > 1) {
+            logger->info("管理员池: " + std::to_string(adminPool.size()) + " 个会话");
+            scheduleRebalance();
+        }
+        if (workerScaler->min() == workerScaler->max()) {
+            logger->info("工作线程数: " + std::to_string(workerTarget.load()));
+        } else {
+            logger->info("工作线程数: " + std::to_string(workerTarget.load()) + "（自动伸缩 " +
+                         std::to_string(workerScaler->min()) + "-" + std::to_string(workerScaler->max()) + "）");
+        }
+
+        // 接收线程只做过滤和派发，回复等网络调用全部交给工作线程
+        bot->getEvents().onCommand("start", [this](TgBot::Message::Ptr message) {
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (isUserBanned(message->from->id)) {
+                return; // 忽略被封禁用户
+            }
+            dispatch(MessageTask::HANDLE_START, message);
+        });
+
+        bot->getEvents().onCommand("help", [this](TgBot::Message::Ptr message) {
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (isUserBanned(message->from->id)) {
+                return;
+            }
+            dispatch(MessageTask::HANDLE_HELP, message);
+        });
+
         bot->getEvents().onCommand("req", [this](TgBot::Message::Ptr message) {
+            Metrics::Timer timer(metrics, intakeHandler);
             if (isUserBanned(message->from->id)) {
-                bot->getApi().sendMessage(message->chat->id, "❌ 您已被限制使用此功能");
+                sendText(message->chat->id, "❌ 您已被限制使用此功能");
                 return;
             }
-            
-            MessageTask task;
-            task.type = MessageTask::HANDLE_REQUEST;
-            task.message = message;
-            addTask(task);
+            if (!admitUserMessage(message, false)) return;
+            flushPending(message);
+            dispatch(MessageTask::HANDLE_REQUEST, message);
         });
 
         // 管理员命令
         bot->getEvents().onCommand("ban", [this](TgBot::Message::Ptr message) {
-            if (message->chat->id != adminId) return;
-            handleBanCommand(message);
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (!isAdminChat(message->chat->id)) return;
+            dispatch(MessageTask::HANDLE_BAN, message);
         });
 
         bot->getEvents().onCommand("unban", [this](TgBot::Message::Ptr message) {
-            if (message->chat->id != adminId) return;
-            handleUnbanCommand(message);
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (!isAdminChat(message->chat->id)) return;
+            dispatch(MessageTask::HANDLE_UNBAN, message);
         });
 
         bot->getEvents().onCommand("banlist", [this](TgBot::Message::Ptr message) {
-            if (message->chat->id != adminId) return;
-            showBannedList();
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (!isAdminChat(message->chat->id)) return;
+            dispatch(MessageTask::HANDLE_BANLIST, message);
+        });
+
+        bot->getEvents().onCommand("history", [this](TgBot::Message::Ptr message) {
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (!isAdminChat(message->chat->id)) return;
+            dispatch(MessageTask::HANDLE_HISTORY, message);
+        });
+
+        bot->getEvents().onCommand("search", [this](TgBot::Message::Ptr message) {
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (!isAdminChat(message->chat->id)) return;
+            dispatch(MessageTask::HANDLE_SEARCH, message);
+        });
+
+        bot->getEvents().onCommand("broadcast", [this](TgBot::Message::Ptr message) {
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (!isAdminChat(message->chat->id)) return;
+            dispatch(MessageTask::HANDLE_BROADCAST, message);
+        });
+
+        bot->getEvents().onCommand("broadcast_stop", [this](TgBot::Message::Ptr message) {
+            Metrics::Timer timer(metrics, intakeHandler);
+            if (!isAdminChat(message->chat->id)) return;
+            dispatch(MessageTask::HANDLE_BROADCAST_STOP, message);
         });
 
         // 处理普通消息
         bot->getEvents().onAnyMessage([this](TgBot::Message::Ptr message) {
+            Metrics::Timer timer(metrics, intakeHandler);
             try {
+                recordIntake(message);
+
+                // 登记与机器人对话过的会话（包括命令），供广播使用
+                if (userRegistry && !isAdminChat(message->chat->id) && !isUserBanned(message->from->id)) {
+                    userRegistry->add(message->chat->id);
+                }
+
                 // 跳过命令消息
                 if (!message->text.empty() && message->text[0] == '/') {
                     return;
                 }
 
-                if (message->chat->id == adminId) {
+                if (isAdminChat(message->chat->id)) {
                     handleAdminReply(message);
                 } else {
                     if (isUserBanned(message->from->id)) {
-                        // 可选：通知用户已被封禁
-                        // bot->getApi().sendMessage(message->chat->id, "❌ 您已被限制发送消息");
                         logger->info("已拦截被封禁用户 " + std::to_string(message->from->id) + " 的消息");
                         return;
                     }
-                    
-                    MessageTask task;
-                    task.type = MessageTask::FORWARD_TO_ADMIN;
-                    task.message = message;
-                    addTask(task);
+                    // 相册只在第一项到达时计入限流
+                    if (!message->mediaGroupId.empty()) {
+                        if (!joinAlbum(message) && admitUserMessage(message, false)) {
+                            flushPending(message);
+                            collectAlbumItem(message, 0);
+                        }
+                    } else if (admitUserMessage(message, !message->text.empty())) {
+                        if (config.coalesceWindowMs > 0 && !message->text.empty()) {
+                            collectBurst(message); // 文字排在此前的相册之后
+                        } else {
+                            // 媒体等不能合并的消息排在此前收集的相册和文字之后
+                            flushPending(message);
+                            dispatch(MessageTask::FORWARD_TO_ADMIN, message);
+                        }
+                    }
                 }
             } catch (std::exception& e) {
                 logger->error("处理消息失败: " + std::string(e.what()));
@@ -401,26 +8025,23 @@ public:
 
         // 处理回调查询
         bot->getEvents().onCallbackQuery([this](TgBot::CallbackQuery::Ptr query) {
+            Metrics::Timer timer(metrics, intakeHandler);
+            recordIntake(query);
             MessageTask task;
             task.type = MessageTask::HANDLE_CALLBACK;
             task.callbackQuery = query;
-            addTask(task);
+            if (query->message) {
+                lookupReplyRoute(query->message->chat->id, query->message->messageId, task.targetUserId);
+            }
+            addTask(std::move(task));
         });
 
         // 主循环
         try {
-            logger->info("机器人已启动，等待消息...");
-            TgBot::TgLongPoll longPoll(*bot);
-            
-            while (running) {
-                try {
-                    longPoll.start();
-                } catch (std::exception& e) {
-                    logger->error("轮询错误: " + std::string(e.what()));
-                    if (running) {
-                        std::this_thread::sleep_for(std::chrono::seconds(5));
-                    }
-                }
+            if (config.updateMode == "webhook") {
+                runWebhook();
+            } else {
+                runLongPoll();
             }
         } catch (std::exception& e) {
             logger->error("致命错误: " + std::string(e.what()));
@@ -430,87 +8051,611 @@ public:
     }
 
 private:
+    void runLongPoll() {
+        // 之前以 Webhook 模式运行过时必须先删除 Webhook，否则 getUpdates 返回 409
+        try {
+            bot->getApi().deleteWebhook();
+        } catch (std::exception& e) {
+            logger->warning("删除 Webhook 失败: " + std::string(e.what()));
+        }
+
+        logger->info("机器人已启动（长轮询），等待消息...");
+        intakeThread() = true;
+
+        // 自行维护 offset：本批更新产生的任务写入任务日志并提交后才记录新 offset，
+        // 下一次 getUpdates 带上该 offset 才向 Telegram 确认，因此重启后不会丢失更新。
+        // 提交失败时继续用已确认的 offset 拉取，Telegram 重发的更新已处理过（handled 之前）就跳过，
+        // 任务日志恢复写入后再确认。处理语义是至少一次：崩溃时已发出但尚未标记完成的任务重启后会再执行一次
+        int32_t confirmed = recovered.offset;
+        int32_t handled = recovered.offset;
+        while (running) {
+            try {
+                Metrics::Timer timer(metrics, pollCycle);
+                std::vector<TgBot::Update::Ptr> updates = bot->getApi().getUpdates(confirmed, 100, 10);
+                for (const TgBot::Update::Ptr& update : updates) {
+                    if (update->updateId < handled) continue;
+                    bot->getEventHandler().handleUpdate(update);
+                    handled = update->updateId + 1;
+                }
+                if (!taskJournal) {
+                    confirmed = handled;
+                } else if (handled != confirmed) {
+                    taskJournal->recordOffset(handled);
+                    if (taskJournal->commit()) {
+                        confirmed = handled;
+                    } else {
+                        // 写线程已报告错误；稍后重试，期间不确认这些更新
+                        std::this_thread::sleep_for(std::chrono::seconds(1));
+                    }
+                }
+            } catch (std::exception& e) {
+                logger->error("轮询错误: " + std::string(e.what()));
+                if (running) {
+                    std::this_thread::sleep_for(std::chrono::seconds(5));
+                }
+            }
+        }
+    }
+
+    void runWebhook() {
+        WebhookServer::Options options;
+        size_t colon = config.webhookListen.rfind(':');
+        if (colon == std::string::npos) {
+            throw std::runtime_error("无效的 WEBHOOK_LISTEN: " + config.webhookListen);
+        }
+        options.address = config.webhookListen.substr(0, colon);
+        options.port = static_cast<unsigned short>(std::stoi(config.webhookListen.substr(colon + 1)));
+        options.path = config.webhookPath;
+        options.secretToken = config.webhookSecret;
+        options.threads = config.webhookThreads;
+        options.certFile = config.webhookCert;
+        options.keyFile = config.webhookKey;
+
+        webhookServer = std::make_unique<WebhookServer>(options, [this](const std::string& body) {
+            intakeThread() = true;
+            return handleWebhookUpdate(body);
+        });
+        std::string error;
+        if (!webhookServer->start(error)) {
+            throw std::runtime_error("Webhook 服务启动失败: " + error);
+        }
+        logger->info(std::string("Webhook 服务已监听 ") + (webhookServer->secure() ? "https://" : "http://") +
+                     config.webhookListen + config.webhookPath);
+        if (config.webhookSecret.empty()) {
+            logger->warning("未配置 WEBHOOK_SECRET，任何人都可以向 Webhook 地址伪造更新");
+        }
+
+        if (!config.webhookUrl.empty()) {
+            TgBot::InputFile::Ptr certificate;
+            if (config.webhookUploadCert && !config.webhookCert.empty()) {
+                certificate = TgBot::InputFile::fromFile(config.webhookCert, "application/x-pem-file");
+            }
+            bot->getApi().setWebhook(config.webhookUrl, certificate,
+                                     std::max(1, std::min(100, config.webhookMaxConnections)),
+                                     std::vector<std::string>(), "", false, config.webhookSecret);
+            logger->info("已登记 Webhook: " + config.webhookUrl);
+        } else {
+            logger->info("未配置 WEBHOOK_URL，沿用 Telegram 侧已登记的 Webhook");
+        }
+
+        logger->info("机器人已启动（Webhook），等待消息...");
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        logger->info("Webhook 服务: 接受 " + std::to_string(webhookServer->acceptedCount()) +
+                     " 拒绝 " + std::to_string(webhookServer->rejectedCount()));
+    }
+
+    // Webhook 请求体即一个 Update，解析后交给与长轮询相同的事件分发。
+    // 返回 false 时响应 503，Telegram 稍后重发该更新
+    bool handleWebhookUpdate(const std::string& body) {
+        Metrics::Timer timer(metrics, webhookDispatch);
+        try {
+            TgBot::TgTypeParser parser;
+            TgBot::Update::Ptr update = parser.parseJsonAndGetUpdate(parser.parseJson(body));
+            bot->getEventHandler().handleUpdate(update);
+            // 任务落盘后才返回 200，Telegram 收到响应即视为送达（多个连接的提交合并为一次 fdatasync）。
+            // 提交失败时任务仍会执行，重发的更新可能再处理一次（至少一次）
+            if (taskJournal && !taskJournal->commit()) {
+                return false;
+            }
+        } catch (std::exception& e) {
+            logger->error("处理 Webhook 更新失败: " + std::string(e.what()));
+        }
+        return true;
+    }
+
     void handleBanCommand(TgBot::Message::Ptr message) {
+        int64_t adminChat = message->chat->id;
         if (!message->replyToMessage) {
-            bot->getApi().sendMessage(adminId, "❌ 请回复要封禁的用户消息并使用 /ban");
+            bot->getApi().sendMessage(adminChat, "❌ 请回复要封禁的用户消息并使用 /ban");
             return;
         }
 
         int64_t userId = 0;
         std::string username;
-        {
-            std::lock_guard<std::mutex> lock(cacheMutex);
-            auto it = messageCache.find(message->replyToMessage->messageId);
-            if (it == messageCache.end()) {
-                bot->getApi().sendMessage(adminId, "⚠️ 找不到对应的用户信息");
-                return;
-            }
-            userId = it->second.first;
-            username = it->second.second;
+        if (!lookupReplyRoute(adminChat, message->replyToMessage->messageId, userId, &username)) {
+            bot->getApi().sendMessage(adminChat, "⚠️ 找不到对应的用户信息");
+            return;
         }
 
-        banUser(userId);
-        bot->getApi().sendMessage(adminId,
+        if (!banUser(userId)) {
+            bot->getApi().sendMessage(adminChat, "❌ 封禁失败：无法写入封禁日志，请检查 " + config.bannedUsersFile +
+                                      ".journal 是否可写");
+            logger->error("封禁用户 " + std::to_string(userId) + " 失败: 无法写入封禁日志");
+            return;
+        }
+        bot->getApi().sendMessage(adminChat,
             "🚫 已封禁用户 " + username + " (ID: " + std::to_string(userId) + ")");
         logger->info("封禁用户: " + std::to_string(userId));
     }
 
     void handleUnbanCommand(TgBot::Message::Ptr message) {
+        int64_t adminChat = message->chat->id;
         std::string text = message->text;
         if (text.length() <= 7) { // "/unban "
-            bot->getApi().sendMessage(adminId, "❌ 用法: /unban <user_id>");
+            bot->getApi().sendMessage(adminChat, "❌ 用法: /unban <user_id>");
             return;
         }
 
+        int64_t userId = 0;
         try {
-            int64_t userId = std::stoll(text.substr(7));
-            unbanUser(userId);
-            bot->getApi().sendMessage(adminId,
-                "✅ 已解封用户 ID: " + std::to_string(userId));
-            logger->info("解封用户: " + std::to_string(userId));
+            userId = std::stoll(text.substr(7));
         } catch (...) {
-            bot->getApi().sendMessage(adminId, "❌ 无效的用户 ID");
+            bot->getApi().sendMessage(adminChat, "❌ 无效的用户 ID");
+            return;
+        }
+        if (!unbanUser(userId)) {
+            bot->getApi().sendMessage(adminChat, "❌ 解封失败：无法写入封禁日志，请检查 " + config.bannedUsersFile +
+                                      ".journal 是否可写");
+            logger->error("解封用户 " + std::to_string(userId) + " 失败: 无法写入封禁日志");
+            return;
         }
+        bot->getApi().sendMessage(adminChat, "✅ 已解封用户 ID: " + std::to_string(userId));
+        logger->info("解封用户: " + std::to_string(userId));
     }
 
-    void showBannedList() {
-        std::lock_guard<std::mutex> lock(bannedMutex);
-        if (bannedUsers.empty()) {
-            bot->getApi().sendMessage(adminId, "📋 封禁列表为空");
+    void showBannedList(int64_t adminChat) {
+        std::vector<int64_t> banned = bannedUsers.list();
+        if (banned.empty()) {
+            bot->getApi().sendMessage(adminChat, "📋 封禁列表为空");
             return;
         }
 
-        std::stringstream ss;
-        ss << "🚫 封禁用户列表:\n\n";
-        for (const auto& userId : bannedUsers) {
-            ss << "• " << userId << "\n";
+        // 单条消息最多 4096 个字符，列表较长时分多条发送
+        std::string text = "🚫 封禁用户列表 (" + std::to_string(banned.size()) + "):\n\n";
+        for (const auto& userId : banned) {
+            std::string line = "• " + std::to_string(userId) + "\n";
+            if (text.size() + line.size() > 4000) {
+                bot->getApi().sendMessage(adminChat, text);
+                text.clear();
+            }
+            text += line;
         }
-        ss << "\n使用 /unban <user_id> 解封用户";
+        text += "\n使用 /unban <user_id> 解封用户";
 
-        bot->getApi().sendMessage(adminId, ss.str());
+        bot->getApi().sendMessage(adminChat, text);
     }
 
-    void handleAdminReply(TgBot::Message::Ptr message) {
-        if (!message->replyToMessage) {
+    // 历史消息的一行：时间、方向（👤 用户 / 💬 管理员回复）和截断后的文本
+    static std::string historyLine(const MessageHistory::Entry& entry, bool withUser) {
+        time_t time = static_cast<time_t>(entry.time);
+        struct tm local;
+        localtime_r(&time, &local);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%m-%d %H:%M", &local);
+        std::string line = std::string("• ") + stamp + " ";
+        if (withUser) line += "🆔 " + std::to_string(entry.userId) + " ";
+        line += entry.direction == MessageHistory::FROM_ADMIN ? "💬 " : "👤 ";
+        std::string text = MessageHistory::clip(entry.text, 300);
+        return line + text + (text.size() < entry.text.size() ? "…" : "") + "\n";
+    }
+
+    // 单条消息最多 4096 个字符，结果较多时分多条发送
+    void sendLines(int64_t chatId, std::string text, const std::vector<std::string>& lines) {
+        for (const std::string& line : lines) {
+            if (telegramLength(text) + telegramLength(line) > 4000) {
+                bot->getApi().sendMessage(chatId, text);
+                text.clear();
+            }
+            text += line;
+        }
+        bot->getApi().sendMessage(chatId, text);
+    }
+
+    // /history <user_id> [条数]，或回复用户消息发送 /history [条数]
+    void processHistoryCommand(TgBot::Message::Ptr message) {
+        int64_t adminChat = message->chat->id;
+        if (!history) {
+            bot->getApi().sendMessage(adminChat, "❌ 未启用会话历史（HISTORY_FILE）");
             return;
         }
 
+        std::istringstream args(message->text);
+        std::string command;
+        args >> command;
         int64_t userId = 0;
-        {
-            std::lock_guard<std::mutex> lock(cacheMutex);
-            auto it = messageCache.find(message->replyToMessage->messageId);
-            if (it == messageCache.end()) {
-                bot->getApi().sendMessage(adminId, "⚠️ 找不到对应的用户信息");
+        long long count = 20;
+        if (message->replyToMessage) {
+            if (!lookupReplyRoute(adminChat, message->replyToMessage->messageId, userId)) {
+                bot->getApi().sendMessage(adminChat, "⚠️ 找不到对应的用户信息");
                 return;
             }
-            userId = it->second.first;
+            args >> count;
+        } else if (!(args >> userId)) {
+            bot->getApi().sendMessage(adminChat, "❌ 用法: /history <user_id> [条数]，或回复用户消息发送 /history");
+            return;
+        } else {
+            args >> count;
+        }
+        count = std::max(1LL, std::min(count, static_cast<long long>(config.historyPerUser)));
+
+        std::vector<MessageHistory::Entry> entries;
+        {
+            Metrics::Timer timer(metrics, historyQuery);
+            entries = history->recent(userId, static_cast<size_t>(count));
+        }
+        if (entries.empty()) {
+            bot->getApi().sendMessage(adminChat, "📜 没有用户 " + std::to_string(userId) + " 的历史消息" +
+                                      (history->isLoaded() ? "" : "（历史索引仍在加载）"));
+            return;
+        }
+
+        // 按时间从旧到新显示
+        std::vector<std::string> lines;
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            lines.push_back(historyLine(*it, false));
+        }
+        sendLines(adminChat, "📜 用户 " + std::to_string(userId) + " 最近 " + std::to_string(entries.size()) +
+                             " 条消息:\n\n", lines);
+    }
+
+    // /search <关键词>：在全部会话历史中查找同时包含各关键词（空格分隔）的消息，显示最新的 20 条
+    void processSearchCommand(TgBot::Message::Ptr message) {
+        int64_t adminChat = message->chat->id;
+        if (!history) {
+            bot->getApi().sendMessage(adminChat, "❌ 未启用会话历史（HISTORY_FILE）");
+            return;
+        }
+        size_t space = message->text.find(' ');
+        std::string query = space == std::string::npos ? "" : message->text.substr(space + 1);
+        if (query.find_first_not_of(" \n") == std::string::npos) {
+            bot->getApi().sendMessage(adminChat, "❌ 用法: /search <关键词>");
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<MessageHistory::Entry> hits;
+        {
+            Metrics::Timer timer(metrics, historyQuery);
+            hits = history->search(query, 20);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        char took[32];
+        snprintf(took, sizeof(took), "（%.1f ms）", elapsed.count() / 1000.0);
+        if (hits.empty()) {
+            bot->getApi().sendMessage(adminChat, "🔍 没有找到包含「" + query + "」的消息" + took +
+                                      (history->isLoaded() ? "" : "，历史索引仍在加载"));
+            return;
+        }
+
+        std::vector<std::string> lines;
+        for (const auto& hit : hits) {
+            lines.push_back(historyLine(hit, true));
+        }
+        sendLines(adminChat, "🔍 「" + query + "」最近 " + std::to_string(hits.size()) + " 条结果" + took +
+                             ":\n\n", lines);
+    }
+
+    // 广播线程：等待任务并逐个执行
+    void broadcastThread() {
+        std::unique_lock<std::mutex> lock(broadcastMutex);
+        while (!stopWorkers) {
+            broadcastCv.wait(lock, [this] { return stopWorkers || broadcastJob; });
+            if (stopWorkers) break;
+            runBroadcast(lock);
+        }
+    }
+
+    // 用户已屏蔽机器人、已注销或会话不存在，以后也无法送达
+    static bool isUnreachable(const std::string& response) {
+        return response.find("\"error_code\":403") != std::string::npos ||
+               response.find("chat not found") != std::string::npos;
+    }
+
+    // 按 BROADCAST_RATE 匀速提交，最多保留约 2 秒的发送在途。全局限额仍由 RateLimitedHttpClient 把关，
+    // 这里不一次性提交全部用户，避免在限速层堆积预约，使管理员和用户的正常消息只需排在少量广播之后
+    void runBroadcast(std::unique_lock<std::mutex>& lock) {
+        BroadcastJob& job = *broadcastJob;
+        broadcastSent = job.sent;
+        broadcastFailed = job.failed;
+        broadcastRemoved = job.removed;
+        const int64_t fromChatId = job.fromChatId;
+        const int32_t messageId = job.messageId;
+        const std::string text = job.text;
+        int64_t processed = job.cursor; // 已提交或跳过的最大 ID
+
+        lock.unlock();
+        std::vector<int64_t> targets = userRegistry->list();
+        lock.lock();
+        if (job.total == 0) {
+            job.total = targets.size();
+        }
+
+        double rate = std::max(0.1, config.broadcastRate);
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / rate));
+        size_t window = std::max<size_t>(1, static_cast<size_t>(rate * 2));
+        auto next = std::chrono::steady_clock::now();
+        auto lastCheckpoint = next;
+
+        auto interrupted = [this, &job] { return stopWorkers || job.cancelled; };
+        auto it = std::upper_bound(targets.begin(), targets.end(), job.cursor);
+        for (; it != targets.end(); ++it) {
+            if (broadcastCv.wait_until(lock, next, interrupted)) break;
+            broadcastCv.wait(lock, [&] { return interrupted() || broadcastInFlight.size() < window; });
+            if (interrupted()) break;
+
+            auto now = std::chrono::steady_clock::now();
+            next = std::max(next + interval, now - std::chrono::seconds(1));
+            int64_t userId = *it;
+            processed = userId;
+            removeUnreachable(lock);
+            if (isUserBanned(userId) || !userRegistry->contains(userId)) {
+                continue;
+            }
+            broadcastInFlight.insert(userId);
+
+            lock.unlock();
+            submitBroadcast(userId, fromChatId, messageId, text);
+            if (now - lastCheckpoint >= std::chrono::seconds(5)) {
+                checkpointBroadcast(processed, true);
+                lastCheckpoint = now;
+            }
+            lock.lock();
+        }
+
+        // 等待在途发送完成；停机时最多再等 10 秒，未完成的在下次启动时重发
+        broadcastCv.wait(lock, [this] { return stopWorkers || broadcastInFlight.empty(); });
+        broadcastCv.wait_for(lock, std::chrono::seconds(10), [this] { return broadcastInFlight.empty(); });
+        removeUnreachable(lock);
+        bool finished = (job.cancelled || it == targets.end()) && broadcastInFlight.empty();
+        lock.unlock();
+
+        checkpointBroadcast(processed, !finished);
+        if (finished) {
+            finishBroadcast();
+        }
+        lock.lock();
+        if (finished) {
+            broadcastJob.reset();
+        }
+    }
+
+    // 把无法送达的用户移出登记表；调用方持有 lock，写文件期间释放
+    void removeUnreachable(std::unique_lock<std::mutex>& lock) {
+        if (broadcastUnreachable.empty()) return;
+        std::vector<int64_t> users;
+        users.swap(broadcastUnreachable);
+        lock.unlock();
+        for (int64_t userId : users) {
+            userRegistry->remove(userId);
+        }
+        lock.lock();
+    }
+
+    // 回调在 HTTP 事件循环线程中执行，只更新计数和在途集合
+    void submitBroadcast(int64_t userId, int64_t fromChatId, int32_t messageId, const std::string& text) {
+        std::string method = fromChatId != 0 ? "copyMessage" : "sendMessage";
+        std::vector<TgBot::HttpReqArg> args = {TgBot::HttpReqArg("chat_id", userId)};
+        if (fromChatId != 0) {
+            args.emplace_back("from_chat_id", fromChatId);
+            args.emplace_back("message_id", messageId);
+        } else {
+            args.emplace_back("text", text);
+        }
+
+        TgBot::Url url(config.apiUrl + "/bot" + config.botToken + "/" + method);
+        httpClient->submit(url, args, [this, userId](const std::string& response, std::exception_ptr error) {
+            bool unreachable = false;
+            if (!error && response.find("\"ok\":true") != std::string::npos) {
+                ++broadcastSent;
+            } else if (!error && isUnreachable(response)) {
+                unreachable = true;
+                ++broadcastRemoved;
+            } else {
+                ++broadcastFailed;
+            }
+            {
+                std::lock_guard<std::mutex> lock(broadcastMutex);
+                broadcastInFlight.erase(userId);
+                if (unreachable) {
+                    broadcastUnreachable.push_back(userId);
+                }
+            }
+            broadcastCv.notify_all();
+        });
+    }
+
+    std::string broadcastReport(const BroadcastJob& job, const std::string& state) {
+        return "📣 广播" + state + "\n\n" +
+               "👥 对象: " + std::to_string(job.total) + "\n" +
+               "✅ 成功: " + std::to_string(job.sent) + "\n" +
+               "❌ 失败: " + std::to_string(job.failed) + "\n" +
+               "🚫 已移除: " + std::to_string(job.removed) + "（屏蔽了机器人或已注销）";
+    }
+
+    // 保存进度；cursor 取在途发送中最小 ID 之前，保证重启后不漏发。
+    // 正在进行时同时更新管理员会话中的进度消息
+    void checkpointBroadcast(int64_t processed, bool report) {
+        BroadcastJob snapshot;
+        {
+            std::lock_guard<std::mutex> lock(broadcastMutex);
+            BroadcastJob& job = *broadcastJob;
+            job.cursor = broadcastInFlight.empty() ? processed : *broadcastInFlight.begin() - 1;
+            uint64_t sent = broadcastSent;
+            uint64_t failed = broadcastFailed;
+            uint64_t removed = broadcastRemoved;
+            bool changed = sent != job.sent || failed != job.failed || removed != job.removed;
+            job.sent = sent;
+            job.failed = failed;
+            job.removed = removed;
+            snapshot = job;
+            if (!changed) report = false;
+        }
+        if (!snapshot.save(broadcastStatePath)) {
+            logger->error("无法保存广播进度 " + broadcastStatePath);
+        }
+        if (report && snapshot.progressMessageId != 0) {
+            callApiAsync("editMessageText", {TgBot::HttpReqArg("chat_id", snapshot.reportChatId),
+                                             TgBot::HttpReqArg("message_id", snapshot.progressMessageId),
+                                             TgBot::HttpReqArg("text", broadcastReport(snapshot, "进行中"))});
+        }
+    }
+
+    // 广播结束：汇报结果并删除状态文件
+    void finishBroadcast() {
+        BroadcastJob snapshot;
+        {
+            std::lock_guard<std::mutex> lock(broadcastMutex);
+            snapshot = *broadcastJob;
+        }
+        std::string state = snapshot.cancelled ? "已取消" : "已完成";
+        if (snapshot.progressMessageId != 0) {
+            callApiAsync("editMessageText", {TgBot::HttpReqArg("chat_id", snapshot.reportChatId),
+                                             TgBot::HttpReqArg("message_id", snapshot.progressMessageId),
+                                             TgBot::HttpReqArg("text", broadcastReport(snapshot, state))});
+        }
+        sendMessageAsync(snapshot.reportChatId, broadcastReport(snapshot, state));
+        ::unlink(broadcastStatePath.c_str());
+        userRegistry->sync();
+        logger->info("广播" + state + ": 成功 " + std::to_string(snapshot.sent) +
+                     " 失败 " + std::to_string(snapshot.failed) + " 移除 " + std::to_string(snapshot.removed));
+    }
+
+    // /broadcast <文本>，或回复一条消息发送 /broadcast 以复制该消息（支持媒体）
+    void processBroadcastCommand(TgBot::Message::Ptr message) {
+        int64_t adminChat = message->chat->id;
+        if (!userRegistry) {
+            bot->getApi().sendMessage(adminChat, "❌ 未启用用户登记（USER_REGISTRY_FILE），无法广播");
+            return;
+        }
+
+        auto job = std::make_unique<BroadcastJob>();
+        size_t space = message->text.find(' ');
+        if (message->replyToMessage) {
+            job->fromChatId = adminChat;
+            job->messageId = message->replyToMessage->messageId;
+        } else if (space != std::string::npos && message->text.find_first_not_of(" \n", space) != std::string::npos) {
+            job->text = message->text.substr(space + 1);
+        } else {
+            bot->getApi().sendMessage(adminChat, "❌ 用法: /broadcast <内容>，或回复要广播的消息并发送 /broadcast");
+            return;
+        }
+
+        // 只在锁内判断，提示在释放 broadcastMutex 之后发出：发送要经过 HTTP 事件循环，
+        // 而事件循环中的广播回调也要获取 broadcastMutex。broadcastStartMutex 使判断到开始之间
+        // 不会有另一条 /broadcast 插入（广播线程只会清除 broadcastJob）
+        std::lock_guard<std::mutex> starting(broadcastStartMutex);
+        bool busy;
+        {
+            std::lock_guard<std::mutex> lock(broadcastMutex);
+            busy = broadcastJob != nullptr;
+        }
+        if (busy) {
+            sendMessageAsync(adminChat, "⚠️ 已有广播在进行，可使用 /broadcast_stop 取消");
+            return;
+        }
+
+        job->total = userRegistry->size();
+        job->reportChatId = adminChat;
+        job->progressMessageId = bot->getApi().sendMessage(adminChat, broadcastReport(*job, "开始"))->messageId;
+        if (!job->save(broadcastStatePath)) {
+            logger->error("无法保存广播进度 " + broadcastStatePath + "，中断后将无法继续");
+        }
+        logger->info("开始广播，对象 " + std::to_string(job->total) + " 个用户");
+
+        {
+            std::lock_guard<std::mutex> lock(broadcastMutex);
+            broadcastJob = std::move(job);
+        }
+        broadcastCv.notify_all();
+    }
+
+    void processBroadcastStop(int64_t adminChat) {
+        bool active;
+        {
+            std::lock_guard<std::mutex> lock(broadcastMutex);
+            active = broadcastJob != nullptr;
+            if (active) {
+                broadcastJob->cancelled = true;
+            }
+        }
+        if (!active) {
+            sendMessageAsync(adminChat, "📋 当前没有进行中的广播");
+            return;
+        }
+        broadcastCv.notify_all();
+        sendMessageAsync(adminChat, "⏹ 正在停止广播，等待已发出的消息完成...");
+    }
+
+    // 是否为机器人自己；令牌中没有数字 ID 时退化为只看是否是机器人
+    bool isSelf(const TgBot::User::Ptr& user) const {
+        return user->isBot && (botUserId == 0 || user->id == botUserId);
+    }
+
+    void handleAdminReply(TgBot::Message::Ptr message) {
+        if (!message->replyToMessage) {
+            // 回复用的相册中只有部分消息带 reply_to_message，其余并入同一相册
+            if (!message->mediaGroupId.empty()) {
+                joinAlbum(message);
+            }
+            return;
         }
 
+        int64_t userId = 0;
+        if (!lookupReplyRoute(message->chat->id, message->replyToMessage->messageId, userId)) {
+            // 群组管理员会话中回复其他成员的消息是普通讨论，只在回复机器人的消息时提示
+            const TgBot::User::Ptr& author = message->replyToMessage->from;
+            if (author && !isSelf(author)) return;
+            sendText(message->chat->id, "⚠️ 找不到对应的用户信息");
+            return;
+        }
+
+        if (!message->mediaGroupId.empty()) {
+            collectAlbumItem(message, userId);
+            return;
+        }
+
+        flushChatAlbum(message->chat->id); // 排在此前回复的相册之后
         MessageTask task;
         task.type = MessageTask::REPLY_TO_USER;
         task.targetUserId = userId;
-        task.text = message->text;
-        addTask(task);
+        task.message = message;
+        addTask(std::move(task));
+    }
+
+    void processStartCommand(TgBot::Message::Ptr message) {
+        bot->getApi().sendMessage(message->chat->id,
+            "🤖 欢迎使用消息转发机器人！\n\n"
+            "📝 使用说明:\n"
+            "• 直接发送消息 - 转发给管理员\n"
+            "• /req <内容> - 发送带按钮的请求\n"
+            "• /help - 查看帮助\n\n"
+            "管理员会尽快回复您的消息！");
+
+        logger->info("用户 " + std::to_string(message->from->id) + " 启动了机器人");
+    }
+
+    void processHelpCommand(TgBot::Message::Ptr message) {
+        bot->getApi().sendMessage(message->chat->id,
+            "📋 帮助信息\n\n"
+            "可用命令:\n"
+            "/start - 开始使用\n"
+            "/help - 显示帮助\n"
+            "/req - 发送请求\n\n"
+            "使用示例:\n"
+            "/req 我需要帮助解决一个问题");
     }
 
     void processRequestCommand(TgBot::Message::Ptr message) {
@@ -553,15 +8698,15 @@ private:
         ss << "📝 " << requestText;
 
         try {
-            auto sentMessage = bot->getApi().sendMessage(adminId, ss.str(), nullptr, nullptr, keyboard);
+            std::string display = getUserDisplay(message->from);
+            int64_t adminChat = assignAdmin(message->from->id, display);
+            auto sentMessage = bot->getApi().sendMessage(adminChat, ss.str(), nullptr, nullptr, keyboard);
             
             // 缓存消息信息
-            {
-                std::lock_guard<std::mutex> lock(cacheMutex);
-                messageCache[sentMessage->messageId] = {message->from->id, getUserDisplay(message->from)};
-            }
+            rememberReplyRoute(adminChat, sentMessage->messageId, message->from->id, display);
 
-            bot->getApi().sendMessage(message->chat->id, "✅ 您的请求已发送给管理员，请耐心等待处理。");
+            recordHistory(message->from->id, MessageHistory::FROM_USER, "[请求] " + requestText);
+            sendMessageAsync(message->chat->id, "✅ 您的请求已发送给管理员，请耐心等待处理。");
             logger->info("收到请求 - 用户: " + std::to_string(message->from->id));
         } catch (std::exception& e) {
             bot->getApi().sendMessage(message->chat->id, "❌ 发送失败，请稍后重试");
@@ -569,76 +8714,249 @@ private:
         }
     }
 
-    void processForwardToAdmin(TgBot::Message::Ptr message) {
+    // 转发给管理员的消息头
+    std::string forwardHeader(const TgBot::Message::Ptr& message) {
         std::stringstream ss;
         ss << "💬 新消息\n\n";
         ss << "👤 用户: " << getUserDisplay(message->from) << "\n";
         ss << "🆔 ID: " << message->from->id << "\n";
         ss << "📅 时间: " << getCurrentTime() << "\n";
         ss << "━━━━━━━━━━━━━━━\n";
-        ss << "💭 " << message->text;
+        return ss.str();
+    }
 
-        try {
-            auto sentMessage = bot->getApi().sendMessage(adminId, ss.str());
-            
-            {
-                std::lock_guard<std::mutex> lock(cacheMutex);
-                messageCache[sentMessage->messageId] = {message->from->id, getUserDisplay(message->from)};
+    // 可以带说明文字的媒体
+    static bool hasCaption(const TgBot::Message::Ptr& message) {
+        return !message->photo.empty() || message->video || message->document || message->audio ||
+               message->animation || message->voice;
+    }
+
+    static std::string mediaLabel(const TgBot::Message::Ptr& message) {
+        if (!message->photo.empty()) return "[图片]";
+        if (message->video) return "[视频]";
+        if (message->document) return "[文件] " + message->document->fileName;
+        if (message->audio) return "[音频]";
+        if (message->animation) return "[动图]";
+        if (message->voice) return "[语音]";
+        if (message->sticker) return "[贴纸]";
+        if (message->videoNote) return "[视频消息]";
+        return "[消息]";
+    }
+
+    // 相册在会话历史中的记录：第一项的类型、项数和说明文字
+    static std::string albumSummary(const std::vector<TgBot::Message::Ptr>& album) {
+        std::string summary = mediaLabel(album.front()) + " ×" + std::to_string(album.size());
+        return album.front()->caption.empty() ? summary : summary + " " + album.front()->caption;
+    }
+
+    // 相册中的一项：直接引用 file_id，不下载也不重新上传
+    static TgBot::InputMedia::Ptr inputMediaOf(const TgBot::Message::Ptr& message) {
+        TgBot::InputMedia::Ptr media;
+        if (!message->photo.empty()) {
+            media = std::make_shared<TgBot::InputMediaPhoto>();
+            media->media = message->photo.back()->fileId; // 最后一项分辨率最高
+        } else if (message->video) {
+            media = std::make_shared<TgBot::InputMediaVideo>();
+            media->media = message->video->fileId;
+        } else if (message->document) {
+            media = std::make_shared<TgBot::InputMediaDocument>();
+            media->media = message->document->fileId;
+        } else if (message->audio) {
+            media = std::make_shared<TgBot::InputMediaAudio>();
+            media->media = message->audio->fileId;
+        } else {
+            return nullptr;
+        }
+        media->caption = message->caption;
+        return media;
+    }
+
+    // 复制一条消息（服务端复制，不经过本机）；caption 非空时替换原说明文字
+    int32_t copyTo(int64_t chatId, const TgBot::Message::Ptr& message, const std::string& caption = "") {
+        return bot->getApi().copyMessage(chatId, message->chat->id, message->messageId, caption)->messageId;
+    }
+
+    // 发送相册，第一项的说明文字前加上 prefix；不能组成相册时逐条复制。返回发出的消息 ID
+    std::vector<int32_t> sendAlbum(int64_t chatId, const std::vector<TgBot::Message::Ptr>& album,
+                                   const std::string& prefix) {
+        std::vector<TgBot::InputMedia::Ptr> media;
+        for (const auto& item : album) {
+            auto m = inputMediaOf(item);
+            if (!m) break;
+            media.push_back(m);
+        }
+
+        std::vector<int32_t> sent;
+        std::string caption = prefix + album.front()->caption;
+        if (media.size() == album.size() && media.size() >= 2 && telegramLength(caption) <= MAX_CAPTION_LENGTH) {
+            media.front()->caption = caption;
+            for (const auto& m : bot->getApi().sendMediaGroup(chatId, media)) {
+                sent.push_back(m->messageId);
             }
+            return sent;
+        }
 
-            logger->info("转发消息 - 用户: " + std::to_string(message->from->id));
-        } catch (std::exception& e) {
-            logger->error("转发消息失败: " + std::string(e.what()));
+        sent.push_back(bot->getApi().sendMessage(chatId, prefix + mediaLabel(album.front()))->messageId);
+        for (const auto& item : album) {
+            sent.push_back(copyTo(chatId, item));
+        }
+        return sent;
+    }
+
+    // 转发和回复都用异步请求，等待 Bot API 响应时不占用工作线程（见 requestAsync）
+    void processForwardToAdmin(TgBot::Message::Ptr message) {
+        std::string header = forwardHeader(message);
+        std::string display = getUserDisplay(message->from);
+        int64_t userId = message->from->id;
+        int64_t adminChat = assignAdmin(userId, display);
+
+        // 记下发出的消息对应的用户，供管理员回复；失败时返回 false
+        auto remember = [this, adminChat, userId, display](const std::string& response, const std::string& error) {
+            if (!error.empty()) {
+                logger->error("转发消息失败: " + error);
+                return false;
+            }
+            int32_t messageId = messageIdOf(response);
+            if (messageId != 0) {
+                rememberReplyRoute(adminChat, messageId, userId, display);
+            }
+            return true;
+        };
+        std::string summary = !message->text.empty()
+            ? message->text
+            : mediaLabel(message) + (message->caption.empty() ? "" : " " + message->caption);
+        auto finished = [this, remember, userId, summary](const std::string& response, const std::string& error) {
+            if (!remember(response, error)) return;
+            recordHistory(userId, MessageHistory::FROM_USER, summary);
+            logger->info("转发消息 - 用户: " + std::to_string(userId));
+        };
+
+        if (!message->text.empty()) {
+            requestAsync("sendMessage", {TgBot::HttpReqArg("chat_id", adminChat),
+                                         TgBot::HttpReqArg("text", header + "💭 " + message->text)}, finished);
+            return;
+        }
+        // 媒体消息：能带说明文字时一次复制完成，否则先发消息头再复制
+        std::string caption = header + "💭 " + mediaLabel(message) +
+                              (message->caption.empty() ? "" : "\n" + message->caption);
+        if (hasCaption(message) && telegramLength(caption) <= MAX_CAPTION_LENGTH) {
+            requestAsync("copyMessage", copyArgs(adminChat, message, caption), finished);
+            return;
         }
+        requestAsync("sendMessage", {TgBot::HttpReqArg("chat_id", adminChat), TgBot::HttpReqArg("text", caption)},
+                     [this, remember, finished, adminChat, message](const std::string& response, const std::string& error) {
+                         if (!remember(response, error)) return;
+                         requestAsync("copyMessage", copyArgs(adminChat, message), finished);
+                     });
     }
 
-    void processReplyToUser(int64_t userId, const std::string& text) {
+    void processForwardAlbum(const std::vector<TgBot::Message::Ptr>& album) {
+        if (album.size() == 1) {
+            processForwardToAdmin(album.front());
+            return;
+        }
+        const TgBot::Message::Ptr& first = album.front();
+        std::string display = getUserDisplay(first->from);
+        int64_t adminChat = assignAdmin(first->from->id, display);
         try {
-            bot->getApi().sendMessage(userId, "💬 管理员回复:\n\n" + text);
-            bot->getApi().sendMessage(adminId, "✅ 消息已发送");
+            for (int32_t messageId : sendAlbum(adminChat, album, forwardHeader(first) + "💭 ")) {
+                rememberReplyRoute(adminChat, messageId, first->from->id, display);
+            }
+            recordHistory(first->from->id, MessageHistory::FROM_USER, albumSummary(album));
+            logger->info("转发相册 - 用户: " + std::to_string(first->from->id) +
+                         " 共 " + std::to_string(album.size()) + " 项");
+        } catch (std::exception& e) {
+            logger->error("转发相册失败: " + std::string(e.what()));
+        }
+    }
+
+    void processReplyToUser(int64_t userId, TgBot::Message::Ptr message) {
+        const std::string prefix = "💬 管理员回复:\n\n";
+        int64_t adminChat = message->chat->id;
+        std::string summary = !message->text.empty()
+            ? message->text
+            : mediaLabel(message) + (message->caption.empty() ? "" : " " + message->caption);
+        auto finished = [this, userId, adminChat, summary](const std::string&, const std::string& error) {
+            if (!error.empty()) {
+                sendMessageAsync(adminChat, "❌ 发送失败: " + error);
+                logger->error("回复失败: " + error);
+                return;
+            }
+            recordHistory(userId, MessageHistory::FROM_ADMIN, summary);
+            adminPool.recordReply(adminChat, userId);
+            sendMessageAsync(adminChat, "✅ 消息已发送");
             logger->info("管理员回复用户 " + std::to_string(userId));
+        };
+
+        if (!message->text.empty()) {
+            requestAsync("sendMessage", {TgBot::HttpReqArg("chat_id", userId),
+                                         TgBot::HttpReqArg("text", prefix + message->text)}, finished);
+        } else if (hasCaption(message) && telegramLength(prefix + message->caption) <= MAX_CAPTION_LENGTH) {
+            requestAsync("copyMessage", copyArgs(userId, message, prefix + message->caption), finished);
+        } else {
+            requestAsync("copyMessage", copyArgs(userId, message), finished);
+        }
+    }
+
+    void processReplyAlbum(int64_t userId, const std::vector<TgBot::Message::Ptr>& album) {
+        if (album.size() == 1) {
+            processReplyToUser(userId, album.front());
+            return;
+        }
+        int64_t adminChat = album.front()->chat->id;
+        try {
+            sendAlbum(userId, album, "💬 管理员回复:\n\n");
+            recordHistory(userId, MessageHistory::FROM_ADMIN, albumSummary(album));
+            adminPool.recordReply(adminChat, userId);
+            sendMessageAsync(adminChat, "✅ 相册已发送");
+            logger->info("管理员向用户 " + std::to_string(userId) + " 回复相册");
         } catch (std::exception& e) {
-            bot->getApi().sendMessage(adminId, "❌ 发送失败: " + std::string(e.what()));
-            logger->error("回复失败: " + std::string(e.what()));
+            bot->getApi().sendMessage(adminChat, "❌ 发送失败: " + std::string(e.what()));
+            logger->error("回复相册失败: " + std::string(e.what()));
         }
     }
 
-    void processCallbackQuery(TgBot::CallbackQuery::Ptr query) {
+    // 接手的管理员收到转交提示，回复该提示即可继续与用户对话
+    void processHandoff(int64_t userId, const std::string& display, int64_t adminChat) {
+        std::stringstream ss;
+        ss << "🔁 会话转交\n\n";
+        ss << "👤 用户: " << display << "\n";
+        ss << "🆔 ID: " << userId << "\n";
+        ss << "━━━━━━━━━━━━━━━\n";
+        ss << "原负责的管理员长时间未回复，请回复本消息继续与该用户对话";
+        auto sentMessage = bot->getApi().sendMessage(adminChat, ss.str());
+        rememberReplyRoute(adminChat, sentMessage->messageId, userId, display);
+    }
+
+    // 回调去重键：按回调 ID，或按 (请求消息, 按钮) 使多个管理员点击同一按钮只处理一次
+    std::string callbackDedupKey(const TgBot::CallbackQuery::Ptr& query) {
+        if (config.callbackDedupMode == "action" && query->message) {
+            return std::to_string(query->message->chat->id) + ":" +
+                   std::to_string(query->message->messageId) + ":" + query->data;
+        }
+        return query->id;
+    }
+
+    // userId 为接收时查出的按钮对应用户，0 表示当时未查到
+    void processCallbackQuery(TgBot::CallbackQuery::Ptr query, int64_t userId) {
         // 检查是否已处理过
+        bool firstTime;
         {
-            std::lock_guard<std::mutex> lock(callbackMutex);
-            auto now = std::chrono::steady_clock::now();
-            
-            // 清理旧记录
-            auto it = processedCallbacks.begin();
-            while (it != processedCallbacks.end()) {
-                if (std::chrono::duration_cast<std::chrono::hours>(now - it->second).count() > 1) {
-                    it = processedCallbacks.erase(it);
-                } else {
-                    ++it;
-                }
-            }
-            
-            // 检查当前回调
-            if (processedCallbacks.find(query->id) != processedCallbacks.end()) {
-                bot->getApi().answerCallbackQuery(query->id, "此操作已处理");
-                return;
-            }
-            processedCallbacks[query->id] = now;
+            std::lock_guard<CountingMutex> lock(callbackMutex);
+            firstTime = processedCallbacks.insert(callbackDedupKey(query));
+        }
+        if (!firstTime) {
+            answerCallbackAsync(query->id, "此操作已处理");
+            return;
         }
 
         std::string data = query->data;
         std::string action = data.substr(0, data.find('_'));
 
-        int64_t userId = 0;
-        {
-            std::lock_guard<std::mutex> lock(cacheMutex);
-            auto it = messageCache.find(query->message->messageId);
-            if (it == messageCache.end()) {
-                bot->getApi().answerCallbackQuery(query->id, "❌ 请求信息不存在");
-                return;
-            }
-            userId = it->second.first;
+        int64_t adminChat = query->message->chat->id;
+        if (userId == 0 && !lookupReplyRoute(adminChat, query->message->messageId, userId)) {
+            answerCallbackAsync(query->id, "❌ 请求信息不存在");
+            return;
         }
 
         std::string response, status;
@@ -659,12 +8977,13 @@ private:
             
             // 更新消息
             std::string updatedText = query->message->text + "\n\n📌 状态: " + status;
-            bot->getApi().editMessageText(updatedText, adminId, query->message->messageId);
+            bot->getApi().editMessageText(updatedText, adminChat, query->message->messageId);
+            adminPool.recordReply(adminChat, userId);
             
-            bot->getApi().answerCallbackQuery(query->id, "✅ 操作成功");
+            answerCallbackAsync(query->id, "✅ 操作成功");
             logger->info("处理请求 - 状态: " + status + " 用户: " + std::to_string(userId));
         } catch (std::exception& e) {
-            bot->getApi().answerCallbackQuery(query->id, "操作失败");
+            answerCallbackAsync(query->id, "操作失败");
             logger->error("处理回调失败: " + std::string(e.what()));
         }
     }
@@ -681,18 +9000,22 @@ private:
     }
 
     std::string getCurrentTime() {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::stringstream ss;
-        ss << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-        return ss.str();
+        time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        struct tm local;
+        localtime_r(&now, &local);
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
+        return buf;
     }
 };
 
+// 组件基准（bench/component_bench.hpp）编入本文件时不需要 main
+#ifndef FORWARD_BOT_NO_MAIN
 int main(int argc, char* argv[]) {
     // 设置信号处理
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGHUP, reloadHandler);
 
     // 配置文件路径
     std::string configFile = "bot_config.ini";
@@ -712,7 +9035,7 @@ int main(int argc, char* argv[]) {
     }
 
     try {
-        ForwardBot bot(config);
+        ForwardBot bot(config, configFile);
         bot.start();
     } catch (std::exception& e) {
         std::cerr << "致命错误: " << e.what() << std::endl;
@@ -721,3 +9044,4 @@ int main(int argc, char* argv[]) {
 
     return 0;
 }
+#endif